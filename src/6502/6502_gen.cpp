@@ -1490,15 +1490,19 @@ static void GenerateConfig(std::set<std::string> *tfns, std::set<std::string> *i
             }
         }
 
+        InstrType type = instr->GetInstrType();
+        bool writes = type == InstrType_W || type == InstrType_RMW;
+
         ASSERT(mnemonic.size() <= 4);
-        P("[0x%02zx]={.mnemonic=\"%s\",.mode=%s,.num_bytes=%u,.undocumented=%d,.always_step_in=%d,.branch_condition=M6502Condition_%s},\n",
+        P("[0x%02zx]={.mnemonic=\"%s\",.mode=%s,.num_bytes=%u,.undocumented=%d,.always_step_in=%d,.branch_condition=M6502Condition_%s,.writes=%d},\n",
           i,
           mnemonic.c_str(),
           mode.c_str(),
           instr->GetNumBytes(),
           instr->undocumented,
           always_step_in,
-          condition.c_str());
+          condition.c_str(),
+          writes);
     }
     P("};\n");
     P("\n");
@@ -2902,6 +2902,9 @@ void M6502_SetDeviceNMI(M6502 *s, M6502_DeviceIRQFlags mask, int wants_nmi) {
 
 static const NamedFn g_known_fns[] = {
     {"M6502_NextInstruction", &M6502_NextInstruction},
+
+    // Not referred to by the generated tables.
+    {"Cycle0_InterruptCMOS", &Cycle0_InterruptCMOS},
     {NULL, NULL},
 };
 
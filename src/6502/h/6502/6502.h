@@ -177,6 +177,10 @@ struct M6502DisassemblyInfo {
     // M6502Condition values.
     uint8_t branch_condition : 5;
 
+    // Set if the instruction writes to its effective address, i.e., it's a
+    // store or a read-modify-write instruction. Stack writes don't count.
+    uint8_t writes : 1;
+
     // Mnemonic.
     char mnemonic[5];
 };
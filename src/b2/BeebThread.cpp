@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <beeb/DiscImage.h>
 #include <vector>
+#include <deque>
 #include "BeebState.h"
 #include "BeebWindows.h"
 #include "b2.h"
@@ -17,6 +18,7 @@
 #include "misc.h"
 #include "Messages.h"
 #include <beeb/Trace.h>
+#include <beeb/TraceIndex.h>
 #include "keys.h"
 #include <string.h>
 #include <inttypes.h>
@@ -49,8 +51,19 @@
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-// Number of 2MHz cycles the emulated BBC will run for, flat out.
-static const CycleCount RUN_CYCLES = {CYCLES_PER_SECOND / 1000};
+// Number of cycles the emulated BBC will run for between checks for messages.
+// This is the size used when speed limited; when running flat out, it grows
+// while there's nothing else going on, and shrinks when messages turn up.
+static const CycleCount DEFAULT_RUN_CYCLES = {CYCLES_PER_SECOND / 1000};
+static const CycleCount MIN_RUN_CYCLES = {CYCLES_PER_SECOND / 8000};
+static const CycleCount MAX_RUN_CYCLES = {CYCLES_PER_SECOND / 20};
+
+// How often to recalculate the overhead fraction for the timing stats.
+static constexpr double TIMING_STATS_PERIOD_SECONDS = .5;
+
+// Maximum age of the BBCMicroReadOnlyState snapshot when nothing's asking for
+// it.
+static constexpr double MAX_BEEB_STATE_AGE_SECONDS = .5;
 
 // ~1MByte
 static constexpr size_t NUM_VIDEO_UNITS = 262144;
@@ -59,6 +72,18 @@ static constexpr size_t NUM_AUDIO_UNITS = NUM_VIDEO_UNITS / 2; //(1<<SOUND_CLOCK
 // When recording, how often to save a state.
 static const CycleCount TIMELINE_SAVE_STATE_FREQUENCY_CYCLES = {CYCLES_PER_SECOND};
 
+// When recording, how many saved states between each keyframe.
+static constexpr size_t TIMELINE_KEYFRAME_FREQUENCY = 10;
+
+static constexpr size_t DEFAULT_TIMELINE_MAX_SIZE_BYTES = 1024 * 1024 * 1024;
+
+// How often to save a state for stepping back, and how far a step back of one
+// frame goes.
+static const CycleCount REWIND_SAVE_STATE_FREQUENCY_CYCLES = {CYCLES_PER_SECOND / 50};
+
+// Max number of states kept for stepping back - 5 seconds' worth.
+static constexpr size_t REWIND_MAX_NUM_STATES = 250;
+
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
@@ -122,6 +147,25 @@ static const float VOLUMES_TABLE[] = {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// A recent state, and the messages handled since it was saved.
+struct BeebThread::RewindState {
+    std::shared_ptr<const BeebState> state;
+    std::vector<TimelineEvent> events;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Where the instruction before END started. See FindPreviousHostInstruction.
+struct StepBackInstructionData {
+    CycleCount end = {0};
+    CycleCount prev = {0};
+    bool found = false;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 struct BeebThread::ThreadState {
     bool stop = false;
 
@@ -130,6 +174,19 @@ struct BeebThread::ThreadState {
     const CycleCount *num_executed_cycles = nullptr;
     CycleCount next_stop_cycles = {0};
 
+    // Current maximum slice size. See ThreadUpdateRunCycles.
+    CycleCount run_cycles = DEFAULT_RUN_CYCLES;
+
+    // Host time spent in the main loop other than waiting for messages, and
+    // the part of that spent in BBCMicro::Update, over the current timing
+    // stats period.
+    uint64_t timing_period_start_ticks = 0;
+    uint64_t timing_busy_ticks = 0;
+    uint64_t timing_update_ticks = 0;
+
+    // When the current BBCMicroReadOnlyState snapshot was taken.
+    uint64_t beeb_state_ticks = 0;
+
     BBCMicro *beeb = nullptr;
     BeebLoadedConfig current_config;
 #if BBCMICRO_TRACE
@@ -137,6 +194,7 @@ struct BeebThread::ThreadState {
     CycleCount trace_start_cycles = {0};
     TraceConditions trace_conditions;
     size_t trace_max_num_bytes = 0;
+    std::string trace_spill_path;
 #endif
     bool boot = false;
     BeebShiftState fake_shift_state = BeebShiftState_Any;
@@ -146,12 +204,49 @@ struct BeebThread::ThreadState {
     // The timeline end event's message pointer is always null.
     TimelineEvent timeline_end_event = {};
     std::vector<TimelineEventList> timeline_event_lists;
+    size_t timeline_size_bytes = 0;
+    std::shared_ptr<const BeebState> timeline_keyframe_state;
+    size_t timeline_num_states_since_keyframe = 0;
+    // Set if ThreadThinTimeline couldn't get the timeline under the limit.
+    bool timeline_thinning_failed = false;
     std::shared_ptr<BeebState> timeline_replay_old_state;
     size_t timeline_replay_list_index = 0;
     size_t timeline_replay_list_event_index = 0;
     CycleCount timeline_replay_time_cycle_count = {0};
     size_t total_num_events = 0;
 
+    // States for stepping back, oldest first. Not kept when replaying, and
+    // cleared whenever the BBCMicro is replaced.
+    std::deque<RewindState> rewind_states;
+
+    // Rewind in progress, if rewinding is set: the BBCMicro has been replaced
+    // with an earlier one, which the main loop is running up to rewind_time,
+    // replaying rewind_events along the way. See ThreadStartRewind.
+    bool rewinding = false;
+    CycleCount rewind_time = {0};
+    bool rewind_video = false;
+    uint64_t rewind_video_begin_n = 0;
+    std::vector<TimelineEvent> rewind_events;
+    size_t rewind_event_index = 0;
+    BBCMicro::InstructionFn rewind_instruction_fn = nullptr;
+    void *rewind_instruction_fn_context = nullptr;
+#if BBCMICRO_DEBUGGER
+    std::shared_ptr<BBCMicro::DebugState> rewind_debug_state;
+#endif
+
+    // Step back in progress. Stepping back by host instruction takes two
+    // rewinds per instruction: one to find the previous instruction, then
+    // one to go back to it. See ThreadStepBack.
+    uint32_t step_back_num_instructions_left = 0;
+    bool step_back_finding_instruction = false;
+    StepBackInstructionData step_back_instruction_data;
+    Message::CompletionFun step_back_completion_fun;
+
+    // Printer output is appended to printer_buffer during the update, and
+    // copied to BeebThread::m_printer_buffer when possible.
+    std::vector<uint8_t> printer_buffer;
+    size_t num_printer_buffer_bytes_published = 0;
+
     bool copy_basic = false;
     std::function<void(std::vector<uint8_t>)> copy_stop_fun;
     std::vector<uint8_t> copy_data;
@@ -776,6 +871,37 @@ bool BeebThread::SetSpeedLimitedMessage::ThreadPrepare(std::shared_ptr<Message>
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+BeebThread::SetFastForwardMessage::SetFastForwardMessage(bool fast_forward)
+    : m_fast_forward(fast_forward) {
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool BeebThread::SetFastForwardMessage::ThreadPrepare(std::shared_ptr<Message> *ptr,
+                                                      CompletionFun *completion_fun,
+                                                      BeebThread *beeb_thread,
+                                                      ThreadState *ts) {
+    (void)completion_fun;
+
+    if (m_fast_forward != beeb_thread->m_is_fast_forward.load(std::memory_order_acquire)) {
+        beeb_thread->m_is_fast_forward.store(m_fast_forward, std::memory_order_release);
+
+        if (!m_fast_forward) {
+            // As after a replay: pick up the sound from the current position,
+            // and wait for the audio thread to ask for more.
+            beeb_thread->ThreadSyncSoundOutput(ts);
+            ts->next_stop_cycles = *ts->num_executed_cycles;
+        }
+    }
+
+    ptr->reset();
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 BeebThread::SetSpeedScaleMessage::SetSpeedScaleMessage(float scale)
     : m_scale(scale) {
     //ASSERT(m_scale>=0.0&&m_scale<=1.0);
@@ -924,6 +1050,10 @@ const std::shared_ptr<const BeebState> &BeebThread::BeebStateMessage::GetBeebSta
     return m_state;
 }
 
+bool BeebThread::BeebStateMessage::WasUserInitiated() const {
+    return m_user_initiated;
+}
+
 void BeebThread::BeebStateMessage::ThreadHandle(BeebThread *beeb_thread,
                                                 ThreadState *ts) const {
     (void)beeb_thread, (void)ts;
@@ -1136,6 +1266,39 @@ bool BeebThread::StopReplayMessage::ThreadPrepare(std::shared_ptr<Message> *ptr,
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+BeebThread::StepBackMessage::StepBackMessage(BeebThreadStepBackType type, uint32_t count)
+    : m_type(type)
+    , m_count(count) {
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool BeebThread::StepBackMessage::ThreadPrepare(std::shared_ptr<Message> *ptr,
+                                                CompletionFun *completion_fun,
+                                                BeebThread *beeb_thread,
+                                                ThreadState *ts) {
+    if (!PrepareUnlessReplaying(ptr, completion_fun, beeb_thread, ts)) {
+        return false;
+    }
+
+    if (!beeb_thread->ThreadStepBack(ts, m_type, m_count)) {
+        return false;
+    }
+
+    // The main loop does the rest, and calls the completion function once
+    // it's done. Nothing to record: the timeline, if recording, gets
+    // truncated.
+    ts->step_back_completion_fun = std::move(*completion_fun);
+    *completion_fun = CompletionFun();
+
+    ptr->reset();
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 bool BeebThread::StartRecordingMessage::ThreadPrepare(std::shared_ptr<Message> *ptr,
                                                       CompletionFun *completion_fun,
                                                       BeebThread *beeb_thread,
@@ -1201,9 +1364,11 @@ bool BeebThread::ClearRecordingMessage::ThreadPrepare(std::shared_ptr<Message> *
 
 #if BBCMICRO_TRACE
 BeebThread::StartTraceMessage::StartTraceMessage(const TraceConditions &conditions,
-                                                 size_t max_num_bytes)
+                                                 size_t max_num_bytes,
+                                                 std::string spill_path)
     : m_conditions(conditions)
-    , m_max_num_bytes(max_num_bytes) {
+    , m_max_num_bytes(max_num_bytes)
+    , m_spill_path(std::move(spill_path)) {
 }
 #endif
 
@@ -1217,6 +1382,7 @@ bool BeebThread::StartTraceMessage::ThreadPrepare(std::shared_ptr<Message> *ptr,
                                                   ThreadState *ts) {
     ts->trace_conditions = m_conditions;
     ts->trace_max_num_bytes = m_max_num_bytes;
+    ts->trace_spill_path = m_spill_path;
 
     beeb_thread->ThreadStartTrace(ts);
 
@@ -1756,9 +1922,19 @@ bool BeebThread::ResetPrinterBufferMessage::ThreadPrepare(std::shared_ptr<Messag
                                                           CompletionFun *completion_fun,
                                                           BeebThread *beeb_thread,
                                                           ThreadState *ts) {
-    (void)completion_fun, (void)ts;
+    (void)completion_fun;
+
+    ts->printer_buffer.clear();
+    ts->num_printer_buffer_bytes_published = 0;
+
+    {
+        LockGuard<Mutex> lock(beeb_thread->m_printer_buffer_mutex);
+
+        beeb_thread->m_printer_buffer.clear();
+    }
+
+    beeb_thread->m_printer_data_size_bytes.store(0, std::memory_order_release);
 
-    beeb_thread->m_printer_buffer.clear();
     ptr->reset();
     return true;
 }
@@ -1842,9 +2018,10 @@ BeebThread::BeebThread(std::shared_ptr<MessageList> message_list,
 
     this->SetBBCVolume(MAX_DB);
     this->SetDiscVolume(MAX_DB);
+    this->SetTimelineMaxSizeBytes(DEFAULT_TIMELINE_MAX_SIZE_BYTES);
 
     MUTEX_SET_NAME(m_mutex, "BeebThread");
-    MUTEX_SET_NAME(m_timeline_state_mutex, "BeebThread timeline_state");
+    MUTEX_SET_NAME(m_printer_buffer_mutex, "BeebThread printer_buffer");
     MUTEX_SET_NAME(m_last_trace_mutex, "BeebThread last_trace");
     MUTEX_SET_NAME(m_beeb_state_mutex, "BeebThread beeb_state");
     m_mq.SetName("BeebThread MQ");
@@ -1966,6 +2143,13 @@ bool BeebThread::IsCopying() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+bool BeebThread::CanStepBack() const {
+    return m_can_step_back.load(std::memory_order_acquire);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if BBCMICRO_TRACE
 const volatile TraceStats *BeebThread::GetTraceStats() const {
     if (m_is_tracing.load(std::memory_order_acquire)) {
@@ -1986,6 +2170,13 @@ bool BeebThread::IsSpeedLimited() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+bool BeebThread::IsFastForward() const {
+    return m_is_fast_forward.load(std::memory_order_acquire);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 float BeebThread::GetSpeedScale() const {
     return m_speed_scale.load(std::memory_order_acquire);
 }
@@ -2029,10 +2220,19 @@ bool BeebThread::GetKeyState(BeebKey beeb_key) const {
 //////////////////////////////////////////////////////////////////////////
 
 std::vector<uint8_t> BeebThread::GetNVRAM() const {
-    LockGuard<Mutex> lock(m_mutex);
+    std::shared_ptr<const BBCMicroReadOnlyState> state;
+    {
+        LockGuard<Mutex> lock(m_beeb_state_mutex);
+
+        state = m_beeb_state;
+        m_beeb_state_wanted.store(true, std::memory_order_release);
+    }
 
-    std::vector<uint8_t> nvram = m_thread_state->beeb->GetNVRAM();
-    return nvram;
+    if (!state) {
+        return std::vector<uint8_t>();
+    }
+
+    return state->GetNVRAM();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -2075,6 +2275,45 @@ std::shared_ptr<Trace> BeebThread::GetLastTrace() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+std::shared_ptr<const TraceIndex> BeebThread::GetLastTraceIndex() {
+#if BBCMICRO_TRACE
+    std::shared_ptr<Trace> last_trace;
+    {
+        LockGuard<Mutex> lock(m_last_trace_mutex);
+
+        if (m_last_trace_index || !m_last_trace) {
+            return m_last_trace_index;
+        }
+
+        last_trace = m_last_trace;
+    }
+
+    // Build the index without holding the lock, so the emulation thread can
+    // carry on.
+    auto index = std::make_shared<TraceIndex>(last_trace);
+
+    {
+        LockGuard<Mutex> lock(m_last_trace_mutex);
+
+        // Only keep it if it's still relevant.
+        if (m_last_trace == last_trace) {
+            if (!m_last_trace_index) {
+                m_last_trace_index = index;
+            }
+
+            return m_last_trace_index;
+        }
+    }
+
+    return index;
+#else
+    return nullptr;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 size_t BeebThread::AudioThreadFillAudioBuffer(float *samples,
                                               size_t num_samples,
                                               bool perfect,
@@ -2306,6 +2545,8 @@ BeebThread::TimingStats BeebThread::GetTimingStats() const {
 
     ts.num_mq_polls = m_num_mq_polls.load(std::memory_order_acquire);
     ts.num_mq_waits = m_num_mq_waits.load(std::memory_order_acquire);
+    ts.run_cycles = m_run_cycles.load(std::memory_order_acquire);
+    ts.overhead_fraction = m_overhead_fraction.load(std::memory_order_acquire);
 
     return ts;
 }
@@ -2314,9 +2555,7 @@ BeebThread::TimingStats BeebThread::GetTimingStats() const {
 //////////////////////////////////////////////////////////////////////////
 
 void BeebThread::GetTimelineState(BeebThreadTimelineState *timeline_state) const {
-    LockGuard<Mutex> lock(m_timeline_state_mutex);
-
-    *timeline_state = m_timeline_state;
+    *timeline_state = m_timeline_state.Read();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -2355,7 +2594,7 @@ size_t BeebThread::GetPrinterDataSizeBytes() const {
 //////////////////////////////////////////////////////////////////////////
 
 std::vector<uint8_t> BeebThread::GetPrinterData() const {
-    LockGuard<Mutex> lock(m_mutex);
+    LockGuard<Mutex> lock(m_printer_buffer_mutex);
 
     return m_printer_buffer;
 }
@@ -2400,6 +2639,20 @@ void BeebThread::SetShowCursor(bool show_cursor) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+size_t BeebThread::GetTimelineMaxSizeBytes() const {
+    return m_timeline_max_size_bytes.load(std::memory_order_acquire);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::SetTimelineMaxSizeBytes(size_t max_size_bytes) {
+    m_timeline_max_size_bytes.store(max_size_bytes, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if BBCMICRO_DEBUGGER
 bool BeebThread::DebugIsHalted() const {
     return m_debug_is_halted.load(std::memory_order_acquire);
@@ -2416,6 +2669,7 @@ void BeebThread::DebugGetState(std::shared_ptr<const BBCMicroReadOnlyState> *sta
 
     if (state_ptr) {
         *state_ptr = m_beeb_state;
+        m_beeb_state_wanted.store(true, std::memory_order_release);
     }
 
     if (debug_state_ptr) {
@@ -2451,7 +2705,6 @@ BeebThread::GetTimelineBeebStateEvents(size_t begin_index,
 bool BeebThread::ThreadHandleTraceInstructionConditions(const BBCMicro *beeb,
                                                         const M6502 *cpu,
                                                         void *context) {
-    (void)beeb;
     auto ts = (ThreadState *)context;
 
     switch (ts->trace_state) {
@@ -2471,6 +2724,14 @@ bool BeebThread::ThreadHandleTraceInstructionConditions(const BBCMicro *beeb,
                 ts->beeb_thread->ThreadBeebStartTrace(ts);
             }
             break;
+
+        case BeebThreadStartTraceCondition_Trigger:
+            if (!ts->trace_conditions.start_trigger.IsWriteTrigger()) {
+                if (ts->trace_conditions.start_trigger.Check(beeb, cpu)) {
+                    ts->beeb_thread->ThreadBeebStartTrace(ts);
+                }
+            }
+            break;
         }
         break;
 
@@ -2501,6 +2762,18 @@ bool BeebThread::ThreadHandleTraceInstructionConditions(const BBCMicro *beeb,
                 return false;
             }
             break;
+
+        case BeebThreadStopTraceCondition_Trigger:
+            if (ts->trace_conditions.stop_trigger.IsWriteTrigger()) {
+                // the write callback handles this one.
+                return false;
+            }
+
+            if (ts->trace_conditions.stop_trigger.Check(beeb, cpu)) {
+                ts->beeb_thread->ThreadStopTrace(ts);
+                return false;
+            }
+            break;
         }
         break;
     }
@@ -2516,7 +2789,6 @@ bool BeebThread::ThreadHandleTraceInstructionConditions(const BBCMicro *beeb,
 bool BeebThread::ThreadHandleTraceWriteConditions(const BBCMicro *beeb,
                                                   const M6502 *cpu,
                                                   void *context) {
-    (void)beeb;
     auto ts = (BeebThread::ThreadState *)context;
 
     switch (ts->trace_state) {
@@ -2535,6 +2807,14 @@ bool BeebThread::ThreadHandleTraceWriteConditions(const BBCMicro *beeb,
                 ts->beeb_thread->ThreadBeebStartTrace(ts);
             }
             break;
+
+        case BeebThreadStartTraceCondition_Trigger:
+            if (ts->trace_conditions.start_trigger.IsWriteTrigger()) {
+                if (ts->trace_conditions.start_trigger.Check(beeb, cpu)) {
+                    ts->beeb_thread->ThreadBeebStartTrace(ts);
+                }
+            }
+            break;
         }
         break;
 
@@ -2551,6 +2831,18 @@ bool BeebThread::ThreadHandleTraceWriteConditions(const BBCMicro *beeb,
                 return false;
             }
             break;
+
+        case BeebThreadStopTraceCondition_Trigger:
+            if (!ts->trace_conditions.stop_trigger.IsWriteTrigger()) {
+                // the instruction callback handles this one.
+                return false;
+            }
+
+            if (ts->trace_conditions.stop_trigger.Check(beeb, cpu)) {
+                ts->beeb_thread->ThreadStopTrace(ts);
+                return false;
+            }
+            break;
         }
         break;
     }
@@ -2657,7 +2949,7 @@ void BeebThread::ThreadReplaceBeeb(ThreadState *ts, std::unique_ptr<BBCMicro> be
 #if BBCMICRO_DEBUGGER
         ts->beeb->SetDebugState(std::move(debug_state));
 #endif
-        ts->beeb->SetPrinterBuffer(&m_printer_buffer);
+        ts->beeb->SetPrinterBuffer(&ts->printer_buffer);
 
         Message::CallCompletionFun(&ts->reset_completion_fun, false, nullptr);
         Message::CallCompletionFun(&ts->paste_completion_fun, false, nullptr);
@@ -2665,17 +2957,9 @@ void BeebThread::ThreadReplaceBeeb(ThreadState *ts, std::unique_ptr<BBCMicro> be
 
     ts->num_executed_cycles = ts->beeb->GetCycleCountPtr();
 
-    {
-        AudioDeviceLock lock(m_sound_device_id);
-
-        m_audio_thread_data->num_consumed_sound_units = ts->num_executed_cycles->n >> RSHIFT_CYCLE_COUNT_TO_SOUND_CLOCK;
+    ts->rewind_states.clear();
 
-        const SoundDataUnit *a, *b;
-        size_t na, nb;
-        if (m_sound_output.GetConsumerBuffers(&a, &na, &b, &nb)) {
-            m_sound_output.Consume(na + nb);
-        }
-    }
+    this->ThreadSyncSoundOutput(ts);
 
     m_has_nvram.store(!ts->beeb->GetNVRAM().empty(), std::memory_order_release);
     m_beeb_type_id.store(ts->beeb->GetTypeID(), std::memory_order_release);
@@ -2729,6 +3013,23 @@ void BeebThread::ThreadReplaceBeeb(ThreadState *ts, std::unique_ptr<BBCMicro> be
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Discard any pending sound output, and have the audio thread carry on from
+// the current cycle count.
+void BeebThread::ThreadSyncSoundOutput(ThreadState *ts) {
+    AudioDeviceLock lock(m_sound_device_id);
+
+    m_audio_thread_data->num_consumed_sound_units = ts->num_executed_cycles->n >> RSHIFT_CYCLE_COUNT_TO_SOUND_CLOCK;
+
+    const SoundDataUnit *a, *b;
+    size_t na, nb;
+    if (m_sound_output.GetConsumerBuffers(&a, &na, &b, &nb)) {
+        m_sound_output.Consume(na + nb);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if BBCMICRO_TRACE
 void BeebThread::ThreadStartTrace(ThreadState *ts) {
     ts->trace_state = BeebThreadTraceState_Waiting;
@@ -2757,6 +3058,15 @@ void BeebThread::ThreadStartTrace(ThreadState *ts) {
     case BeebThreadStartTraceCondition_WriteAddress:
         any_write_condition = true;
         break;
+
+    case BeebThreadStartTraceCondition_Trigger:
+        ts->trace_conditions.start_trigger.ResetCount();
+        if (ts->trace_conditions.start_trigger.IsWriteTrigger()) {
+            any_write_condition = true;
+        } else {
+            any_instruction_condition = true;
+        }
+        break;
     }
 
     //ts->beeb->SetInstructionTraceEventFn(nullptr,nullptr);
@@ -2778,6 +3088,15 @@ void BeebThread::ThreadStartTrace(ThreadState *ts) {
     case BeebThreadStopTraceCondition_WriteAddress:
         any_write_condition = true;
         break;
+
+    case BeebThreadStopTraceCondition_Trigger:
+        ts->trace_conditions.stop_trigger.ResetCount();
+        if (ts->trace_conditions.stop_trigger.IsWriteTrigger()) {
+            any_write_condition = true;
+        } else {
+            any_instruction_condition = true;
+        }
+        break;
     }
 
     if (any_instruction_condition) {
@@ -2803,6 +3122,11 @@ void BeebThread::ThreadBeebStartTrace(ThreadState *ts) {
     ts->trace_start_cycles = *ts->num_executed_cycles;
     ts->trace_state = BeebThreadTraceState_Tracing;
     ts->beeb->StartTrace(ts->trace_conditions.trace_flags, ts->trace_max_num_bytes);
+
+    if (!ts->trace_spill_path.empty()) {
+        // If the file can't be created, the trace just works as normal.
+        ts->beeb->GetTrace()->SetSpillFile(ts->trace_spill_path, ts->msgs);
+    }
 }
 #endif
 
@@ -2995,9 +3319,13 @@ void BeebThread::ThreadMain(void) {
         //ts.timeline_state.num_beeb_state_events = ts.timeline_event_lists.size();
 
         ts.total_num_events = 0;
-        for (const TimelineEventList &list : ts.timeline_event_lists) {
-            ts.total_num_events += 1 + list.events.size();
-            m_timeline_beeb_state_events_copy.push_back(list.state_event);
+        for (size_t i = 0; i < ts.timeline_event_lists.size(); ++i) {
+            const TimelineEventList *list = &ts.timeline_event_lists[i];
+
+            ts.total_num_events += 1 + list->events.size();
+            m_timeline_beeb_state_events_copy.push_back(list->state_event);
+
+            this->ThreadUpdateTimelineStateSize(&ts, i);
         }
 
         if (!ts.timeline_event_lists.empty()) {
@@ -3013,6 +3341,9 @@ void BeebThread::ThreadMain(void) {
 
     std::vector<SentMessage> messages;
 
+    ts.timing_period_start_ticks = GetCurrentTickCount();
+    uint64_t busy_start_ticks = ts.timing_period_start_ticks;
+
     int handle_messages_reason;
     for (;;) {
         handle_messages_reason = -1;
@@ -3031,11 +3362,21 @@ void BeebThread::ThreadMain(void) {
 
         const char *what;
 
-        if (paused ||
-            (m_is_speed_limited.load(std::memory_order_acquire) && ts.next_stop_cycles.n <= ts.num_executed_cycles->n)) {
+        bool is_fast_forward = m_is_fast_forward.load(std::memory_order_acquire);
+        bool is_speed_limited = m_is_speed_limited.load(std::memory_order_acquire) && !is_fast_forward;
+
+        if (ts.rewinding) {
+            // Any new messages wait until the rewind is done.
+            what = "rewinding";
+            (void)what;
+        } else if (messages.empty() &&
+                   (paused ||
+                    (is_speed_limited && ts.next_stop_cycles.n <= ts.num_executed_cycles->n))) {
             PROFILE_SCOPE(PROFILER_COLOUR_ALICE_BLUE, "MQ Wait");
             rmt_ScopedCPUSample(MessageQueueWaitForMessage, 0);
+            ts.timing_busy_ticks += GetCurrentTickCount() - busy_start_ticks;
             m_mq.ConsumerWaitForMessages(&messages);
+            busy_start_ticks = GetCurrentTickCount();
             ++m_num_mq_waits;
             what = "waited";
             (void)what;
@@ -3051,13 +3392,24 @@ void BeebThread::ThreadMain(void) {
             (void)what;
         }
 
+        this->ThreadUpdateRunCycles(&ts, is_speed_limited, !messages.empty());
+        this->ThreadUpdateTimingStats(&ts, &busy_start_ticks);
+
         CycleCount stop_cycles;
 
         //if(!messages.empty())
         {
             LockGuard<Mutex> lock(m_mutex);
 
+            size_t num_handled_messages = 0;
             for (auto &&m : messages) {
+                if (ts.rewinding) {
+                    // Leave the rest for once the rewind is done.
+                    break;
+                }
+
+                ++num_handled_messages;
+
                 bool prepared = m.message->ThreadPrepare(&m.message, &m.completion_fun, this, &ts);
                 if (!prepared) {
                     Message::CallCompletionFun(&m.completion_fun, false, nullptr);
@@ -3073,6 +3425,10 @@ void BeebThread::ThreadMain(void) {
 
                     Message::CallCompletionFun(&m.completion_fun, true, nullptr);
 
+                    if (!ts.rewind_states.empty()) {
+                        ts.rewind_states.back().events.push_back({*ts.num_executed_cycles, m.message});
+                    }
+
                     if (ts.timeline_mode == BeebThreadTimelineMode_Record) {
                         ASSERT(!ts.timeline_event_lists.empty());
                         TimelineEvent event{*ts.num_executed_cycles, std::move(m.message)};
@@ -3086,7 +3442,7 @@ void BeebThread::ThreadMain(void) {
                 }
             }
 
-            messages.clear();
+            messages.erase(messages.begin(), messages.begin() + (ptrdiff_t)num_handled_messages);
 
             if (!ts.beeb) {
                 // No point carrying on with the other stuff if there's
@@ -3095,12 +3451,34 @@ void BeebThread::ThreadMain(void) {
             }
 
             stop_cycles = ts.next_stop_cycles;
+            if (is_fast_forward) {
+                // There's no output, so the audio thread doesn't set the
+                // pace.
+                stop_cycles.n = UINT64_MAX;
+            }
+
+            if (ts.rewinding) {
+                this->ThreadUpdateRewind(&ts, &stop_cycles);
+            }
 
             uint32_t clone_impediments = ts.beeb->GetCloneImpediments();
 
             m_clone_impediments.store(clone_impediments, std::memory_order_release);
             m_update_flags.store(ts.beeb->GetUpdateFlags(), std::memory_order_release);
 
+            this->ThreadUpdateRewindStates(&ts, clone_impediments);
+
+            if (!ts.rewind_states.empty()) {
+                // Rewind states are only saved here, so stop in time for the
+                // next one. Otherwise, a long run (fast forward, say) would
+                // space them out further than
+                // REWIND_SAVE_STATE_FREQUENCY_CYCLES.
+                uint64_t next_rewind_n = ts.rewind_states.back().state->cycle_count.n + REWIND_SAVE_STATE_FREQUENCY_CYCLES.n;
+                if (next_rewind_n < stop_cycles.n) {
+                    stop_cycles.n = next_rewind_n;
+                }
+            }
+
             bool can_record = false;
 
             // Update ThreadState timeline stuff.
@@ -3110,6 +3488,11 @@ void BeebThread::ThreadMain(void) {
                 break;
 
             case BeebThreadTimelineMode_Record:
+                if (ts.rewinding) {
+                    // Recording carries on from wherever the rewind ends up.
+                    break;
+                }
+
                 {
                     ASSERT(!ts.timeline_event_lists.empty());
                     ts.timeline_end_event.time_cycles = *ts.num_executed_cycles;
@@ -3122,7 +3505,7 @@ void BeebThread::ThreadMain(void) {
                             // There have been no events since the last save
                             // event. Don't bother saving a new one.
                         } else {
-                            if (!this->ThreadRecordSaveState(&ts, true)) {
+                            if (!this->ThreadRecordSaveState(&ts, false)) {
                                 // ugh, something went wrong :(
                                 this->ThreadStopRecording(&ts);
                                 ts.msgs.e.f("Internal error - failed to save state.\n");
@@ -3172,7 +3555,6 @@ void BeebThread::ThreadMain(void) {
 #if BBCMICRO_TRACE
                 ts.beeb->GetTraceStats(&m_trace_stats);
 #endif
-                m_printer_data_size_bytes.store(m_printer_buffer.size(), std::memory_order_release);
             }
 
             if (ts.boot) {
@@ -3182,31 +3564,48 @@ void BeebThread::ThreadMain(void) {
             }
 
             {
-                LockGuard<Mutex> lock2(m_timeline_state_mutex);
+                BeebThreadTimelineState timeline_state;
 
-                m_timeline_state.mode = ts.timeline_mode;
+                timeline_state.mode = ts.timeline_mode;
 
-                m_timeline_state.num_beeb_state_events = ts.timeline_event_lists.size();
+                timeline_state.num_beeb_state_events = ts.timeline_event_lists.size();
 
-                if (m_timeline_state.num_beeb_state_events == 0) {
-                    ASSERT(m_timeline_state.num_events == 0);
-                    m_timeline_state.begin_cycles = {0};
-                    m_timeline_state.end_cycles = {0};
+                if (timeline_state.num_beeb_state_events == 0) {
+                    ASSERT(m_timeline_state.Read().num_events == 0);
+                    timeline_state.begin_cycles = {0};
+                    timeline_state.end_cycles = {0};
                 } else {
-                    m_timeline_state.begin_cycles = ts.timeline_event_lists[0].state_event.time_cycles;
-                    m_timeline_state.end_cycles = ts.timeline_end_event.time_cycles;
+                    timeline_state.begin_cycles = ts.timeline_event_lists[0].state_event.time_cycles;
+                    timeline_state.end_cycles = ts.timeline_end_event.time_cycles;
                 }
 
-                m_timeline_state.current_cycles = *ts.num_executed_cycles;
-                m_timeline_state.num_events = ts.total_num_events;
-                m_timeline_state.can_record = can_record;
-                m_timeline_state.clone_impediments = clone_impediments;
+                timeline_state.current_cycles = *ts.num_executed_cycles;
+                timeline_state.num_events = ts.total_num_events;
+                timeline_state.size_bytes = ts.timeline_size_bytes;
+                timeline_state.over_max_size = ts.timeline_thinning_failed && ts.timeline_size_bytes > m_timeline_max_size_bytes.load(std::memory_order_acquire);
+                timeline_state.can_record = can_record;
+                timeline_state.clone_impediments = clone_impediments;
+
+                m_timeline_state.Write(timeline_state);
             }
 
-            {
+            // Don't publish anything from part way through a rewind. The UI
+            // sees the old state until it's done.
+            if (!ts.rewinding) {
+                std::shared_ptr<const BBCMicroReadOnlyState> beeb_state;
+
+                uint64_t now_ticks = GetCurrentTickCount();
+                if (m_beeb_state_wanted.exchange(false, std::memory_order_acq_rel) ||
+                    GetSecondsFromTicks(now_ticks - ts.beeb_state_ticks) >= MAX_BEEB_STATE_AGE_SECONDS) {
+                    beeb_state = ts.beeb->DebugGetState();
+                    ts.beeb_state_ticks = now_ticks;
+                }
+
                 LockGuard<Mutex> lock2(m_beeb_state_mutex);
 
-                m_beeb_state = ts.beeb->DebugGetState();
+                if (!!beeb_state) {
+                    m_beeb_state = std::move(beeb_state);
+                }
 #if BBCMICRO_DEBUGGER
                 m_beeb_debug_state = ts.beeb->GetDebugState();
                 if (!!m_beeb_debug_state) {
@@ -3226,8 +3625,23 @@ void BeebThread::ThreadMain(void) {
             ASSERT(ts.beeb);
 
             CycleCount num_cycles = {stop_cycles.n - ts.num_executed_cycles->n};
-            if (num_cycles.n > RUN_CYCLES.n) {
-                num_cycles.n = RUN_CYCLES.n;
+
+            if (ts.rewinding) {
+                // The rewind sets its own stop points. It doesn't need to
+                // stop for messages, as they'll wait.
+                this->ThreadRunRewind(&ts, num_cycles);
+                continue;
+            }
+
+            if (num_cycles.n > ts.run_cycles.n) {
+                num_cycles.n = ts.run_cycles.n;
+            }
+
+            ts.beeb->SetCatchUpMode(is_fast_forward);
+
+            if (is_fast_forward) {
+                this->ThreadFastForward(&ts, num_cycles);
+                continue;
             }
 
             VideoDataUnit *va, *vb;
@@ -3277,8 +3691,10 @@ void BeebThread::ThreadMain(void) {
                 bool vunits_a = true;
                 size_t num_vunits = 0;
 
-                UniqueLock<Mutex> lock(m_mutex);
+                uint64_t update_start_ticks = GetCurrentTickCount();
 
+                // No locks are held here. Anything the UI needs is published
+                // from the message handling part of the loop.
                 for (;;) {
 #if BBCMICRO_DEBUGGER
                     if (ts.beeb->DebugIsHalted()) {
@@ -3322,8 +3738,12 @@ void BeebThread::ThreadMain(void) {
                 }
 
                 m_video_output.Produce(num_vunits);
+
+                ts.timing_update_ticks += GetCurrentTickCount() - update_start_ticks;
             }
 
+            this->ThreadPublishPrinterBuffer(&ts);
+
             // It's a bit dumb having multiple copies.
             m_num_cycles.store(*ts.num_executed_cycles, std::memory_order_release);
         }
@@ -3369,12 +3789,27 @@ bool BeebThread::ThreadRecordSaveState(ThreadState *ts, bool user_initiated) {
         return false;
     }
 
-    auto message = std::make_shared<BeebStateMessage>(std::make_shared<BeebState>(*beeb_state),
+    auto state = std::make_shared<BeebState>(*beeb_state);
+
+    // Most states store their RAM as a delta against the last keyframe, to
+    // save memory.
+    TimelineEventList list;
+
+    if (!ts->timeline_keyframe_state ||
+        ts->timeline_num_states_since_keyframe >= TIMELINE_KEYFRAME_FREQUENCY) {
+        list.keyframe = true;
+        ts->timeline_keyframe_state = state;
+        ts->timeline_num_states_since_keyframe = 0;
+    } else {
+        state->CompressRAM(*ts->timeline_keyframe_state);
+        ++ts->timeline_num_states_since_keyframe;
+    }
+
+    auto message = std::make_shared<BeebStateMessage>(std::move(state),
                                                       user_initiated);
 
     CycleCount time = *ts->num_executed_cycles;
 
-    TimelineEventList list;
     list.state_event = {time, std::move(message)};
 
     m_timeline_beeb_state_events_copy.push_back(list.state_event);
@@ -3383,8 +3818,12 @@ bool BeebThread::ThreadRecordSaveState(ThreadState *ts, bool user_initiated) {
 
     ++ts->total_num_events;
 
+    this->ThreadUpdateTimelineStateSize(ts, ts->timeline_event_lists.size() - 1);
+
     this->ThreadCheckTimeline(ts);
 
+    this->ThreadThinTimeline(ts);
+
     return true;
 }
 
@@ -3406,6 +3845,9 @@ void BeebThread::ThreadClearRecording(ThreadState *ts) {
 
     ts->timeline_event_lists.clear();
     ts->total_num_events = 0;
+    ts->timeline_size_bytes = 0;
+    ts->timeline_keyframe_state.reset();
+    ts->timeline_thinning_failed = false;
     m_timeline_beeb_state_events_copy.clear();
 
     this->ThreadCheckTimeline(ts);
@@ -3416,6 +3858,7 @@ void BeebThread::ThreadClearRecording(ThreadState *ts) {
 
 void BeebThread::ThreadCheckTimeline(ThreadState *ts) {
     size_t num_events = 0;
+    size_t size_bytes = 0;
 
     size_t num_event_lists = ts->timeline_event_lists.size();
     ASSERT(num_event_lists == m_timeline_beeb_state_events_copy.size());
@@ -3429,6 +3872,7 @@ void BeebThread::ThreadCheckTimeline(ThreadState *ts) {
             ASSERT(e->state_event.time_cycles.n == e->state_event.message->GetBeebState()->cycle_count.n);
 
             num_events += 1 + e->events.size();
+            size_bytes += e->state_size_bytes;
 
             if (pe) {
                 ASSERT(e->state_event.time_cycles.n >= pe->state_event.time_cycles.n);
@@ -3461,6 +3905,9 @@ void BeebThread::ThreadCheckTimeline(ThreadState *ts) {
 
     //ASSERT(m_timeline_state.num_events == num_events);
     (void)num_events;
+
+    ASSERT(ts->timeline_size_bytes == size_bytes);
+    (void)size_bytes;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -3475,6 +3922,21 @@ void BeebThread::ThreadDeleteTimelineState(ThreadState *ts,
         return;
     }
 
+    this->ThreadDeleteTimelineEventList(ts, index);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadDeleteTimelineEventList(ThreadState *ts, size_t index) {
+    this->ThreadCheckTimeline(ts);
+
+    ASSERT(index < ts->timeline_event_lists.size());
+
+    if (ts->timeline_event_lists[index].keyframe) {
+        this->ThreadRebaseTimelineStates(ts, index);
+    }
+
     TimelineEventList *list = &ts->timeline_event_lists[index];
 
     if (index == 0) {
@@ -3493,52 +3955,236 @@ void BeebThread::ThreadDeleteTimelineState(ThreadState *ts,
     ASSERT(ts->total_num_events > 0);
     --ts->total_num_events;
 
+    ASSERT(ts->timeline_size_bytes >= list->state_size_bytes);
+    ts->timeline_size_bytes -= list->state_size_bytes;
+
     // Remove.
     m_timeline_beeb_state_events_copy.erase(m_timeline_beeb_state_events_copy.begin() + (ptrdiff_t)index);
     ts->timeline_event_lists.erase(ts->timeline_event_lists.begin() + (ptrdiff_t)index);
 
+    // The next state now has a different previous state.
+    if (index < ts->timeline_event_lists.size()) {
+        this->ThreadUpdateTimelineStateSize(ts, index);
+    }
+
     this->ThreadCheckTimeline(ts);
 }
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-void BeebThread::ThreadTruncateTimeline(ThreadState *ts,
-                                        const std::shared_ptr<const BeebState> &state) {
-    this->ThreadCheckTimeline(ts);
+void BeebThread::ThreadThinTimeline(ThreadState *ts) {
+    size_t max_size_bytes = m_timeline_max_size_bytes.load(std::memory_order_acquire);
 
-    size_t index;
-    if (!this->ThreadFindTimelineEventListIndexByBeebState(ts, &index, state)) {
-        return; // Umm...
-    }
+    while (ts->timeline_size_bytes > max_size_bytes) {
+        size_t n = ts->timeline_event_lists.size();
+        if (n < 3) {
+            break;
+        }
 
-    TimelineEventList *list = &ts->timeline_event_lists[index];
+        // Find the state whose removal leaves the smallest gap, relative to
+        // its age, so that older states end up further apart than newer ones.
+        //
+        // The first and last states are always kept, as are any the user
+        // asked for. Keyframes are only removed once there's nothing else, as
+        // removing one means re-basing the states that refer to it.
+        uint64_t now = ts->timeline_event_lists[n - 1].state_event.time_cycles.n;
+        size_t best_index = 0;
+        double best_score = 0.;
+
+        for (int keyframes = 0; keyframes < 2 && best_index == 0; ++keyframes) {
+            for (size_t i = 1; i < n - 1; ++i) {
+                const TimelineEventList *list = &ts->timeline_event_lists[i];
+
+                if (list->keyframe != !!keyframes || list->state_event.message->WasUserInitiated()) {
+                    continue;
+                }
 
-    // Account for removal of this state's events.
-    ASSERT(ts->total_num_events >= list->events.size());
-    ts->total_num_events -= list->events.size();
+                uint64_t gap = (ts->timeline_event_lists[i + 1].state_event.time_cycles.n -
+                                ts->timeline_event_lists[i - 1].state_event.time_cycles.n);
+                uint64_t age = now - list->state_event.time_cycles.n;
+                if (age == 0) {
+                    continue;
+                }
 
-    // Account for removal of subsequent states and their events.
-    for (size_t i = index + 1; i < ts->timeline_event_lists.size(); ++i) {
-        ASSERT(ts->total_num_events >= 1 + ts->timeline_event_lists[i].events.size());
-        ts->total_num_events -= 1 + ts->timeline_event_lists[i].events.size();
+                double score = (double)gap / (double)age;
+                if (best_index == 0 || score < best_score) {
+                    best_index = i;
+                    best_score = score;
+                }
+            }
+        }
+
+        if (best_index == 0) {
+            break;
+        }
+
+        this->ThreadDeleteTimelineEventList(ts, best_index);
+    }
+
+    ts->timeline_thinning_failed = ts->timeline_size_bytes > max_size_bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadRebaseTimelineStates(ThreadState *ts, size_t index) {
+    ASSERT(index < ts->timeline_event_lists.size());
+    ASSERT(ts->timeline_event_lists[index].keyframe);
+
+    const std::shared_ptr<const BeebState> &old_keyframe_state = ts->timeline_event_lists[index].state_event.message->GetBeebState();
+
+    // The states compressed against this keyframe are the ones up to the next
+    // keyframe. The first becomes the new keyframe, and the rest are
+    // compressed against that instead.
+    //
+    // The states are shared with the UI, so they're replaced rather than
+    // modified. (ThreadFindTimelineEventListIndexByBeebState still finds the
+    // replacements from the UI's copies.)
+    std::shared_ptr<const BeebState> new_keyframe_state;
+
+    size_t end = index + 1;
+    while (end < ts->timeline_event_lists.size() && !ts->timeline_event_lists[end].keyframe) {
+        TimelineEventList *list = &ts->timeline_event_lists[end];
+        const BeebStateMessage *old_message = list->state_event.message.get();
+
+        auto state = std::make_shared<BeebState>(*old_message->GetBeebState());
+        state->DecompressRAM();
+
+        if (!new_keyframe_state) {
+            list->keyframe = true;
+            new_keyframe_state = state;
+        } else {
+            state->CompressRAM(*new_keyframe_state);
+        }
+
+        list->state_event.message = std::make_shared<BeebStateMessage>(std::move(state),
+                                                                       old_message->WasUserInitiated());
+        m_timeline_beeb_state_events_copy[end] = list->state_event;
+
+        ++end;
+    }
+
+    if (ts->timeline_keyframe_state == old_keyframe_state) {
+        // Further states get compressed against the new keyframe, if there is
+        // one, or become a keyframe themselves.
+        ts->timeline_keyframe_state = new_keyframe_state;
+        if (!new_keyframe_state) {
+            ts->timeline_num_states_since_keyframe = 0;
+        }
+    }
+
+    for (size_t i = index + 1; i <= end && i < ts->timeline_event_lists.size(); ++i) {
+        this->ThreadUpdateTimelineStateSize(ts, i);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadUpdateTimelineStateSize(ThreadState *ts, size_t index) {
+    ASSERT(index < ts->timeline_event_lists.size());
+    TimelineEventList *list = &ts->timeline_event_lists[index];
+
+    const BeebState *prev_state = nullptr;
+    if (index > 0) {
+        prev_state = ts->timeline_event_lists[index - 1].state_event.message->GetBeebState().get();
     }
 
+    ASSERT(ts->timeline_size_bytes >= list->state_size_bytes);
+    ts->timeline_size_bytes -= list->state_size_bytes;
+
+    const BeebState *state = list->state_event.message->GetBeebState().get();
+    list->state_size_bytes = sizeof *state + state->GetNumUnsharedRAMBytes(prev_state);
+
+    ts->timeline_size_bytes += list->state_size_bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadTruncateTimeline(ThreadState *ts,
+                                        const std::shared_ptr<const BeebState> &state) {
+    this->ThreadCheckTimeline(ts);
+
+    size_t index;
+    if (!this->ThreadFindTimelineEventListIndexByBeebState(ts, &index, state)) {
+        return; // Umm...
+    }
+
+    TimelineEventList *list = &ts->timeline_event_lists[index];
+
     // Remove this state's events.
+    ASSERT(ts->total_num_events >= list->events.size());
+    ts->total_num_events -= list->events.size();
     list->events.clear();
 
+    this->ThreadEraseTimelineEventListsAfter(ts, index);
+
+    // The given state is now the end of the timeline.
+    ts->timeline_end_event.time_cycles = list->state_event.time_cycles;
+
+    this->ThreadCheckTimeline(ts);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadTruncateTimelineAt(ThreadState *ts, CycleCount time) {
+    this->ThreadCheckTimeline(ts);
+
+    size_t index;
+    if (!this->ThreadFindTimelineEventListIndexByCycleCount(ts, &index, time)) {
+        // The whole timeline is after TIME.
+        this->ThreadClearRecording(ts);
+        return;
+    }
+
+    TimelineEventList *list = &ts->timeline_event_lists[index];
+
+    // Remove this state's events after TIME.
+    auto it = list->events.begin();
+    while (it != list->events.end() && it->time_cycles.n <= time.n) {
+        ++it;
+    }
+
+    size_t num_removed = (size_t)(list->events.end() - it);
+    ASSERT(ts->total_num_events >= num_removed);
+    ts->total_num_events -= num_removed;
+    list->events.erase(it, list->events.end());
+
+    this->ThreadEraseTimelineEventListsAfter(ts, index);
+
+    ts->timeline_end_event.time_cycles = time;
+
+    this->ThreadCheckTimeline(ts);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadEraseTimelineEventListsAfter(ThreadState *ts, size_t index) {
+    ASSERT(index < ts->timeline_event_lists.size());
+
+    // Account for removal of subsequent states and their events.
+    for (size_t i = index + 1; i < ts->timeline_event_lists.size(); ++i) {
+        ASSERT(ts->total_num_events >= 1 + ts->timeline_event_lists[i].events.size());
+        ts->total_num_events -= 1 + ts->timeline_event_lists[i].events.size();
+
+        ASSERT(ts->timeline_size_bytes >= ts->timeline_event_lists[i].state_size_bytes);
+        ts->timeline_size_bytes -= ts->timeline_event_lists[i].state_size_bytes;
+    }
+
     // Remove subsequent states.
     ts->timeline_event_lists.erase(ts->timeline_event_lists.begin() + (ptrdiff_t)index + 1,
                                    ts->timeline_event_lists.end());
 
-    // The given state is now the end of the timeline.
-    ts->timeline_end_event.time_cycles = list->state_event.time_cycles;
+    // Start a new keyframe for any further states.
+    ts->timeline_keyframe_state.reset();
 
     // Truncate the copy list as well.
     m_timeline_beeb_state_events_copy.erase(m_timeline_beeb_state_events_copy.begin() + (ptrdiff_t)index + 1,
                                             m_timeline_beeb_state_events_copy.end());
-
-    this->ThreadCheckTimeline(ts);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -3552,8 +4198,28 @@ bool BeebThread::ThreadFindTimelineEventListIndexByBeebState(ThreadState *ts,
     size_t n = ts->timeline_event_lists.size();
     ASSERT(n < PTRDIFF_MAX);
 
+    // Match by time rather than by pointer: the UI may still have an older
+    // copy of the state, from before ThreadRebaseTimelineStates replaced it.
     for (size_t i = 0; i < n; ++i) {
-        if (ts->timeline_event_lists[i].state_event.message->GetBeebState() == state) {
+        if (ts->timeline_event_lists[i].state_event.time_cycles.n == state->cycle_count.n) {
+            *index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool BeebThread::ThreadFindTimelineEventListIndexByCycleCount(ThreadState *ts,
+                                                              size_t *index,
+                                                              CycleCount time) {
+    this->ThreadCheckTimeline(ts);
+
+    for (size_t i = ts->timeline_event_lists.size(); i-- > 0;) {
+        if (ts->timeline_event_lists[i].state_event.time_cycles.n <= time.n) {
             *index = i;
             return true;
         }
@@ -3621,10 +4287,506 @@ void BeebThread::ThreadStopReplay(ThreadState *ts) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void BeebThread::ThreadUpdateRunCycles(ThreadState *ts, bool is_speed_limited, bool got_messages) {
+    if (is_speed_limited) {
+        // The audio thread sets the pace, and there may be user input to
+        // respond to.
+        ts->run_cycles = DEFAULT_RUN_CYCLES;
+    } else if (got_messages) {
+        // Something's going on - check back sooner.
+        ts->run_cycles.n = std::max(ts->run_cycles.n / 2, MIN_RUN_CYCLES.n);
+    } else {
+        // Nothing's going on - spend less time checking.
+        ts->run_cycles.n = std::min(ts->run_cycles.n * 2, MAX_RUN_CYCLES.n);
+    }
+
+    m_run_cycles.store(ts->run_cycles, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadUpdateTimingStats(ThreadState *ts, uint64_t *busy_start_ticks) {
+    uint64_t now_ticks = GetCurrentTickCount();
+
+    ts->timing_busy_ticks += now_ticks - *busy_start_ticks;
+    *busy_start_ticks = now_ticks;
+
+    if (GetSecondsFromTicks(now_ticks - ts->timing_period_start_ticks) < TIMING_STATS_PERIOD_SECONDS) {
+        return;
+    }
+
+    double overhead_fraction = 0.;
+    if (ts->timing_busy_ticks > 0) {
+        ASSERT(ts->timing_update_ticks <= ts->timing_busy_ticks);
+        overhead_fraction = (double)(ts->timing_busy_ticks - ts->timing_update_ticks) / ts->timing_busy_ticks;
+    }
+
+    m_overhead_fraction.store(overhead_fraction, std::memory_order_release);
+
+    ts->timing_period_start_ticks = now_ticks;
+    ts->timing_busy_ticks = 0;
+    ts->timing_update_ticks = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadPublishPrinterBuffer(ThreadState *ts) {
+    ASSERT(ts->num_printer_buffer_bytes_published <= ts->printer_buffer.size());
+    if (ts->num_printer_buffer_bytes_published == ts->printer_buffer.size()) {
+        return;
+    }
+
+    // Don't wait if the UI is busy copying the data. The new bytes can go
+    // next time.
+    if (!m_printer_buffer_mutex.try_lock()) {
+        return;
+    }
+
+    m_printer_buffer.insert(m_printer_buffer.end(),
+                            ts->printer_buffer.begin() + (ptrdiff_t)ts->num_printer_buffer_bytes_published,
+                            ts->printer_buffer.end());
+
+    m_printer_buffer_mutex.unlock();
+
+    ts->num_printer_buffer_bytes_published = ts->printer_buffer.size();
+    m_printer_data_size_bytes.store(ts->printer_buffer.size(), std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadFastForward(ThreadState *ts, CycleCount num_cycles) {
+    PROFILE_SCOPE(PROFILER_COLOUR_BLUE, "Beeb Fast Forward");
+    rmt_ScopedCPUSample(BeebFastForward, 0);
+
+    // Catch-up mode doesn't touch the units, so they can be dummies, and
+    // nothing waits for the output buffers.
+    VideoDataUnit dummy_video_unit;
+    SoundDataUnit dummy_sound_unit;
+
+    uint64_t update_start_ticks = GetCurrentTickCount();
+
+    uint64_t stop_n = ts->num_executed_cycles->n + num_cycles.n;
+    while (ts->num_executed_cycles->n < stop_n) {
+#if BBCMICRO_DEBUGGER
+        if (ts->beeb->DebugIsHalted()) {
+            break;
+        }
+#endif
+
+        ts->beeb->Update(&dummy_video_unit, &dummy_sound_unit);
+    }
+
+    ts->timing_update_ticks += GetCurrentTickCount() - update_start_ticks;
+
+    this->ThreadPublishPrinterBuffer(ts);
+
+    m_num_cycles.store(*ts->num_executed_cycles, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadUpdateRewindStates(ThreadState *ts, uint32_t clone_impediments) {
+    if (ts->timeline_mode == BeebThreadTimelineMode_Replay || clone_impediments != 0) {
+        // There's no stepping back through a replay, and there's no saving a
+        // state with clone impediments.
+        ts->rewind_states.clear();
+    } else if (ts->rewind_states.empty() ||
+               ts->num_executed_cycles->n - ts->rewind_states.back().state->cycle_count.n >= REWIND_SAVE_STATE_FREQUENCY_CYCLES.n) {
+        if (std::shared_ptr<BeebState> state = this->ThreadSaveState(ts)) {
+            if (ts->rewind_states.size() >= REWIND_MAX_NUM_STATES) {
+                ts->rewind_states.pop_front();
+            }
+
+            ts->rewind_states.push_back({std::move(state), {}});
+        } else {
+            ts->rewind_states.clear();
+        }
+    }
+
+    bool can_step_back = !ts->rewind_states.empty();
+    if (ts->timeline_mode == BeebThreadTimelineMode_Record && !ts->timeline_event_lists.empty()) {
+        can_step_back = true;
+    }
+
+    m_can_step_back.store(can_step_back, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool BeebThread::ThreadStartRewind(ThreadState *ts,
+                                   CycleCount time,
+                                   bool video,
+                                   BBCMicro::InstructionFn instruction_fn,
+                                   void *instruction_fn_context) {
+    ASSERT(!ts->rewinding);
+    ASSERT(time.n <= ts->num_executed_cycles->n);
+
+    // Start from a state at least a frame before TIME, if there is one, so
+    // there's a whole frame of video output. Otherwise, the latest state no
+    // later than TIME.
+    uint64_t video_begin_n = 0;
+    if (time.n >= REWIND_SAVE_STATE_FREQUENCY_CYCLES.n) {
+        video_begin_n = time.n - REWIND_SAVE_STATE_FREQUENCY_CYCLES.n;
+    }
+
+    std::shared_ptr<const BeebState> state;
+    std::vector<TimelineEvent> events;
+
+    size_t rewind_index = ts->rewind_states.size();
+    for (size_t i = ts->rewind_states.size(); i-- > 0;) {
+        uint64_t n = ts->rewind_states[i].state->cycle_count.n;
+        if (n <= time.n) {
+            rewind_index = i;
+            if (n <= video_begin_n) {
+                break;
+            }
+        }
+    }
+
+    if (rewind_index < ts->rewind_states.size()) {
+        state = ts->rewind_states[rewind_index].state;
+
+        for (size_t i = rewind_index; i < ts->rewind_states.size(); ++i) {
+            for (const TimelineEvent &event : ts->rewind_states[i].events) {
+                if (event.time_cycles.n <= time.n) {
+                    events.push_back(event);
+                }
+            }
+        }
+
+        // The later states, and this state's events, get recreated along the
+        // way.
+        ts->rewind_states.erase(ts->rewind_states.begin() + (ptrdiff_t)rewind_index + 1,
+                                ts->rewind_states.end());
+        ts->rewind_states.back().events.clear();
+    } else if (ts->timeline_mode == BeebThreadTimelineMode_Record) {
+        // Too far back for the rewind states, but the timeline covers it.
+        size_t index;
+        if (!this->ThreadFindTimelineEventListIndexByCycleCount(ts, &index, time)) {
+            return false;
+        }
+
+        if (index > 0 && ts->timeline_event_lists[index].state_event.time_cycles.n > video_begin_n) {
+            --index;
+        }
+
+        state = ts->timeline_event_lists[index].state_event.message->GetBeebState();
+
+        for (size_t i = index; i < ts->timeline_event_lists.size(); ++i) {
+            for (const TimelineEvent &event : ts->timeline_event_lists[i].events) {
+                if (event.time_cycles.n <= time.n) {
+                    events.push_back(event);
+                }
+            }
+        }
+
+        ts->rewind_states.clear();
+        ts->rewind_states.push_back({state, {}});
+    } else {
+        return false;
+    }
+
+    {
+        std::deque<RewindState> rewind_states = std::move(ts->rewind_states);
+        this->ThreadReplaceBeeb(ts, std::make_unique<BBCMicro>(*state), 0);
+        ts->rewind_states = std::move(rewind_states);
+    }
+
+#if BBCMICRO_DEBUGGER
+    // Breakpoints mustn't stop the replay.
+    ts->rewind_debug_state = ts->beeb->TakeDebugState();
+#endif
+
+    if (instruction_fn) {
+        ts->beeb->AddHostInstructionFn(instruction_fn, instruction_fn_context);
+    }
+
+    ts->rewinding = true;
+    ts->rewind_time = time;
+    ts->rewind_video = video;
+    ts->rewind_video_begin_n = video_begin_n;
+    ts->rewind_events = std::move(events);
+    ts->rewind_event_index = 0;
+    ts->rewind_instruction_fn = instruction_fn;
+    ts->rewind_instruction_fn_context = instruction_fn_context;
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadUpdateRewind(ThreadState *ts, CycleCount *stop_cycles) {
+    for (;;) {
+        ASSERT(ts->rewinding);
+        uint64_t now = ts->num_executed_cycles->n;
+
+        while (ts->rewind_event_index < ts->rewind_events.size() &&
+               ts->rewind_events[ts->rewind_event_index].time_cycles.n <= now) {
+            const TimelineEvent &event = ts->rewind_events[ts->rewind_event_index];
+            ASSERT(event.time_cycles.n == now);
+            event.message->ThreadHandle(this, ts);
+
+            if (!ts->rewind_states.empty()) {
+                ts->rewind_states.back().events.push_back(event);
+            }
+
+            ++ts->rewind_event_index;
+        }
+
+        if (now < ts->rewind_time.n) {
+            break;
+        }
+
+        this->ThreadFinishRewind(ts);
+        this->ThreadContinueStepBack(ts);
+
+        if (!ts->rewinding) {
+            // Nothing more to run until the audio thread asks for it.
+            *stop_cycles = *ts->num_executed_cycles;
+            return;
+        }
+    }
+
+    // Stop for the next event, the start of the video output, or the end.
+    *stop_cycles = ts->rewind_time;
+
+    if (ts->rewind_event_index < ts->rewind_events.size()) {
+        const TimelineEvent &event = ts->rewind_events[ts->rewind_event_index];
+        if (event.time_cycles.n < stop_cycles->n) {
+            *stop_cycles = event.time_cycles;
+        }
+    }
+
+    if (ts->rewind_video &&
+        ts->num_executed_cycles->n < ts->rewind_video_begin_n &&
+        ts->rewind_video_begin_n < stop_cycles->n) {
+        stop_cycles->n = ts->rewind_video_begin_n;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadRunRewind(ThreadState *ts, CycleCount num_cycles) {
+    PROFILE_SCOPE(PROFILER_COLOUR_BLUE, "Beeb Rewind");
+
+    // The last frame's worth goes to the video output. Sound output is
+    // discarded, and everything before the last frame is run in catch-up
+    // mode.
+    bool video = ts->rewind_video && ts->num_executed_cycles->n >= ts->rewind_video_begin_n;
+
+    ts->beeb->SetCatchUpMode(!video);
+
+    VideoDataUnit dummy_video_unit;
+    SoundDataUnit dummy_sound_unit;
+    VideoDataUnit *va = nullptr, *vb = nullptr;
+    size_t num_va = 0, num_vb = 0;
+    size_t num_vunits = 0;
+
+    if (video) {
+        if (!m_video_output.GetProducerBuffers(&va, &num_va, &vb, &num_vb)) {
+            num_va = 0;
+            num_vb = 0;
+        }
+    }
+
+    uint64_t update_start_ticks = GetCurrentTickCount();
+
+    uint64_t stop_n = ts->num_executed_cycles->n + num_cycles.n;
+    while (ts->num_executed_cycles->n < stop_n) {
+        VideoDataUnit *vunit = &dummy_video_unit;
+        if (num_vunits < num_va) {
+            vunit = va + num_vunits;
+        } else if (num_vunits - num_va < num_vb) {
+            vunit = vb + (num_vunits - num_va);
+        }
+
+        uint32_t update_result = ts->beeb->Update(vunit, &dummy_sound_unit);
+
+        if ((update_result & BBCMicroUpdateResultFlag_VideoUnit) && vunit != &dummy_video_unit) {
+            ++num_vunits;
+        }
+    }
+
+    if (num_vunits > 0) {
+        m_video_output.Produce(num_vunits);
+    }
+
+    ts->timing_update_ticks += GetCurrentTickCount() - update_start_ticks;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadFinishRewind(ThreadState *ts) {
+    ASSERT(ts->rewinding);
+    ASSERT(ts->num_executed_cycles->n >= ts->rewind_time.n);
+
+    ts->rewinding = false;
+    ts->rewind_events.clear();
+
+    ts->beeb->SetCatchUpMode(false);
+
+    if (ts->rewind_instruction_fn) {
+        ts->beeb->RemoveHostInstructionFn(ts->rewind_instruction_fn, ts->rewind_instruction_fn_context);
+        ts->rewind_instruction_fn = nullptr;
+        ts->rewind_instruction_fn_context = nullptr;
+    }
+
+#if BBCMICRO_DEBUGGER
+    bool was_halted = ts->rewind_debug_state && ts->rewind_debug_state->is_halted;
+
+    ts->beeb->SetDebugState(std::move(ts->rewind_debug_state));
+
+    if (was_halted) {
+        ts->beeb->DebugHalt("step back");
+    }
+#endif
+
+    this->ThreadSyncSoundOutput(ts);
+
+    // Wait for the audio thread to ask for more, rather than running flat out
+    // to the old stop point.
+    ts->next_stop_cycles = *ts->num_executed_cycles;
+
+    m_num_cycles.store(*ts->num_executed_cycles, std::memory_order_release);
+
+    if (ts->timeline_mode == BeebThreadTimelineMode_Record) {
+        this->ThreadTruncateTimelineAt(ts, ts->rewind_time);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static bool FindPreviousHostInstruction(const BBCMicro *beeb, const M6502 *cpu, void *context) {
+    (void)cpu;
+    auto data = (StepBackInstructionData *)context;
+
+    // This is called part way through the update for the cycle, and the
+    // debugger halts once that update is done.
+    CycleCount time = {beeb->GetCycleCountPtr()->n + 1};
+    if (time.n < data->end.n) {
+        data->prev = time;
+        data->found = true;
+    }
+
+    return true;
+}
+
+bool BeebThread::ThreadStepBack(ThreadState *ts, BeebThreadStepBackType type, uint32_t count) {
+    if (!ts->beeb) {
+        return false;
+    }
+
+    // Find how far back it's possible to go.
+    CycleCount begin = *ts->num_executed_cycles;
+
+    if (!ts->rewind_states.empty()) {
+        begin = ts->rewind_states.front().state->cycle_count;
+    }
+
+    if (ts->timeline_mode == BeebThreadTimelineMode_Record && !ts->timeline_event_lists.empty()) {
+        if (ts->timeline_event_lists[0].state_event.time_cycles.n < begin.n) {
+            begin = ts->timeline_event_lists[0].state_event.time_cycles;
+        }
+    }
+
+    if (begin.n == ts->num_executed_cycles->n) {
+        ts->msgs.e.f("Can't step back: no earlier states\n");
+        return false;
+    }
+
+    switch (type) {
+    default:
+        ASSERT(false);
+        return false;
+
+    case BeebThreadStepBackType_Frame:
+        {
+            CycleCount time = *ts->num_executed_cycles;
+
+            uint64_t num_cycles = count * REWIND_SAVE_STATE_FREQUENCY_CYCLES.n;
+            if (num_cycles > time.n - begin.n) {
+                num_cycles = time.n - begin.n;
+            }
+
+            time.n -= num_cycles;
+
+            ts->step_back_num_instructions_left = 0;
+            ts->step_back_finding_instruction = false;
+
+            return this->ThreadStartRewind(ts, time, true, nullptr, nullptr);
+        }
+
+    case BeebThreadStepBackType_HostInstruction:
+        if (count == 0) {
+            return true;
+        }
+
+        ts->step_back_num_instructions_left = count;
+
+        return this->ThreadStartStepBackInstruction(ts);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool BeebThread::ThreadStartStepBackInstruction(ThreadState *ts) {
+    ASSERT(ts->step_back_num_instructions_left > 0);
+    --ts->step_back_num_instructions_left;
+
+    // Replay up to the current point to find where the previous instruction
+    // started. ThreadContinueStepBack then goes back there.
+    ts->step_back_finding_instruction = true;
+    ts->step_back_instruction_data = StepBackInstructionData();
+    ts->step_back_instruction_data.end = *ts->num_executed_cycles;
+
+    return this->ThreadStartRewind(ts, ts->step_back_instruction_data.end, false, &FindPreviousHostInstruction, &ts->step_back_instruction_data);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BeebThread::ThreadContinueStepBack(ThreadState *ts) {
+    bool ok = true;
+
+    if (ts->step_back_finding_instruction) {
+        ts->step_back_finding_instruction = false;
+
+        if (!ts->step_back_instruction_data.found) {
+            ts->msgs.e.f("Can't step back: no earlier states\n");
+            ok = false;
+        } else if (!this->ThreadStartRewind(ts, ts->step_back_instruction_data.prev, true, nullptr, nullptr)) {
+            ok = false;
+        }
+    } else if (ts->step_back_num_instructions_left > 0) {
+        if (!this->ThreadStartStepBackInstruction(ts)) {
+            ok = false;
+        }
+    }
+
+    if (!ok || !ts->rewinding) {
+        ts->step_back_num_instructions_left = 0;
+        Message::CallCompletionFun(&ts->step_back_completion_fun, ok, nullptr);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void BeebThread::SetLastTrace(std::shared_ptr<Trace> last_trace) {
     LockGuard<Mutex> lock(m_last_trace_mutex);
 
     m_last_trace = std::move(last_trace);
+    m_last_trace_index = nullptr;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -6,11 +6,13 @@
 
 #include "conf.h"
 #include <shared/mutex.h>
+#include <shared/seqlock.h>
 #include <thread>
 #include <beeb/OutputData.h>
 #include <memory>
 #include <vector>
 #include <beeb/Trace.h>
+#include <beeb/TraceTrigger.h>
 #include "keys.h"
 #include <beeb/BBCMicro.h>
 #include <atomic>
@@ -28,6 +30,7 @@
 struct Message;
 struct BeebWindowInitArguments;
 class TVOutput;
+class TraceIndex;
 struct Message;
 class BeebState;
 class MessageList;
@@ -49,10 +52,12 @@ struct TraceConditions {
     BeebThreadStartTraceCondition start = BeebThreadStartTraceCondition_Immediate;
     int8_t start_key = -1;
     uint16_t start_address = 0;
+    TraceTrigger start_trigger;
 
     BeebThreadStopTraceCondition stop = BeebThreadStopTraceCondition_ByRequest;
     CycleCount stop_num_cycles = {0};
     uint16_t stop_address = 0;
+    TraceTrigger stop_trigger;
 
     uint32_t trace_flags = 0;
 };
@@ -92,6 +97,10 @@ struct BeebThreadTimelineState {
     CycleCount current_cycles = {0};
     size_t num_events = 0;
     size_t num_beeb_state_events = 0;
+    size_t size_bytes = 0;
+    // Set if the timeline is over the maximum size, and there's nothing more
+    // that can be removed.
+    bool over_max_size = false;
     bool can_record = false;
     uint32_t clone_impediments = 0;
 };
@@ -182,6 +191,14 @@ class BeebThread {
         TimelineBeebStateEvent state_event;
         std::vector<TimelineEvent> events;
 
+        // Approximate memory used by the state, not counting anything shared
+        // with the previous list's state.
+        size_t state_size_bytes = 0;
+
+        // Set if the state's RAM was stored in full. Other states' RAM is
+        // stored relative to the most recent keyframe.
+        bool keyframe = false;
+
         TimelineEventList() = default;
 
         // Moving is fine. Copying isn't!
@@ -367,6 +384,23 @@ class BeebThread {
         const bool m_limited = false;
     };
 
+    // While fast forwarding, the emulation runs as fast as possible in
+    // BBCMicro catch-up mode, producing no video or sound. Output resumes,
+    // from wherever the emulation got to, when fast forward is turned off.
+    class SetFastForwardMessage : public Message {
+      public:
+        explicit SetFastForwardMessage(bool fast_forward);
+
+        bool ThreadPrepare(std::shared_ptr<Message> *ptr,
+                           CompletionFun *completion_fun,
+                           BeebThread *beeb_thread,
+                           ThreadState *ts) override;
+
+      protected:
+      private:
+        const bool m_fast_forward = false;
+    };
+
     class SetSpeedScaleMessage : public Message {
       public:
         explicit SetSpeedScaleMessage(float scale);
@@ -535,6 +569,23 @@ class BeebThread {
       private:
     };
 
+    // Step back in time, by recreating an earlier state from the recent states
+    // the thread keeps, or (when recording) the timeline.
+    class StepBackMessage : public Message {
+      public:
+        explicit StepBackMessage(BeebThreadStepBackType type, uint32_t count = 1);
+
+        bool ThreadPrepare(std::shared_ptr<Message> *ptr,
+                           CompletionFun *completion_fun,
+                           BeebThread *beeb_thread,
+                           ThreadState *ts) override;
+
+      protected:
+      private:
+        const BeebThreadStepBackType m_type = BeebThreadStepBackType_Frame;
+        const uint32_t m_count = 1;
+    };
+
     class StartRecordingMessage : public Message {
       public:
         bool ThreadPrepare(std::shared_ptr<Message> *ptr,
@@ -571,7 +622,9 @@ class BeebThread {
 #if BBCMICRO_TRACE
     class StartTraceMessage : public Message {
       public:
-        explicit StartTraceMessage(const TraceConditions &conditions, size_t max_num_bytes);
+        // If spill_path is non-empty, chunks that would be discarded once
+        // the trace is max_num_bytes are spilled to that file instead.
+        explicit StartTraceMessage(const TraceConditions &conditions, size_t max_num_bytes, std::string spill_path);
 
         bool ThreadPrepare(std::shared_ptr<Message> *ptr,
                            CompletionFun *completion_fun,
@@ -582,6 +635,7 @@ class BeebThread {
       private:
         const TraceConditions m_conditions;
         const size_t m_max_num_bytes;
+        const std::string m_spill_path;
     };
 #endif
 
@@ -908,6 +962,13 @@ class BeebThread {
     struct TimingStats {
         size_t num_mq_waits = 0;
         size_t num_mq_polls = 0;
+
+        // Current maximum number of cycles run between checks for messages.
+        CycleCount run_cycles = {0};
+
+        // Fraction of the emulation thread's recent non-waiting time spent
+        // outside BBCMicro::Update.
+        double overhead_fraction = 0.;
     };
 
     // When planning to set up the BeebThread using a saved state,
@@ -953,11 +1014,16 @@ class BeebThread {
 
     bool IsCopying() const;
 
+    // Returns true if there's anything to step back to.
+    bool CanStepBack() const;
+
     // Get trace stats, or nullptr if there's no trace.
     const volatile TraceStats *GetTraceStats() const;
 
     bool IsSpeedLimited() const;
 
+    bool IsFastForward() const;
+
     // Get the speed scale.
     float GetSpeedScale() const;
 
@@ -974,6 +1040,9 @@ class BeebThread {
     // Get/set NVRAM. 0 is the first byte of CMOS RAM/EEPROM (the RTC
     // data is not included) - so the values are indexed as per the
     // OSWORD calls.
+    //
+    // The result comes from the thread's most recent snapshot of the
+    // BBCMicro state, so it may be up to half a second out of date.
     std::vector<uint8_t> GetNVRAM() const;
 
     // Returns true if the emulated computer has NVRAM.
@@ -989,6 +1058,11 @@ class BeebThread {
     // Get a shared_ptr to the last recorded trace, if there is one.
     std::shared_ptr<Trace> GetLastTrace();
 
+    // Get an index for the last recorded trace, if there is one. The index is
+    // built on the calling thread the first time it's requested, which can
+    // take a while, and then kept until the trace is replaced.
+    std::shared_ptr<const TraceIndex> GetLastTraceIndex();
+
     // Call to produce more audio and send timing messages to the
     // thread.
     //
@@ -1047,6 +1121,10 @@ class BeebThread {
 
 #if BBCMICRO_DEBUGGER
     bool DebugIsHalted() const;
+
+    // The state is the thread's most recent snapshot. A new one is taken next
+    // time round the thread's loop, so callers that call this regularly (e.g.,
+    // once per frame) see something reasonably current.
     void DebugGetState(std::shared_ptr<const BBCMicroReadOnlyState> *state_ptr, std::shared_ptr<const BBCMicro::DebugState> *debug_state_ptr) const;
 #endif
 
@@ -1061,9 +1139,15 @@ class BeebThread {
     bool GetShowCursor() const;
     void SetShowCursor(bool show_cursor);
 
+    // When recording, older timeline states are thinned out to keep the total
+    // memory used by the timeline under this limit.
+    size_t GetTimelineMaxSizeBytes() const;
+    void SetTimelineMaxSizeBytes(size_t max_size_bytes);
+
   protected:
   private:
     struct AudioThreadData;
+    struct RewindState;
 
     class KeyStates {
       public:
@@ -1101,6 +1185,7 @@ class BeebThread {
     // Safe provided they are updated atomically.
     std::atomic<CycleCount> m_num_cycles{};
     std::atomic<bool> m_is_speed_limited{true};
+    std::atomic<bool> m_is_fast_forward{false};
     std::atomic<float> m_speed_scale{1.0};
     std::atomic<uint32_t> m_leds{0};
 #if BBCMICRO_TRACE
@@ -1108,6 +1193,7 @@ class BeebThread {
 #endif
     std::atomic<bool> m_is_pasting{false};
     std::atomic<bool> m_is_copying{false};
+    std::atomic<bool> m_can_step_back{false};
     std::atomic<bool> m_has_nvram{false};
     std::atomic<BBCMicroTypeID> m_beeb_type_id{BBCMicroTypeID_B};
     std::atomic<uint32_t> m_clone_impediments{0};
@@ -1116,26 +1202,32 @@ class BeebThread {
     std::atomic<size_t> m_printer_data_size_bytes{false};
     std::atomic<uint64_t> m_num_mq_polls{0};
     std::atomic<uint64_t> m_num_mq_waits{0};
+    std::atomic<CycleCount> m_run_cycles{};
+    std::atomic<double> m_overhead_fraction{0.};
     std::atomic<bool> m_debug_is_halted{false};
     std::atomic<uint32_t> m_update_flags{0};
 
     // Stuff the BeebThread reads to update the BBCMicro at appropriate times.
     std::atomic<bool> m_show_cursor{true};
+    std::atomic<size_t> m_timeline_max_size_bytes{0};
     bool m_power_on_tone = true;
 
     // Lock m_mutex first, if locking both. (The public API makes this hard to
     // get wrong.)
     mutable Mutex m_beeb_state_mutex;
     std::shared_ptr<const BBCMicroReadOnlyState> m_beeb_state;
+
+    // Set when m_beeb_state is read. Taking a new snapshot isn't free, so the
+    // thread only does it when the last one has been asked for, or when it's
+    // getting old.
+    mutable std::atomic<bool> m_beeb_state_wanted{true};
 #if BBCMICRO_DEBUGGER
     std::shared_ptr<const BBCMicro::DebugState> m_beeb_debug_state;
     std::shared_ptr<const BBCMicro::UpdateMFnData> m_update_mfn_data;
 #endif
 
-    // Lock m_mutex first, if locking both. (The public API makes this hard to
-    // get wrong.)
-    mutable Mutex m_timeline_state_mutex;
-    BeebThreadTimelineState m_timeline_state;
+    // Written by the thread each time round the loop.
+    SeqLock<BeebThreadTimelineState> m_timeline_state;
 
     // Controlled by m_mutex.
     std::vector<TimelineBeebStateEvent> m_timeline_beeb_state_events_copy;
@@ -1152,10 +1244,14 @@ class BeebThread {
     // get wrong.)
     Mutex m_last_trace_mutex;
 
-    // Last recorded trace. Controlled by m_last_trace_mutex.
+    // Last recorded trace, and its index if one has been built. Controlled by
+    // m_last_trace_mutex.
     std::shared_ptr<Trace> m_last_trace;
+    std::shared_ptr<const TraceIndex> m_last_trace_index;
 
-    // Controlled by m_mutex.
+    // Copy of the printer output so far. Controlled by m_printer_buffer_mutex.
+    // The thread only ever try-locks this.
+    mutable Mutex m_printer_buffer_mutex;
     std::vector<uint8_t> m_printer_buffer;
 
 #if BBCMICRO_TRACE
@@ -1188,6 +1284,7 @@ class BeebThread {
 
     std::shared_ptr<BeebState> ThreadSaveState(ThreadState *ts);
     void ThreadReplaceBeeb(ThreadState *ts, std::unique_ptr<BBCMicro> beeb, uint32_t flags);
+    void ThreadSyncSoundOutput(ThreadState *ts);
 #if BBCMICRO_TRACE
     void ThreadStartTrace(ThreadState *ts);
     void ThreadBeebStartTrace(ThreadState *ts);
@@ -1211,14 +1308,39 @@ class BeebThread {
     // Delete one timeline save state event, leaving the timeline as intact as
     // possible.
     void ThreadDeleteTimelineState(ThreadState *ts, const std::shared_ptr<const BeebState> &state);
+    void ThreadDeleteTimelineEventList(ThreadState *ts, size_t index);
+
+    // Delete older timeline states until the timeline fits in the memory
+    // limit, or there's nothing left that can be deleted.
+    void ThreadThinTimeline(ThreadState *ts);
+
+    // Before removing the keyframe at INDEX, make the states that refer to it
+    // refer to the next one instead.
+    void ThreadRebaseTimelineStates(ThreadState *ts, size_t index);
+
+    // Recalculate size of the given timeline event list's state.
+    void ThreadUpdateTimelineStateSize(ThreadState *ts, size_t index);
 
     // Truncate the timeline. STATE is the new end.
     void ThreadTruncateTimeline(ThreadState *ts, const std::shared_ptr<const BeebState> &state);
 
+    // Truncate the timeline. TIME is the new end; events at TIME are kept.
+    void ThreadTruncateTimelineAt(ThreadState *ts, CycleCount time);
+
+    // Remove the event lists after the given one.
+    void ThreadEraseTimelineEventListsAfter(ThreadState *ts, size_t index);
+
+    // Find the event list for STATE, which may be a previous copy of the
+    // list's state. Lists are matched by time.
     bool ThreadFindTimelineEventListIndexByBeebState(ThreadState *ts,
                                                      size_t *index,
                                                      const std::shared_ptr<const BeebState> &state);
 
+    // Find the last event list whose state is no later than TIME.
+    bool ThreadFindTimelineEventListIndexByCycleCount(ThreadState *ts,
+                                                      size_t *index,
+                                                      CycleCount time);
+
     // Get next un-replayed replay event.
     const TimelineEvent *ThreadGetNextReplayEvent(ThreadState *ts);
 
@@ -1228,6 +1350,54 @@ class BeebThread {
 
     void ThreadStopReplay(ThreadState *ts);
 
+    // Adjust the maximum slice size for the next run of the emulated BBC,
+    // depending on whether there's likely to be anything to respond to.
+    void ThreadUpdateRunCycles(ThreadState *ts, bool is_speed_limited, bool got_messages);
+
+    // Account for the main loop time since *BUSY_START_TICKS, and update the
+    // overhead fraction if it's time.
+    void ThreadUpdateTimingStats(ThreadState *ts, uint64_t *busy_start_ticks);
+
+    // Copy any new printer output to m_printer_buffer, unless the UI has it
+    // locked.
+    void ThreadPublishPrinterBuffer(ThreadState *ts);
+
+    // Run for NUM_CYCLES (or until the debugger halts) in catch-up mode,
+    // without producing any output.
+    void ThreadFastForward(ThreadState *ts, CycleCount num_cycles);
+
+    // Save a rewind state, if it's time for a new one.
+    void ThreadUpdateRewindStates(ThreadState *ts, uint32_t clone_impediments);
+
+    // Start replacing the BBCMicro with a recreation of the current one as it
+    // was at TIME. The recreation starts from an earlier state, and the main
+    // loop runs it up to TIME, replaying any messages from along the way, with
+    // m_mutex unlocked as usual. (Any new messages wait until it's done.)
+    //
+    // If VIDEO, the last frame's worth of video output is produced, so that
+    // the display is up to date. INSTRUCTION_FN, if non-null, is added as a
+    // host instruction callback while the recreation is being run.
+    bool ThreadStartRewind(ThreadState *ts,
+                           CycleCount time,
+                           bool video,
+                           BBCMicro::InstructionFn instruction_fn,
+                           void *instruction_fn_context);
+
+    // Replay any messages due, and limit *STOP_CYCLES so the main loop stops
+    // for the next one. Finishes the rewind once it's reached its time.
+    void ThreadUpdateRewind(ThreadState *ts, CycleCount *stop_cycles);
+
+    // Run the rewind for NUM_CYCLES.
+    void ThreadRunRewind(ThreadState *ts, CycleCount num_cycles);
+
+    void ThreadFinishRewind(ThreadState *ts);
+
+    // Start stepping back. The rest happens in ThreadContinueStepBack, each
+    // time a rewind finishes.
+    bool ThreadStepBack(ThreadState *ts, BeebThreadStepBackType type, uint32_t count);
+    bool ThreadStartStepBackInstruction(ThreadState *ts);
+    void ThreadContinueStepBack(ThreadState *ts);
+
     void SetLastTrace(std::shared_ptr<Trace> last_trace);
 
     static bool ThreadWaitForHardReset(const BBCMicro *beeb, const M6502 *cpu, void *context);
@@ -18,6 +18,7 @@ EPN(NextKeypress)
 EPN(Instruction)
 EPN(WriteAddress)
 EPN(Reset)
+EPN(Trigger)
 EEND()
 #undef ENAME
 #endif
@@ -33,6 +34,7 @@ EPN(OSWORD0)
 EPN(BRK)
 EPN(NumCycles)
 EPN(WriteAddress)
+EPN(Trigger)
 EEND()
 #undef ENAME
 #endif
@@ -51,6 +53,19 @@ EEND()
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+#define ENAME BeebThreadStepBackType
+EBEGIN()
+// Go back one 50 Hz frame's worth of cycles.
+EPN(Frame)
+
+// Go back to the start of the previous host CPU instruction.
+EPN(HostInstruction)
+EEND()
+#undef ENAME
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #define ENAME BeebThreadHardResetFlag
 EBEGIN()
 EPNV(Boot, 1 << 0)
@@ -113,10 +113,14 @@ static Command2 g_copy_printer_buffer_command = Command2(&g_beeb_window_command_
 static Command2 g_save_printer_buffer_command = Command2(&g_beeb_window_command_table, "save_printer_buffer", "Save printer buffer...");
 static Command2 g_debug_stop_command = Command2(&g_beeb_window_command_table, "debug_stop", "Stop").WithShortcut(SDLK_F5 | PCKeyModifier_Shift).VisibleIf(BBCMICRO_DEBUGGER);
 static Command2 g_debug_run_command = Command2(&g_beeb_window_command_table, "debug_run", "Run").WithShortcut(SDLK_F5).VisibleIf(BBCMICRO_DEBUGGER);
+static Command2 g_debug_step_back_frame_command = Command2(&g_beeb_window_command_table, "debug_step_back_frame", "Step back frame").WithShortcut(SDLK_F6 | PCKeyModifier_Shift).VisibleIf(BBCMICRO_DEBUGGER);
+static Command2 g_debug_start_profile_command = Command2(&g_beeb_window_command_table, "debug_start_profile", "Start profile").VisibleIf(BBCMICRO_DEBUGGER);
+static Command2 g_debug_stop_profile_command = Command2(&g_beeb_window_command_table, "debug_stop_profile", "Stop profile and save...").VisibleIf(BBCMICRO_DEBUGGER);
 static Command2 g_save_default_nvram_command = Command2(&g_beeb_window_command_table, "save_default_nvram", "Save CMOS/EEPROM contents");
 static Command2 g_reset_default_nvram_command = Command2(&g_beeb_window_command_table, "reset_default_nvram", "Reset CMOS/EEPROM").MustConfirm();
 static Command2 g_save_config_command = Command2(&g_beeb_window_command_table, "save_config", "Save config");
 static Command2 g_toggle_prioritize_shortcuts_command = Command2(&g_beeb_window_command_table, "toggle_prioritize_shortcuts", "Prioritize command keys").WithTick();
+static Command2 g_toggle_fast_forward_command = Command2(&g_beeb_window_command_table, "toggle_fast_forward", "Fast forward").WithTick();
 static Command2 g_save_screenshot_command = Command2(&g_beeb_window_command_table, "save_screenshot", "Save screenshot");
 static Command2 g_copy_screenshot_command = Command2(&g_beeb_window_command_table, "copy_screenshot", "Copy screenshot");
 #if ENABLE_SDL_FULL_SCREEN
@@ -236,6 +240,8 @@ static bool InitialiseTogglePopupCommands() {
     InitialiseTogglePopupCommand(BeebWindowPopupType_SystemDebug, "toggle_system_debug", "System debug", &CreateSystemDebugWindow);
     InitialiseTogglePopupCommand(BeebWindowPopupType_MouseDebug, "toggle_mouse_debug", "Mouse debug", &CreateMouseDebugWindow);
     InitialiseTogglePopupCommand(BeebWindowPopupType_WD1770Debug, "toggle_wd1770_debug", "WD1770 Debug", &CreateWD1770DebugWindow);
+    InitialiseTogglePopupCommand(BeebWindowPopupType_GuestProfileDebug, "toggle_guest_profile_debug", "Guest Profile", &CreateGuestProfileDebugWindow);
+    InitialiseTogglePopupCommand(BeebWindowPopupType_TraceQueryDebug, "toggle_trace_query_debug", "Trace Query", &CreateTraceQueryDebugWindow);
     return true;
 }
 
@@ -272,6 +278,7 @@ static const std::string RECENT_PATHS_DISC_IMAGE = "disc_image";
 static const std::string RECENT_PATHS_NVRAM = "nvram";
 static const std::string RECENT_PATHS_SCREENSHOT = "screenshot";
 static const std::string RECENT_PATHS_PRINTER = "printer";
+static const std::string RECENT_PATHS_PROFILE = "profile";
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -1387,6 +1394,53 @@ void BeebWindow::DoCommands(bool *close_window) {
     }
 #endif
 
+#if BBCMICRO_DEBUGGER
+    m_cst.SetEnabled(g_debug_step_back_frame_command, this->DebugIsStepBackEnabled());
+    if (m_cst.WasActioned(g_debug_step_back_frame_command)) {
+        m_beeb_thread->Send(std::make_shared<BeebThread::StepBackMessage>(BeebThreadStepBackType_Frame));
+    }
+#endif
+
+#if BBCMICRO_DEBUGGER
+    m_cst.SetEnabled(g_debug_start_profile_command, !m_is_profiling);
+    if (m_cst.WasActioned(g_debug_start_profile_command)) {
+        m_beeb_thread->Send(std::make_shared<BeebThread::CallbackMessage>([](BBCMicro *m) -> void {
+            m->StartProfile();
+        }));
+        m_is_profiling = true;
+    }
+
+    m_cst.SetEnabled(g_debug_stop_profile_command, m_is_profiling);
+    if (m_cst.WasActioned(g_debug_stop_profile_command)) {
+        SaveFileDialog fd(RECENT_PATHS_PROFILE);
+
+        fd.AddFilter("Folded stacks", {".folded", ".txt"});
+        fd.AddAllFilesFilter();
+
+        std::string path;
+        if (fd.Open(&path)) {
+            m_beeb_thread->Send(std::make_shared<BeebThread::CallbackMessage>([path, message_list = m_message_list](BBCMicro *m) -> void {
+                Messages msg(message_list);
+
+                // A reset or state load replaces the BBCMicro, and the
+                // profile goes with it.
+                if (!m->IsProfiling()) {
+                    msg.e.f("Profile was lost (BBC Micro was reset?)\n");
+                    return;
+                }
+
+                std::string stacks = m->GetProfileFoldedStacks();
+                m->StopProfile();
+
+                if (SaveTextFile(stacks, path, &msg)) {
+                    msg.i.f("Saved profile: %s\n", path.c_str());
+                }
+            }));
+            m_is_profiling = false;
+        }
+    }
+#endif
+
     m_cst.SetEnabled(g_save_default_nvram_command, m_beeb_thread->HasNVRAM());
     if (m_cst.WasActioned(g_save_default_nvram_command)) {
         if (BeebConfig *config = FindBeebConfigByName(this->GetConfigName())) {
@@ -1412,6 +1466,11 @@ void BeebWindow::DoCommands(bool *close_window) {
         this->ShowPrioritizeCommandShortcutsStatus();
     }
 
+    m_cst.SetTicked(g_toggle_fast_forward_command, m_beeb_thread->IsFastForward());
+    if (m_cst.WasActioned(g_toggle_fast_forward_command)) {
+        m_beeb_thread->Send(std::make_shared<BeebThread::SetFastForwardMessage>(!m_beeb_thread->IsFastForward()));
+    }
+
     if (m_cst.WasActioned(g_save_screenshot_command)) {
         SaveFileDialog fd(RECENT_PATHS_SCREENSHOT);
 
@@ -2135,6 +2194,10 @@ void BeebWindow::DoToolsMenu() {
 
         ImGui::Separator();
 
+        m_cst.DoMenuItem(g_toggle_fast_forward_command);
+
+        ImGui::Separator();
+
         if (ImGui::BeginMenu("LEDs")) {
             ImGuiMenuItemEnumValue("Auto hide", nullptr, &m_settings.leds_popup_mode, BeebWindowLEDsPopupMode_Auto);
             ImGuiMenuItemEnumValue("Always on", nullptr, &m_settings.leds_popup_mode, BeebWindowLEDsPopupMode_On);
@@ -2241,11 +2304,19 @@ void BeebWindow::DoDebugMenu() {
         m_cst.DoMenuItem(g_popups[BeebWindowPopupType_KeyboardDebug].command);
         m_cst.DoMenuItem(g_popups[BeebWindowPopupType_MouseDebug].command);
         m_cst.DoMenuItem(g_popups[BeebWindowPopupType_WD1770Debug].command);
+        m_cst.DoMenuItem(g_popups[BeebWindowPopupType_GuestProfileDebug].command);
+        m_cst.DoMenuItem(g_popups[BeebWindowPopupType_TraceQueryDebug].command);
 
         ImGui::Separator();
 
         m_cst.DoMenuItem(g_debug_stop_command);
         m_cst.DoMenuItem(g_debug_run_command);
+        m_cst.DoMenuItem(g_debug_step_back_frame_command);
+
+        ImGui::Separator();
+
+        m_cst.DoMenuItem(g_debug_start_profile_command);
+        m_cst.DoMenuItem(g_debug_stop_profile_command);
 
 #endif
 
@@ -2326,10 +2397,10 @@ void BeebWindow::UpdateTVTextureThread(UpdateTVTextureThreadState *state) {
                                                                     state->update_inhibit);
             }
 
-            {
+            if (state->update_dest_pixels) {
                 PROFILE_SCOPE(PROFILER_COLOUR_CORAL, "CopyTexturePixels");
 
-                ASSERT(state->update_dest_pitch >= 0);
+                ASSERT(state->update_dest_pitch > 0);
                 state->update_tv->CopyTexturePixels(state->update_dest_pixels,
                                                     (size_t)state->update_dest_pitch);
             }
@@ -2432,7 +2503,11 @@ bool BeebWindow::InhibitUpdateTVTexture() const {
 //////////////////////////////////////////////////////////////////////////
 
 void BeebWindow::BeginUpdateTVTexture(bool threaded, void *dest_pixels, int dest_pitch) {
-    ASSERT(dest_pitch > 0);
+    ASSERT(!dest_pixels || dest_pitch > 0);
+
+    // The update thread isn't running at this point.
+    m_tv.SetKeepLastVSyncTexturePixels(m_settings.screenshot_last_vsync);
+
     if (threaded) {
         {
             UniqueLock<Mutex> lock(m_update_tv_texture_state.mutex);
@@ -2454,7 +2529,7 @@ void BeebWindow::BeginUpdateTVTexture(bool threaded, void *dest_pixels, int dest
 void BeebWindow::EndUpdateTVTexture(bool threaded, VBlankRecord *vblank_record, void *dest_pixels, int dest_pitch) {
     Timer tmr(&g_HandleVBlank_UpdateTVTexture_Consume_timer_def);
 
-    ASSERT(dest_pitch > 0);
+    ASSERT(!dest_pixels || dest_pitch > 0);
 
     if (threaded) {
         UniqueLock<Mutex> lock(m_update_tv_texture_state.mutex);
@@ -2474,13 +2549,55 @@ void BeebWindow::EndUpdateTVTexture(bool threaded, VBlankRecord *vblank_record,
 
         vblank_record->num_video_units = num_units_consumed;
 
-        m_tv.CopyTexturePixels(dest_pixels, (size_t)dest_pitch);
+        if (dest_pixels) {
+            m_tv.CopyTexturePixels(dest_pixels, (size_t)dest_pitch);
+        }
     }
 }
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Dirty spans separated by fewer clean lines than this are uploaded in one
+// go, to avoid lots of tiny uploads.
+static const int MAX_TV_TEXTURE_UPLOAD_GAP = 8;
+
+void BeebWindow::UploadTVTexture() {
+    const uint32_t *pixels = m_tv.GetTexturePixels(nullptr);
+
+    if (!m_tv_texture_up_to_date) {
+        SDL_UpdateTexture(m_tv_texture, nullptr, pixels, TV_TEXTURE_WIDTH * 4);
+        m_tv_texture_up_to_date = true;
+    } else {
+        const uint8_t *dirty_lines = m_tv.GetDirtyLines();
+
+        int y = 0;
+        while (y < TV_TEXTURE_HEIGHT) {
+            if (!dirty_lines[y]) {
+                ++y;
+                continue;
+            }
+
+            int last_dirty_y = y;
+            for (int i = y + 1; i < TV_TEXTURE_HEIGHT && i - last_dirty_y <= MAX_TV_TEXTURE_UPLOAD_GAP; ++i) {
+                if (dirty_lines[i]) {
+                    last_dirty_y = i;
+                }
+            }
+
+            SDL_Rect rect = {0, y, TV_TEXTURE_WIDTH, last_dirty_y + 1 - y};
+            SDL_UpdateTexture(m_tv_texture, &rect, pixels + y * TV_TEXTURE_WIDTH, TV_TEXTURE_WIDTH * 4);
+
+            y = last_dirty_y + 1;
+        }
+    }
+
+    m_tv.ResetDirtyLines();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 BeebWindow::VBlankRecord *BeebWindow::NewVBlankRecord(uint64_t ticks) {
     VBlankRecord *vblank_record;
 
@@ -2688,10 +2805,18 @@ bool BeebWindow::HandleVBlank(uint64_t ticks) {
 
         VBlankRecord *vblank_record = this->NewVBlankRecord(ticks);
 
+        // Without markers, the TVOutput texture can be uploaded as-is once
+        // it's up to date. Otherwise, the markers get added as it's copied
+        // into the locked texture.
         void *dest_pixels = nullptr;
         int dest_pitch = 0;
+        bool upload_tv_texture = false;
         if (m_tv_texture) {
-            SDL_LockTexture(m_tv_texture, nullptr, &dest_pixels, &dest_pitch);
+            if (m_tv.HasMarkers()) {
+                SDL_LockTexture(m_tv_texture, nullptr, &dest_pixels, &dest_pitch);
+            } else {
+                upload_tv_texture = true;
+            }
         }
 
         this->BeginUpdateTVTexture(threaded_update, dest_pixels, dest_pitch);
@@ -2713,6 +2838,13 @@ bool BeebWindow::HandleVBlank(uint64_t ticks) {
 
         if (dest_pixels) {
             SDL_UnlockTexture(m_tv_texture);
+
+            // The texture has markers in it now.
+            m_tv_texture_up_to_date = false;
+        } else if (upload_tv_texture) {
+            Timer tmr(&g_HandleVBlank_UpdateTVTexture_Copy_timer_def);
+
+            this->UploadTVTexture();
         }
 
         //        {
@@ -3425,6 +3557,7 @@ bool BeebWindow::RecreateTexture() {
     SetRenderScaleQualityHint(m_settings.display_filter);
 
     m_tv_texture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, TV_TEXTURE_WIDTH, TV_TEXTURE_HEIGHT);
+    m_tv_texture_up_to_date = false;
     if (!m_tv_texture) {
         m_msg.e.f("Failed to create TV texture: %s\n", SDL_GetError());
         return false;
@@ -3550,6 +3683,24 @@ bool BeebWindow::DebugIsHalted() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+#if BBCMICRO_DEBUGGER
+bool BeebWindow::DebugIsStepBackEnabled() const {
+    return m_beeb_thread->CanStepBack();
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+void BeebWindow::DebugStepBackInstruction() {
+    m_beeb_thread->Send(std::make_shared<BeebThread::StepBackMessage>(BeebThreadStepBackType_HostInstruction));
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void BeebWindow::SaveConfig() {
     this->SaveSettings();
 
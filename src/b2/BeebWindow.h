@@ -296,6 +296,8 @@ class BeebWindow {
     bool DebugIsHalted() const;
     void DebugStepOver(uint32_t dso);
     void DebugStepIn(uint32_t dso);
+    bool DebugIsStepBackEnabled() const;
+    void DebugStepBackInstruction();
 #endif
 
     // Handle double click or drag'n'drop.
@@ -348,6 +350,10 @@ class BeebWindow {
     SDL_Texture *m_tv_texture = nullptr;
     bool m_recreate_tv_texture = false;
 
+    // Set if m_tv_texture matches the TVOutput texture as of the last
+    // ResetDirtyLines, so only the dirty lines need uploading.
+    bool m_tv_texture_up_to_date = false;
+
     float m_blend_amt = 0.f;
 
     // Audio output
@@ -407,6 +413,7 @@ class BeebWindow {
 #if BBCMICRO_DEBUGGER
     bool m_test_pattern = false;
     bool m_display_fill = false;
+    bool m_is_profiling = false;
 #endif
 
     //
@@ -496,6 +503,7 @@ class BeebWindow {
     bool InhibitUpdateTVTexture() const;
     void BeginUpdateTVTexture(bool threaded, void *dest_pixels, int dest_pitch);
     void EndUpdateTVTexture(bool threaded, VBlankRecord *vblank_record, void *dest_pixels, int dest_pitch);
+    void UploadTVTexture();
     VBlankRecord *NewVBlankRecord(uint64_t ticks);
     bool DoBeebDisplayUI();
 
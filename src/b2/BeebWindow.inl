@@ -76,6 +76,8 @@ EPN(KeyboardDebug)
 EPN(SystemDebug)
 EPN(MouseDebug)
 EPN(WD1770Debug)
+EPN(GuestProfileDebug)
+EPN(TraceQueryDebug)
 
 // must be last
 EQPN(MaxValue)
@@ -500,6 +500,13 @@ std::vector<std::shared_ptr<JobQueue::Job>> BeebWindows::GetJobs() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void BeebWindows::ParallelFor(size_t n, const std::function<void(size_t)> &fn) {
+    g_->job_queue.ParallelFor(n, fn);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 BeebWindow *BeebWindows::FindBeebWindowForSDLWindow(SDL_Window *sdl_window) {
     auto window = (BeebWindow *)SDL_GetWindowData(sdl_window, BeebWindow::SDL_WINDOW_DATA_NAME);
     if (!window) {
@@ -130,6 +130,9 @@ namespace BeebWindows {
     // Get the job queue's list of jobs.
     std::vector<std::shared_ptr<JobQueue::Job>> GetJobs();
 
+    // Spread some work over the job queue - see JobQueue::ParallelFor.
+    void ParallelFor(size_t n, const std::function<void(size_t)> &fn);
+
     BeebWindow *FindBeebWindowForSDLWindow(SDL_Window *sdl_window);
 
     BeebWindow *FindBeebWindowBySDLWindowID(uint32_t sdl_window_id);
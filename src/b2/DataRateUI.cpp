@@ -281,6 +281,8 @@ void DataRateUI::DoImGui() {
 
         ImGui::Text("MQ polls: %zu", stats.num_mq_polls);
         ImGui::Text("MQ waits: %zu", stats.num_mq_waits);
+        ImGui::Text("Run cycles: %" PRIu64 " (%.3f ms)", stats.run_cycles.n, stats.run_cycles.n * 1000. / CYCLES_PER_SECOND);
+        ImGui::Text("Overhead: %.1f%%", stats.overhead_fraction * 100.);
     }
 
 #if BBCMICRO_DEBUGGER
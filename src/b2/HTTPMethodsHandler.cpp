@@ -17,6 +17,8 @@
 #include "Messages.h"
 #include <shared/path.h>
 #include <beeb/DiscGeometry.h>
+#include <beeb/TraceIndex.h>
+#include "JobQueue.h"
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -26,6 +28,66 @@ static const std::string HTTP_DISC_IMAGE_LOAD_METHOD = "http";
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+#if BBCMICRO_TRACE
+// Building the index can take a while, so trace queries are answered from a
+// job thread.
+class HTTPTraceQueryJob : public JobQueue::Job {
+  public:
+    HTTPTraceQueryJob(HTTPServer *server,
+                      HTTPResponseData response_data,
+                      std::shared_ptr<BeebThread> beeb_thread,
+                      TraceQuery query,
+                      uint64_t begin_2MHz_cycles,
+                      uint64_t end_2MHz_cycles,
+                      size_t max_num_results)
+        : m_server(server)
+        , m_response_data(std::move(response_data))
+        , m_beeb_thread(std::move(beeb_thread))
+        , m_query(query)
+        , m_begin_2MHz_cycles(begin_2MHz_cycles)
+        , m_end_2MHz_cycles(end_2MHz_cycles)
+        , m_max_num_results(max_num_results) {
+    }
+
+    void ThreadExecute() override {
+        std::shared_ptr<const TraceIndex> index = m_beeb_thread->GetLastTraceIndex();
+        if (!index) {
+            m_server->SendResponse(m_response_data, HTTPResponse::ServiceUnavailable());
+            return;
+        }
+
+        m_query.begin = index->GetTimeFrom2MHzCycles(m_begin_2MHz_cycles);
+        if (m_end_2MHz_cycles != UINT64_MAX) {
+            m_query.end = index->GetTimeFrom2MHzCycles(m_end_2MHz_cycles);
+        }
+
+        std::vector<std::string> descriptions;
+        index->GetMatchDescriptions(&descriptions, m_query, m_max_num_results);
+
+        std::string text;
+        for (const std::string &description : descriptions) {
+            text += description;
+            text += "\n";
+        }
+
+        m_server->SendResponse(m_response_data, HTTPResponse(HTTP_TEXT_CONTENT_TYPE, std::move(text)));
+    }
+
+  protected:
+  private:
+    HTTPServer *m_server = nullptr;
+    HTTPResponseData m_response_data;
+    std::shared_ptr<BeebThread> m_beeb_thread;
+    TraceQuery m_query;
+    uint64_t m_begin_2MHz_cycles = 0;
+    uint64_t m_end_2MHz_cycles = UINT64_MAX;
+    size_t m_max_num_results = 0;
+};
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 static std::vector<std::string> GetPathParts(const std::string &path) {
     std::vector<std::string> parts;
     std::string part;
@@ -88,6 +150,9 @@ class HTTPMethodsHandler : public HTTPHandler {
         {"peek", &HTTPMethodsHandler::HandlePeekRequest},
         {"mount", &HTTPMethodsHandler::HandleMountRequest},
         {"run", &HTTPMethodsHandler::HandleRunRequest},
+#endif
+#if BBCMICRO_TRACE
+        {"trace-query", &HTTPMethodsHandler::HandleTraceQueryRequest},
 #endif
         {"launch", &HTTPMethodsHandler::HandleLaunchRequest},
     };
@@ -165,6 +230,10 @@ class HTTPMethodsHandler : public HTTPHandler {
                 if (!this->HandleArgOrSendResponse(va_arg(v, uint32_t *), value, &GetUInt32FromString, 0, server, request, "32-bit value")) {
                     return false;
                 }
+            } else if (strcmp(fmt, "u64") == 0) {
+                if (!this->HandleArgOrSendResponse(va_arg(v, uint64_t *), value, &GetUInt64FromString, 0, server, request, "64-bit value")) {
+                    return false;
+                }
             } else if (strcmp(fmt, "x64") == 0) {
                 if (!this->HandleArgOrSendResponse(va_arg(v, uint64_t *), value, &GetUInt64FromString, 16, server, request, "64-bit hex value")) {
                     return false;
@@ -436,6 +505,65 @@ class HTTPMethodsHandler : public HTTPHandler {
     }
 #endif
 
+#if BBCMICRO_TRACE
+    void HandleTraceQueryRequest(HTTPServer *server, HTTPRequest &&request, const std::vector<std::string> &path_parts, size_t command_index) {
+        BeebWindow *beeb_window;
+        std::string pc, write, type;
+        bool parasite = false;
+        uint64_t begin = 0, end = UINT64_MAX;
+        uint32_t max = 1000;
+        if (!this->ParseArgsOrSendResponse(server, request, path_parts, command_index,
+                                           "window", nullptr, &beeb_window,
+                                           "std::string", "pc", &pc,
+                                           "std::string", "write", &write,
+                                           "std::string", "type", &type,
+                                           "bool", "parasite", &parasite,
+                                           "u64", "begin", &begin,
+                                           "u64", "end", &end,
+                                           "u32", "max", &max,
+                                           nullptr)) {
+            return;
+        }
+
+        TraceQuery query;
+        query.source = parasite ? TraceEventSource_Parasite : TraceEventSource_Host;
+
+        if ((!pc.empty()) + (!write.empty()) + (!type.empty()) != 1) {
+            server->SendResponse(request, HTTPResponse::BadRequest(request, "exactly one of pc, write or type must be specified"));
+            return;
+        }
+
+        if (!pc.empty()) {
+            query.type = TraceQueryType_Execute;
+            if (!GetUInt16FromString(&query.addr, pc, 16)) {
+                server->SendResponse(request, HTTPResponse::BadRequest(request, "bad 16-bit hex value: %s", pc.c_str()));
+                return;
+            }
+        } else if (!write.empty()) {
+            query.type = TraceQueryType_Write;
+            if (!GetUInt16FromString(&query.addr, write, 16)) {
+                server->SendResponse(request, HTTPResponse::BadRequest(request, "bad 16-bit hex value: %s", write.c_str()));
+                return;
+            }
+        } else {
+            query.type = TraceQueryType_EventType;
+            query.event_type = TraceEventType::FindByName(type);
+            if (!query.event_type) {
+                server->SendResponse(request, HTTPResponse::BadRequest(request, "unknown event type: %s", type.c_str()));
+                return;
+            }
+        }
+
+        BeebWindows::AddJob(std::make_shared<HTTPTraceQueryJob>(server,
+                                                                request.response_data,
+                                                                beeb_window->GetBeebThread(),
+                                                                query,
+                                                                begin,
+                                                                end,
+                                                                max));
+    }
+#endif
+
     void HandleLaunchRequest(HTTPServer *server, HTTPRequest &&request, const std::vector<std::string> &path_parts, size_t command_index) {
         std::string path;
         if (!this->ParseArgsOrSendResponse(server, request, path_parts, command_index,
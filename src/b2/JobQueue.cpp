@@ -1,7 +1,9 @@
 #include <shared/system.h>
 #include "JobQueue.h"
+#include <shared/futex.h>
 #include <functional>
 #include <system_error>
+#include <algorithm>
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -59,6 +61,77 @@ void JobQueue::Job::DoImGui() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Shared between the ParallelFor caller and its helper jobs. A helper job that
+// only gets to run once the caller has returned finds nothing left to do, and
+// the shared_ptr keeps this alive for it to find that out.
+struct ParallelForState {
+    JobQueue *job_queue = nullptr;
+    std::function<void(size_t)> fn;
+    size_t n = 0;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> num_done{0};
+
+    // Number of helper jobs that may still be added.
+    std::atomic<size_t> num_helpers_left{0};
+
+    // Set to 1, and woken, once all n calls have finished.
+    std::atomic<uint32_t> finished{0};
+
+    void Run() {
+        for (;;) {
+            size_t i = this->next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= this->n) {
+                break;
+            }
+
+            this->fn(i);
+
+            if (this->num_done.fetch_add(1, std::memory_order_acq_rel) + 1 == this->n) {
+                this->finished.store(1, std::memory_order_release);
+                FutexWakeOne(&this->finished);
+            }
+        }
+    }
+};
+
+static void AddParallelForHelper(const std::shared_ptr<ParallelForState> &state);
+
+class ParallelForJob : public JobQueue::Job {
+  public:
+    explicit ParallelForJob(std::shared_ptr<ParallelForState> state)
+        : m_state(std::move(state)) {
+    }
+
+    void ThreadExecute() override {
+        if (m_state->next.load(std::memory_order_relaxed) < m_state->n) {
+            // There's still work to do, so another thread might be able to
+            // help too.
+            AddParallelForHelper(m_state);
+
+            m_state->Run();
+        }
+    }
+
+  protected:
+  private:
+    std::shared_ptr<ParallelForState> m_state;
+};
+
+// Helpers are added one at a time, each one as the previous one starts, so
+// that no helper gets queued once all the work has been claimed.
+static void AddParallelForHelper(const std::shared_ptr<ParallelForState> &state) {
+    size_t num_helpers_left = state->num_helpers_left.load(std::memory_order_relaxed);
+    while (num_helpers_left > 0 && state->next.load(std::memory_order_relaxed) < state->n) {
+        if (state->num_helpers_left.compare_exchange_weak(num_helpers_left, num_helpers_left - 1, std::memory_order_relaxed)) {
+            state->job_queue->AddJob(std::make_shared<ParallelForJob>(state));
+            break;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 JobQueue::JobQueue() {
     MUTEX_SET_NAME(m_jobs_mutex, "Jobs");
 }
@@ -158,6 +231,37 @@ std::vector<std::shared_ptr<JobQueue::Job>> JobQueue::GetJobs() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void JobQueue::ParallelFor(size_t n, const std::function<void(size_t)> &fn) {
+    if (n == 0) {
+        return;
+    } else if (n == 1 || m_threads.empty()) {
+        for (size_t i = 0; i < n; ++i) {
+            fn(i);
+        }
+
+        return;
+    }
+
+    auto state = std::make_shared<ParallelForState>();
+    state->job_queue = this;
+    state->fn = fn;
+    state->n = n;
+
+    // The calling thread does some too.
+    state->num_helpers_left.store(std::min(m_threads.size(), n - 1), std::memory_order_relaxed);
+    AddParallelForHelper(state);
+
+    state->Run();
+
+    // Whatever's left is already in progress on another thread.
+    while (state->finished.load(std::memory_order_acquire) == 0) {
+        FutexWait(&state->finished, 0);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void JobQueue::ThreadFunc(ThreadData *td) {
     SetCurrentThreadNamef("JobQueue%zu", td->index);
 
@@ -9,6 +9,8 @@
 #include <condition_variable>
 #include <vector>
 #include <atomic>
+#include <functional>
+#include <memory>
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -59,6 +61,12 @@ class JobQueue {
     // Get all jobs, running and waiting.
     std::vector<std::shared_ptr<Job>> GetJobs() const;
 
+    // Calls fn(i) for each i in [0,n), on the calling thread and on any job
+    // queue threads that are free, and returns once all the calls have
+    // finished. The calling thread does whatever isn't picked up by another
+    // thread, so this is fine to call from a job, however busy the queue is.
+    void ParallelFor(size_t n, const std::function<void(size_t)> &fn);
+
   protected:
   private:
     struct ThreadData {
@@ -11,31 +11,91 @@
 
 #include <shared/system.h>
 #include <shared/debug.h>
+#include <shared/futex.h>
 #include <shared/mutex.h>
-#include <condition_variable>
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Multiple producers, one consumer.
+//
+// Pushed messages go into a fixed-size ring, without taking a lock. If it's
+// full, they go on a mutex-protected overflow list instead, which the consumer
+// empties once the ring is empty. Once anything's on the overflow list, everything
+// goes there until the consumer has emptied it, so that each producer's
+// messages stay in order. Producers never wait for the consumer.
+//
 // T needs to be default-constructible and movable.
 template <class T>
 class MessageQueue {
   public:
-    MessageQueue() = default;
+    static const size_t CAPACITY = 1024;
+
+    MessageQueue()
+        : m_slots(CAPACITY) {
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        for (std::atomic<Message *> &indexed_message : m_indexed_messages) {
+            indexed_message.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~MessageQueue() {
+        for (std::atomic<Message *> &indexed_message : m_indexed_messages) {
+            delete indexed_message.load(std::memory_order_acquire);
+        }
+    }
+
+    MessageQueue(const MessageQueue &) = delete;
+    MessageQueue &operator=(const MessageQueue &) = delete;
+    MessageQueue(MessageQueue &&) = delete;
+    MessageQueue &operator=(MessageQueue &&) = delete;
 
     void SetName(const char *name) {
         (void)name;
-        MUTEX_SET_NAME(m_mutex, name);
+        MUTEX_SET_NAME(m_overflow_mutex, name);
     }
 
     // Pushed messages are retrieved in the order they were submitted.
     void ProducerPush(T message) {
-        LockGuard<Mutex> lock(m_mutex);
+        if (!m_overflowing.load(std::memory_order_acquire)) {
+            uint64_t pos = m_push_pos.load(std::memory_order_relaxed);
+            for (;;) {
+                Slot *slot = &m_slots[pos % CAPACITY];
+
+                uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+                if (sequence == pos) {
+                    // The slot is free. Try to claim it.
+                    if (m_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        slot->message = Message(std::move(message));
+                        slot->sequence.store(pos + 1, std::memory_order_release);
+
+                        this->Wake();
+                        return;
+                    }
+                } else if (sequence < pos) {
+                    // The ring is full.
+                    break;
+                } else {
+                    // Another producer claimed it.
+                    pos = m_push_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
 
-        m_messages.push_back(Message(std::move(message)));
+        {
+            LockGuard<Mutex> lock(m_overflow_mutex);
+
+            m_overflow.push_back(Message(std::move(message)));
+            m_overflowing.store(true, std::memory_order_release);
+        }
 
-        m_cv.notify_one();
+        this->Wake();
     }
 
     // When no pushed messages are available, an indexed pushed
@@ -53,37 +113,40 @@ class MessageQueue {
     void ProducerPushIndexed(uint8_t index, T message) {
         ASSERT(index < 64);
 
-        uint64_t old_indexed_messages_pending;
-        {
-            LockGuard<Mutex> lock(m_mutex);
+        auto new_message = new Message(std::move(message));
 
-            old_indexed_messages_pending = m_indexed_messages_pending;
+        // Whoever gets the old message out of the slot owns it.
+        delete m_indexed_messages[index].exchange(new_message, std::memory_order_acq_rel);
 
-            m_indexed_messages[index] = Message(std::move(message));
-            m_indexed_messages_pending |= 1ull << index;
-        }
+        uint64_t old_indexed_messages_pending = m_indexed_messages_pending.fetch_or(1ull << index, std::memory_order_release);
 
         if (old_indexed_messages_pending == 0) {
-            m_cv.notify_one();
+            this->Wake();
         }
     }
 
     void ConsumerWaitForMessages(std::vector<T> *messages) {
-        UniqueLock<Mutex> lock(m_mutex);
-
         for (;;) {
-            if (this->PollLocked(messages)) {
+            // Read the wake counter before polling, so a push after the poll
+            // is guaranteed to change it.
+            uint32_t wake_counter = m_wake_counter.load();
+
+            if (this->Poll(messages)) {
                 return;
             }
 
-            m_cv.wait(lock);
+            m_consumer_waiting.store(true);
+
+            if (m_wake_counter.load() == wake_counter) {
+                FutexWait(&m_wake_counter, wake_counter);
+            }
+
+            m_consumer_waiting.store(false, std::memory_order_relaxed);
         }
     }
 
     bool ConsumerPollForMessages(std::vector<T> *messages) {
-        LockGuard<Mutex> lock(m_mutex);
-
-        return this->PollLocked(messages);
+        return this->Poll(messages);
     }
 
   protected:
@@ -101,49 +164,108 @@ class MessageQueue {
         }
     };
 
-    Mutex m_mutex;
-    std::condition_variable_any m_cv;
-    std::vector<Message> m_messages;
-    Message m_indexed_messages[64];
-    uint64_t m_indexed_messages_pending = 0;
+    // The slot at ring position pos is free for the producer when its
+    // sequence is pos, and ready for the consumer when it's pos+1.
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        Message message;
+    };
+
+    std::vector<Slot> m_slots;
+    std::atomic<uint64_t> m_push_pos{0};
+    uint64_t m_pop_pos = 0; //only touched by the consumer
+
+    // Controlled by m_overflow_mutex. m_overflowing is set while m_overflow
+    // isn't empty.
+    Mutex m_overflow_mutex;
+    std::vector<Message> m_overflow;
+    std::atomic<bool> m_overflowing{false};
+
+    std::atomic<Message *> m_indexed_messages[64];
+    std::atomic<uint64_t> m_indexed_messages_pending{0};
+
+    // Incremented on each push. The consumer sleeps on this when there's
+    // nothing to do, and producers only wake it if it might be asleep.
+    std::atomic<uint32_t> m_wake_counter{0};
+    std::atomic<bool> m_consumer_waiting{false};
+
 #if MESSAGE_QUEUE_TRACK_LATENCY
     uint64_t m_total_latency = 0;
     uint64_t m_min_latency = UINT64_MAX;
     uint64_t m_max_latency = 0;
 #endif
 
-    bool PollLocked(std::vector<T> *messages) {
+    void Wake() {
+        m_wake_counter.fetch_add(1);
+
+        if (m_consumer_waiting.load()) {
+            FutexWakeOne(&m_wake_counter);
+        }
+    }
+
+    bool Poll(std::vector<T> *messages) {
         bool any = false;
         uint64_t push_ticks = UINT64_MAX;
 
-        if (!m_messages.empty()) {
+        for (;;) {
+            Slot *slot = &m_slots[m_pop_pos % CAPACITY];
+
+            if (slot->sequence.load(std::memory_order_acquire) != m_pop_pos + 1) {
+                break;
+            }
+
 #if MESSAGE_QUEUE_TRACK_LATENCY
-            push_ticks = m_messages[0].push_ticks;
+            push_ticks = std::min(push_ticks, slot->message.push_ticks);
 #endif
+            messages->push_back(std::move(slot->message.value));
 
-            for (Message &message : m_messages) {
-                messages->push_back(std::move(message.value));
-            }
+            // Don't keep anything alive longer than necessary.
+            slot->message = Message();
 
-            m_messages.clear();
+            slot->sequence.store(m_pop_pos + CAPACITY, std::memory_order_release);
+            ++m_pop_pos;
             any = true;
         }
 
-        if (m_indexed_messages_pending != 0) {
-            for (uint8_t i = 0; i < 64; ++i) {
-                if (m_indexed_messages_pending & 1ull << i) {
-                    Message *m = &m_indexed_messages[i];
+        // Anything on the overflow list was pushed after everything in the
+        // ring from the same producer - but the ring loop stops at a slot
+        // that's been claimed and not yet filled in, and there could be
+        // messages after it from a producer that's since overflowed. So the
+        // overflow list has to wait until the ring is empty.
+        if (m_overflowing.load(std::memory_order_acquire) && m_pop_pos == m_push_pos.load(std::memory_order_acquire)) {
+            LockGuard<Mutex> lock(m_overflow_mutex);
+
+            for (Message &m : m_overflow) {
+#if MESSAGE_QUEUE_TRACK_LATENCY
+                push_ticks = std::min(push_ticks, m.push_ticks);
+#endif
+                messages->push_back(std::move(m.value));
+                any = true;
+            }
+
+            m_overflow.clear();
+            m_overflowing.store(false, std::memory_order_release);
+        }
 
+        if (m_indexed_messages_pending.load(std::memory_order_relaxed) != 0) {
+            uint64_t pending = m_indexed_messages_pending.exchange(0, std::memory_order_acquire);
+
+            for (uint8_t i = 0; i < 64; ++i) {
+                if (pending & 1ull << i) {
+                    // The slot may already have been emptied, if the message
+                    // was pushed after the previous poll read the pending
+                    // flags.
+                    if (Message *m = m_indexed_messages[i].exchange(nullptr, std::memory_order_acq_rel)) {
 #if MESSAGE_QUEUE_TRACK_LATENCY
-                    push_ticks = std::min(push_ticks, m->push_ticks);
+                        push_ticks = std::min(push_ticks, m->push_ticks);
 #endif
-                    messages->push_back(std::move(m->value));
+                        messages->push_back(std::move(m->value));
+                        delete m;
 
-                    any = true;
+                        any = true;
+                    }
                 }
             }
-
-            m_indexed_messages_pending = 0;
         }
 
 #if MESSAGE_QUEUE_TRACK_LATENCY
@@ -6,8 +6,19 @@
 #include "ThumbnailsUI.h"
 #include "BeebState.h"
 #include <beeb/DiscImage.h>
+#include <beeb/BBCMicroStateFile.h>
+#include <shared/path.h>
 #include "BeebWindow.h"
 #include "BeebThread.h"
+#include "native_ui.h"
+#include "Messages.h"
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+static const std::string RECENT_PATHS_SAVED_STATE("saved_state");
+
+static const std::string SAVED_STATE_EXTENSION(".b2state");
 
 ////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////
@@ -42,6 +53,10 @@ class SavedStatesUI : public SettingsUI {
 
         ImGui::Text("%d saved states", num_states);
 
+        if (ImGui::Button("Load from file...")) {
+            this->LoadFromFile();
+        }
+
         ImGui::BeginChild("saved_states_container", ImVec2(0, 0), true, ImGuiWindowFlags_AlwaysVerticalScrollbar);
         {
             ImGui::BeginChild("saved_states", ImVec2(0, num_states * row_height), false, 0);
@@ -78,6 +93,12 @@ class SavedStatesUI : public SettingsUI {
                                 ImGui::Button("Load");
                             }
 
+                            ImGui::SameLine();
+
+                            if (ImGui::Button("Save to file...")) {
+                                this->SaveToFile(*s);
+                            }
+
                             // Name
                             if (s->name.empty()) {
                                 ImGui::TextUnformatted("(no name)");
@@ -119,6 +140,49 @@ class SavedStatesUI : public SettingsUI {
   private:
     BeebWindow *m_beeb_window = nullptr;
     ThumbnailsUI m_thumbnails;
+
+    void LoadFromFile() {
+        OpenFileDialog fd(RECENT_PATHS_SAVED_STATE);
+        fd.AddFilter("b2 saved state", {SAVED_STATE_EXTENSION});
+        fd.AddAllFilesFilter();
+
+        std::string path;
+        if (!fd.Open(&path)) {
+            return;
+        }
+
+        fd.AddLastPathToRecentPaths();
+
+        Messages msg(m_beeb_window->GetMessageList());
+        std::unique_ptr<BBCMicroUniqueState> state = BBCMicroStateFile::Load(path, nullptr, nullptr, msg);
+        if (!state) {
+            return;
+        }
+
+        auto saved_state = std::make_shared<BeebState>(*state);
+        saved_state->name = PathGetName(path);
+
+        BeebWindows::AddSavedState(std::move(saved_state));
+    }
+
+    void SaveToFile(const BeebState &state) {
+        SaveFileDialog fd(RECENT_PATHS_SAVED_STATE);
+        fd.AddFilter("b2 saved state", {SAVED_STATE_EXTENSION});
+
+        std::string path;
+        if (!fd.Open(&path)) {
+            return;
+        }
+
+        fd.AddLastPathToRecentPaths();
+
+        if (PathGetExtension(path).empty()) {
+            path += SAVED_STATE_EXTENSION;
+        }
+
+        Messages msg(m_beeb_window->GetMessageList());
+        BBCMicroStateFile::Save(path, state, msg);
+    }
 };
 
 ////////////////////////////////////////////////////////////////////////////
@@ -115,6 +115,18 @@ class TimelineUI : public SettingsUI {
                                 timeline_state.num_events,
                                 GetCycleCountString(timeline_duration).c_str());
                 }
+
+                ImGui::Text("Memory: %" PRIthou ".3f MB", timeline_state.size_bytes / 1024. / 1024.);
+                if (timeline_state.over_max_size) {
+                    ImGui::TextWrapped("Note: Over the maximum, as the remaining states can't be removed. (The first and last states are always kept, as are states saved by hand.)");
+                }
+
+                int max_size_mbytes = (int)(beeb_thread->GetTimelineMaxSizeBytes() / 1024 / 1024);
+                if (ImGui::InputInt("Max memory (MB)", &max_size_mbytes)) {
+                    if (max_size_mbytes > 0) {
+                        beeb_thread->SetTimelineMaxSizeBytes((size_t)max_size_mbytes * 1024 * 1024);
+                    }
+                }
             }
             break;
 
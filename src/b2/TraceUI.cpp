@@ -1,6 +1,8 @@
 #include <shared/system.h>
 #include "TraceUI.h"
 #include <beeb/Trace.h>
+#include <beeb/TraceFile.h>
+#include <beeb/TraceTrigger.h>
 #include "dear_imgui.h"
 #include "BeebThread.h"
 #include "JobQueue.h"
@@ -17,6 +19,7 @@
 #include <atomic>
 #include "SettingsUI.h"
 #include <shared/file_io.h>
+#include "load_save.h"
 
 #include <shared/enum_def.h>
 #include "TraceUI.inl"
@@ -26,6 +29,9 @@
 //////////////////////////////////////////////////////////////////////////
 
 static const std::string RECENT_PATHS_TRACES = "traces";
+static const std::string RECENT_PATHS_TRACE_FILES = "trace_files";
+
+static uint64_t g_next_spill_file_index = 0;
 
 // It's a bit ugly having a single set of default settings, but compared to the
 // old behaviour (per-instance settings, defaults overwritten when dialog
@@ -50,6 +56,26 @@ void SetDefaultTraceUISettings(const TraceUISettings &settings) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+#if BBCMICRO_TRACE
+static bool CompileTrigger(TraceTrigger *trigger, const std::string &expr, std::string *error) {
+    LogPrinterString printer(error);
+    Log log("", &printer);
+
+    if (trigger->Compile(expr, &log)) {
+        return true;
+    }
+
+    while (!error->empty() && error->back() == '\n') {
+        error->pop_back();
+    }
+
+    return false;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if BBCMICRO_TRACE
 
 class TraceUI : public SettingsUI {
@@ -82,8 +108,9 @@ class TraceUI : public SettingsUI {
     int GetKeyIndex(uint8_t beeb_key) const;
     void ResetTextBoxes();
     void DoAddressGui(uint16_t *addr, char *str, size_t str_size);
+    void DoTriggerGui(std::string *expr);
     void StartTrace();
-    void StartSaveTraceJob(std::shared_ptr<Trace> last_trace, std::string path);
+    void StartSaveTraceJob(std::shared_ptr<Trace> last_trace, std::string path, bool binary);
 
     static bool GetBeebKeyName(void *data, int idx, const char **out_text);
 #endif
@@ -98,16 +125,30 @@ class TraceUI::SaveTraceJob : public JobQueue::Job {
                           std::string file_name,
                           std::shared_ptr<MessageList> message_list,
                           uint32_t output_flags,
-                          std::string fopen_mode)
+                          std::string fopen_mode,
+                          bool binary)
         : m_trace(std::move(trace))
         , m_file_name(std::move(file_name))
         , m_output_flags(output_flags)
         , m_msgs(message_list)
-        , m_fopen_mode(std::move(fopen_mode)) {
+        , m_fopen_mode(std::move(fopen_mode))
+        , m_binary(binary) {
         ASSERT(!!m_trace);
     }
 
     void ThreadExecute() {
+        if (m_binary) {
+            // No formatting involved, so this is quick enough not to bother
+            // with progress or cancellation.
+            if (SaveTraceFile(m_file_name, *m_trace, m_msgs)) {
+                m_msgs.i.f(
+                    "trace file saved: %s\n",
+                    m_file_name.c_str());
+            }
+
+            return;
+        }
+
         FILE *f = fopenUTF8(m_file_name.c_str(), m_fopen_mode.c_str());
         if (!f) {
             int err = errno;
@@ -161,6 +202,7 @@ class TraceUI::SaveTraceJob : public JobQueue::Job {
     Messages m_msgs; // this is quite a big object
     SaveTraceProgress m_progress;
     std::string m_fopen_mode;
+    bool m_binary = false;
 
     static bool SaveData(const void *data, size_t num_bytes, void *context) {
         size_t num_bytes_written = fwrite(data, 1, num_bytes, (FILE *)context);
@@ -207,6 +249,13 @@ static void DoTraceStatsImGui(const volatile TraceStats *stats) {
     ImGui::Text("%" PRIthou ".3f MB", stats->num_allocated_bytes / 1024. / 1024.);
     ImGui::NextColumn();
 
+    if (stats->num_spilled_bytes > 0) {
+        ImGui::TextUnformatted("Bytes Spilled");
+        ImGui::NextColumn();
+        ImGui::Text("%" PRIthou ".3f MB", stats->num_spilled_bytes / 1024. / 1024.);
+        ImGui::NextColumn();
+    }
+
     ImGui::Columns(1);
 
     ImGui::Separator();
@@ -286,7 +335,7 @@ void TraceUI::DoImGui() {
                 if (!g_default_settings.auto_save_path.empty()) {
                     std::shared_ptr<Trace> last_trace = beeb_thread->GetLastTrace();
                     if (!!last_trace) {
-                        this->StartSaveTraceJob(last_trace, g_default_settings.auto_save_path);
+                        this->StartSaveTraceJob(last_trace, g_default_settings.auto_save_path, false);
                     }
                 }
             }
@@ -318,6 +367,10 @@ void TraceUI::DoImGui() {
                                    m_start_write_address_str,
                                    sizeof m_start_write_address_str);
             }
+            ImGuiRadioButton(&g_default_settings.start, TraceUIStartCondition_Trigger, "Trigger");
+            if (g_default_settings.start == TraceUIStartCondition_Trigger) {
+                this->DoTriggerGui(&g_default_settings.start_trigger);
+            }
         }
         ImGui::Spacing();
 
@@ -349,6 +402,10 @@ void TraceUI::DoImGui() {
                                    m_stop_write_address_str,
                                    sizeof m_stop_write_address_str);
             }
+            ImGuiRadioButton(&g_default_settings.stop, TraceUIStopCondition_Trigger, "Trigger");
+            if (g_default_settings.stop == TraceUIStopCondition_Trigger) {
+                this->DoTriggerGui(&g_default_settings.stop_trigger);
+            }
         }
 
         ImGui::Spacing();
@@ -386,6 +443,9 @@ void TraceUI::DoImGui() {
 
         ImGui::TextUnformatted("Other settings");
         ImGui::Checkbox("Unlimited recording", &g_default_settings.unlimited);
+        if (!g_default_settings.unlimited) {
+            ImGui::Checkbox("Spill to disk when full", &g_default_settings.spill_to_disk);
+        }
 #if SYSTEM_WINDOWS
         ImGui::Checkbox("Unix line endings", &g_default_settings.unix_line_endings);
 #endif
@@ -439,7 +499,22 @@ void TraceUI::DoImGui() {
                 std::string path;
                 if (fd.Open(&path)) {
                     fd.AddLastPathToRecentPaths();
-                    this->StartSaveTraceJob(last_trace, std::move(path));
+                    this->StartSaveTraceJob(last_trace, std::move(path), false);
+                }
+            }
+
+            ImGui::SameLine();
+
+            if (ImGui::Button("Save binary...")) {
+                SaveFileDialog fd(RECENT_PATHS_TRACE_FILES);
+
+                fd.AddFilter("b2 trace files", {".b2trace"});
+                fd.AddAllFilesFilter();
+
+                std::string path;
+                if (fd.Open(&path)) {
+                    fd.AddLastPathToRecentPaths();
+                    this->StartSaveTraceJob(last_trace, std::move(path), true);
                 }
             }
 
@@ -522,6 +597,20 @@ void TraceUI::DoAddressGui(uint16_t *addr, char *str, size_t str_size) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void TraceUI::DoTriggerGui(std::string *expr) {
+    ImGuiInputText(expr, "Expression", *expr);
+
+    // Compiling is cheap enough to just do it every frame.
+    TraceTrigger trigger;
+    std::string error;
+    if (!CompileTrigger(&trigger, *expr, &error)) {
+        ImGui::Text("Invalid: %s", error.c_str());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 bool TraceUI::GetBeebKeyName(void *data, int idx, const char **out_text) {
     auto this_ = (TraceUI *)data;
 
@@ -563,6 +652,19 @@ void TraceUI::StartTrace() {
     case TraceUIStartCondition_Reset:
         c.start = BeebThreadStartTraceCondition_Reset;
         break;
+
+    case TraceUIStartCondition_Trigger:
+        {
+            std::string error;
+            if (!CompileTrigger(&c.start_trigger, g_default_settings.start_trigger, &error)) {
+                Messages msgs(m_beeb_window->GetMessageList());
+                msgs.e.f("Invalid start trigger: %s\n", error.c_str());
+                return;
+            }
+
+            c.start = BeebThreadStartTraceCondition_Trigger;
+        }
+        break;
     }
 
     switch (g_default_settings.stop) {
@@ -587,11 +689,25 @@ void TraceUI::StartTrace() {
         c.stop = BeebThreadStopTraceCondition_WriteAddress;
         c.stop_address = g_default_settings.stop_write_address;
         break;
+
+    case TraceUIStopCondition_Trigger:
+        {
+            std::string error;
+            if (!CompileTrigger(&c.stop_trigger, g_default_settings.stop_trigger, &error)) {
+                Messages msgs(m_beeb_window->GetMessageList());
+                msgs.e.f("Invalid stop trigger: %s\n", error.c_str());
+                return;
+            }
+
+            c.stop = BeebThreadStopTraceCondition_Trigger;
+        }
+        break;
     }
 
     c.trace_flags = g_default_settings.flags;
 
     size_t max_num_bytes;
+    std::string spill_path;
     if (g_default_settings.unlimited) {
         max_num_bytes = SIZE_MAX;
     } else {
@@ -603,9 +719,15 @@ void TraceUI::StartTrace() {
         // text file. This ought to be enough to be getting on with,
         // and the buffer size is not excessive even for 32-bit systems.
         max_num_bytes = 256 * 1024 * 1024;
+
+        if (g_default_settings.spill_to_disk) {
+            // One file per trace, as the last trace, with its spill file,
+            // hangs around until the next one is finished.
+            spill_path = GetCachePath(strprintf("trace_spill_%p_%" PRIu64 ".dat", (void *)this, g_next_spill_file_index++));
+        }
     }
 
-    auto message = std::make_shared<BeebThread::StartTraceMessage>(c, max_num_bytes);
+    auto message = std::make_shared<BeebThread::StartTraceMessage>(c, max_num_bytes, std::move(spill_path));
     std::shared_ptr<BeebThread> beeb_thread = m_beeb_window->GetBeebThread();
     beeb_thread->Send(std::move(message));
 
@@ -615,7 +737,7 @@ void TraceUI::StartTrace() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-void TraceUI::StartSaveTraceJob(std::shared_ptr<Trace> last_trace, std::string path) {
+void TraceUI::StartSaveTraceJob(std::shared_ptr<Trace> last_trace, std::string path, bool binary) {
     ASSERT(!!last_trace);
     ASSERT(!m_save_trace_job);
 
@@ -630,7 +752,8 @@ void TraceUI::StartSaveTraceJob(std::shared_ptr<Trace> last_trace, std::string p
                                                       std::move(path),
                                                       m_beeb_window->GetMessageList(),
                                                       g_default_settings.output_flags,
-                                                      std::move(fopen_mode));
+                                                      std::move(fopen_mode),
+                                                      binary);
     BeebWindows::AddJob(m_save_trace_job);
 }
 
@@ -26,15 +26,18 @@ struct TraceUISettings {
     TraceUIStartCondition start = TraceUIStartCondition_Now;
     uint16_t start_instruction_address = 0;
     uint16_t start_write_address = 0;
+    std::string start_trigger;
 
     // Stop condition and any arguments.
     TraceUIStopCondition stop = TraceUIStopCondition_ByRequest;
     uint64_t stop_num_2MHz_cycles = 0;
     uint16_t stop_write_address = 0;
+    std::string stop_trigger;
 
     // Other stuff.
     uint32_t flags = 0;
     bool unlimited = false;
+    bool spill_to_disk = false;
 #if SYSTEM_WINDOWS
     bool unix_line_endings = false;
 #endif
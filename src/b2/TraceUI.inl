@@ -5,6 +5,7 @@ EPN(Return)
 EPN(Instruction)
 EPN(WriteAddress)
 EPN(Reset)
+EPN(Trigger)
 EEND()
 #undef ENAME
 
@@ -15,5 +16,6 @@ EPN(OSWORD0)
 EPN(NumCycles)
 EPN(WriteAddress)
 EPN(BRK)
+EPN(Trigger)
 EEND()
 #undef ENAME
@@ -10,10 +10,12 @@
 #include <shared/debug.h>
 #include "dear_imgui.h"
 #include "BeebThread.h"
+#include "BeebWindows.h"
 #include <shared/load_store.h>
 #include "load_save.h"
 #include <shared/path.h>
 #include <beeb/sound.h>
+#include <algorithm>
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -23,6 +25,23 @@
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Scanlines are drawn in batches of this many, spread over the job queue.
+static const size_t NUM_SCANLINES_PER_BATCH = 32;
+
+static void DrawScanlines(TVOutput *tv_output, const std::vector<TVOutput::Scanline> &scanlines) {
+    size_t num_batches = (scanlines.size() + NUM_SCANLINES_PER_BATCH - 1) / NUM_SCANLINES_PER_BATCH;
+
+    BeebWindows::ParallelFor(num_batches, [tv_output, &scanlines](size_t i) {
+        size_t begin = i * NUM_SCANLINES_PER_BATCH;
+        size_t num_scanlines = std::min(NUM_SCANLINES_PER_BATCH, scanlines.size() - begin);
+
+        tv_output->DrawScanlines(scanlines.data() + begin, num_scanlines);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if WAV
 static void AddChunkHeader(std::vector<uint8_t> *data, const char *fourcc) {
     ASSERT(strlen(fourcc) == 4);
@@ -200,6 +219,7 @@ void WriteVideoJob::ThreadExecute() {
     std::vector<char> audio_buf;
     static const size_t NUM_SAMPLES = 4096;
     TVOutput tv_output;
+    std::vector<TVOutput::Scanline> scanlines;
     std::shared_ptr<BeebThread> beeb_thread;
     std::shared_ptr<const BeebState> start_state;
     std::vector<BeebThread::TimelineEventList> event_lists;
@@ -269,7 +289,6 @@ void WriteVideoJob::ThreadExecute() {
 
     {
         bool replaying = true;
-        bool was_vblank = tv_output.IsInVerticalBlank();
         OutputDataBuffer<VideoDataUnit> *video_output = beeb_thread->GetVideoOutput();
 
         beeb_thread->Send(std::make_shared<BeebThread::StartReplayMessage>(start_state));
@@ -335,11 +354,15 @@ void WriteVideoJob::ThreadExecute() {
 
                     ASSERT((n & 1) == 0);
 
-                    for (size_t j = 0; j < n; ++j) {
-                        tv_output.Update(v++, 1);
+                    while (n > 0) {
+                        bool vertical_retrace;
+                        size_t num_consumed = tv_output.PrepareScanlines(v, n, &scanlines, &vertical_retrace);
+                        v += num_consumed;
+                        n -= num_consumed;
 
-                        bool is_vblank = tv_output.IsInVerticalBlank();
-                        if (is_vblank && !was_vblank) {
+                        DrawScanlines(&tv_output, scanlines);
+
+                        if (vertical_retrace) {
                             const void *data = tv_output.GetTexturePixels(nullptr);
 
                             if (!m_writer->WriteVideo(data)) {
@@ -350,8 +373,6 @@ void WriteVideoJob::ThreadExecute() {
                                 goto done;
                             }
                         }
-
-                        was_vblank = is_vblank;
                     }
                 }
 
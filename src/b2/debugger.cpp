@@ -5,6 +5,7 @@
 #include "joysticks.h"
 #include "SettingsUI.h"
 #include <shared/file_io.h>
+#include <shared/mutex.h>
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -18,6 +19,7 @@ static Command2 g_page_up_command = Command2(&g_disassembly_table, "page_up", "P
 static Command2 g_page_down_command = Command2(&g_disassembly_table, "page_down", "Page Down").WithShortcut(SDLK_PAGEDOWN);
 static Command2 g_step_over_command = Command2(&g_disassembly_table, "step_over", "Step Over").WithShortcut(SDLK_F10);
 static Command2 g_step_in_command = Command2(&g_disassembly_table, "step_in", "Step In").WithShortcut(SDLK_F11);
+static Command2 g_step_back_command = Command2(&g_disassembly_table, "step_back", "Step Back").WithShortcut(SDLK_F11 | PCKeyModifier_Shift);
 
 static CommandTable2 g_6502_table("6502 Window", BBCMICRO_DEBUGGER);
 static Command2 g_reset_relative_cycles_command = Command2(&g_6502_table, "reset_relative_cycles", "Reset").WithExtraText("Relative cycles");
@@ -34,6 +36,10 @@ static Command2 g_toggle_reset_relative_cycles_on_breakpoint_command = Command2(
 #include <shared/log.h>
 #include <dear_imgui_hex_editor.h>
 #include <inttypes.h>
+#include <beeb/GuestProfile.h>
+#include <beeb/TraceIndex.h>
+#include "BeebWindows.h"
+#include "JobQueue.h"
 #include "misc.h"
 #include "load_save.h"
 #include <algorithm>
@@ -1450,6 +1456,15 @@ class DisassemblyDebugWindow : public DebugUI,
             m_beeb_window->DebugStepIn(m_dso);
         }
 
+        // Only the host CPU can be stepped back.
+        this->cst->SetEnabled(g_step_back_command,
+                              m_beeb_window->DebugIsRunEnabled() &&
+                                  !(m_dso & BBCMicroDebugStateOverride_Parasite) &&
+                                  m_beeb_window->DebugIsStepBackEnabled());
+        if (this->cst->WasActioned(g_step_back_command)) {
+            m_beeb_window->DebugStepBackInstruction();
+        }
+
         float maxY = ImGui::GetCurrentWindow()->Size.y; //-ImGui::GetTextLineHeight()-GImGui->Style.WindowPadding.y*2.f;
 
         this->DoDebugPageOverrideImGui();
@@ -1494,6 +1509,8 @@ class DisassemblyDebugWindow : public DebugUI,
         this->cst->DoButton(g_step_over_command);
         ImGui::SameLine();
         this->cst->DoButton(g_step_in_command);
+        ImGui::SameLine();
+        this->cst->DoButton(g_step_back_command);
 
         if (m_track_pc) {
             if (m_beeb_debug_state && m_beeb_debug_state->is_halted) {
@@ -2326,9 +2343,12 @@ class R6522DebugWindow : public DebugUI {
         t1l.b.l = via.m_t1ll;
         t1l.b.h = via.m_t1lh;
 
-        ImGui::Text("T1 : $%04x %05d %s%s", via.m_t1, via.m_t1, BINARY_BYTE_STRINGS[via.m_t1 >> 8 & 0xff], BINARY_BYTE_STRINGS[via.m_t1 & 0xff]);
+        uint16_t t1 = via.GetT1();
+        uint16_t t2 = via.GetT2();
+
+        ImGui::Text("T1 : $%04x %05d %s%s", t1, t1, BINARY_BYTE_STRINGS[t1 >> 8 & 0xff], BINARY_BYTE_STRINGS[t1 & 0xff]);
         ImGui::Text("T1L: $%04x %05d %s%s", t1l.w, t1l.w, BINARY_BYTE_STRINGS[t1l.b.h], BINARY_BYTE_STRINGS[t1l.b.l]);
-        ImGui::Text("T2 : $%04x %05d %s%s", via.m_t2, via.m_t2, BINARY_BYTE_STRINGS[via.m_t2 >> 8 & 0xff], BINARY_BYTE_STRINGS[via.m_t2 & 0xff]);
+        ImGui::Text("T2 : $%04x %05d %s%s", t2, t2, BINARY_BYTE_STRINGS[t2 >> 8 & 0xff], BINARY_BYTE_STRINGS[t2 & 0xff]);
         ImGui::Text("SR : $%02x %03d %s", via.m_sr, via.m_sr, BINARY_BYTE_STRINGS[via.m_sr]);
         ImGui::Text("ACR: PA latching = %s", BOOL_STR(via.m_acr.bits.pa_latching));
         ImGui::Text("ACR: PB latching = %s", BOOL_STR(via.m_acr.bits.pb_latching));
@@ -3752,6 +3772,405 @@ std::unique_ptr<SettingsUI> CreateWD1770DebugWindow(BeebWindow *beeb_window) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+class GuestProfileDebugWindow : public DebugUI {
+  public:
+    GuestProfileDebugWindow()
+        : m_pending(std::make_shared<Pending>()) {
+    }
+
+  protected:
+    void DoImGui2() override {
+        {
+            LockGuard<Mutex> lock(m_pending->mutex);
+
+            if (m_pending->done) {
+                m_report = std::move(m_pending->report);
+                m_pending->done = false;
+            }
+        }
+
+        if (!m_is_profiling) {
+            if (ImGui::Button("Start")) {
+                m_beeb_thread->Send(std::make_shared<BeebThread::CallbackMessage>([](BBCMicro *m) -> void {
+                    m->StartGuestProfile();
+                }));
+                m_is_profiling = true;
+                m_report.reset();
+            }
+        } else {
+            if (ImGui::Button("Stop")) {
+                m_beeb_thread->Send(std::make_shared<BeebThread::CallbackMessage>([](BBCMicro *m) -> void {
+                    m->StopGuestProfile();
+                }));
+                m_is_profiling = false;
+                this->RequestReport();
+            }
+        }
+
+        ImGui::SameLine();
+
+        if (ImGui::Button("Refresh")) {
+            this->RequestReport();
+        }
+
+        ImGui::SameLine();
+
+        {
+            ImGuiStyleColourPusher pusher;
+            pusher.PushDisabledButtonColours(!m_report);
+            if (ImGui::Button("Save CSV...") && m_report) {
+                SaveFileDialog fd(RECENT_PATHS_GUEST_PROFILE);
+
+                fd.AddFilter("CSV", {".csv"});
+                fd.AddAllFilesFilter();
+
+                std::string path;
+                if (fd.Open(&path)) {
+                    Messages msg(m_beeb_window->GetMessageList());
+                    if (SaveTextFile(GetGuestProfileReportCSV(*m_report), path, &msg)) {
+                        msg.i.f("Saved guest profile: %s\n", path.c_str());
+                    }
+                }
+            }
+        }
+
+        ImGui::SliderInt("Max rows", &m_max_num_rows, 10, 1000);
+
+        if (!m_report) {
+            if (m_is_profiling) {
+                ImGui::TextUnformatted("Profiling. Click Refresh to see the results so far.");
+            } else {
+                ImGui::TextUnformatted("No profile.");
+            }
+
+            return;
+        }
+
+        ImGui::Text("Host: %" PRIu64 " cycles (2 MHz)", m_report->total_cycles[GuestProfileCPU_Host]);
+        ImGui::Text("Parasite: %" PRIu64 " cycles (4 MHz)", m_report->total_cycles[GuestProfileCPU_Parasite]);
+
+        if (ImGui::CollapsingHeader("Hot loops", ImGuiTreeNodeFlags_DefaultOpen)) {
+            this->DoLoopsImGui();
+        }
+
+        if (ImGui::CollapsingHeader("Hot instructions", ImGuiTreeNodeFlags_DefaultOpen)) {
+            this->DoInstructionsImGui();
+        }
+    }
+
+  private:
+    // Filled in on the emulation thread.
+    struct Pending {
+        Mutex mutex;
+        bool done = false;
+        std::unique_ptr<GuestProfileReport> report;
+    };
+
+    static const std::string RECENT_PATHS_GUEST_PROFILE;
+
+    std::shared_ptr<Pending> m_pending;
+    std::unique_ptr<GuestProfileReport> m_report;
+    bool m_is_profiling = false;
+    int m_max_num_rows = 100;
+
+    void RequestReport() {
+        m_beeb_thread->Send(std::make_shared<BeebThread::CallbackMessage>([pending = m_pending](BBCMicro *m) -> void {
+            std::unique_ptr<GuestProfileReport> report = m->CreateGuestProfileReport();
+
+            LockGuard<Mutex> lock(pending->mutex);
+            pending->report = std::move(report);
+            pending->done = true;
+        }));
+    }
+
+    void DoLoopsImGui() {
+        if (m_report->loops.empty()) {
+            ImGui::TextUnformatted("No loops.");
+            return;
+        }
+
+        size_t num_loops = std::min(m_report->loops.size(), (size_t)m_max_num_rows);
+        for (size_t loop_index = 0; loop_index < num_loops; ++loop_index) {
+            const GuestProfileReport::Loop *loop = &m_report->loops[loop_index];
+            const BigPageMetadata *metadata = &m_report->type->big_pages_metadata[loop->big_page_index.i];
+
+            ImGuiIDPusher id_pusher((int)loop_index);
+
+            bool open = ImGui::TreeNode("loop",
+                                        "%6.2f%% %s $%04x-$%04x (%s): %" PRIu64 " cycles, %" PRIu64 " iterations",
+                                        loop->fraction * 100.,
+                                        loop->cpu == GuestProfileCPU_Parasite ? "Parasite" : "Host",
+                                        loop->begin_addr,
+                                        loop->end_addr,
+                                        metadata->description.c_str(),
+                                        loop->cycles,
+                                        loop->num_branch_executions);
+            if (open) {
+                this->DoInstructionsTableImGui(nullptr, loop->begin_index, loop->end_index);
+                ImGui::TreePop();
+            }
+        }
+    }
+
+    void DoInstructionsImGui() {
+        size_t num_instructions = std::min(m_report->hot_instructions.size(), (size_t)m_max_num_rows);
+        this->DoInstructionsTableImGui(m_report->hot_instructions.data(), 0, num_instructions);
+    }
+
+    // If indexes is non-null, the rows are m_report->instructions[indexes[i]]
+    // for i in [begin,end); otherwise, m_report->instructions[i].
+    void DoInstructionsTableImGui(const size_t *indexes, size_t begin, size_t end) {
+        if (!ImGui::BeginTable("instructions_table", 6, ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg)) {
+            return;
+        }
+
+        ImGui::TableSetupColumn("%", ImGuiTableColumnFlags_WidthFixed, 0.f);
+        ImGui::TableSetupColumn("Cycles", ImGuiTableColumnFlags_WidthFixed, 0.f);
+        ImGui::TableSetupColumn("Count", ImGuiTableColumnFlags_WidthFixed, 0.f);
+        ImGui::TableSetupColumn("Cycles/count", ImGuiTableColumnFlags_WidthFixed, 0.f);
+        ImGui::TableSetupColumn("Address", ImGuiTableColumnFlags_WidthFixed, 0.f);
+        ImGui::TableSetupColumn("Instruction");
+        ImGui::TableHeadersRow();
+
+        for (size_t i = begin; i < end; ++i) {
+            const GuestProfileReport::Instruction *instruction = &m_report->instructions[indexes ? indexes[i] : i];
+            const BigPageMetadata *metadata = &m_report->type->big_pages_metadata[instruction->big_page_index.i];
+
+            ImGui::TableNextRow();
+
+            ImGui::TableNextColumn();
+            ImGui::Text("%6.2f", instruction->fraction * 100.);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("%" PRIu64, instruction->cycles);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("%" PRIu64, instruction->num_executions);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", (double)instruction->cycles / instruction->num_executions);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("$%04x%c%s", instruction->addr, ADDRESS_SUFFIX_SEPARATOR, metadata->aligned_codes);
+
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(instruction->disassembly.c_str());
+        }
+
+        ImGui::EndTable();
+    }
+};
+
+const std::string GuestProfileDebugWindow::RECENT_PATHS_GUEST_PROFILE = "guest_profile";
+
+std::unique_ptr<SettingsUI> CreateGuestProfileDebugWindow(BeebWindow *beeb_window) {
+    return CreateDebugUI<GuestProfileDebugWindow>(beeb_window, ImVec2(600, 500));
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+class TraceQueryDebugWindow : public DebugUI {
+  public:
+    TraceQueryDebugWindow()
+        : m_pending(std::make_shared<Pending>()) {
+    }
+
+  protected:
+    void DoImGui2() override {
+        {
+            LockGuard<Mutex> lock(m_pending->mutex);
+
+            if (m_pending->done) {
+                m_results = std::move(m_pending->results);
+                m_pending->done = false;
+                m_job.reset();
+            }
+        }
+
+        ImGuiRadioButton(&m_type, TraceQueryType_Execute, "Execute");
+        ImGui::SameLine();
+        ImGuiRadioButton(&m_type, TraceQueryType_Write, "Write");
+        ImGui::SameLine();
+        ImGuiRadioButton(&m_type, TraceQueryType_EventType, "Event type");
+
+        if (m_type == TraceQueryType_EventType) {
+            ImGui::InputText("Type name", m_event_type_name, sizeof m_event_type_name);
+        } else {
+            ImGui::InputText("Address (hex)", m_addr_str, sizeof m_addr_str, ImGuiInputTextFlags_CharsHexadecimal);
+            ImGui::Checkbox("Parasite", &m_parasite);
+        }
+
+        ImGui::InputText("From cycle", m_begin_str, sizeof m_begin_str, ImGuiInputTextFlags_CharsDecimal);
+        ImGui::InputText("To cycle", m_end_str, sizeof m_end_str, ImGuiInputTextFlags_CharsDecimal);
+        ImGui::TextUnformatted("(2 MHz cycles since trace start. Leave blank for no limit.)");
+
+        ImGuiInputUInt("Max results", &m_max_num_results, 100, 1000);
+
+        if (m_job) {
+            ImGui::TextUnformatted("Searching...");
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel")) {
+                m_job->Cancel();
+            }
+        } else {
+            if (ImGui::Button("Search")) {
+                this->StartQuery();
+            }
+        }
+
+        ImGui::Separator();
+
+        if (!m_results) {
+            return;
+        }
+
+        if (!m_results->error.empty()) {
+            ImGui::TextUnformatted(m_results->error.c_str());
+            return;
+        }
+
+        if (m_results->descriptions.size() < m_results->num_matches) {
+            ImGui::Text("%zu matches (%zu shown)", m_results->num_matches, m_results->descriptions.size());
+        } else {
+            ImGui::Text("%zu matches", m_results->num_matches);
+        }
+
+        ImGui::BeginChild("##results", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
+
+        ImGuiListClipper clipper;
+        clipper.Begin((int)m_results->descriptions.size());
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                ImGui::TextUnformatted(m_results->descriptions[(size_t)i].c_str());
+            }
+        }
+
+        ImGui::EndChild();
+    }
+
+  private:
+    struct Results {
+        std::string error;
+        std::vector<std::string> descriptions;
+        size_t num_matches = 0;
+    };
+
+    // Filled in by the job.
+    struct Pending {
+        Mutex mutex;
+        bool done = false;
+        std::unique_ptr<Results> results;
+    };
+
+    // Building the index can take a while, so the query happens on a job
+    // thread.
+    class QueryJob : public JobQueue::Job {
+      public:
+        QueryJob(std::shared_ptr<BeebThread> beeb_thread,
+                 std::shared_ptr<Pending> pending,
+                 TraceQuery query,
+                 uint64_t begin_2MHz_cycles,
+                 uint64_t end_2MHz_cycles,
+                 size_t max_num_results)
+            : m_beeb_thread(std::move(beeb_thread))
+            , m_pending(std::move(pending))
+            , m_query(query)
+            , m_begin_2MHz_cycles(begin_2MHz_cycles)
+            , m_end_2MHz_cycles(end_2MHz_cycles)
+            , m_max_num_results(max_num_results) {
+        }
+
+        void ThreadExecute() override {
+            auto results = std::make_unique<Results>();
+
+            std::shared_ptr<const TraceIndex> index = m_beeb_thread->GetLastTraceIndex();
+            if (!index) {
+                results->error = "No trace.";
+            } else if (this->WasCanceled()) {
+                results->error = "Canceled.";
+            } else {
+                m_query.begin = index->GetTimeFrom2MHzCycles(m_begin_2MHz_cycles);
+                if (m_end_2MHz_cycles != UINT64_MAX) {
+                    m_query.end = index->GetTimeFrom2MHzCycles(m_end_2MHz_cycles);
+                }
+
+                results->num_matches = index->GetMatchDescriptions(&results->descriptions, m_query, m_max_num_results);
+            }
+
+            LockGuard<Mutex> lock(m_pending->mutex);
+            m_pending->results = std::move(results);
+            m_pending->done = true;
+        }
+
+      protected:
+      private:
+        std::shared_ptr<BeebThread> m_beeb_thread;
+        std::shared_ptr<Pending> m_pending;
+        TraceQuery m_query;
+        uint64_t m_begin_2MHz_cycles = 0;
+        uint64_t m_end_2MHz_cycles = UINT64_MAX;
+        size_t m_max_num_results = 0;
+    };
+
+    std::shared_ptr<Pending> m_pending;
+    std::shared_ptr<QueryJob> m_job;
+    std::unique_ptr<Results> m_results;
+
+    TraceQueryType m_type = TraceQueryType_Execute;
+    bool m_parasite = false;
+    char m_addr_str[10] = {};
+    char m_event_type_name[100] = {};
+    char m_begin_str[30] = {};
+    char m_end_str[30] = {};
+    unsigned m_max_num_results = 1000;
+
+    void StartQuery() {
+        m_results = std::make_unique<Results>();
+
+        TraceQuery query;
+        query.type = m_type;
+        query.source = m_parasite ? TraceEventSource_Parasite : TraceEventSource_Host;
+
+        if (m_type == TraceQueryType_EventType) {
+            query.event_type = TraceEventType::FindByName(m_event_type_name);
+            if (!query.event_type) {
+                m_results->error = std::string("Unknown event type: ") + m_event_type_name;
+                return;
+            }
+        } else {
+            if (!GetUInt16FromString(&query.addr, m_addr_str, 16)) {
+                m_results->error = "Bad address.";
+                return;
+            }
+        }
+
+        uint64_t begin = 0;
+        if (m_begin_str[0] != 0 && !GetUInt64FromString(&begin, m_begin_str)) {
+            m_results->error = "Bad from cycle.";
+            return;
+        }
+
+        uint64_t end = UINT64_MAX;
+        if (m_end_str[0] != 0 && !GetUInt64FromString(&end, m_end_str)) {
+            m_results->error = "Bad to cycle.";
+            return;
+        }
+
+        m_results.reset();
+
+        m_job = std::make_shared<QueryJob>(m_beeb_thread, m_pending, query, begin, end, (size_t)m_max_num_results);
+        BeebWindows::AddJob(m_job);
+    }
+};
+
+std::unique_ptr<SettingsUI> CreateTraceQueryDebugWindow(BeebWindow *beeb_window) {
+    return CreateDebugUI<TraceQueryDebugWindow>(beeb_window, ImVec2(600, 500));
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #else
 
 std::unique_ptr<SettingsUI> CreateSystemDebugWindow(BeebWindow *) {
@@ -3854,4 +4273,12 @@ std::unique_ptr<SettingsUI> CreateWD1770DebugWindow(BeebWindow *) {
     return nullptr;
 }
 
+std::unique_ptr<SettingsUI> CreateGuestProfileDebugWindow(BeebWindow *) {
+    return nullptr;
+}
+
+std::unique_ptr<SettingsUI> CreateTraceQueryDebugWindow(BeebWindow *) {
+    return nullptr;
+}
+
 #endif
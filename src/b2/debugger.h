@@ -41,6 +41,8 @@ std::unique_ptr<SettingsUI> CreateDigitalJoystickDebugWindow(BeebWindow *beeb_wi
 std::unique_ptr<SettingsUI> CreateKeyboardDebugWindow(BeebWindow *beeb_window);
 std::unique_ptr<SettingsUI> CreateMouseDebugWindow(BeebWindow *beeb_window);
 std::unique_ptr<SettingsUI> CreateWD1770DebugWindow(BeebWindow *beeb_window);
+std::unique_ptr<SettingsUI> CreateGuestProfileDebugWindow(BeebWindow *beeb_window);
+std::unique_ptr<SettingsUI> CreateTraceQueryDebugWindow(BeebWindow *beeb_window);
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
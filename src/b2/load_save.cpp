@@ -925,12 +925,15 @@ static const char GLOBALS[] = "globals";
 static const char VSYNC[] = "vsync";
 static const char EXT_MEM[] = "ext_mem";
 static const char UNLIMITED[] = "unlimited";
+static const char SPILL_TO_DISK[] = "spill_to_disk";
 static const char BEEBLINK[] = "beeblink";
 static const char URLS[] = "urls";
 static const char NVRAM[] = "nvram";
 static const char START_INSTRUCTION_ADDRESS[] = "start_address"; //yes, inconsistent naming...
 static const char START_WRITE_ADDRESS[] = "start_write_address";
 static const char STOP_WRITE_ADDRESS[] = "stop_write_address";
+static const char START_TRIGGER[] = "start_trigger";
+static const char STOP_TRIGGER[] = "stop_trigger";
 static const char STOP_NUM_CYCLES[] = "stop_num_cycles";
 static const char OUTPUT_FLAGS[] = "output_flags";
 static const char POWER_ON_TONE[] = "power_on_tone";
@@ -1944,11 +1947,14 @@ static bool LoadTrace(rapidjson::Value *trace_json, Messages *msg) {
     FindEnumMember(&settings.start, trace_json, START, "start condition", &GetTraceUIStartConditionEnumName, msg);
     FindEnumMember(&settings.stop, trace_json, STOP, "stop condition", &GetTraceUIStopConditionEnumName, msg);
     FindBoolMember(&settings.unlimited, trace_json, UNLIMITED, nullptr);
+    FindBoolMember(&settings.spill_to_disk, trace_json, SPILL_TO_DISK, nullptr);
     FindFlagsMember(&settings.output_flags, trace_json, OUTPUT_FLAGS, "output flags", &GetTraceOutputFlagsEnumName, msg);
     FindUInt64Member(&settings.stop_num_2MHz_cycles, trace_json, STOP_NUM_CYCLES, nullptr);
     FindUInt16Member(&settings.start_instruction_address, trace_json, START_INSTRUCTION_ADDRESS, nullptr);
     FindUInt16Member(&settings.start_write_address, trace_json, START_WRITE_ADDRESS, nullptr);
     FindUInt16Member(&settings.stop_write_address, trace_json, STOP_WRITE_ADDRESS, nullptr);
+    FindStringMember(&settings.start_trigger, trace_json, START_TRIGGER, nullptr);
+    FindStringMember(&settings.stop_trigger, trace_json, STOP_TRIGGER, nullptr);
     FindBoolMember(&settings.auto_save, trace_json, AUTO_SAVE, nullptr);
     FindStringMember(&settings.auto_save_path, trace_json, AUTO_SAVE_PATH, nullptr);
 #if SYSTEM_WINDOWS
@@ -1981,6 +1987,9 @@ static void SaveTrace(JSONWriter<StringStream> *writer) {
         writer->Key(UNLIMITED);
         writer->Bool(settings.unlimited);
 
+        writer->Key(SPILL_TO_DISK);
+        writer->Bool(settings.spill_to_disk);
+
         writer->Key(START_INSTRUCTION_ADDRESS);
         writer->Uint64(settings.start_instruction_address);
 
@@ -1990,6 +1999,12 @@ static void SaveTrace(JSONWriter<StringStream> *writer) {
         writer->Key(STOP_WRITE_ADDRESS);
         writer->Uint64(settings.stop_write_address);
 
+        writer->Key(START_TRIGGER);
+        writer->String(settings.start_trigger.c_str());
+
+        writer->Key(STOP_TRIGGER);
+        writer->String(settings.stop_trigger.c_str());
+
         writer->Key(STOP_NUM_CYCLES);
         writer->Uint64(settings.stop_num_2MHz_cycles);
 
@@ -37,6 +37,56 @@ struct TestJob1 : JobQueue::Job {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Does a ParallelFor from inside a job.
+struct ParallelForJob1 : JobQueue::Job {
+    JobQueue *jq = nullptr;
+    std::vector<std::atomic<int32_t>> *values = nullptr;
+
+    void ThreadExecute() override {
+        this->jq->ParallelFor(this->values->size(), [this](size_t i) {
+            ++(*this->values)[i];
+        });
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestParallelFor(unsigned num_threads, bool from_job) {
+    printf("ParallelFor: %u thread(s), %s\n", num_threads, from_job ? "from job" : "from main thread");
+
+    JobQueue jq;
+
+    TEST_TRUE(jq.Init(num_threads));
+
+    for (size_t n : {0, 1, 2, 3, 100, 10000}) {
+        std::vector<std::atomic<int32_t>> values(n);
+
+        if (from_job) {
+            auto job = std::make_shared<ParallelForJob1>();
+            job->jq = &jq;
+            job->values = &values;
+
+            jq.AddJob(job);
+
+            while (!job->IsFinished()) {
+                SleepMS(1);
+            }
+        } else {
+            jq.ParallelFor(n, [&values](size_t i) {
+                ++values[i];
+            });
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            TEST_EQ_II(values[i], 1);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 int main(void) {
     setbuf(stdout, nullptr);
 
@@ -104,4 +154,12 @@ int main(void) {
 
         printf("all done...\n");
     }
+
+    TestParallelFor(1, false);
+    TestParallelFor(4, false);
+
+    // With 1 thread, the job doing the ParallelFor is using the only
+    // thread.
+    TestParallelFor(1, true);
+    TestParallelFor(4, true);
 }
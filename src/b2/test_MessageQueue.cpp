@@ -0,0 +1,246 @@
+#include <shared/system.h>
+#include "MessageQueue.h"
+#include <shared/testing.h>
+#include <thread>
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static const uint32_t NUM_PRODUCERS = 4;
+
+// Enough to fill the ring several times over.
+static const uint32_t NUM_MESSAGES_PER_PRODUCER = 10000;
+
+static uint32_t GetMessage(uint32_t producer, uint32_t index) {
+    return producer << 24 | index;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestMultipleProducers() {
+    MessageQueue<uint32_t> mq;
+
+    std::vector<std::thread> producers;
+    for (uint32_t producer = 0; producer < NUM_PRODUCERS; ++producer) {
+        producers.emplace_back([&mq, producer]() {
+            for (uint32_t i = 0; i < NUM_MESSAGES_PER_PRODUCER; ++i) {
+                mq.ProducerPush(GetMessage(producer, i));
+            }
+        });
+    }
+
+    std::vector<uint32_t> next_indexes(NUM_PRODUCERS, 0);
+    uint32_t num_messages = 0;
+    std::vector<uint32_t> messages;
+    while (num_messages < NUM_PRODUCERS * NUM_MESSAGES_PER_PRODUCER) {
+        messages.clear();
+        mq.ConsumerWaitForMessages(&messages);
+        TEST_FALSE(messages.empty());
+
+        for (uint32_t message : messages) {
+            uint32_t producer = message >> 24;
+            TEST_TRUE(producer < NUM_PRODUCERS);
+
+            // Each producer's messages must turn up in order.
+            TEST_EQ_UU(message & 0xffffff, next_indexes[producer]);
+            ++next_indexes[producer];
+            ++num_messages;
+        }
+    }
+
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+
+    messages.clear();
+    TEST_FALSE(mq.ConsumerPollForMessages(&messages));
+    TEST_TRUE(messages.empty());
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestIndexed() {
+    MessageQueue<uint32_t> mq;
+    std::vector<uint32_t> messages;
+
+    TEST_FALSE(mq.ConsumerPollForMessages(&messages));
+
+    mq.ProducerPush(1);
+    mq.ProducerPushIndexed(5, 100);
+    mq.ProducerPushIndexed(5, 101);
+    mq.ProducerPushIndexed(63, 200);
+    mq.ProducerPush(2);
+
+    TEST_TRUE(mq.ConsumerPollForMessages(&messages));
+    TEST_EQ_UU(messages.size(), 4);
+    TEST_EQ_UU(messages[0], 1);
+    TEST_EQ_UU(messages[1], 2);
+    TEST_EQ_UU(messages[2], 101);
+    TEST_EQ_UU(messages[3], 200);
+
+    messages.clear();
+    TEST_FALSE(mq.ConsumerPollForMessages(&messages));
+
+    // Leave one behind for the destructor to clean up.
+    mq.ProducerPushIndexed(0, 300);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Pushing more than the ring holds mustn't block, and the messages must still
+// turn up in order.
+static void TestOverflow() {
+    MessageQueue<uint32_t> mq;
+    std::vector<uint32_t> messages;
+
+    const uint32_t n = 3 * MessageQueue<uint32_t>::CAPACITY + 10;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        mq.ProducerPush(i);
+    }
+
+    TEST_TRUE(mq.ConsumerPollForMessages(&messages));
+    TEST_EQ_UU(messages.size(), n);
+    for (uint32_t i = 0; i < n; ++i) {
+        TEST_EQ_UU(messages[i], i);
+    }
+
+    // Once the overflow list is empty, the ring gets used again.
+    for (uint32_t i = 0; i < 10; ++i) {
+        mq.ProducerPush(n + i);
+    }
+
+    messages.clear();
+    TEST_TRUE(mq.ConsumerPollForMessages(&messages));
+    TEST_EQ_UU(messages.size(), 10);
+    for (uint32_t i = 0; i < 10; ++i) {
+        TEST_EQ_UU(messages[i], n + i);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// A message that can hold up its producer after the slot has been claimed and
+// before it's been filled in. The slot is filled in by move assignment.
+struct StallingMessage {
+    uint32_t value = 0;
+    std::atomic<bool> *stalled = nullptr;
+    std::atomic<bool> *release = nullptr;
+
+    StallingMessage() = default;
+
+    StallingMessage(uint32_t value_, std::atomic<bool> *stalled_ = nullptr, std::atomic<bool> *release_ = nullptr)
+        : value(value_)
+        , stalled(stalled_)
+        , release(release_) {
+    }
+
+    StallingMessage(StallingMessage &&) = default;
+
+    StallingMessage &operator=(StallingMessage &&oth) {
+        value = oth.value;
+        stalled = oth.stalled;
+        release = oth.release;
+
+        if (release) {
+            stalled->store(true);
+            while (!release->load()) {
+                std::this_thread::yield();
+            }
+        }
+
+        return *this;
+    }
+};
+
+// One producer stalls part way through a push, while another fills the ring
+// and starts overflowing. The second producer's messages must still turn up
+// in order.
+static void TestStalledProducer() {
+    MessageQueue<StallingMessage> mq;
+    std::vector<StallingMessage> messages;
+
+    std::atomic<bool> stalled{false};
+    std::atomic<bool> release{false};
+
+    std::thread stalling_producer([&mq, &stalled, &release]() {
+        mq.ProducerPush(StallingMessage(0xffffffff, &stalled, &release));
+    });
+
+    while (!stalled.load()) {
+        std::this_thread::yield();
+    }
+
+    const uint32_t n = MessageQueue<StallingMessage>::CAPACITY + 10;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        mq.ProducerPush(StallingMessage(i));
+    }
+
+    // Nothing can come out until the stalled message is filled in.
+    TEST_FALSE(mq.ConsumerPollForMessages(&messages));
+    TEST_TRUE(messages.empty());
+
+    release.store(true);
+    stalling_producer.join();
+
+    TEST_TRUE(mq.ConsumerPollForMessages(&messages));
+    TEST_EQ_UU(messages.size(), n + 1);
+    TEST_EQ_UU(messages[0].value, 0xffffffff);
+    for (uint32_t i = 0; i < n; ++i) {
+        TEST_EQ_UU(messages[1 + i].value, i);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// The consumer goes to sleep before each message is pushed, and must get
+// woken up each time.
+static void TestWake() {
+    MessageQueue<uint32_t> mq;
+    std::atomic<uint32_t> num_received{0};
+
+    std::thread producer([&mq, &num_received]() {
+        for (uint32_t i = 0; i < 100; ++i) {
+            SleepMS(1);
+
+            if (i % 2 == 0) {
+                mq.ProducerPush(i);
+            } else {
+                mq.ProducerPushIndexed(0, i);
+            }
+
+            while (num_received.load() == i) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::vector<uint32_t> messages;
+    while (num_received.load() < 100) {
+        messages.clear();
+        mq.ConsumerWaitForMessages(&messages);
+        TEST_EQ_UU(messages.size(), 1);
+        TEST_EQ_UU(messages[0], num_received.load());
+        ++num_received;
+    }
+
+    producer.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    TestIndexed();
+    TestOverflow();
+    TestStalledProducer();
+    TestMultipleProducers();
+    TestWake();
+}
@@ -0,0 +1,743 @@
+#include <shared/system.h>
+#include "HeadlessBeeb.h"
+#include <beeb/BBCMicro.h>
+#include <beeb/BBCMicroStateFile.h>
+#include <beeb/DiscInterface.h>
+#include <beeb/DiscGeometry.h>
+#include <beeb/GuestProfile.h>
+#include <beeb/MemoryDiscImage.h>
+#include <beeb/TVOutput.h>
+#include <beeb/Trace.h>
+#include <beeb/TraceFile.h>
+#include <beeb/type.h>
+#include <shared/debug.h>
+#include <shared/file_io.h>
+#include <shared/log.h>
+#include <shared/path.h>
+
+#include <shared/enum_def.h>
+#include "HeadlessBeeb.inl"
+#include <shared/enum_end.h>
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static constexpr uint16_t WRCHV = 0x20e;
+static constexpr uint16_t WORDV = 0x20c;
+
+// The trace is written out as it goes, so there's no need to keep much of it
+// in memory.
+static constexpr size_t TRACE_MAX_NUM_BYTES = 64 * 1024 * 1024;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct HeadlessModel {
+    std::string name;
+    BBCMicroTypeID type_id = BBCMicroTypeID_B;
+    const DiscInterface *disc_interface = nullptr;
+    BBCMicroParasiteType parasite_type = BBCMicroParasiteType_None;
+
+    // All paths are relative to the ROMs folder.
+    std::string os;
+    std::string roms[16];
+    bool ram_banks[16] = {};
+    std::string parasite_os;
+
+    std::vector<uint8_t> nvram;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static std::vector<uint8_t> GetMaster128NVRAM() {
+    std::vector<uint8_t> nvram(50);
+
+    nvram[5] = 0xC9;  // 5 - LANG 12; FS 9
+    nvram[6] = 0xFF;  // 6 - INSERT 0 ... INSERT 7
+    nvram[7] = 0xFF;  // 7 - INSERT 8 ... INSERT 15
+    nvram[8] = 0x00;  // 8
+    nvram[9] = 0x00;  // 9
+    nvram[10] = 0x17; //10 - MODE 7; SHADOW 0; TV 0 1
+    nvram[11] = 0x80; //11 - FLOPPY
+    nvram[12] = 55;   //12 - DELAY 55
+    nvram[13] = 0x03; //13 - REPEAT 3
+    nvram[14] = 0x00; //14
+    nvram[15] = 0x01; //15 - TUBE
+    nvram[16] = 0x02; //16 - LOUD
+
+    return nvram;
+}
+
+static std::vector<uint8_t> GetMasterCompactNVRAM() {
+    std::vector<uint8_t> nvram(128);
+
+    nvram[5] = 0xED;  // 5 - LANG 14; FS 13
+    nvram[6] = 0xFF;  // 6 - INSERT 0 ... INSERT 7
+    nvram[7] = 0xFF;  // 7 - INSERT 8 ... INSERT 15
+    nvram[10] = 0x17; //10 - MODE 7; SHADOW 0; TV 0 1
+    nvram[11] = 0xC0; //11 - FLOPPY; NODIR
+    nvram[12] = 55;   //12 - DELAY 55
+    nvram[13] = 0x03; //13 - REPEAT 3
+    nvram[15] = 0x01; //15 - TUBE
+    nvram[16] = 0x02; //16 - LOUD
+    nvram[127] = 0xb0;
+
+    return nvram;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static HeadlessModel GetMaster128Model(std::string name, const std::string &version) {
+    HeadlessModel model;
+
+    model.name = std::move(name);
+    model.type_id = BBCMicroTypeID_Master;
+    model.disc_interface = &DISC_INTERFACE_MASTER128;
+    model.os = PathJoined("M128", version, "mos.rom");
+    model.roms[15] = PathJoined("M128", version, "terminal.rom");
+    model.roms[14] = PathJoined("M128", version, "view.rom");
+    model.roms[13] = PathJoined("M128", version, "adfs.rom");
+    model.roms[12] = PathJoined("M128", version, "basic4.rom");
+    model.roms[11] = PathJoined("M128", version, "edit.rom");
+    model.roms[10] = PathJoined("M128", version, "viewsht.rom");
+    model.roms[9] = PathJoined("M128", version, "dfs.rom");
+    for (size_t i = 4; i < 8; ++i) {
+        model.ram_banks[i] = true;
+    }
+    model.nvram = GetMaster128NVRAM();
+
+    return model;
+}
+
+// The disc interface objects are references to objects in another
+// translation unit, so this can't be a static table.
+static const std::vector<HeadlessModel> &GetHeadlessModels() {
+    static std::vector<HeadlessModel> models;
+
+    if (models.empty()) {
+        {
+            HeadlessModel model;
+
+            model.name = "b";
+            model.disc_interface = &DISC_INTERFACE_ACORN_1770;
+            model.os = "OS12.ROM";
+            model.roms[15] = "BASIC2.ROM";
+            model.roms[14] = PathJoined("acorn", "DFS-2.26.rom");
+            model.ram_banks[13] = true;
+
+            models.push_back(model);
+
+            model.name = "b-6502sp";
+            model.parasite_type = BBCMicroParasiteType_External3MHz6502;
+            model.parasite_os = "TUBE110.rom";
+
+            models.push_back(model);
+        }
+
+        {
+            HeadlessModel model;
+
+            model.name = "bplus";
+            model.type_id = BBCMicroTypeID_BPlus;
+            model.disc_interface = &DISC_INTERFACE_ACORN_1770;
+            model.os = "B+MOS.rom";
+            model.roms[15] = "BASIC2.ROM";
+            model.roms[14] = PathJoined("acorn", "DFS-2.26.rom");
+
+            models.push_back(model);
+
+            model.name = "bplus128";
+            model.ram_banks[0] = true;
+            model.ram_banks[1] = true;
+            model.ram_banks[12] = true;
+            model.ram_banks[13] = true;
+
+            models.push_back(model);
+        }
+
+        models.push_back(GetMaster128Model("master128-mos320", "3.20"));
+        models.push_back(GetMaster128Model("master128-mos350", "3.50"));
+
+        {
+            HeadlessModel model = GetMaster128Model("master-turbo", "3.20");
+
+            model.parasite_type = BBCMicroParasiteType_MasterTurbo;
+            model.parasite_os = "MasterTurboParasite.rom";
+
+            models.push_back(model);
+        }
+
+        {
+            HeadlessModel model;
+
+            model.name = "compact-mos510";
+            model.type_id = BBCMicroTypeID_MasterCompact;
+            model.disc_interface = &DISC_INTERFACE_MASTER128;
+            model.os = PathJoined("MCompact", "5.10", "mos.rom");
+            model.roms[15] = PathJoined("MCompact", "5.10", "utils.rom");
+            model.roms[14] = PathJoined("MCompact", "5.10", "basic4.rom");
+            model.roms[13] = PathJoined("MCompact", "5.10", "adfs.rom");
+            for (size_t i = 4; i < 8; ++i) {
+                model.ram_banks[i] = true;
+            }
+            model.nvram = GetMasterCompactNVRAM();
+
+            models.push_back(model);
+        }
+    }
+
+    return models;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::vector<std::string> GetHeadlessModelNames() {
+    std::vector<std::string> names;
+
+    for (const HeadlessModel &model : GetHeadlessModels()) {
+        names.push_back(model.name);
+    }
+
+    return names;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+template <size_t SIZE>
+static std::shared_ptr<std::array<uint8_t, SIZE>> LoadOSROM(const std::string &path, const LogSet &logs) {
+    std::vector<uint8_t> data;
+    if (!LoadFile(&data, path, &logs)) {
+        return nullptr;
+    }
+
+    if (data.size() > SIZE) {
+        logs.e.f("ROM too large (%zu bytes; max: %zu bytes): %s\n", data.size(), SIZE, path.c_str());
+        return nullptr;
+    }
+
+    auto rom = std::make_shared<std::array<uint8_t, SIZE>>();
+    rom->fill(0);
+
+    // fill the OS ROM backwards. The vectors are at the end.
+    for (size_t i = 0; i < data.size(); ++i) {
+        (*rom)[rom->size() - data.size() + i] = data[i];
+    }
+
+    return rom;
+}
+
+static std::shared_ptr<std::vector<uint8_t>> LoadSidewaysROM(const std::string &path, const LogSet &logs) {
+    auto rom = std::make_shared<std::vector<uint8_t>>();
+    if (!LoadFile(rom.get(), path, &logs)) {
+        return nullptr;
+    }
+
+    if (rom->size() > 16384) {
+        logs.e.f("ROM too large (%zu bytes; max: 16384 bytes): %s\n", rom->size(), path.c_str());
+        return nullptr;
+    }
+
+    rom->resize(16384);
+
+    return rom;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<HeadlessBeeb> HeadlessBeeb::Create(HeadlessSettings settings, const LogSet &logs) {
+    std::unique_ptr<HeadlessBeeb> hb(new HeadlessBeeb(std::move(settings)));
+
+    if (!hb->Init(logs)) {
+        return nullptr;
+    }
+
+    return hb;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+HeadlessBeeb::HeadlessBeeb(HeadlessSettings settings)
+    : m_settings(std::move(settings)) {
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+HeadlessBeeb::~HeadlessBeeb() {
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool HeadlessBeeb::Run(uint64_t max_num_cycles) {
+    if (m_stop_reason != HeadlessStopReason_None) {
+        return true;
+    }
+
+    if (m_settings.max_num_cycles > 0) {
+        uint64_t num_cycles_left = m_settings.max_num_cycles - m_num_cycles;
+        if (max_num_cycles > num_cycles_left) {
+            max_num_cycles = num_cycles_left;
+        }
+    }
+
+    // The instruction callback sets m_stop_reason, so that's what ends the
+    // loop early. In catch-up mode, the video and sound units aren't written
+    // to.
+    BBCMicro *beeb = m_beeb.get();
+    beeb->OptionalLowFrequencyUpdate();
+
+    uint64_t i = 0;
+    while (i < max_num_cycles && m_stop_reason == HeadlessStopReason_None) {
+        beeb->Update(&m_video_unit, &m_sound_unit);
+        ++i;
+    }
+
+    m_num_cycles += i;
+
+    if (m_boot) {
+        if (beeb->GetAndResetDiscAccessFlag()) {
+            beeb->SetKeyState(BeebKey_Shift, false);
+            m_boot = false;
+        }
+    }
+
+    if (!m_pasted && !m_settings.paste_text.empty() && !m_boot) {
+        // Leave it until the OS has got going. There's no particular rush.
+        // (When starting from a saved state, it probably already has.)
+        if (beeb->GetCycleCountPtr()->n >= CYCLES_PER_SECOND) {
+            std::string text;
+            for (size_t j = 0; j < m_settings.paste_text.size(); ++j) {
+                char c = m_settings.paste_text[j];
+                if (c == '\r' && j + 1 < m_settings.paste_text.size() && m_settings.paste_text[j + 1] == '\n') {
+                    // CR LF -> CR.
+                } else if (c == '\n') {
+                    text.push_back(13);
+                } else {
+                    text.push_back(c);
+                }
+            }
+
+            beeb->StartPaste(std::make_shared<std::string>(std::move(text)));
+            m_pasted = true;
+        }
+    }
+
+    if (m_stop_reason == HeadlessStopReason_None) {
+        if (m_settings.max_num_cycles > 0 && m_num_cycles >= m_settings.max_num_cycles) {
+            this->Stop(HeadlessStopReason_NumCycles);
+        }
+    }
+
+    return m_stop_reason != HeadlessStopReason_None;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+HeadlessStopReason HeadlessBeeb::GetStopReason() const {
+    return m_stop_reason;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+uint64_t HeadlessBeeb::GetNumCycles() const {
+    return m_num_cycles;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+const std::string &HeadlessBeeb::GetOSWRCHOutput() const {
+    return m_oswrch_output;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool HeadlessBeeb::SaveOutput(const LogSet &logs) {
+    bool good = true;
+
+#if BBCMICRO_TRACE
+    if (!!m_trace_writer) {
+        std::shared_ptr<Trace> trace;
+        m_beeb->StopTrace(&trace);
+
+        trace->FlushChunks();
+        trace->SetChunkFn(nullptr, nullptr);
+
+        if (!m_trace_writer->Close()) {
+            good = false;
+        }
+
+        m_trace_writer.reset();
+    }
+#endif
+
+    if (!m_settings.text_output_path.empty()) {
+        if (!SaveFile(m_oswrch_output.data(), m_oswrch_output.size(), m_settings.text_output_path, &logs)) {
+            good = false;
+        }
+    }
+
+#if BBCMICRO_DEBUGGER
+    // Save the profile before the screenshot gets counted in it.
+    if (!m_settings.profile_path.empty()) {
+        std::string profile = m_beeb->GetProfileFoldedStacks();
+        m_beeb->StopProfile();
+
+        if (!SaveFile(profile.data(), profile.size(), m_settings.profile_path, &logs)) {
+            good = false;
+        }
+    }
+
+    if (!m_settings.guest_profile_path.empty()) {
+        m_beeb->StopGuestProfile();
+
+        std::unique_ptr<GuestProfileReport> report = m_beeb->CreateGuestProfileReport();
+        std::string csv = GetGuestProfileReportCSV(*report);
+
+        if (!SaveFile(csv.data(), csv.size(), m_settings.guest_profile_path, &logs)) {
+            good = false;
+        }
+    }
+#endif
+
+    // Save the state before the screenshot moves things on.
+    if (!m_settings.save_state_path.empty()) {
+        const BBCMicroUniqueState *state = m_beeb->GetUniqueState();
+        if (!state) {
+            logs.e.f("can't save state: disc image or BeebLink in use\n");
+            good = false;
+        } else if (!BBCMicroStateFile::Save(m_settings.save_state_path, *state, logs)) {
+            good = false;
+        }
+    }
+
+    if (!m_settings.screenshot_path.empty()) {
+        if (!this->SaveScreenshot(logs)) {
+            good = false;
+        }
+    }
+
+    return good;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool HeadlessBeeb::Init(const LogSet &logs) {
+    if (!m_settings.load_state_path.empty()) {
+        std::unique_ptr<BBCMicroUniqueState> state = BBCMicroStateFile::Load(m_settings.load_state_path, nullptr, nullptr, logs);
+        if (!state) {
+            return false;
+        }
+
+        m_beeb = std::make_unique<BBCMicro>(*state);
+    } else {
+        if (!this->CreateBeeb(logs)) {
+            return false;
+        }
+    }
+
+    for (int drive = 0; drive < NUM_DRIVES; ++drive) {
+        const std::string &path = m_settings.disc_paths[drive];
+        if (path.empty()) {
+            continue;
+        }
+
+        std::vector<uint8_t> data;
+        if (!LoadFile(&data, path, &logs)) {
+            return false;
+        }
+
+        DiscGeometry geometry;
+        if (!FindDiscGeometryFromFileDetails(&geometry, path.c_str(), data.size(), &logs)) {
+            return false;
+        }
+
+        std::shared_ptr<DiscImage> disc_image = MemoryDiscImage::LoadFromBuffer(path, MemoryDiscImage::LOAD_METHOD_FILE, data.data(), data.size(), geometry, logs);
+        if (!disc_image) {
+            return false;
+        }
+
+        m_beeb->SetDiscImage(drive, std::move(disc_image));
+    }
+
+    // Nothing is shown, so there's no need to produce any output.
+    m_beeb->SetCatchUpMode(true);
+
+    if (m_settings.boot) {
+        m_beeb->SetKeyState(BeebKey_Shift, true);
+        m_boot = true;
+    }
+
+    // The instruction callback is needed for OSWRCH capture if there's text
+    // output, or an OSWRCH stop condition; it's only worth the overhead if
+    // something is going to use it.
+    if (m_settings.stop_on_osword0 ||
+        m_settings.stop_address >= 0 ||
+        !m_settings.stop_oswrch_text.empty() ||
+        !m_settings.text_output_path.empty()) {
+        m_beeb->AddHostInstructionFn(&HandleInstruction, this);
+    }
+
+    if (!m_settings.profile_path.empty()) {
+#if BBCMICRO_DEBUGGER
+        m_beeb->StartProfile();
+#else
+        logs.e.f("profiling not supported in this build\n");
+        return false;
+#endif
+    }
+
+    if (!m_settings.guest_profile_path.empty()) {
+#if BBCMICRO_DEBUGGER
+        m_beeb->StartGuestProfile();
+#else
+        logs.e.f("guest profiling not supported in this build\n");
+        return false;
+#endif
+    }
+
+    if (!m_settings.trace_path.empty()) {
+#if BBCMICRO_TRACE
+        m_beeb->StartTrace(0, TRACE_MAX_NUM_BYTES);
+        std::shared_ptr<Trace> trace = m_beeb->GetTrace();
+
+        m_trace_writer = std::make_unique<TraceFileWriter>(logs);
+        if (!m_trace_writer->Open(m_settings.trace_path, *trace)) {
+            return false;
+        }
+
+        trace->SetChunkFn(&TraceFileWriter::ChunkFn, m_trace_writer.get());
+#else
+        logs.e.f("tracing not supported in this build\n");
+        return false;
+#endif
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool HeadlessBeeb::CreateBeeb(const LogSet &logs) {
+    const HeadlessModel *model = nullptr;
+    for (const HeadlessModel &m : GetHeadlessModels()) {
+        if (m.name == m_settings.model) {
+            model = &m;
+            break;
+        }
+    }
+
+    if (!model) {
+        logs.e.f("unknown model: %s\n", m_settings.model.c_str());
+        return false;
+    }
+
+    std::string os_path = m_settings.os_path;
+    if (os_path.empty()) {
+        os_path = PathJoined(m_settings.roms_folder, model->os);
+    }
+
+    std::shared_ptr<const std::array<uint8_t, 16384>> os = LoadOSROM<16384>(os_path, logs);
+    if (!os) {
+        return false;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> roms[16];
+    bool ram_banks[16];
+    for (size_t i = 0; i < 16; ++i) {
+        std::string rom_path = m_settings.rom_paths[i];
+        if (rom_path.empty() && !model->roms[i].empty()) {
+            rom_path = PathJoined(m_settings.roms_folder, model->roms[i]);
+        }
+
+        if (!rom_path.empty()) {
+            roms[i] = LoadSidewaysROM(rom_path, logs);
+            if (!roms[i]) {
+                return false;
+            }
+        }
+
+        ram_banks[i] = model->ram_banks[i] || m_settings.ram_banks[i];
+    }
+
+    std::shared_ptr<const std::array<uint8_t, 4096>> parasite_os;
+    if (model->parasite_type != BBCMicroParasiteType_None) {
+        parasite_os = LoadOSROM<4096>(PathJoined(m_settings.roms_folder, model->parasite_os), logs);
+        if (!parasite_os) {
+            return false;
+        }
+    }
+
+    static const ROMType ROM_TYPES[16] = {};
+
+    m_beeb = std::make_unique<BBCMicro>(CreateBBCMicroType(model->type_id, ROM_TYPES),
+                                        model->disc_interface,
+                                        model->parasite_type,
+                                        model->nvram,
+                                        nullptr,
+                                        BBCMicroInitFlag_VideoNuLA,
+                                        nullptr,
+                                        CycleCount{0});
+
+    m_beeb->SetOSROM(std::move(os));
+
+    for (uint8_t i = 0; i < 16; ++i) {
+        if (ram_banks[i]) {
+            m_beeb->SetSidewaysRAM(i, roms[i]);
+        } else {
+            m_beeb->SetSidewaysROM(i, roms[i], ROMType_16KB);
+        }
+    }
+
+    if (model->parasite_type != BBCMicroParasiteType_None) {
+        m_beeb->SetParasiteOS(std::move(parasite_os));
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void HeadlessBeeb::Stop(HeadlessStopReason reason) {
+    if (m_stop_reason == HeadlessStopReason_None) {
+        m_stop_reason = reason;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool HeadlessBeeb::SaveScreenshot(const LogSet &logs) {
+    // Only now is there any need for a TVOutput, or any video output.
+    auto tv = std::make_unique<TVOutput>();
+    m_beeb->SetCatchUpMode(false);
+
+    static constexpr size_t MAX_NUM_VUNITS = 1000;
+    std::vector<VideoDataUnit> vunits(MAX_NUM_VUNITS);
+    size_t num_vunits = 0;
+
+    uint64_t version;
+    const uint32_t *pixels = tv->GetTexturePixels(&version);
+
+    // Give up if the screen never produces a frame - 5 seconds is plenty.
+    uint64_t max_num_cycles = m_num_cycles + 5 * CYCLES_PER_SECOND;
+
+    int num_frames = 0;
+    while (num_frames < m_settings.screenshot_num_frames && m_num_cycles < max_num_cycles) {
+        uint32_t update_result = m_beeb->Update(&vunits[num_vunits], &m_sound_unit);
+        ++m_num_cycles;
+
+        if (update_result & BBCMicroUpdateResultFlag_VideoUnit) {
+            ++num_vunits;
+            if (num_vunits == vunits.size()) {
+                tv->Update(vunits.data(), num_vunits);
+                num_vunits = 0;
+
+                uint64_t new_version;
+                pixels = tv->GetTexturePixels(&new_version);
+                if (new_version > version) {
+                    version = new_version;
+                    ++num_frames;
+                }
+            }
+        }
+    }
+
+    if (num_frames < m_settings.screenshot_num_frames) {
+        logs.w.f("only got %d frame(s) for screenshot\n", num_frames);
+    }
+
+    // The emulator doesn't bother to fill in the alpha channel, and the
+    // pixels are the wrong way round for stb_image_write.
+    std::vector<uint32_t> image(pixels, pixels + TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT);
+    for (uint32_t &pixel : image) {
+        uint32_t r = (uint8_t)(pixel >> 16);
+        uint32_t g = (uint8_t)(pixel >> 8);
+        uint32_t b = (uint8_t)(pixel >> 0);
+
+        pixel = r << 0 | g << 8 | b << 16 | 0xffu << 24;
+    }
+
+    if (!PathCreateFolder(PathGetFolder(m_settings.screenshot_path))) {
+        logs.e.f("failed to create folder for: %s\n", m_settings.screenshot_path.c_str());
+        return false;
+    }
+
+    if (!stbi_write_png(m_settings.screenshot_path.c_str(),
+                        TV_TEXTURE_WIDTH,
+                        TV_TEXTURE_HEIGHT,
+                        4,
+                        image.data(),
+                        TV_TEXTURE_WIDTH * 4)) {
+        logs.e.f("failed to save screenshot: %s\n", m_settings.screenshot_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool HeadlessBeeb::HandleInstruction(const BBCMicro *m, const M6502 *cpu, void *context) {
+    auto hb = (HeadlessBeeb *)context;
+    const uint8_t *ram = m->GetRAM();
+
+    if (hb->m_settings.stop_address >= 0) {
+        if (cpu->abus.w == hb->m_settings.stop_address) {
+            hb->Stop(HeadlessStopReason_Address);
+        }
+    }
+
+    if (cpu->abus.b.l == ram[WRCHV + 0] && cpu->abus.b.h == ram[WRCHV + 1]) {
+        auto c = (char)cpu->a;
+
+        hb->m_oswrch_output.push_back(c);
+
+        const std::string &stop_text = hb->m_settings.stop_oswrch_text;
+        if (!stop_text.empty()) {
+            if (hb->m_oswrch_output.size() >= stop_text.size()) {
+                if (hb->m_oswrch_output.compare(hb->m_oswrch_output.size() - stop_text.size(),
+                                                stop_text.size(),
+                                                stop_text) == 0) {
+                    hb->Stop(HeadlessStopReason_OSWRCHText);
+                }
+            }
+        }
+    } else if (cpu->abus.b.l == ram[WORDV + 0] && cpu->abus.b.h == ram[WORDV + 1]) {
+        if (hb->m_settings.stop_on_osword0 && cpu->a == 0) {
+            hb->Stop(HeadlessStopReason_OSWORD0);
+        }
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,160 @@
+#ifndef HEADER_E160BE4B12794E3FB56A4A8B39BB5A36 // -*- mode:c++ -*-
+#define HEADER_E160BE4B12794E3FB56A4A8B39BB5A36
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include <beeb/conf.h>
+#include <beeb/video.h>
+#include <beeb/sound.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class BBCMicro;
+struct M6502;
+class TraceFileWriter;
+struct LogSet;
+
+#include <shared/enum_decl.h>
+#include "HeadlessBeeb.inl"
+#include <shared/enum_end.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Everything needed to set up and run one headless BBCMicro.
+//
+// The b2 BeebConfig can't be used here, as loading one drags in SDL (for the
+// asset paths) and the JSON config stuff, so the model is chosen by name from
+// a built-in list that mirrors b2's default configs. Individual ROMs can then
+// be overridden.
+struct HeadlessSettings {
+    // If non-empty, start from the state saved in this file, rather than
+    // powering on. The model and ROM settings are then ignored.
+    std::string load_state_path;
+
+    // One of the names from GetHeadlessModelNames.
+    std::string model = "b";
+
+    // Folder that the model's ROM paths are relative to.
+    std::string roms_folder;
+
+    // If non-empty, replacement OS ROM.
+    std::string os_path;
+
+    // If non-empty, replacement contents for the corresponding bank.
+    std::string rom_paths[16];
+
+    // Banks to be made sideways RAM, in addition to any the model has.
+    bool ram_banks[16] = {};
+
+    std::string disc_paths[NUM_DRIVES];
+
+    // Hold SHIFT on startup until the first disc access.
+    bool boot = false;
+
+    // Text to paste in once the machine has started.
+    std::string paste_text;
+
+    // 0 = no limit.
+    uint64_t max_num_cycles = 0;
+
+    bool stop_on_osword0 = false;
+
+    // <0 = none.
+    int stop_address = -1;
+
+    // If non-empty, stop once this text has been printed via OSWRCH.
+    std::string stop_oswrch_text;
+
+    // If non-empty, write the OSWRCH output here.
+    std::string text_output_path;
+
+    // If non-empty, run on for screenshot_num_frames frames after stopping
+    // and save the last frame as a PNG.
+    std::string screenshot_path;
+    int screenshot_num_frames = 2;
+
+    // If non-empty, save the state here after stopping.
+    std::string save_state_path;
+
+    // If non-empty, profile the emulator and save the result here after
+    // stopping, in folded stack format. Only supported when the debugger is
+    // compiled in.
+    std::string profile_path;
+
+    // If non-empty, profile the guest code and save the hot spot report here
+    // after stopping, in CSV format. Only supported when the debugger is
+    // compiled in.
+    std::string guest_profile_path;
+
+    // If non-empty, trace the run, streaming the trace to this file in binary
+    // format as it's recorded. Only supported when tracing is compiled in.
+    std::string trace_path;
+};
+
+std::vector<std::string> GetHeadlessModelNames();
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+class HeadlessBeeb {
+  public:
+    // Returns nullptr, having printed something to logs.e, if the setup
+    // failed.
+    static std::unique_ptr<HeadlessBeeb> Create(HeadlessSettings settings, const LogSet &logs);
+
+    ~HeadlessBeeb();
+
+    HeadlessBeeb(const HeadlessBeeb &) = delete;
+    HeadlessBeeb &operator=(const HeadlessBeeb &) = delete;
+    HeadlessBeeb(HeadlessBeeb &&) = delete;
+    HeadlessBeeb &operator=(HeadlessBeeb &&) = delete;
+
+    // Run for up to max_num_cycles cycles, stopping early if a stop
+    // condition is hit. Returns true if the run is finished, false if
+    // there's more to do.
+    bool Run(uint64_t max_num_cycles);
+
+    HeadlessStopReason GetStopReason() const;
+    uint64_t GetNumCycles() const;
+    const std::string &GetOSWRCHOutput() const;
+
+    // Write the text output, state and screenshot, if requested. The
+    // screenshot requires further emulation, so this can take a little
+    // while.
+    bool SaveOutput(const LogSet &logs);
+
+  protected:
+  private:
+    HeadlessSettings m_settings;
+    std::unique_ptr<BBCMicro> m_beeb;
+    uint64_t m_num_cycles = 0;
+    HeadlessStopReason m_stop_reason = HeadlessStopReason_None;
+    std::string m_oswrch_output;
+    bool m_boot = false;
+    bool m_pasted = false;
+#if BBCMICRO_TRACE
+    std::unique_ptr<TraceFileWriter> m_trace_writer;
+#endif
+
+    // Scratch output. When no frame is needed, the video output goes
+    // nowhere.
+    VideoDataUnit m_video_unit;
+    SoundDataUnit m_sound_unit;
+
+    explicit HeadlessBeeb(HeadlessSettings settings);
+
+    bool Init(const LogSet &logs);
+    bool CreateBeeb(const LogSet &logs);
+    void Stop(HeadlessStopReason reason);
+    bool SaveScreenshot(const LogSet &logs);
+
+    static bool HandleInstruction(const BBCMicro *m, const M6502 *cpu, void *context);
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
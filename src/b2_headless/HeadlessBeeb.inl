@@ -0,0 +1,15 @@
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#define ENAME HeadlessStopReason
+EBEGIN()
+EPN(None)
+EPN(NumCycles)
+EPN(OSWORD0)
+EPN(Address)
+EPN(OSWRCHText)
+EEND()
+#undef ENAME
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,147 @@
+#include <shared/system.h>
+#include "HeadlessFarm.h"
+#include "HeadlessBeeb.h"
+#include <shared/debug.h>
+#include <functional>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+HeadlessFarm::HeadlessFarm(unsigned num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+
+    if (num_threads == 0) {
+        num_threads = 1; // got to do something.
+    }
+
+    for (unsigned i = 0; i < num_threads; ++i) {
+        auto worker = std::make_unique<Worker>();
+
+        worker->index = i;
+        MUTEX_SET_NAME(worker->mutex, "HeadlessFarm worker");
+
+        m_workers.push_back(std::move(worker));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+HeadlessFarm::~HeadlessFarm() {
+    // Run joins all the threads, so there's nothing to do.
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+unsigned HeadlessFarm::GetNumThreads() const {
+    return (unsigned)m_workers.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void HeadlessFarm::AddBeeb(HeadlessBeeb *beeb) {
+    Worker *worker = m_workers[m_next_worker_index].get();
+
+    ++m_next_worker_index;
+    m_next_worker_index %= m_workers.size();
+
+    LockGuard<Mutex> lock(worker->mutex);
+
+    worker->beebs.push_back(beeb);
+    ++m_num_beebs;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+HeadlessFarmStats HeadlessFarm::Run(uint64_t slice_num_cycles) {
+    m_slice_num_cycles = slice_num_cycles;
+    m_num_beebs_left.store(m_num_beebs, std::memory_order_release);
+
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        worker->stats = {};
+        worker->thread = std::thread(std::bind(&HeadlessFarm::ThreadFunc, this, worker.get()));
+    }
+
+    HeadlessFarmStats stats;
+
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        worker->thread.join();
+
+        stats.num_slices += worker->stats.num_slices;
+        stats.num_steals += worker->stats.num_steals;
+    }
+
+    m_num_beebs = 0;
+
+    return stats;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void HeadlessFarm::ThreadFunc(Worker *worker) {
+    SetCurrentThreadNamef("HeadlessFarm%zu", worker->index);
+
+    while (m_num_beebs_left.load(std::memory_order_acquire) > 0) {
+        HeadlessBeeb *beeb = nullptr;
+
+        {
+            LockGuard<Mutex> lock(worker->mutex);
+
+            if (!worker->beebs.empty()) {
+                beeb = worker->beebs.front();
+                worker->beebs.pop_front();
+            }
+        }
+
+        if (!beeb) {
+            beeb = this->ThreadSteal(worker);
+            if (!beeb) {
+                // Everything left is being run by some other worker. A
+                // worker only ever puts a BBCMicro back on its own queue, so
+                // there'll never be anything more for this one to do.
+                break;
+            }
+
+            ++worker->stats.num_steals;
+        }
+
+        bool finished = beeb->Run(m_slice_num_cycles);
+        ++worker->stats.num_slices;
+
+        if (finished) {
+            m_num_beebs_left.fetch_sub(1, std::memory_order_acq_rel);
+        } else {
+            LockGuard<Mutex> lock(worker->mutex);
+
+            worker->beebs.push_back(beeb);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+HeadlessBeeb *HeadlessFarm::ThreadSteal(Worker *worker) {
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        Worker *victim = m_workers[(worker->index + i) % m_workers.size()].get();
+
+        LockGuard<Mutex> lock(victim->mutex);
+
+        if (!victim->beebs.empty()) {
+            HeadlessBeeb *beeb = victim->beebs.back();
+            victim->beebs.pop_back();
+            return beeb;
+        }
+    }
+
+    return nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,76 @@
+#ifndef HEADER_7D00DA26711845C0B83237F699039A6F // -*- mode:c++ -*-
+#define HEADER_7D00DA26711845C0B83237F699039A6F
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include <shared/mutex.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class HeadlessBeeb;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Runs many HeadlessBeeb objects on a fixed number of worker threads.
+//
+// Each worker has its own queue of BBCMicros, and steps the one at the front
+// for a slice of slice_num_cycles cycles, then puts it on the back (if it
+// isn't finished). A worker whose queue is empty steals a BBCMicro from the
+// back of another worker's queue, and finishes if there's nothing to steal.
+//
+// The slices keep the load balanced as BBCMicros finish, and only one thread
+// per core is ever needed however many BBCMicros there are.
+
+struct HeadlessFarmStats {
+    uint64_t num_slices = 0;
+    uint64_t num_steals = 0;
+};
+
+class HeadlessFarm {
+  public:
+    // num_threads==0 means one per core.
+    explicit HeadlessFarm(unsigned num_threads = 0);
+    ~HeadlessFarm();
+
+    HeadlessFarm(const HeadlessFarm &) = delete;
+    HeadlessFarm &operator=(const HeadlessFarm &) = delete;
+    HeadlessFarm(HeadlessFarm &&) = delete;
+    HeadlessFarm &operator=(HeadlessFarm &&) = delete;
+
+    unsigned GetNumThreads() const;
+
+    // The HeadlessBeeb must remain valid until Run returns.
+    void AddBeeb(HeadlessBeeb *beeb);
+
+    // Run all HeadlessBeebs added so far until they're all finished.
+    HeadlessFarmStats Run(uint64_t slice_num_cycles);
+
+  protected:
+  private:
+    struct Worker {
+        Mutex mutex;
+        std::deque<HeadlessBeeb *> beebs;
+        std::thread thread;
+        size_t index = 0;
+        HeadlessFarmStats stats;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    size_t m_next_worker_index = 0;
+    size_t m_num_beebs = 0;
+    uint64_t m_slice_num_cycles = 0;
+    std::atomic<size_t> m_num_beebs_left{0};
+
+    void ThreadFunc(Worker *worker);
+    HeadlessBeeb *ThreadSteal(Worker *worker);
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,500 @@
+#include <shared/system.h>
+#include <shared/CommandLineParser.h>
+#include <shared/debug.h>
+#include <shared/log.h>
+#include <shared/file_io.h>
+#include <beeb/BBCMicro.h>
+#include <beeb/SaveTrace.h>
+#include <beeb/TraceFile.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include "HeadlessBeeb.h"
+#include "HeadlessFarm.h"
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Runs one BBCMicro as fast as possible, with no UI, no audio device and
+// (unless a screenshot is requested) no video output.
+//
+// Intended for driving b2 from scripts: start it up, maybe load a disc and
+// paste some text in, then run until some condition, and save the output.
+//
+// The state can be saved when done, and then loaded by later runs, so that
+// the same boot process doesn't have to be repeated each time.
+//
+// Given a jobs file, runs many BBCMicros at once, one per line, using a
+// HeadlessFarm.
+//
+// Binary trace files, from --trace or the b2 trace window, can be converted
+// to the usual text format with --convert-trace.
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef ROMS_FOLDER
+#error
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+LOG_DEFINE(OUTPUT, "", &log_printer_stdout_and_debugger, true);
+LOG_DEFINE(INFO, "", &log_printer_stdout_and_debugger, false);
+LOG_DEFINE(WARN, "", &log_printer_stderr_and_debugger, true);
+LOG_DEFINE(ERR, "", &log_printer_stderr_and_debugger, true);
+
+static const LogSet LOGS = {LOG(INFO), LOG(WARN), LOG(ERR)};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Run in slices of this many cycles. Stop conditions other than the number
+// of cycles are checked every cycle, so this only affects how promptly the
+// boot and paste stuff happens.
+static constexpr uint64_t RUN_CYCLES = CYCLES_PER_SECOND / 1000;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct Options {
+    HeadlessSettings settings;
+    std::string num_cycles;
+    std::string num_seconds;
+    std::string stop_address;
+    std::vector<std::string> roms;
+    std::vector<std::string> ram_banks;
+    std::string paste_file;
+    std::string jobs_path;
+    std::string convert_trace_path;
+    int num_threads = 0;
+    bool print_output = false;
+    bool verbose = false;
+    bool help = false;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static bool ParseUInt64(uint64_t *value, const std::string &str) {
+    const char *c = str.c_str();
+    int radix = 0;
+
+    if (*c == '&' || *c == '$') {
+        radix = 16;
+        ++c;
+    }
+
+    char *ep;
+    errno = 0;
+    unsigned long long tmp = strtoull(c, &ep, radix);
+    if (*c == 0 || *ep != 0 || errno != 0) {
+        return false;
+    }
+
+    *value = tmp;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static bool ParseBank(uint8_t *bank, const std::string &str) {
+    uint64_t value;
+    if (str.size() == 1 && isxdigit((unsigned char)str[0])) {
+        // A single char is interpreted as hex, as per *ROMS.
+        value = (uint64_t)strtoul(str.c_str(), nullptr, 16);
+    } else if (!ParseUInt64(&value, str)) {
+        return false;
+    }
+
+    if (value >= 16) {
+        return false;
+    }
+
+    *bank = (uint8_t)value;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// If is_job, argv is one line from the jobs file.
+static bool ParseCommandLineOptions(Options *options, int argc, const char *const argv[], bool is_job) {
+    CommandLineParser p("Run a BBC Micro with no UI");
+
+    p.SetLogs(&LOG(OUTPUT), &LOG(ERR));
+
+    std::string models;
+    for (const std::string &name : GetHeadlessModelNames()) {
+        if (!models.empty()) {
+            models += " ";
+        }
+
+        models += name;
+    }
+
+    p.AddOption("load-state").Arg(&options->settings.load_state_path).Meta("FILE").Help("start from state saved in FILE with --save-state, rather than powering on. Model and ROM options are ignored");
+    p.AddOption('m', "model").Arg(&options->settings.model).Meta("MODEL").Help("model to emulate. One of: " + models).ShowDefault();
+    p.AddOption("roms").Arg(&options->settings.roms_folder).Meta("FOLDER").Help("folder for the model's standard ROMs").ShowDefault();
+    p.AddOption("os").Arg(&options->settings.os_path).Meta("FILE").Help("use FILE as the OS ROM");
+    p.AddOption('r', "rom").AddArgToList(&options->roms).Meta("BANK=FILE").Help("load ROM FILE into sideways bank BANK");
+    p.AddOption("ram").AddArgToList(&options->ram_banks).Meta("BANK").Help("make sideways bank BANK writeable");
+
+    for (int drive = 0; drive < NUM_DRIVES; ++drive) {
+        p.AddOption((char)('0' + drive)).Arg(&options->settings.disc_paths[drive]).Meta("FILE").Help("load in-memory disc image from FILE into drive " + std::to_string(drive));
+    }
+
+    p.AddOption('b', "boot").SetIfPresent(&options->settings.boot).Help("attempt to auto-boot disc");
+    p.AddOption('p', "paste").Arg(&options->settings.paste_text).Meta("TEXT").Help("paste TEXT in once the machine has started");
+    p.AddOption("paste-file").Arg(&options->paste_file).Meta("FILE").Help("paste contents of FILE in once the machine has started");
+
+    p.AddOption('n', "cycles").Arg(&options->num_cycles).Meta("CYCLES").Help("stop after CYCLES emulated cycles (" + std::to_string(CYCLES_PER_SECOND) + "/sec)");
+    p.AddOption('s', "seconds").Arg(&options->num_seconds).Meta("SECONDS").Help("stop after SECONDS emulated seconds");
+    p.AddOption("stop-osword0").SetIfPresent(&options->settings.stop_on_osword0).Help("stop when OSWORD 0 (read line) is called");
+    p.AddOption("stop-address").Arg(&options->stop_address).Meta("ADDR").Help("stop when host CPU is about to execute instruction at ADDR");
+    p.AddOption("stop-text").Arg(&options->settings.stop_oswrch_text).Meta("TEXT").Help("stop once TEXT has been printed via OSWRCH");
+
+    p.AddOption('o', "text").Arg(&options->settings.text_output_path).Meta("FILE").Help("save OSWRCH output to FILE");
+    p.AddOption("print").SetIfPresent(&options->print_output).Help("print OSWRCH output to stdout when done");
+    p.AddOption("screenshot").Arg(&options->settings.screenshot_path).Meta("FILE").Help("save screenshot to FILE (PNG format) when done");
+    p.AddOption("screenshot-frames").Arg(&options->settings.screenshot_num_frames).Meta("N").Help("number of frames to run for before taking screenshot").ShowDefault();
+    p.AddOption("save-state").Arg(&options->settings.save_state_path).Meta("FILE").Help("save state to FILE when done");
+    p.AddOption("profile").Arg(&options->settings.profile_path).Meta("FILE").Help("profile the emulator and save folded stacks (time in microseconds) to FILE when done");
+    p.AddOption("guest-profile").Arg(&options->settings.guest_profile_path).Meta("FILE").Help("profile the emulated 6502 code and save a CSV hot spot report to FILE when done");
+    p.AddOption("trace").Arg(&options->settings.trace_path).Meta("FILE").Help("trace the run, streaming it to FILE in binary format");
+
+    if (!is_job) {
+        p.AddOption('v', "verbose").SetIfPresent(&options->verbose).Help("be extra verbose");
+        p.AddOption("jobs").Arg(&options->jobs_path).Meta("FILE").Help("run multiple jobs in parallel: each line of FILE is the options for one job");
+        p.AddOption("convert-trace").Arg(&options->convert_trace_path).Meta("FILE").Help("print binary trace FILE as text, then exit");
+        p.AddOption('j', "threads").Arg(&options->num_threads).Meta("N").Help("with --jobs, use N worker threads (0 = one per core)").ShowDefault();
+    }
+
+    p.AddHelpOption(&options->help);
+
+    if (!p.Parse(argc, argv)) {
+        return false;
+    }
+
+    if (options->help) {
+        return true;
+    }
+
+    for (const std::string &rom : options->roms) {
+        std::string::size_type eq = rom.find('=');
+        uint8_t bank;
+        if (eq == std::string::npos || !ParseBank(&bank, rom.substr(0, eq))) {
+            LOGF(ERR, "invalid ROM: %s\n", rom.c_str());
+            return false;
+        }
+
+        options->settings.rom_paths[bank] = rom.substr(eq + 1);
+    }
+
+    for (const std::string &ram_bank : options->ram_banks) {
+        uint8_t bank;
+        if (!ParseBank(&bank, ram_bank)) {
+            LOGF(ERR, "invalid bank: %s\n", ram_bank.c_str());
+            return false;
+        }
+
+        options->settings.ram_banks[bank] = true;
+    }
+
+    if (!options->num_cycles.empty()) {
+        if (!ParseUInt64(&options->settings.max_num_cycles, options->num_cycles)) {
+            LOGF(ERR, "invalid number of cycles: %s\n", options->num_cycles.c_str());
+            return false;
+        }
+    }
+
+    if (!options->num_seconds.empty()) {
+        char *ep;
+        double num_seconds = strtod(options->num_seconds.c_str(), &ep);
+        if (*ep != 0 || num_seconds <= 0.) {
+            LOGF(ERR, "invalid number of seconds: %s\n", options->num_seconds.c_str());
+            return false;
+        }
+
+        options->settings.max_num_cycles = (uint64_t)(num_seconds * CYCLES_PER_SECOND);
+    }
+
+    if (!options->stop_address.empty()) {
+        uint64_t address;
+        if (!ParseUInt64(&address, options->stop_address) || address > 0xffff) {
+            LOGF(ERR, "invalid address: %s\n", options->stop_address.c_str());
+            return false;
+        }
+
+        options->settings.stop_address = (int)address;
+    }
+
+    if (!options->paste_file.empty()) {
+        std::vector<uint8_t> data;
+        if (!LoadFile(&data, options->paste_file, &LOGS)) {
+            return false;
+        }
+
+        options->settings.paste_text.append(data.begin(), data.end());
+    }
+
+    if (!options->jobs_path.empty() || !options->convert_trace_path.empty()) {
+        // Each job has its own stop conditions, and converting a trace
+        // doesn't run anything.
+        return true;
+    }
+
+    if (options->settings.max_num_cycles == 0 &&
+        !options->settings.stop_on_osword0 &&
+        options->settings.stop_address < 0 &&
+        options->settings.stop_oswrch_text.empty()) {
+        LOGF(ERR, "must specify at least one stop condition\n");
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Splits a line from the jobs file into arguments. Arguments are separated
+// by whitespace; use double quotes for arguments containing spaces.
+static std::vector<std::string> GetJobArgs(const std::string &line) {
+    std::vector<std::string> args;
+    std::string arg;
+    bool any = false, quoted = false;
+
+    for (char c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+            any = true;
+        } else if (!quoted && isspace((unsigned char)c)) {
+            if (any) {
+                args.push_back(arg);
+                arg.clear();
+                any = false;
+            }
+        } else {
+            arg.push_back(c);
+            any = true;
+        }
+    }
+
+    if (any) {
+        args.push_back(arg);
+    }
+
+    return args;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Returns exit code.
+static int FinishRun(const Options &options, HeadlessBeeb *hb, const char *name) {
+    LOGF(INFO, "%sStop reason: %s\n", name, GetHeadlessStopReasonEnumName(hb->GetStopReason()));
+    LOGF(INFO, "%sCycles: %" PRIu64 "\n", name, hb->GetNumCycles());
+
+    if (options.print_output) {
+        const std::string &output = hb->GetOSWRCHOutput();
+        for (char c : output) {
+            if (c == 13) {
+                // ignore.
+            } else if (c == 10 || (c >= 32 && c < 127)) {
+                LOG(OUTPUT).c(c);
+            }
+        }
+
+        LOG(OUTPUT).EnsureBOL();
+    }
+
+    if (!hb->SaveOutput(LOGS)) {
+        return 1;
+    }
+
+    if (hb->GetStopReason() == HeadlessStopReason_NumCycles &&
+        (options.settings.stop_on_osword0 ||
+         options.settings.stop_address >= 0 ||
+         !options.settings.stop_oswrch_text.empty())) {
+        // Hit the time limit before the actual stop condition.
+        LOGF(ERR, "%stimed out after %" PRIu64 " cycles\n", name, hb->GetNumCycles());
+        return 2;
+    }
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static int RunJobs(const Options &options) {
+    std::vector<uint8_t> data;
+    if (!LoadFile(&data, options.jobs_path, &LOGS)) {
+        return 1;
+    }
+
+    std::vector<Options> jobs_options;
+    std::vector<std::unique_ptr<HeadlessBeeb>> hbs;
+
+    std::string jobs(data.begin(), data.end());
+    std::string::size_type line_begin = 0;
+    size_t line_number = 0;
+    while (line_begin < jobs.size()) {
+        std::string::size_type line_end = jobs.find('\n', line_begin);
+        if (line_end == std::string::npos) {
+            line_end = jobs.size();
+        }
+
+        std::string line = jobs.substr(line_begin, line_end - line_begin);
+        line_begin = line_end + 1;
+        ++line_number;
+
+        std::vector<std::string> args = GetJobArgs(line);
+        if (args.empty() || args[0][0] == '#') {
+            continue;
+        }
+
+        std::vector<const char *> argv;
+        argv.push_back("b2_headless");
+        for (const std::string &arg : args) {
+            argv.push_back(arg.c_str());
+        }
+
+        Options job_options;
+        job_options.settings.roms_folder = options.settings.roms_folder;
+        job_options.print_output = options.print_output;
+
+        if (!ParseCommandLineOptions(&job_options, (int)argv.size(), argv.data(), true) || job_options.help) {
+            LOGF(ERR, "%s:%zu: invalid job\n", options.jobs_path.c_str(), line_number);
+            return 1;
+        }
+
+        std::unique_ptr<HeadlessBeeb> hb = HeadlessBeeb::Create(job_options.settings, LOGS);
+        if (!hb) {
+            LOGF(ERR, "%s:%zu: failed to create job\n", options.jobs_path.c_str(), line_number);
+            return 1;
+        }
+
+        jobs_options.push_back(std::move(job_options));
+        hbs.push_back(std::move(hb));
+    }
+
+    HeadlessFarm farm((unsigned)options.num_threads);
+
+    LOGF(INFO, "Running %zu jobs on %u threads\n", hbs.size(), farm.GetNumThreads());
+
+    for (const std::unique_ptr<HeadlessBeeb> &hb : hbs) {
+        farm.AddBeeb(hb.get());
+    }
+
+    uint64_t start_ticks = GetCurrentTickCount();
+
+    HeadlessFarmStats stats = farm.Run(RUN_CYCLES);
+
+    double num_seconds = GetSecondsFromTicks(GetCurrentTickCount() - start_ticks);
+
+    uint64_t total_num_cycles = 0;
+    int result = 0;
+    for (size_t i = 0; i < hbs.size(); ++i) {
+        std::string name = "Job " + std::to_string(i) + ": ";
+        int job_result = FinishRun(jobs_options[i], hbs[i].get(), name.c_str());
+        if (job_result > result) {
+            result = job_result;
+        }
+
+        total_num_cycles += hbs[i]->GetNumCycles();
+    }
+
+    LOGF(INFO, "Slices: %" PRIu64 " (%" PRIu64 " stolen)\n", stats.num_slices, stats.num_steals);
+    if (num_seconds > 0.) {
+        LOGF(INFO, "Overall speed: %.2fx\n", total_num_cycles / (num_seconds * CYCLES_PER_SECOND));
+    }
+
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_TRACE
+static bool SaveTraceData(const void *data, size_t num_bytes, void *context) {
+    (void)context;
+
+    return fwrite(data, 1, num_bytes, stdout) == num_bytes;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static int ConvertTrace(const Options &options) {
+#if BBCMICRO_TRACE
+    std::shared_ptr<Trace> trace = LoadTraceFile(options.convert_trace_path, LOGS);
+    if (!trace) {
+        return 1;
+    }
+
+    if (!SaveTrace(trace, DEFAULT_TRACE_OUTPUT_FLAGS, &SaveTraceData, nullptr, nullptr, nullptr, nullptr) ||
+        fflush(stdout) != 0) {
+        LOGF(ERR, "failed to write trace\n");
+        return 1;
+    }
+
+    return 0;
+#else
+    (void)options;
+
+    LOGF(ERR, "tracing not supported in this build\n");
+    return 1;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]) {
+    Options options;
+    options.settings.roms_folder = ROMS_FOLDER;
+
+    if (!ParseCommandLineOptions(&options, argc, argv, false)) {
+        return 1;
+    }
+
+    if (options.help) {
+        return 0;
+    }
+
+    if (options.verbose) {
+        LOG(INFO).Enable();
+    }
+
+    if (!options.convert_trace_path.empty()) {
+        return ConvertTrace(options);
+    }
+
+    if (!options.jobs_path.empty()) {
+        return RunJobs(options);
+    }
+
+    std::unique_ptr<HeadlessBeeb> hb = HeadlessBeeb::Create(options.settings, LOGS);
+    if (!hb) {
+        return 1;
+    }
+
+    uint64_t start_ticks = GetCurrentTickCount();
+
+    while (!hb->Run(RUN_CYCLES)) {
+    }
+
+    double num_seconds = GetSecondsFromTicks(GetCurrentTickCount() - start_ticks);
+    if (num_seconds > 0.) {
+        LOGF(INFO, "Speed: %.2fx\n", hb->GetNumCycles() / (num_seconds * CYCLES_PER_SECOND));
+    }
+
+    return FinishRun(options, hb.get(), "");
+}
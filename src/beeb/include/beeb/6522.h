@@ -181,10 +181,20 @@ class R6522 {
     // Get current PCR value, no side-effects.
     PCR GetPCR() const;
 
+    // Get current timer counter values, no side-effects.
+    uint16_t GetT1() const;
+    uint16_t GetT2() const;
+
     // Return non-0 to indicate IRQ.
     uint8_t UpdatePhi2LeadingEdge();
     uint8_t UpdatePhi2TrailingEdge();
 
+    // The timers are normally only updated on cycles where something
+    // happens, and brought up to date when read. If FORCE is set, they're
+    // updated every cycle, which is slower but otherwise indistinguishable.
+    // (This is for testing.)
+    void ForceTimerTicking(bool force);
+
 #if BBCMICRO_TRACE
     void SetTrace(Trace *t, bool extra);
 #endif
@@ -220,6 +230,20 @@ class R6522 {
     /* old value of port B, for use when counting PB6 pulses. */
     uint8_t m_old_pb = 0;
 
+    // Number of trailing edges so far.
+    uint64_t m_tick = 0;
+
+    // The timer state is as of the trailing edge of m_timers_tick. Each
+    // trailing edge between then and m_tick decremented both counters and
+    // did nothing else.
+    uint64_t m_timers_tick = 0;
+
+    // Trailing edge at which the timers next need a proper update: a reload,
+    // a timeout, or the cycle after one.
+    uint64_t m_next_timer_tick = 0;
+
+    bool m_force_timer_ticking = false;
+
 #if BBCMICRO_TRACE
     Trace *m_trace = nullptr;
     bool m_trace_extra = false;
@@ -228,6 +252,9 @@ class R6522 {
     uint8_t m_id = 0;
     const char *m_name = nullptr;
 
+    void UpdateTimers();
+    void ScheduleTimers();
+
     void TickControlPhi2TrailingEdge(Port *port,
                                      uint8_t latching,
                                      uint8_t pcr_bits,
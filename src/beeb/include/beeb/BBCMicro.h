@@ -11,6 +11,8 @@ struct VideoDataUnit;
 struct SoundDataUnit;
 class Trace;
 struct TraceStats;
+class GuestProfile;
+struct GuestProfileReport;
 class TraceEventType;
 class DiscImage;
 class BeebLinkHandler;
@@ -157,6 +159,9 @@ class BBCMicro : private WD1770Handler {
         // big page isn't writeable.
         uint8_t *w = nullptr;
 
+        // points to the big page's dirty flag, to be set after writing via w.
+        uint8_t *dirty = nullptr;
+
 #if BBCMICRO_DEBUGGER
         // if non-NULL, points to BIG_PAGE_SIZE_BYTES values. NULL if this
         // BBCMicro has no associated DebugState.
@@ -216,7 +221,9 @@ class BBCMicro : private WD1770Handler {
     // result is a combination of BBCMicroCloneImpediment.
     uint32_t GetCloneImpediments() const;
 
-    const BBCMicroUniqueState *GetUniqueState() const;
+    // Updates the RAM buffers' big pages first, so that copies of the result
+    // share the modified big pages rather than copying them separately.
+    const BBCMicroUniqueState *GetUniqueState();
 
     //typedef std::array<uint8_t, 16384> ROMData;
 
@@ -238,6 +245,7 @@ class BBCMicro : private WD1770Handler {
     // probably marginal.
     struct MemoryBigPages {
         uint8_t *w[16] = {};
+        uint8_t *dirty[16] = {};
         const uint8_t *r[16] = {};
 #if BBCMICRO_DEBUGGER
         uint8_t *byte_debug_flags[16] = {};
@@ -350,6 +358,9 @@ class BBCMicro : private WD1770Handler {
     void StopTrace(std::shared_ptr<Trace> *old_trace_ptr);
 
     int GetTraceStats(struct TraceStats *stats);
+
+    // The current trace, or nullptr if there isn't one.
+    std::shared_ptr<Trace> GetTrace() const;
 #endif
 
     // Add host CPU instruction/host CPU write callback. It's an error to add
@@ -396,7 +407,8 @@ class BBCMicro : private WD1770Handler {
     void StartPaste(std::shared_ptr<const std::string> text);
     void StopPaste();
 
-    std::shared_ptr<const BBCMicroReadOnlyState> DebugGetState() const;
+    // As GetUniqueState, this updates the RAM buffers' big pages first.
+    std::shared_ptr<const BBCMicroReadOnlyState> DebugGetState();
 
     const M6502 *GetM6502() const;
 
@@ -486,6 +498,35 @@ class BBCMicro : private WD1770Handler {
     uint32_t GetUpdateFlags() const;
 #if BBCMICRO_DEBUGGER
     std::shared_ptr<const UpdateMFnData> GetUpdateMFnData() const;
+
+    // While profiling, the host time spent in Update is periodically
+    // attributed to the current update function variant and the big page the
+    // host CPU is executing from, and each MMIO read/write handler call is
+    // timed separately.
+    //
+    // OptionalLowFrequencyUpdate restarts the clock, so time spent outside
+    // Update isn't counted, provided it's called before each batch of updates.
+    void StartProfile();
+    void StopProfile();
+    bool IsProfiling() const;
+
+    // Profile so far, in folded stack format (as used by flamegraph.pl,
+    // speedscope, etc.): one line per stack, frames separated by ';', then the
+    // time in microseconds.
+    std::string GetProfileFoldedStacks() const;
+
+    // While guest profiling, the time taken by each instruction executed by
+    // the host and parasite CPUs is accumulated by address and big page, so
+    // code in different ROM banks is kept separate.
+    //
+    // Stopping keeps the data collected so far. Starting again discards it.
+    void StartGuestProfile();
+    void StopGuestProfile();
+    bool IsGuestProfiling() const;
+
+    // Report for the guest profile so far, or nullptr if there's never been
+    // one. The disassembly is produced from the current memory contents.
+    std::unique_ptr<GuestProfileReport> CreateGuestProfileReport() const;
 #endif
 
     void AddMouseMotion(int dx, int dy);
@@ -493,6 +534,24 @@ class BBCMicro : private WD1770Handler {
 
     void SetShowCursor(bool show_cursor);
 
+    // In catch-up mode, the video and sound data units aren't written, and
+    // anything that only affects them is skipped, or (for the SN76489)
+    // brought up to date only when necessary. The update result flags are
+    // as normal, so the caller's loop needn't change.
+    //
+    // The emulated BBC Micro behaves identically either way. This is for
+    // running as fast as possible when there's no output to show.
+    //
+    // Only the SN76489 is brought up to date lazily. The CRTC and the VIAs
+    // are still updated every cycle, though the VIAs' timers only do any real
+    // work on cycles where something happens (see R6522::ScheduleTimers).
+    //
+    // The mode can be changed between one Update call and the next. It's a
+    // runtime check rather than an update flag: a flag would double the
+    // number of update functions, and the check always goes the same way.
+    void SetCatchUpMode(bool catch_up_mode);
+    bool GetCatchUpMode() const;
+
   protected:
     // Hacks, not part of the public API, for use by the testing stuff so that
     // it can run even when the debugger isn't compiled in.
@@ -539,6 +598,11 @@ class BBCMicro : private WD1770Handler {
     //////////////////////////////////////////////////////////////////////////
 
     BigPage m_big_pages[NUM_BIG_PAGES];
+
+    // Dirty flag for writes to unmapped big pages. Nothing reads it, but it's
+    // per-BBCMicro so that BBCMicros on different threads don't race.
+    uint8_t m_unmapped_writes_dirty = 0;
+
     UpdateMFn m_update_mfn = nullptr;
     uint32_t m_update_flags = 0;
 
@@ -591,6 +655,7 @@ class BBCMicro : private WD1770Handler {
     uint8_t *m_ram = nullptr;
 
     uint8_t *m_parasite_ram = nullptr;
+    uint8_t *m_parasite_ram_dirty_flags = nullptr;
     ReadMMIOFn m_parasite_read_mmio_fns[8] = {};
     WriteMMIOFn m_parasite_write_mmio_fns[8] = {};
 
@@ -617,6 +682,13 @@ class BBCMicro : private WD1770Handler {
     // This doesn't need to be copied. It can be updated regularly.
     uint8_t m_cursor_mask = 1;
 
+    // See SetCatchUpMode.
+    bool m_catch_up_mode = false;
+
+    // The Video ULA's expanded pixels. This doesn't need to be copied - it's
+    // refilled as required.
+    std::unique_ptr<VideoULA::PixelCache> m_video_ula_pixel_cache;
+
 #if BBCMICRO_TRACE
     // Event trace stuff.
     //
@@ -653,6 +725,17 @@ class BBCMicro : private WD1770Handler {
     std::shared_ptr<UpdateMFnData> m_update_mfn_data_ptr;
     UpdateMFnData *m_update_mfn_data = nullptr;
     CycleCount m_last_mfn_change_cycle_count = {};
+
+    // Sample once every this many cycles (must be 1 less than a power of 2,
+    // and at least 1 less than the sound clock period).
+    static constexpr uint64_t PROFILE_SAMPLE_CYCLE_MASK = 1023;
+
+    struct Profile;
+    struct ProfileMMIO;
+    std::unique_ptr<Profile> m_profile;
+
+    std::unique_ptr<GuestProfile> m_guest_profile;
+    bool m_is_guest_profiling = false;
 #endif
 
     void InitStuff();
@@ -661,6 +744,7 @@ class BBCMicro : private WD1770Handler {
 #endif
     void UpdatePaging();
     void InitPaging();
+    void UpdateRAMBigPages();
     static void Write1770ControlRegister(void *m_, M6502Word a, uint8_t value);
     static uint8_t Read1770ControlRegister(void *m_, M6502Word a);
 #if BBCMICRO_TRACE
@@ -718,6 +802,10 @@ class BBCMicro : private WD1770Handler {
 
 #if BBCMICRO_DEBUGGER
     void UpdateUpdateMFnData();
+    void ProfileSample();
+    void ProfileAddMMIO(const ProfileMMIO *pm, bool write, uint64_t ticks);
+    static uint8_t ProfileReadMMIO(void *context, M6502Word a);
+    static void ProfileWriteMMIO(void *context, M6502Word a, uint8_t value);
 #endif
 
     void UpdateMapperRegion(uint8_t region);
@@ -25,6 +25,7 @@ class Log;
 #include "video.h"
 #include "type.h"
 #include "BBCMicroParasiteType.h"
+#include "PagedRAM.h"
 
 #include <shared/enum_decl.h>
 #include "BBCMicroState.inl"
@@ -199,6 +200,9 @@ class BBCMicroState {
 
     std::shared_ptr<const DiscImage> GetDiscImage(int drive) const;
 
+    // Contents of the RTC or EEPROM, if the model has one.
+    std::vector<uint8_t> GetNVRAM() const;
+
     std::shared_ptr<const BBCMicroType> type;
 
     const uint32_t init_flags = 0;
@@ -317,12 +321,13 @@ class BBCMicroState {
     CycleCount last_vsync_cycle_count = {0};
     CycleCount last_frame_cycle_count = {0};
 
-    std::shared_ptr<std::vector<uint8_t>> ram_buffer;
+    PagedRAM ram_buffer;
 
     std::shared_ptr<const std::array<uint8_t, 16384>> os_buffer;
     std::shared_ptr<const std::vector<uint8_t>> sideways_rom_buffers[16];
-    // Each element is either a copy of the ROMData contents, or null.
-    std::shared_ptr<std::array<uint8_t, 16384>> sideways_ram_buffers[16];
+    // Each element is either 16 KB, or size 0 if there's no sideways RAM in
+    // that bank.
+    PagedRAM sideways_ram_buffers[16];
 
     // Combination of BBCMicroHackFlag.
     uint32_t hack_flags = 0;
@@ -350,7 +355,8 @@ class BBCMicroState {
 
   protected:
     std::shared_ptr<const std::array<uint8_t, 4096>> parasite_rom_buffer;
-    std::shared_ptr<std::vector<uint8_t>> parasite_ram_buffer;
+    // Size 0 if there's no parasite.
+    PagedRAM parasite_ram_buffer;
     bool parasite_boot_mode = true;
     Tube parasite_tube;
 
@@ -363,13 +369,15 @@ class BBCMicroState {
                            CycleCount initial_cycle_count);
 
     friend class BBCMicro;
+    friend class BBCMicroStateFile;
 };
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
 // A unique state has its own copy of all the shared_ptr'd buffers and all the
-// Handler and Trace pointers (etc.) are valid.
+// Handler and Trace pointers (etc.) are valid. (The RAM buffers share their
+// unmodified big pages with the original, but this isn't visible.)
 
 class BBCMicroUniqueState : public BBCMicroState {
   public:
@@ -378,8 +386,20 @@ class BBCMicroUniqueState : public BBCMicroState {
     explicit BBCMicroUniqueState(const BBCMicroUniqueState &src);
     ~BBCMicroUniqueState() = default;
 
+    // Compress this state's RAM relative to keyframe's. See
+    // PagedRAM::Compress. The state can still be used to create a BBCMicro.
+    void CompressRAM(const BBCMicroUniqueState &keyframe);
+
+    // Undo CompressRAM, so that the state no longer refers to the keyframe.
+    void DecompressRAM();
+
+    // Get approximate number of bytes used by this state's RAM that aren't
+    // shared with other's. other may be null.
+    size_t GetNumUnsharedRAMBytes(const BBCMicroUniqueState *other) const;
+
   protected:
   private:
+    friend class BBCMicroStateFile;
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -389,18 +409,14 @@ class BBCMicroUniqueState : public BBCMicroState {
 // possibly itself a read-only one too. Read-only states may share buffers with
 // other states, so the following apply:
 //
-// - the various ROM and RAM shared_ptr'd buffers can refer to the same buffers
-//   as the original state. They may be out of sync relative to the rest of the
-//   hardware state!
+// - the various ROM shared_ptr'd buffers can refer to the same buffers as the
+//   original state
+// - the RAM buffers share their unmodified big pages with the original state
 // - any hardware Handler or Trace pointers (etc.) are not necessarily valid
 //
 // This means that a read-only state is kind of useless! They're there purely
 // for the debugger to use for updating its UI without having to have each
-// window take a lock (or have the debugger copy all of BBC memory).
-//
-// The potential discrepancy between RAM contents and hardware state doesn't
-// matter; when the BBC is running, it's impossible to tell, and when it's
-// stopped, the two are actually in sync.
+// window take a lock.
 //
 // (Any actual modification to the BBCMicro state is done via BeebThread
 // messages.)
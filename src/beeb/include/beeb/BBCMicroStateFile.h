@@ -0,0 +1,92 @@
+#ifndef HEADER_5B0C7A1E92D44E3C8F6A0D2B4E7C9F13 // -*- mode:c++ -*-
+#define HEADER_5B0C7A1E92D44E3C8F6A0D2B4E7C9F13
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+class BBCMicroUniqueState;
+class DiscImage;
+struct LogSet;
+
+#include <shared/enum_decl.h>
+#include "BBCMicroStateFile.inl"
+#include <shared/enum_end.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Details of a disc image referred to by a saved state file. Disc images that
+// haven't been written to aren't included in the file, so they have to be
+// found again when loading. (The contents of discs that have been written to
+// are included, so the changes aren't lost.)
+struct BBCMicroStateFileDiscImage {
+    int drive = -1;
+
+    // Name and load method of the disc image when the state was saved.
+    std::string name;
+    std::string load_method;
+
+    // DiscImage::GetHash of the disc image when the state was saved.
+    std::string hash;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Saves and loads a BBCMicroUniqueState as a binary file.
+//
+// The file is a header, a chunk directory, then the chunk data. The large
+// buffers - RAM and ROMs - are stored on page boundaries, so that loading can
+// map the file into memory rather than reading it. The loaded state's OS and
+// parasite ROMs point straight into the mapping; everything else is copied,
+// as the emulation needs its own copy anyway.
+//
+// Saving writes a new file and renames it over the old one, so it's safe to
+// save a state back over the file it was loaded from.
+//
+// The hardware state is stored as raw images of the structs, so a file can
+// only be loaded by a build with the same version of the format, and the same
+// struct layouts. (Loading checks this.) The results of loading a state file
+// on a different build won't be any more useful than a BBCMicro that's just
+// been reset, so this isn't much of a limitation.
+//
+// States using the Opus Challenger's extra hardware can't be saved, and nor
+// can ExtMem contents. (ExtMem contents aren't preserved by saved states
+// anyway.)
+class BBCMicroStateFile {
+  public:
+    // Find the disc image for a drive whose contents weren't saved. Returns
+    // nullptr, having printed something to logs.e, if it can't be found.
+    typedef std::shared_ptr<DiscImage> (*FindDiscImageFn)(const BBCMicroStateFileDiscImage &disc_image, const LogSet &logs, void *context);
+
+    // Returns false, having printed something to logs.e, if the state
+    // couldn't be saved.
+    static bool Save(const std::string &path, const BBCMicroUniqueState &state, const LogSet &logs);
+
+    // Returns nullptr, having printed something to logs.e, if the state
+    // couldn't be loaded. If find_disc_image_fn is null, FindDiscImageFile
+    // is used.
+    //
+    // The Handler and Trace pointers in the result are all null; they get
+    // sorted out when a BBCMicro is created from it.
+    static std::unique_ptr<BBCMicroUniqueState> Load(const std::string &path,
+                                                     FindDiscImageFn find_disc_image_fn,
+                                                     void *find_disc_image_context,
+                                                     const LogSet &logs);
+
+    // Loads an in-memory disc image from the file it was originally loaded
+    // from, and checks its hash matches.
+    static std::shared_ptr<DiscImage> FindDiscImageFile(const BBCMicroStateFileDiscImage &disc_image, const LogSet &logs, void *context);
+
+  protected:
+  private:
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
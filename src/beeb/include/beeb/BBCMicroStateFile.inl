@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Chunk types in a saved state file. The values are part of the file format,
+// so don't renumber them.
+
+#define ENAME BBCMicroStateFileChunkID
+EBEGIN_DERIVED(uint32_t)
+// Model, disc interface, and so on: what's needed to create the state.
+EPNV(Machine, 1)
+
+// Raw images of the hardware state.
+EPNV(Hardware, 2)
+
+// Host CPU state.
+EPNV(HostCPU, 3)
+
+// Disc drive state, and details of each drive's disc image.
+EPNV(Drives, 4)
+
+// Paste text, if any.
+EPNV(Paste, 5)
+
+// Parasite CPU state.
+EPNV(ParasiteCPU, 6)
+
+// The remaining chunks are large buffers, stored on page boundaries.
+
+EPNV(OSROM, 100)
+
+// Index is the bank.
+EPNV(SidewaysROM, 101)
+
+EPNV(RAM, 102)
+
+// Index is the bank.
+EPNV(SidewaysRAM, 103)
+
+EPNV(ParasiteROM, 104)
+
+EPNV(ParasiteRAM, 105)
+
+// Contents of a disc that's been written to, so the changes aren't lost.
+// Index is the drive.
+EPNV(DiscContents, 106)
+EEND()
+#undef ENAME
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
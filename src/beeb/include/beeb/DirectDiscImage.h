@@ -16,6 +16,7 @@
 
 #include <beeb/DiscImage.h>
 #include "DiscGeometry.h"
+#include <shared/mutex.h>
 #include <stdio.h>
 
 //////////////////////////////////////////////////////////////////////////
@@ -60,10 +61,16 @@ class DirectDiscImage : public DiscImage {
     std::string m_path;
     DiscGeometry m_geometry;
     bool m_write_protected;
+
+    // The emulation thread reads and writes, but the UI can save. m_fp and
+    // m_fp_write are controlled by m_mutex.
+    mutable Mutex m_mutex;
     mutable FILE *m_fp = nullptr;
     mutable bool m_fp_write = false;
 
     DirectDiscImage(std::string path, const DiscGeometry &geometry, bool write_protected);
+
+    // Call with m_mutex locked.
     bool fopenAndSeek(bool write, uint8_t side, uint8_t track, uint8_t sector, size_t offset) const;
     void Close() const;
 };
@@ -9,6 +9,7 @@
 #include <vector>
 
 struct LogSet;
+struct DiscGeometry;
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -89,6 +90,14 @@ class DiscImage : public std::enable_shared_from_this<DiscImage> {
     // method indicates a file.
     virtual bool SaveToFile(const std::string &file_name, const LogSet &logs) const = 0;
 
+    // If the disc has been written to since it was loaded, and the changes
+    // exist only in memory, fill in *data and *geometry with its contents
+    // and return true. Otherwise, return false - the disc can be recreated by
+    // loading it again.
+    //
+    // default impl returns false.
+    virtual bool GetModifiedContents(std::vector<uint8_t> *data, DiscGeometry *geometry) const;
+
     //
     virtual bool Read(uint8_t *value, uint8_t side, uint8_t track, uint8_t sector, size_t offset) const = 0;
     virtual bool Write(uint8_t side, uint8_t track, uint8_t sector, size_t offset, uint8_t value) = 0;
@@ -41,6 +41,8 @@ class ExtMem {
     uint8_t m_address_h = 0;
 
     std::shared_ptr<std::vector<uint8_t>> m_ram_buffer;
+
+    friend class BBCMicroStateFile;
 };
 
 //////////////////////////////////////////////////////////////////////////
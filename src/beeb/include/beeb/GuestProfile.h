@@ -0,0 +1,182 @@
+#ifndef HEADER_2B96E49F9A9C4691B5AC1FE009B1BC64 // -*- mode:c++ -*-
+#define HEADER_2B96E49F9A9C4691B5AC1FE009B1BC64
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include "conf.h"
+#include "type.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct M6502Config;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Which CPU an instruction ran on. The big page index would tell you, but
+// each CPU needs its own notion of the current instruction.
+enum GuestProfileCPU {
+    GuestProfileCPU_Host,
+    GuestProfileCPU_Parasite,
+    GuestProfileCPU_Count,
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Per-byte histogram of time spent executing guest code, for each CPU.
+//
+// The histogram is stored a big page at a time, allocated the first time
+// anything in that big page is executed. Once every big page of interest has
+// been visited, adding an instruction never allocates.
+class GuestProfile {
+  public:
+    struct BigPage {
+        // Total time, in CycleCount units, spent in the instruction whose
+        // opcode is at each offset.
+        uint64_t cycles[BIG_PAGE_SIZE_BYTES] = {};
+
+        // Number of times the instruction at each offset started.
+        uint64_t num_executions[BIG_PAGE_SIZE_BYTES] = {};
+    };
+
+    GuestProfile();
+    ~GuestProfile();
+
+    GuestProfile(const GuestProfile &) = delete;
+    GuestProfile &operator=(const GuestProfile &) = delete;
+    GuestProfile(GuestProfile &&) = delete;
+    GuestProfile &operator=(GuestProfile &&) = delete;
+
+    // Call when the CPU is about to execute the instruction at the given
+    // offset in the given big page. The time since the previous call for the
+    // same CPU is attributed to the previous instruction.
+    void AddInstruction(GuestProfileCPU cpu, BigPageIndex big_page_index, uint16_t offset, CycleCount now) {
+        Current *current = &m_current[cpu];
+
+        if (current->valid) {
+            BigPage *bp = m_big_pages[current->big_page_index.i].get();
+            bp->cycles[current->offset] += now.n - current->start.n;
+        }
+
+        BigPage *bp = m_big_pages[big_page_index.i].get();
+        if (!bp) {
+            bp = this->AllocBigPage(big_page_index);
+        }
+
+        ++bp->num_executions[offset];
+
+        current->valid = true;
+        current->big_page_index = big_page_index;
+        current->offset = offset;
+        current->start = now;
+    }
+
+    // Forget the current instruction for each CPU, so that the time until
+    // the next AddInstruction isn't counted.
+    void Break();
+
+    // nullptr if nothing in this big page has been executed.
+    const BigPage *GetBigPage(BigPageIndex big_page_index) const;
+
+  protected:
+  private:
+    struct Current {
+        bool valid = false;
+        BigPageIndex big_page_index = {};
+        uint16_t offset = 0;
+        CycleCount start = {};
+    };
+
+    std::unique_ptr<BigPage> m_big_pages[NUM_BIG_PAGES];
+    Current m_current[GuestProfileCPU_Count];
+
+    BigPage *AllocBigPage(BigPageIndex big_page_index);
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Summary of a GuestProfile, in a form suitable for display.
+//
+// Cycles are in units of the relevant CPU's clock: 2 MHz for the host, and 4
+// MHz for the parasite. (The 3 MHz external parasite runs at 4 MHz with 1
+// cycle in 4 skipped, and the skipped cycles are included.)
+struct GuestProfileReport {
+    // Big page metadata for the model profiled.
+    std::shared_ptr<const BBCMicroType> type;
+
+    struct Instruction {
+        GuestProfileCPU cpu = GuestProfileCPU_Host;
+        BigPageIndex big_page_index = {};
+        uint16_t addr = 0;
+        uint64_t cycles = 0;
+        uint64_t num_executions = 0;
+
+        // Relative to the total for this instruction's CPU.
+        double fraction = 0.;
+
+        // Disassembly of whatever is in memory at the time the report is
+        // produced, which may not be what was executed.
+        std::string disassembly;
+
+        // Index into loops of the innermost loop containing this
+        // instruction, or SIZE_MAX if none.
+        size_t loop_index = SIZE_MAX;
+    };
+
+    // A loop is the range of code between a backwards branch or jump and its
+    // destination, inclusive, within one big page.
+    struct Loop {
+        GuestProfileCPU cpu = GuestProfileCPU_Host;
+        BigPageIndex big_page_index = {};
+        uint16_t begin_addr = 0;
+
+        // Address of the branch or jump instruction.
+        uint16_t end_addr = 0;
+
+        // Total cycles of all instructions in the loop, including any inner
+        // loops.
+        uint64_t cycles = 0;
+
+        double fraction = 0.;
+
+        // Number of times the branch or jump was executed, taken or not.
+        uint64_t num_branch_executions = 0;
+
+        // Range of indexes into instructions.
+        size_t begin_index = 0;
+        size_t end_index = 0;
+    };
+
+    uint64_t total_cycles[GuestProfileCPU_Count] = {};
+
+    // Every instruction executed, in big page then address order.
+    std::vector<Instruction> instructions;
+
+    // Indexes into instructions, most cycles first.
+    std::vector<size_t> hot_instructions;
+
+    // Most cycles first.
+    std::vector<Loop> loops;
+};
+
+// get_big_page_data returns the contents of the given big page, or nullptr if
+// it's unavailable.
+//
+// parasite_m6502_config may be null if there's no parasite.
+std::unique_ptr<GuestProfileReport> CreateGuestProfileReport(const GuestProfile &profile,
+                                                             std::shared_ptr<const BBCMicroType> type,
+                                                             const M6502Config *parasite_m6502_config,
+                                                             const std::function<const uint8_t *(BigPageIndex)> &get_big_page_data);
+
+// One row per instruction, hottest first, with a header row.
+std::string GetGuestProfileReportCSV(const GuestProfileReport &report);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -21,6 +21,11 @@ class MemoryDiscImage : public DiscImage {
 
     static std::shared_ptr<MemoryDiscImage> LoadFromBuffer(std::string path, std::string load_method, const void *data, size_t data_size, const DiscGeometry &geometry, const LogSet &logs);
 
+    // As LoadFromBuffer, but the data is the modified contents of a disc
+    // previously loaded from path, as returned by GetModifiedContents. The
+    // result counts as modified too.
+    static std::shared_ptr<MemoryDiscImage> LoadModifiedFromBuffer(std::string path, std::string load_method, const void *data, size_t data_size, const DiscGeometry &geometry, const LogSet &logs);
+
     // If the load succeeds, the method will be LOAD_METHOD_FILE or
     // LOAD_METHOD_ZIP.
     //static std::shared_ptr<MemoryDiscImage> LoadFromFile(std::string path, const LogSet &logs);
@@ -45,6 +50,7 @@ class MemoryDiscImage : public DiscImage {
     std::string GetDescription() const override;
     std::vector<FileDialogFilter> GetFileDialogFilters() const override;
     bool SaveToFile(const std::string &file_name, const LogSet &logs) const override;
+    bool GetModifiedContents(std::vector<uint8_t> *data, DiscGeometry *geometry) const override;
     //void SetNameAndLoadMethod(std::string name,std::string load_method);
 
     bool Read(uint8_t *value, uint8_t side, uint8_t track, uint8_t sector, size_t offset) const override;
@@ -0,0 +1,128 @@
+#ifndef HEADER_19122ED1980144F2B648C7DF53F450F4 // -*- mode:c++ -*-
+#define HEADER_19122ED1980144F2B648C7DF53F450F4
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include "conf.h"
+#include "type.h"
+#include <memory>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// RAM buffer that can be copied cheaply, so that saved states are cheap to
+// make.
+//
+// The contents are held as a list of read-only big pages, shared between all
+// copies. A big page is only copied when it's been modified since the last
+// copy was made, so copies share all the unmodified pages.
+//
+// For the emulation's benefit, the contents can also be accessed as a single
+// contiguous buffer, which is created on demand. Anything that writes to the
+// contiguous buffer must set the corresponding big page's dirty flag.
+//
+// Copying a PagedRAM doesn't modify the original. Any big pages modified since
+// the original's last UpdateBigPages are copied from its contiguous buffer, and
+// not shared with anything else; call UpdateBigPages first so that the copy
+// and any later ones share them instead.
+//
+// Big pages can also be compressed, by storing them as a delta against the
+// corresponding big page of some other PagedRAM, and decompressed again.
+class PagedRAM {
+  public:
+    // Zero-filled RAM. size must be a multiple of BIG_PAGE_SIZE_BYTES.
+    explicit PagedRAM(size_t size = 0);
+
+    PagedRAM(const PagedRAM &src);
+    PagedRAM &operator=(const PagedRAM &src);
+
+    PagedRAM(PagedRAM &&) = default;
+    PagedRAM &operator=(PagedRAM &&) = default;
+
+    ~PagedRAM() = default;
+
+    size_t GetSize() const;
+    size_t GetNumBigPages() const;
+
+    // Get contiguous buffer, creating it if necessary. The result is valid
+    // until the PagedRAM is destroyed or assigned to. Returns nullptr if the
+    // size is 0.
+    uint8_t *GetData();
+
+    // Get the dirty flags for the contiguous buffer, one byte per big page.
+    // Set a big page's flag to non-zero after modifying it.
+    //
+    // Only valid once GetData has been called.
+    uint8_t *GetDirtyFlags();
+
+    // Get pointer to a big page's contents, without creating the contiguous
+    // buffer. If there is a contiguous buffer, the result points into that.
+    //
+    // Not valid for compressed big pages when there's no contiguous buffer.
+    const uint8_t *GetBigPage(size_t big_page_index) const;
+
+    // Copy the contents to dest, which must have room for GetSize() bytes.
+    // Works for compressed big pages, and doesn't create the contiguous
+    // buffer.
+    void GetContents(uint8_t *dest) const;
+
+    // Store any big pages that differ from keyframe's as deltas against
+    // keyframe's, where that saves memory. The contents are unchanged.
+    //
+    // There mustn't be a contiguous buffer. Does nothing if the sizes differ.
+    void Compress(const PagedRAM &keyframe);
+
+    // Store any big pages stored as deltas in full again. The contents are
+    // unchanged.
+    //
+    // There mustn't be a contiguous buffer.
+    void Decompress();
+
+    // Get approximate number of bytes used by the big pages that aren't shared
+    // with other's. other may be null.
+    size_t GetNumUnsharedBytes(const PagedRAM *other) const;
+
+    // Bring the list of big pages up to date with the contiguous buffer, if
+    // there is one, copying the big pages whose dirty flags are set.
+    void UpdateBigPages();
+
+  protected:
+  private:
+    struct BigPage {
+        // Contents, if stored in full. Empty if stored as a delta.
+        std::vector<uint8_t> bytes;
+
+        // If stored as a delta: the big page it's against, and the run-length
+        // encoded XOR of the two.
+        std::shared_ptr<const BigPage> base;
+        std::vector<uint8_t> delta;
+
+        // Result of the last attempt to compress this big page, so that
+        // PagedRAMs sharing it can share the compressed version too.
+        // compressed is null if compressing against compressed_base didn't
+        // help.
+        //
+        // Big pages are shared between threads, so these are only accessed
+        // with the compressed mutex held.
+        mutable std::weak_ptr<const BigPage> compressed_base;
+        mutable std::shared_ptr<const BigPage> compressed;
+    };
+
+    size_t m_size = 0;
+    std::vector<uint8_t> m_data;
+
+    std::vector<std::shared_ptr<const BigPage>> m_big_pages;
+    std::vector<uint8_t> m_dirty_flags;
+
+    static std::shared_ptr<const BigPage> CreateBigPage(const uint8_t *bytes);
+    static std::shared_ptr<const BigPage> GetZeroBigPage();
+    static void GetBigPageContents(uint8_t *dest, const BigPage *big_page);
+    static std::shared_ptr<const BigPage> CompressBigPage(const std::shared_ptr<const BigPage> &base, const BigPage *big_page);
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
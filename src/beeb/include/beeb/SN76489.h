@@ -52,6 +52,14 @@ class SN76489 {
 
     Output Update(bool write, uint8_t value);
 
+    // Equivalent to a call to Update(false,...), with the output discarded.
+    // The skipped updates are caught up on the next call to Update or
+    // CatchUp, at a cost proportional to the number of output transitions
+    // rather than the number of updates.
+    void Skip();
+
+    void CatchUp();
+
 #if BBCMICRO_TRACE
     void SetTrace(Trace *t);
 #endif
@@ -79,12 +87,15 @@ class SN76489 {
     };
 
     State m_state;
+    uint64_t m_num_skipped_updates = 0;
 #if BBCMICRO_TRACE
     Trace *m_trace;
 #endif
 
     uint8_t NextWhiteNoiseBit();
     uint8_t NextPeriodicNoiseBit();
+    void UpdateNoiseMask();
+    uint16_t GetNoisePeriod() const;
 
     // Inconsistent layout - but this needs a bunch of other stuff from above...
   public:
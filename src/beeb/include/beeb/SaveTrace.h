@@ -35,13 +35,17 @@ struct SaveTraceProgress {
 typedef bool (*SaveTraceWasCanceledFn)(void *context);
 typedef bool (*SaveTraceSaveDataFn)(const void *data, size_t num_bytes, void *context);
 
+// The text is produced on num_threads worker threads (0 = one per hardware
+// thread), so was_canceled_fn may be called from any of them. save_data_fn
+// is only ever called from the calling thread, with the text in order.
 bool SaveTrace(std::shared_ptr<Trace> trace,
                uint32_t output_flags, //combination of TraceOutputFlags
                SaveTraceSaveDataFn save_data_fn,
                void *save_data_context,
                SaveTraceWasCanceledFn was_canceled_fn,
                void *was_canceled_context,
-               SaveTraceProgress *progress);
+               SaveTraceProgress *progress,
+               unsigned num_threads = 0);
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -19,6 +19,7 @@
 //////////////////////////////////////////////////////////////////////////
 
 struct VideoDataUnit;
+union VideoDataUnitPixels;
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -56,6 +57,32 @@ class TVOutput {
     // returns number of us consumed.
     void Update(const VideoDataUnit *units, size_t num_units);
 
+    // Alternative to Update that lets the drawing be spread over multiple
+    // threads.
+    //
+    // PrepareScanlines runs the TV over the units, as Update would, but only
+    // records the scanlines that need drawing in *scanlines. It stops after
+    // the unit that starts vertical retrace, if any, so no two scanlines
+    // refer to the same texture rows, and sets *vertical_retrace to indicate
+    // whether that happened. Returns the number of units consumed.
+    //
+    // Then call DrawScanlines on every scanline, in any order, possibly
+    // from multiple threads at once. Each call has some setup overhead, so
+    // pass decent-sized batches. Every scanline must be drawn, and the units
+    // must remain valid, until that's done - and it must be done before the
+    // next Update or PrepareScanlines call, and before the texture is used.
+    //
+    // The result is exactly as if the consumed units had been passed to
+    // Update.
+    struct Scanline {
+        const VideoDataUnit *units;
+        size_t num_units;
+        size_t x;
+        size_t y;
+    };
+    size_t PrepareScanlines(const VideoDataUnit *units, size_t num_units, std::vector<Scanline> *scanlines, bool *vertical_retrace);
+    void DrawScanlines(const Scanline *scanlines, size_t num_scanlines);
+
 #if BBCMICRO_DEBUGGER
     void FillWithTestPattern();
 #endif
@@ -64,7 +91,8 @@ class TVOutput {
     // each vblank. (Between vblanks, the buffer contains a partially scanned-out frame,
     // with no guarantees of anything.)
     //
-    // The pointer is not const. Any modifications will just eventually get overwritten.
+    // The pointer is not const, but don't modify the data. Units that are the
+    // same as last time aren't redrawn, so any modifications could stick.
     uint32_t *GetTexturePixels(uint64_t *texture_data_version) const;
 
     // There's no versioning for this - you just get whatever was there last time.
@@ -72,10 +100,28 @@ class TVOutput {
     // still in use if the Update call is being made on another thread.
     //
     // The pointer is not const. Any modifications will just eventually get overwritten.
+    //
+    // If the last vsync texture isn't being kept, this is the same as
+    // GetTexturePixels.
     uint32_t *GetLastVSyncTexturePixels(UniqueLock<Mutex> *lock) const;
 
+    // Copying the texture at each vsync costs a full frame's worth of memory
+    // bandwidth, so it's off by default. Don't call while Update is being
+    // called on another thread.
+    bool GetKeepLastVSyncTexturePixels() const;
+    void SetKeepLastVSyncTexturePixels(bool keep);
+
     void CopyTexturePixels(void *dest_pixels, size_t dest_pitch) const;
 
+    // If false, CopyTexturePixels would produce an exact copy of the
+    // GetTexturePixels data, so the caller can use that data directly.
+    bool HasMarkers() const;
+
+    // One entry per texture row, TV_TEXTURE_HEIGHT in all. Non-zero if the
+    // row's contents have changed since the last ResetDirtyLines call.
+    const uint8_t *GetDirtyLines() const;
+    void ResetDirtyLines();
+
 #if VIDEO_TRACK_METADATA
     const VideoDataUnit *GetTextureUnits() const;
 #endif
@@ -97,21 +143,24 @@ class TVOutput {
   protected:
   private:
     TVOutputState m_state = TVOutputState_VerticalRetrace;
-    uint32_t *m_pixels_line = nullptr;
-#if VIDEO_TRACK_METADATA
-    VideoDataUnit *m_units_line = nullptr;
-#endif
     size_t m_x = 0;
     size_t m_y = 0;
     int m_state_timer = 0;
     size_t m_num_fields = 0;
     bool m_interlace = false; //it's horrid. It's there, but you don't want it
+    bool m_keep_last_vsync_texture_pixels = false;
 #if BBCMICRO_DEBUGGER
     bool m_texture_dirty = false;
 #endif
 
     // TV - output texture and its properties
     mutable std::vector<uint32_t> m_texture_pixels;
+
+    // For each texture row, the pixels of the unit last drawn in each 8-texel
+    // column - arranged as for the top row of a pair, so a unit drawn the same
+    // way as last time can be skipped.
+    std::vector<VideoDataUnitPixels> m_row_units;
+    std::vector<uint8_t> m_dirty_lines;
 #if VIDEO_TRACK_METADATA
     std::vector<VideoDataUnit> m_texture_units;
 #endif
@@ -131,6 +180,17 @@ class TVOutput {
     // 2/3 j<<4|j.
     uint8_t m_blend[16][16] = {};
 
+    // Teletext output pixels for recently used background/foreground pairs:
+    // pixels[i] is the 8 texels for 6-bit scanline data i. Entries are
+    // expanded as they're first needed - valid_mask bit i indicates whether
+    // pixels[i] has been filled in.
+    struct TeletextColours {
+        uint32_t bg_fg = ~(uint32_t)0;
+        uint64_t valid_mask = 0;
+        uint32_t pixels[64][8];
+    };
+    std::vector<TeletextColours> m_teletext_colours;
+
     uint32_t m_usec_marker_xor = 0;
     uint32_t m_half_usec_marker_xor = 0;
     uint32_t m_6845_raster0_marker_xor = 0;
@@ -139,6 +199,12 @@ class TVOutput {
 
     uint32_t GetTexelValue(uint8_t r, uint8_t g, uint8_t b) const;
     void InitPalette();
+    void InvalidateRowUnits();
+    const uint32_t *GetTeletextPixels(std::vector<TeletextColours> *teletext_colours, const VideoDataUnitPixels &pixels, uint16_t data) const;
+    void ExpandTeletextPixels(uint32_t *dest, const VideoDataUnitPixels &pixels, uint8_t data) const;
+    void DrawUnits(std::vector<TeletextColours> *teletext_colours, size_t x, size_t y, const VideoDataUnit *units, size_t num_units);
+    size_t Scan(const VideoDataUnit *units, size_t num_units, std::vector<Scanline> *scanlines);
+    bool UpdateRowUnits(size_t x, size_t y, const VideoDataUnitPixels &pixels0, const VideoDataUnitPixels &pixels1);
 #if VIDEO_TRACK_METADATA
     void AddMetadataMarkers(void *dest_pixels, size_t dest_pitch_bytes, bool add, uint8_t metadata_flag, uint32_t xor_value) const;
 #endif
@@ -46,6 +46,8 @@
 #include "BBCMicroParasiteType.h"
 
 struct M6502Config;
+struct LogSet;
+class MappedFile;
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -67,6 +69,10 @@ class TraceEventType {
 
     const std::string &GetName() const;
 
+    // nullptr if there's no such type.
+    static const TraceEventType *GetByID(uint8_t type_id);
+    static const TraceEventType *FindByName(const std::string &name);
+
   protected:
   private:
     std::string m_name;
@@ -80,6 +86,10 @@ struct TraceStats {
     size_t num_used_bytes = 0;
     size_t num_allocated_bytes = 0;
     CycleCount max_time = {0};
+
+    // Events and bytes used include anything spilled to disk. Bytes
+    // allocated is memory only.
+    uint64_t num_spilled_bytes = 0;
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -139,6 +149,27 @@ class Trace : public std::enable_shared_from_this<Trace> {
     static const TraceEventType PARASITE_BOOT_MODE_EVENT;
     static const TraceEventType SET_MAPPER_REGION_EVENT;
 
+    // A chunk's worth of raw event data, as stored in memory: a 2-byte header
+    // per event, with the time as a delta from the previous event's, then the
+    // event's data. The type IDs are only meaningful in this build.
+    struct ChunkData {
+        const void *data = nullptr;
+        size_t size = 0;
+        size_t num_events = 0;
+
+        CycleCount initial_time = {};
+        CycleCount last_time = {};
+
+        PagingState initial_paging;
+        bool initial_parasite_boot_mode = false;
+
+        // If the chunk was spilled to disk, the file it's in. Holding on to
+        // this keeps data valid after the ForEachChunk callback returns.
+        std::shared_ptr<const MappedFile> spill_file;
+    };
+
+    typedef void (*ChunkFn)(const ChunkData *chunk, void *context);
+
     // max_num_bytes is approximate - actual consumption may be greater.
     // Supply SIZE_MAX to just have the data grow indefinitely.
     explicit Trace(size_t max_num_bytes,
@@ -219,9 +250,61 @@ class Trace : public std::enable_shared_from_this<Trace> {
     // false if iteration was canceled.
     int ForEachEvent(ForEachEventFn fn, void *context);
 
+    // The chunk fn is called with each chunk once it's finished with, in
+    // order, so the trace can be written out as it's recorded. Any existing
+    // chunks are passed to it as they're finished with too.
+    //
+    // A chunk is finished with once the chunk after it is full, as the
+    // current instruction events can still be updated after a new chunk is
+    // started. When the trace has a size limit, chunks are always passed to
+    // the chunk fn before being discarded.
+    void SetChunkFn(ChunkFn fn, void *context);
+
+    // Pass any remaining chunks to the chunk fn. Call once the trace is
+    // stopped. Any further events will go in a new chunk.
+    void FlushChunks();
+
+    typedef bool (*ForEachChunkFn)(const ChunkData *chunk, void *context);
+
+    // return true to continue iteration, false to stop it. returns false if
+    // iteration was canceled.
+    bool ForEachChunk(ForEachChunkFn fn, void *context) const;
+
+    // Call fn for each event in part of a chunk's data, from begin to end.
+    // Each must be the start or end of the chunk data, or the end of an
+    // event's data (e->event + e->size).
+    //
+    // *time is the time of the event before begin. Start with the first
+    // chunk's initial time, and carry it over from one call to the next, so
+    // the events can be processed in whatever size pieces are convenient.
+    //
+    // Returns false if iteration was canceled.
+    bool ForEachEventInRange(const void *begin,
+                             const void *end,
+                             CycleCount *time,
+                             ForEachEventFn fn,
+                             void *context);
+
+    // Add a chunk, as produced by ForEachChunk or the chunk fn, possibly
+    // from another build. types maps the chunk's type IDs to this build's
+    // types. Returns false if the chunk data isn't valid.
+    bool AddChunk(const ChunkData &chunk, const TraceEventType *const types[256]);
+
+    // Rather than discarding the oldest chunks once the size limit is
+    // reached, hand them to a background thread that appends them to the
+    // given file. Memory use stays bounded, and the trace can grow until the
+    // disk is full. ForEachEvent and ForEachChunk cover the spilled chunks
+    // too.
+    //
+    // The file is temporary, and is deleted when the Trace is destroyed.
+    // Returns false, having printed something to logs.e, if it couldn't be
+    // created.
+    bool SetSpillFile(const std::string &path, const LogSet &logs);
+
   protected:
   private:
     struct Chunk;
+    struct SpillState;
 
     class LogPrinterTrace : public LogPrinter {
       public:
@@ -235,6 +318,10 @@ class Trace : public std::enable_shared_from_this<Trace> {
     };
 
     Chunk *m_head = nullptr, *m_tail = nullptr;
+    bool m_tail_flushed = false;
+    ChunkFn m_chunk_fn = nullptr;
+    void *m_chunk_fn_context = nullptr;
+    std::unique_ptr<SpillState> m_spill;
     TraceStats m_stats;
     uint8_t *m_last_alloc = nullptr;
     CycleCount m_last_time = {0};
@@ -259,6 +346,17 @@ class Trace : public std::enable_shared_from_this<Trace> {
     char *AllocString2(TraceEventSource source, const char *str, size_t len);
 
     void *Alloc(CycleCount time, size_t n);
+    void CallChunkFn(const Chunk *end);
+    static void GetChunkData(ChunkData *data, const Chunk *c);
+    void SpillChunk(Chunk *c);
+    std::shared_ptr<const MappedFile> GetSpilledChunks() const;
+    void SpillThreadFunc();
+
+    // Calls fn(const Chunk *, const std::shared_ptr<const MappedFile> &) for
+    // each chunk, spilled or not, in order. The file is null for chunks in
+    // memory.
+    template <class ChunkFnType>
+    bool ForEachChunkInternal(ChunkFnType &&fn) const;
     void Check();
     static void PrintToTraceLog(const char *str, size_t str_len, void *data);
 };
@@ -0,0 +1,95 @@
+#ifndef HEADER_8A85AF9676A247DABAB603C1FDF2DDFB // -*- mode:c++ -*-
+#define HEADER_8A85AF9676A247DABAB603C1FDF2DDFB
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include "conf.h"
+
+#if BBCMICRO_TRACE
+
+#include "Trace.h"
+#include <stdio.h>
+#include <memory>
+#include <string>
+
+struct LogSet;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Binary trace files.
+//
+// A trace file is a header, describing the machine and the event types,
+// followed by the Trace's chunks. Each chunk's data is written exactly as it
+// is in memory: 2 bytes of header per event, including a delta-encoded time,
+// followed by the raw event data. So writing a trace file involves no
+// formatting at all, and the file can be written while the trace is still
+// being recorded, a chunk at a time. SaveTrace can produce the usual text
+// output from a loaded trace file afterwards.
+//
+// As with saved states, the event data is stored as raw images of the
+// structs, so a file can only be loaded by a build with the same version of
+// the format, and the same struct layouts. Event type IDs are assigned at
+// startup, and could differ from build to build, so the types are stored by
+// name and remapped when loading.
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+class TraceFileWriter {
+  public:
+    explicit TraceFileWriter(const LogSet &logs);
+    ~TraceFileWriter();
+
+    TraceFileWriter(const TraceFileWriter &) = delete;
+    TraceFileWriter &operator=(const TraceFileWriter &) = delete;
+    TraceFileWriter(TraceFileWriter &&) = delete;
+    TraceFileWriter &operator=(TraceFileWriter &&) = delete;
+
+    // Create the file and write the header, using the details of the given
+    // trace. Returns false, having printed something to logs.e, if anything
+    // went wrong.
+    bool Open(const std::string &path, const Trace &trace);
+
+    // Errors are sticky: once one write fails, the rest are ignored, and
+    // Close will return false.
+    void WriteChunk(const Trace::ChunkData &chunk);
+
+    // Returns false, having printed something to logs.e, if anything went
+    // wrong at any point.
+    bool Close();
+
+    uint64_t GetNumBytesWritten() const;
+
+    // Suitable for use with Trace::SetChunkFn. The context is the
+    // TraceFileWriter.
+    static void ChunkFn(const Trace::ChunkData *chunk, void *context);
+
+  protected:
+  private:
+    const LogSet &m_logs;
+    std::string m_path;
+    FILE *m_f = nullptr;
+    uint64_t m_num_bytes_written = 0;
+    bool m_good = false;
+
+    void Write(const void *data, size_t num_bytes);
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Save a complete trace. Returns false, having printed something to logs.e,
+// if the file couldn't be saved.
+bool SaveTraceFile(const std::string &path, const Trace &trace, const LogSet &logs);
+
+// Returns nullptr, having printed something to logs.e, if the file couldn't
+// be loaded.
+std::shared_ptr<Trace> LoadTraceFile(const std::string &path, const LogSet &logs);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
+#endif
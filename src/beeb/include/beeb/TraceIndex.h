@@ -0,0 +1,152 @@
+#ifndef HEADER_9451573C85474DB3B215509CB972AFE0 // -*- mode:c++ -*-
+#define HEADER_9451573C85474DB3B215509CB972AFE0
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include "conf.h"
+
+#if BBCMICRO_TRACE
+
+#include "Trace.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+struct M6502Config;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Indexes over a finished trace, for answering questions like "every write to
+// &FE40 between cycle X and Y" or "all executions of &FFE3" without scanning
+// the whole thing.
+//
+// The trace's events are divided into blocks of a few thousand, and for each
+// PC executed, each address written and each event type, the index records
+// which blocks contain at least one such event. A query only rescans the
+// candidate blocks that overlap its cycle range.
+//
+// The index refers to the trace's event data directly, so nothing must be
+// added to the trace once it's been indexed.
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+enum TraceQueryType {
+    // Instructions executed at a given address.
+    TraceQueryType_Execute,
+
+    // Instructions that write to a given address: stores and
+    // read-modify-write instructions. Stack writes aren't included.
+    TraceQueryType_Write,
+
+    // Events of a given type.
+    TraceQueryType_EventType,
+};
+
+struct TraceQuery {
+    TraceQueryType type = TraceQueryType_Execute;
+
+    // CPU of interest, for Execute and Write queries.
+    TraceEventSource source = TraceEventSource_Host;
+
+    // Instruction address for Execute queries, effective address for Write
+    // queries.
+    uint16_t addr = 0;
+
+    // Type of interest, for EventType queries.
+    const TraceEventType *event_type = nullptr;
+
+    // Only events with begin<=time<end match.
+    CycleCount begin = {0};
+    CycleCount end = {UINT64_MAX};
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+class TraceIndex {
+  public:
+    // Building the index involves one pass over the whole trace.
+    explicit TraceIndex(std::shared_ptr<Trace> trace);
+    ~TraceIndex();
+
+    TraceIndex(const TraceIndex &) = delete;
+    TraceIndex &operator=(const TraceIndex &) = delete;
+    TraceIndex(TraceIndex &&) = delete;
+    TraceIndex &operator=(TraceIndex &&) = delete;
+
+    const std::shared_ptr<Trace> &GetTrace() const;
+
+    // Call fn for each matching event, in trace order. fn returns true to
+    // continue iteration, false to stop it. Returns false if iteration was
+    // canceled.
+    //
+    // Safe to call from multiple threads at once.
+    bool ForEachMatch(const TraceQuery &query, Trace::ForEachEventFn fn, void *context) const;
+
+    // If e is an instruction event for an instruction that writes to memory,
+    // get the address written to, and return true. Otherwise, return false.
+    bool GetInstructionWriteAddress(uint16_t *addr, const TraceEvent *e) const;
+
+    // Convert a time in 2 MHz cycles since the first event, as per the
+    // default trace output, to an absolute time suitable for a TraceQuery.
+    CycleCount GetTimeFrom2MHzCycles(uint64_t num_2MHz_cycles) const;
+
+    // One-line summary of an event, without a trailing newline, for listing
+    // query results. The time is in 2 MHz cycles since the first event.
+    std::string GetEventDescription(const TraceEvent *e) const;
+
+    // Get descriptions of the first max_num_results matches, as per
+    // GetEventDescription, and return the total number of matches.
+    size_t GetMatchDescriptions(std::vector<std::string> *descriptions,
+                                const TraceQuery &query,
+                                size_t max_num_results) const;
+
+  protected:
+  private:
+    struct Block {
+        const void *begin = nullptr;
+        const void *end = nullptr;
+
+        // Time of the event before begin.
+        CycleCount time = {0};
+
+        // Range of times of the events in the block.
+        CycleCount min_time = {UINT64_MAX};
+        CycleCount max_time = {0};
+    };
+
+    // Block numbers, ascending.
+    typedef std::vector<uint32_t> BlockList;
+
+    struct Builder;
+
+    std::shared_ptr<Trace> m_trace;
+    const M6502Config *m_m6502_configs[TraceEventSource_Count] = {};
+    std::vector<Block> m_blocks;
+    CycleCount m_first_event_time = {0};
+
+    // Spilled chunks referred to by the blocks.
+    std::vector<std::shared_ptr<const MappedFile>> m_spill_files;
+
+    // If time never goes backwards, the candidate blocks can be found by
+    // binary search.
+    bool m_monotonic = true;
+
+    // Indexed by source*65536+addr.
+    std::vector<BlockList> m_execute_blocks;
+    std::vector<BlockList> m_write_blocks;
+
+    // Indexed by type ID.
+    BlockList m_event_type_blocks[256];
+
+    const BlockList *GetBlockList(const TraceQuery &query) const;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
+#endif
@@ -0,0 +1,105 @@
+#ifndef HEADER_2E0F7A3C91D44B6C8A5D1F09B3E67C42 // -*- mode:c++ -*-
+#define HEADER_2E0F7A3C91D44B6C8A5D1F09B3E67C42
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include "conf.h"
+
+#if BBCMICRO_TRACE
+
+#include <string>
+#include <vector>
+
+class BBCMicro;
+class Log;
+struct M6502;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// A condition for starting or stopping a trace, checked from the BBCMicro's
+// host instruction or write callbacks.
+//
+// The expression is one or more terms separated by "&&", all of which must be
+// true. Each term is NAME OP VALUE, OP being one of = == != < <= > >=. Values
+// are hex, optionally prefixed with & or $, and = and != also take a range,
+// LO-HI.
+//
+// pc, a, x, y, s, p, opcode - registers. In a write trigger, pc is the
+// address of the instruction doing the write
+//
+// [ADDR] - byte at ADDR in main RAM. ADDR must be less than &8000
+//
+// write - address being written. Makes this a write trigger
+//
+// value - value being written. Makes this a write trigger
+//
+// count=N - fire on the Nth match rather than the first. N is decimal
+//
+// For example, "pc=ffe3 && a=0d && count=10" fires at the 10th OSASCI call
+// with a carriage return, and "write=fe40-fe4f && value>=80" fires at the
+// first write of a value with the top bit set to the system VIA.
+//
+// The expression is compiled to a list of tests, each with its own
+// specialized function, so checking involves no parsing and no dispatching
+// on the type of test.
+
+class TraceTrigger {
+  public:
+    TraceTrigger();
+    ~TraceTrigger();
+
+    TraceTrigger(const TraceTrigger &) = default;
+    TraceTrigger &operator=(const TraceTrigger &) = default;
+    TraceTrigger(TraceTrigger &&) = default;
+    TraceTrigger &operator=(TraceTrigger &&) = default;
+
+    // Returns true if OK. Returns false if not (*this unmodified), and prints
+    // error messages on *log if not NULL.
+    bool Compile(const std::string &expr, Log *log);
+
+    // An empty trigger never fires.
+    bool IsEmpty() const;
+
+    // If true, call Check from a host write callback; otherwise, from a host
+    // instruction callback.
+    bool IsWriteTrigger() const;
+
+    // Returns true if the trigger fires.
+    bool Check(const BBCMicro *m, const M6502 *cpu);
+
+    // Forget any matches counted so far.
+    void ResetCount();
+
+  protected:
+  private:
+    struct Test;
+    typedef bool (*TestFn)(const Test &test, const BBCMicro *m, const M6502 *cpu);
+
+    // Passes if (value-min)&0xffff<=range, or the reverse if the test is
+    // negated.
+    struct Test {
+        TestFn fn = nullptr;
+        uint16_t addr = 0;
+        uint16_t min = 0;
+        uint16_t range = 0;
+    };
+
+    std::vector<Test> m_tests;
+    bool m_write = false;
+    uint64_t m_count = 1;
+    uint64_t m_num_matches = 0;
+
+    template <int FIELD, bool NEGATE>
+    static bool TestField(const Test &test, const BBCMicro *m, const M6502 *cpu);
+
+    template <int FIELD>
+    static TestFn GetTestFn(bool negate);
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
+#endif
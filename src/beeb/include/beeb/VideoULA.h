@@ -61,6 +61,25 @@ class VideoULA {
     // Public because the Mode 7 handling works differently.
     uint8_t cursor_pattern = 0;
 
+    // Expanded output for each possible work byte value, for the
+    // non-attribute bitmap modes, one table per line width. The 8 pixels are
+    // a function of the work byte and the palette stuff only, so an Emit is
+    // a lookup and a 16-byte copy.
+    //
+    // Entries are filled in on first use. Anything that affects the palette
+    // output invalidates the lot, by bumping the version. The cache isn't part
+    // of the state - the owner supplies it - so saved states stay small.
+    struct PixelCache {
+        struct Table {
+            VideoDataUnitPixels pixels[256] = {};
+
+            // An entry is valid if its version matches the ULA's.
+            uint32_t versions[256] = {};
+        };
+
+        Table tables[4];
+    };
+
     static void WriteControlRegister(void *ula, M6502Word a, uint8_t value);
     static void WritePalette(void *ula, M6502Word a, uint8_t value);
 
@@ -74,6 +93,10 @@ class VideoULA {
     // Could do with rationalizing this a bit, maybe.
     void InitStuff();
 
+    // CACHE may be NULL, in which case the bitmap pixels are calculated each
+    // time. It must be set again after copying the state.
+    void SetPixelCache(PixelCache *cache);
+
     void DisplayEnabled();
 
     void Byte(uint8_t byte, uint8_t cudisp);
@@ -111,20 +134,26 @@ class VideoULA {
     Trace *m_trace = nullptr;
 #endif
     EmitMFn m_emit_mfn = nullptr;
+    PixelCache *m_pixel_cache = nullptr;
+
+    // Never 0, so a fresh cache has no valid entries.
+    uint32_t m_pixel_cache_version = 1;
 
     void UpdatePixelBufferOffset();
 
     void ResetNuLAState();
+    void InvalidatePixelCache();
     VideoDataPixel GetPalette(uint8_t index);
-    VideoDataPixel Shift();
     VideoDataPixel ShiftAttributeMode0();
     VideoDataPixel ShiftAttributeMode1();
     VideoDataPixel ShiftAttributeText();
 
-    void Emit2MHz(VideoDataUnitPixels *pixels);
-    void Emit4MHz(VideoDataUnitPixels *pixels);
-    void Emit8MHz(VideoDataUnitPixels *pixels);
-    void Emit16MHz(VideoDataUnitPixels *pixels);
+    template <uint8_t LINE_WIDTH>
+    void ExpandPixels(VideoDataUnitPixels *pixels, uint8_t work_byte);
+
+    template <uint8_t LINE_WIDTH>
+    void EmitBitmap(VideoDataUnitPixels *pixels);
+
     void EmitNuLAAttributeMode0(VideoDataUnitPixels *pixels);
     void EmitNuLAAttributeMode1(VideoDataUnitPixels *pixels);
     void EmitNuLAAttributeMode4(VideoDataUnitPixels *pixels);
@@ -4,6 +4,7 @@
 #include <beeb/6522.h>
 #include <string.h>
 #include <beeb/Trace.h>
+#include <algorithm>
 
 #include <shared/enum_def.h>
 #include <beeb/6522.inl>
@@ -30,6 +31,11 @@
 // cycles. (But once the half cycle offset has happened, it's happened, so
 // subsequent timeouts will be after N+2 cycles.)
 //
+// The control lines are driven by the rest of the system, so they're updated
+// every cycle, but most cycles the timers just count down. So the timers are
+// only updated on cycles where something else happens, and the counters are
+// worked out from the number of cycles since when required.
+//
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
@@ -262,7 +268,7 @@ uint8_t R6522::Read4(void *via_, M6502Word addr) {
         via->ifr.bits.t1 = 0;
     }
 
-    return (uint8_t)(via->m_t1);
+    return (uint8_t)via->GetT1();
 }
 
 /* T1L-L */
@@ -281,7 +287,7 @@ uint8_t R6522::Read5(void *via_, M6502Word addr) {
     auto via = (R6522 *)via_;
     (void)addr;
 
-    return (uint8_t)(via->m_t1 >> 8);
+    return (uint8_t)(via->GetT1() >> 8);
 }
 
 void R6522::Write5(void *via_, M6502Word addr, uint8_t value) {
@@ -299,6 +305,7 @@ void R6522::Write5(void *via_, M6502Word addr, uint8_t value) {
     via->m_t1_pending = true;
     via->m_t1_reload = true;
     via->m_t1_pb7 = 0;
+    via->m_next_timer_tick = via->m_tick + 1;
 
     //TRACEF(via->m_trace,"%s - Write T1C-H. T1=%d T1_irq=%d",via->m_name,via->m_t1,via->m_t1_irq);
 }
@@ -362,7 +369,7 @@ uint8_t R6522::Read8(void *via_, M6502Word addr) {
         via->ifr.bits.t2 = 0;
     }
 
-    return (uint8_t)via->m_t2;
+    return (uint8_t)via->GetT2();
 }
 
 void R6522::Write8(void *via_, M6502Word addr, uint8_t value) {
@@ -380,7 +387,7 @@ uint8_t R6522::Read9(void *via_, M6502Word addr) {
     auto via = (R6522 *)via_;
     (void)addr;
 
-    return (uint8_t)(via->m_t2 >> 8);
+    return (uint8_t)(via->GetT2() >> 8);
 }
 
 void R6522::Write9(void *via_, M6502Word addr, uint8_t value) {
@@ -396,6 +403,7 @@ void R6522::Write9(void *via_, M6502Word addr, uint8_t value) {
     via->m_t2lh = value;
     via->m_t2_pending = true;
     via->m_t2_reload = true;
+    via->m_next_timer_tick = via->m_tick + 1;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -438,6 +446,9 @@ void R6522::WriteB(void *via_, M6502Word addr, uint8_t value) {
             via->m_t1_pending = false;
         }
     }
+
+    // T2 might be switching to or from counting PB6 pulses.
+    via->m_next_timer_tick = via->m_tick + 1;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -465,6 +476,17 @@ R6522::PCR R6522::GetPCR() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+uint16_t R6522::GetT1() const {
+    return (uint16_t)(m_t1 - (m_tick - m_timers_tick));
+}
+
+uint16_t R6522::GetT2() const {
+    return (uint16_t)(m_t2 - (m_tick - m_timers_tick));
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 /* IFR */
 uint8_t R6522::ReadD(void *via_, M6502Word addr) {
     auto via = (R6522 *)via_;
@@ -552,6 +574,33 @@ uint8_t R6522::UpdatePhi2TrailingEdge() {
     /* CB1/CB2 */
     TickControlPhi2TrailingEdge(&this->b, m_acr.bits.pb_latching, m_pcr.value >> 4, R6522IRQMask_CB2, 'B');
 
+    ++m_tick;
+    if (m_tick >= m_next_timer_tick) {
+        this->UpdateTimers();
+    }
+
+    return this->ier.value & this->ifr.value & 0x7f;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void R6522::ForceTimerTicking(bool force) {
+    m_force_timer_ticking = force;
+    m_next_timer_tick = m_tick + 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Bring the timers up to date as of the previous trailing edge, then do the
+// full update for this one.
+void R6522::UpdateTimers() {
+    ASSERT(m_tick > m_timers_tick);
+    m_t1 = (uint16_t)(m_t1 - (m_tick - 1 - m_timers_tick));
+    m_t2 = (uint16_t)(m_t2 - (m_tick - 1 - m_timers_tick));
+    m_timers_tick = m_tick;
+
     /* T1 */
     m_t1_timeout = false;
 
@@ -621,7 +670,39 @@ uint8_t R6522::UpdatePhi2TrailingEdge() {
         }
     }
 
-    return this->ier.value & this->ifr.value & 0x7f;
+    this->ScheduleTimers();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void R6522::ScheduleTimers() {
+    ASSERT(m_timers_tick == m_tick);
+
+    bool tick = m_force_timer_ticking;
+
+    // In pulse counting mode, T2 doesn't count every cycle.
+    tick |= m_acr.bits.t2_count_pb6 || !m_t2_count;
+
+#if BBCMICRO_TRACE
+    // Timer tick events are per cycle.
+    tick |= m_trace && m_trace_extra;
+#endif
+
+    tick |= m_t1_reload || m_t1_timeout || m_t2_reload || m_t2_timeout;
+
+    if (tick) {
+        m_next_timer_tick = m_tick + 1;
+    } else {
+        // Next time T1 reaches $ffff, so it reloads, and maybe times out.
+        m_next_timer_tick = m_tick + m_t1 + 1;
+
+        if (m_t2_pending) {
+            // Next time T2 reaches $ffff and times out. It doesn't reload, so
+            // when it isn't pending, it can just run.
+            m_next_timer_tick = std::min(m_next_timer_tick, m_tick + m_t2 + 1);
+        }
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -631,6 +712,7 @@ uint8_t R6522::UpdatePhi2TrailingEdge() {
 void R6522::SetTrace(Trace *trace, bool extra) {
     m_trace = trace;
     m_trace_extra = extra;
+    m_next_timer_tick = m_tick + 1;
 }
 #endif
 
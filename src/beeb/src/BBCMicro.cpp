@@ -28,7 +28,9 @@
 #include <beeb/tube.h>
 #include <set>
 #include <unordered_set>
+#include <unordered_map>
 #include <shared/sha1.h>
+#include <beeb/GuestProfile.h>
 
 #include <shared/enum_decl.h>
 #include "BBCMicro_private.inl"
@@ -204,11 +206,13 @@ uint32_t BBCMicro::GetCloneImpediments() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-const BBCMicroUniqueState *BBCMicro::GetUniqueState() const {
+const BBCMicroUniqueState *BBCMicro::GetUniqueState() {
     if (this->GetCloneImpediments() != 0) {
         return nullptr;
     }
 
+    this->UpdateRAMBigPages();
+
     return &m_state;
 }
 
@@ -282,6 +286,50 @@ std::vector<uint8_t> BBCMicro::*BBCMicro::ms_write_mmios_stretch_mptrs[] = {
     &BBCMicro::m_mmios_stretch_hw_cartridge, //IFJ|ROMIO
 };
 
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+// Context for the profiling MMIO wrappers. Points to the wrapped entry, rather
+// than a copy, as the MMIO tables get modified after the profile has started.
+struct BBCMicro::ProfileMMIO {
+    BBCMicro *m = nullptr;
+    const ReadMMIO *read = nullptr;
+    const WriteMMIO *write = nullptr;
+    uint16_t mmio_index = 0;
+};
+
+struct BBCMicro::Profile {
+    static constexpr size_t NUM_MMIOS_TABLES = sizeof ms_read_mmios_mptrs / sizeof ms_read_mmios_mptrs[0];
+    static_assert(NUM_MMIOS_TABLES == sizeof ms_write_mmios_mptrs / sizeof ms_write_mmios_mptrs[0]);
+
+    // Wrapper tables, used in place of the usual ones while profiling.
+    std::vector<ProfileMMIO> mmios[NUM_MMIOS_TABLES];
+    std::vector<ReadMMIO> read_mmios[NUM_MMIOS_TABLES];
+    std::vector<WriteMMIO> write_mmios[NUM_MMIOS_TABLES];
+
+    // Host ticks for each key, as produced by GetProfileKey.
+    std::unordered_map<uint64_t, uint64_t> ticks_by_key;
+
+    uint64_t last_sample_ticks = 0;
+
+    // MMIO ticks since the last sample, already accounted for.
+    uint64_t mmio_ticks = 0;
+};
+
+static const uint64_t PROFILE_KIND_SELF = 0;
+static const uint64_t PROFILE_KIND_MMIO_READ = 1;
+static const uint64_t PROFILE_KIND_MMIO_WRITE = 2;
+
+static uint64_t GetProfileKey(uint32_t update_flags, BigPageIndex big_page_index, uint64_t kind, uint16_t mmio_index) {
+    ASSERT(update_flags < BBCMicro::NUM_UPDATE_MFNS);
+    ASSERT(kind < 4);
+    ASSERT(mmio_index < 4096);
+
+    return (uint64_t)update_flags << 32 | (uint64_t)big_page_index.i << 16 | kind << 12 | mmio_index;
+}
+#endif
+
 void BBCMicro::UpdatePaging() {
     MemoryBigPageTables tables;
     uint32_t paging_flags;
@@ -295,6 +343,7 @@ void BBCMicro::UpdatePaging() {
             const BigPage *bp = &m_big_pages[tables.mem_big_pages[i][j].i];
 
             mbp->w[j] = bp->w;
+            mbp->dirty[j] = bp->dirty;
             mbp->r[j] = bp->r;
 #if BBCMICRO_DEBUGGER
             mbp->byte_debug_flags[j] = bp->byte_debug_flags;
@@ -320,6 +369,13 @@ void BBCMicro::UpdatePaging() {
     m_write_mmios = (this->*ms_write_mmios_mptrs[index]).data();
     m_write_mmios_stretch = (this->*ms_write_mmios_stretch_mptrs[index]).data();
 
+#if BBCMICRO_DEBUGGER
+    if (m_profile) {
+        m_read_mmios = m_profile->read_mmios[index].data();
+        m_write_mmios = m_profile->write_mmios[index].data();
+    }
+#endif
+
     bool parasite_accessible;
     switch (m_state.parasite_type) {
     default:
@@ -418,8 +474,8 @@ void BBCMicro::InitReadOnlyBigPage(ReadOnlyBigPage *bp,
         big_page_index.i < 16) {
         size_t offset = big_page_index.i * BIG_PAGE_SIZE_BYTES;
 
-        if (offset < state->ram_buffer->size()) {
-            bp->r = &state->ram_buffer->at(offset);
+        if (offset < state->ram_buffer.GetSize()) {
+            bp->r = state->ram_buffer.GetBigPage((size_t)big_page_index.i);
             bp->writeable = true;
         }
     } else if (big_page_index.i >= ROM0_BIG_PAGE_INDEX.i &&
@@ -437,8 +493,9 @@ void BBCMicro::InitReadOnlyBigPage(ReadOnlyBigPage *bp,
 
         if (!!state->sideways_rom_buffers[bank]) {
             bp->r = &state->sideways_rom_buffers[bank]->at(offset);
-        } else if (!!state->sideways_ram_buffers[bank]) {
-            bp->r = &state->sideways_ram_buffers[bank]->at(offset);
+        } else if (state->sideways_ram_buffers[bank].GetSize() > 0) {
+            ASSERT(offset % BIG_PAGE_SIZE_BYTES == 0);
+            bp->r = state->sideways_ram_buffers[bank].GetBigPage(offset / BIG_PAGE_SIZE_BYTES);
             bp->writeable = true;
         }
     } else if (big_page_index.i >= MOS_BIG_PAGE_INDEX.i &&
@@ -450,8 +507,7 @@ void BBCMicro::InitReadOnlyBigPage(ReadOnlyBigPage *bp,
     } else if (big_page_index.i >= PARASITE_BIG_PAGE_INDEX.i &&
                big_page_index.i < PARASITE_BIG_PAGE_INDEX.i + NUM_PARASITE_BIG_PAGES) {
         if (state->parasite_type != BBCMicroParasiteType_None) {
-            size_t offset = (big_page_index.i - PARASITE_BIG_PAGE_INDEX.i) * BIG_PAGE_SIZE_BYTES;
-            bp->r = &state->parasite_ram_buffer->at(offset);
+            bp->r = state->parasite_ram_buffer.GetBigPage((size_t)(big_page_index.i - PARASITE_BIG_PAGE_INDEX.i));
             bp->writeable = true;
         }
     } else if (big_page_index.i >= PARASITE_ROM_BIG_PAGE_INDEX.i &&
@@ -492,6 +548,21 @@ void BBCMicro::InitReadOnlyBigPage(ReadOnlyBigPage *bp,
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Find the dirty flag for the big page at w, which must be in one of the RAM
+// buffers.
+static uint8_t *FindDirtyFlag(PagedRAM *ram_buffer, const uint8_t *w) {
+    if (ram_buffer->GetSize() == 0) {
+        return nullptr;
+    }
+
+    const uint8_t *data = ram_buffer->GetData();
+    if (w < data || w >= data + ram_buffer->GetSize()) {
+        return nullptr;
+    }
+
+    return &ram_buffer->GetDirtyFlags()[(size_t)(w - data) / BIG_PAGE_SIZE_BYTES];
+}
+
 void BBCMicro::InitPaging() {
     for (BigPage &bp : m_big_pages) {
         bp = {};
@@ -512,6 +583,18 @@ void BBCMicro::InitPaging() {
         bp->r = rbp.r;
         if (rbp.writeable) {
             bp->w = const_cast<uint8_t *>(bp->r);
+
+            bp->dirty = FindDirtyFlag(&m_state.ram_buffer, bp->w);
+
+            if (!bp->dirty) {
+                bp->dirty = FindDirtyFlag(&m_state.parasite_ram_buffer, bp->w);
+            }
+
+            for (size_t bank = 0; bank < 16 && !bp->dirty; ++bank) {
+                bp->dirty = FindDirtyFlag(&m_state.sideways_ram_buffers[bank], bp->w);
+            }
+
+            ASSERT(bp->dirty);
         }
 
 #if BBCMICRO_DEBUGGER
@@ -525,6 +608,7 @@ void BBCMicro::InitPaging() {
 
         if (!bp->w) {
             bp->w = g_unmapped_writes;
+            bp->dirty = &m_unmapped_writes_dirty;
         }
     }
 
@@ -538,6 +622,19 @@ void BBCMicro::InitPaging() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void BBCMicro::UpdateRAMBigPages() {
+    m_state.ram_buffer.UpdateBigPages();
+
+    for (PagedRAM &sideways_ram_buffer : m_state.sideways_ram_buffers) {
+        sideways_ram_buffer.UpdateBigPages();
+    }
+
+    m_state.parasite_ram_buffer.UpdateBigPages();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 // TODO: could the state pointer be m_state?
 void BBCMicro::Write1770ControlRegister(void *m_, M6502Word a, uint8_t value) {
     auto m = (BBCMicro *)m_;
@@ -909,6 +1006,12 @@ void BBCMicro::SetTeletextDebug(bool teletext_debug) {
 void BBCMicro::OptionalLowFrequencyUpdate() {
 #if BBCMICRO_DEBUGGER
     this->UpdateUpdateMFnData();
+
+    if (m_profile) {
+        // Don't count whatever happened since the last Update.
+        m_profile->last_sample_ticks = GetCurrentTickCount();
+        m_profile->mmio_ticks = 0;
+    }
 #endif
 }
 
@@ -971,16 +1074,7 @@ uint32_t BBCMicro::GetLEDs() {
 //////////////////////////////////////////////////////////////////////////
 
 std::vector<uint8_t> BBCMicro::GetNVRAM() const {
-    switch (m_state.type->type_id) {
-    case BBCMicroTypeID_Master:
-        return m_state.rtc.GetRAMContents();
-
-    case BBCMicroTypeID_MasterCompact:
-        return std::vector<uint8_t>(m_state.eeprom.ram, m_state.eeprom.ram + sizeof m_state.eeprom.ram);
-
-    default:
-        return std::vector<uint8_t>();
-    }
+    return m_state.GetNVRAM();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -999,7 +1093,7 @@ void BBCMicro::SetSidewaysROM(uint8_t bank, std::shared_ptr<const std::vector<ui
     ASSERT(bank < 16);
 
     // No sideways RAM in this bank.
-    m_state.sideways_ram_buffers[bank].reset();
+    m_state.sideways_ram_buffers[bank] = PagedRAM();
 
     m_state.sideways_rom_buffers[bank] = std::move(data);
     m_state.paging.rom_types[bank] = type;
@@ -1014,12 +1108,19 @@ void BBCMicro::SetSidewaysROM(uint8_t bank, std::shared_ptr<const std::vector<ui
 void BBCMicro::SetSidewaysRAM(uint8_t bank, std::shared_ptr<const std::vector<uint8_t>> data) {
     ASSERT(bank < 16);
 
+    m_state.sideways_ram_buffers[bank] = PagedRAM(16384);
+
     if (data) {
-        m_state.sideways_ram_buffers[bank] = std::make_shared<std::array<uint8_t, 16384>>();
-        for (size_t i = 0; i < std::min(data->size(), (size_t)16384); ++i) {
+        PagedRAM *ram_buffer = &m_state.sideways_ram_buffers[bank];
+
+        memcpy(ram_buffer->GetData(), data->data(), std::min(data->size(), ram_buffer->GetSize()));
+
+        for (size_t i = 0; i < ram_buffer->GetNumBigPages(); ++i) {
+            ram_buffer->GetDirtyFlags()[i] = 1;
         }
     } else {
-        m_state.sideways_ram_buffers[bank] = std::make_shared<std::array<uint8_t, 16384>>();
+        // Ensure the contiguous buffer exists, for InitPaging's benefit.
+        m_state.sideways_ram_buffers[bank].GetData();
     }
 
     // No sideways ROM in this bank.
@@ -1103,6 +1204,15 @@ int BBCMicro::GetTraceStats(struct TraceStats *stats) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+#if BBCMICRO_TRACE
+std::shared_ptr<Trace> BBCMicro::GetTrace() const {
+    return m_trace_ptr;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void BBCMicro::AddHostInstructionFn(InstructionFn fn, void *context) {
     ASSERT(std::find(m_host_instruction_fns.begin(), m_host_instruction_fns.end(), std::make_pair(fn, context)) == m_host_instruction_fns.end());
 
@@ -1268,7 +1378,9 @@ void BBCMicro::StopPaste() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-std::shared_ptr<const BBCMicroReadOnlyState> BBCMicro::DebugGetState() const {
+std::shared_ptr<const BBCMicroReadOnlyState> BBCMicro::DebugGetState() {
+    this->UpdateRAMBigPages();
+
     auto result = std::make_shared<BBCMicroReadOnlyState>(m_state);
     return result;
 }
@@ -1509,6 +1621,7 @@ void BBCMicro::DebugSetBytes(M6502Word addr, uint32_t dso, bool mos, const uint8
 
         if (bp->w) {
             bp->w[addr.p.o] = bytes[i];
+            *bp->dirty = 1;
         }
 
         ++addr.w;
@@ -2025,6 +2138,208 @@ std::shared_ptr<const BBCMicro::UpdateMFnData> BBCMicro::GetUpdateMFnData() cons
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+#if BBCMICRO_DEBUGGER
+void BBCMicro::StartProfile() {
+    if (m_profile) {
+        return;
+    }
+
+    auto profile = std::make_unique<Profile>();
+
+    for (size_t i = 0; i < Profile::NUM_MMIOS_TABLES; ++i) {
+        const std::vector<ReadMMIO> *read_mmios = &(this->*ms_read_mmios_mptrs[i]);
+        const std::vector<WriteMMIO> *write_mmios = &(this->*ms_write_mmios_mptrs[i]);
+        ASSERT(read_mmios->size() == write_mmios->size());
+
+        profile->mmios[i].resize(read_mmios->size());
+        profile->read_mmios[i].resize(read_mmios->size());
+        profile->write_mmios[i].resize(write_mmios->size());
+
+        for (size_t j = 0; j < read_mmios->size(); ++j) {
+            ProfileMMIO *pm = &profile->mmios[i][j];
+
+            pm->m = this;
+            pm->read = &(*read_mmios)[j];
+            pm->write = &(*write_mmios)[j];
+            pm->mmio_index = (uint16_t)j;
+
+            profile->read_mmios[i][j] = {&ProfileReadMMIO, pm};
+            profile->write_mmios[i][j] = {&ProfileWriteMMIO, pm};
+        }
+    }
+
+    profile->last_sample_ticks = GetCurrentTickCount();
+
+    m_profile = std::move(profile);
+
+    // Switch to the wrapper tables.
+    this->UpdatePaging();
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+void BBCMicro::StopProfile() {
+    if (!m_profile) {
+        return;
+    }
+
+    m_profile.reset();
+
+    this->UpdatePaging();
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+bool BBCMicro::IsProfiling() const {
+    return !!m_profile;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+// Frame names mustn't contain the separator.
+static void AppendProfileFrame(std::string *stack, const std::string &frame) {
+    if (!stack->empty()) {
+        stack->push_back(';');
+    }
+
+    for (char c : frame) {
+        if (c == ';') {
+            c = ',';
+        }
+
+        stack->push_back(c);
+    }
+}
+
+std::string BBCMicro::GetProfileFoldedStacks() const {
+    if (!m_profile) {
+        return {};
+    }
+
+    // Different keys could conceivably produce the same stack, and sorting
+    // makes the output a bit easier to diff.
+    std::map<std::string, uint64_t> ticks_by_stack;
+
+    for (const auto &key_and_ticks : m_profile->ticks_by_key) {
+        uint64_t key = key_and_ticks.first;
+        auto update_flags = (uint32_t)(key >> 32);
+        BigPageIndex big_page_index = {(BigPageIndex::Type)(key >> 16)};
+        uint64_t kind = key >> 12 & 3;
+        auto mmio_index = (uint16_t)(key & 0xfff);
+
+        std::string stack;
+
+        std::string update_flags_expr = GetUpdateFlagExpr(update_flags);
+        if (update_flags_expr.empty()) {
+            update_flags_expr = "0";
+        }
+        AppendProfileFrame(&stack, update_flags_expr);
+
+        ASSERT(big_page_index.i < m_state.type->big_pages_metadata.size());
+        const BigPageMetadata *metadata = &m_state.type->big_pages_metadata[big_page_index.i];
+        AppendProfileFrame(&stack, metadata->description);
+
+        char tmp[100];
+        snprintf(tmp, sizeof tmp, "$%04x", metadata->addr);
+        AppendProfileFrame(&stack, tmp);
+
+        if (kind == PROFILE_KIND_MMIO_READ || kind == PROFILE_KIND_MMIO_WRITE) {
+            snprintf(tmp, sizeof tmp, "MMIO %s $%04x", kind == PROFILE_KIND_MMIO_READ ? "read" : "write", 0xfc00 + mmio_index);
+            AppendProfileFrame(&stack, tmp);
+        }
+
+        ticks_by_stack[stack] += key_and_ticks.second;
+    }
+
+    std::string result;
+    for (const auto &stack_and_ticks : ticks_by_stack) {
+        auto us = (uint64_t)(GetSecondsFromTicks(stack_and_ticks.second) * 1e6 + .5);
+        if (us > 0) {
+            result += stack_and_ticks.first;
+            result += " ";
+            result += std::to_string(us);
+            result += "\n";
+        }
+    }
+
+    return result;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+void BBCMicro::StartGuestProfile() {
+    m_guest_profile = std::make_unique<GuestProfile>();
+    m_is_guest_profiling = true;
+
+    this->UpdateCPUDataBusFn();
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+void BBCMicro::StopGuestProfile() {
+    if (!m_is_guest_profiling) {
+        return;
+    }
+
+    // The last instruction for each CPU is still in progress, so it doesn't
+    // get counted.
+    m_guest_profile->Break();
+    m_is_guest_profiling = false;
+
+    this->UpdateCPUDataBusFn();
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+bool BBCMicro::IsGuestProfiling() const {
+    return m_is_guest_profiling;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+std::unique_ptr<GuestProfileReport> BBCMicro::CreateGuestProfileReport() const {
+    if (!m_guest_profile) {
+        return nullptr;
+    }
+
+    const M6502Config *parasite_m6502_config = nullptr;
+    if (m_state.parasite_type != BBCMicroParasiteType_None) {
+        parasite_m6502_config = m_state.parasite_cpu.config;
+    }
+
+    return ::CreateGuestProfileReport(*m_guest_profile,
+                                      m_state.type,
+                                      parasite_m6502_config,
+                                      [this](BigPageIndex big_page_index) {
+                                          return m_big_pages[big_page_index.i].r;
+                                      });
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void BBCMicro::AddMouseMotion(int dx, int dy) {
     if (!(m_update_flags & BBCMicroUpdateFlag_Mouse)) {
         return;
@@ -2079,18 +2394,33 @@ void BBCMicro::SetShowCursor(bool show_cursor) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void BBCMicro::SetCatchUpMode(bool catch_up_mode) {
+    m_catch_up_mode = catch_up_mode;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool BBCMicro::GetCatchUpMode() const {
+    return m_catch_up_mode;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void BBCMicro::TestSetByte(uint16_t ram_buffer_index, uint8_t value) {
-    ASSERT(ram_buffer_index < m_state.ram_buffer->size());
-    m_state.ram_buffer->at(ram_buffer_index) = value;
+    ASSERT(ram_buffer_index < m_state.ram_buffer.GetSize());
+    m_ram[ram_buffer_index] = value;
+    m_state.ram_buffer.GetDirtyFlags()[ram_buffer_index / BIG_PAGE_SIZE_BYTES] = 1;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
 void BBCMicro::TestSetParasiteByte(uint16_t addr, uint8_t value) {
-    ASSERT(!!m_state.parasite_ram_buffer);
-    ASSERT(addr < m_state.parasite_ram_buffer->size());
-    m_state.parasite_ram_buffer->at(addr) = value;
+    ASSERT(m_state.parasite_ram_buffer.GetSize() == 65536);
+    m_parasite_ram[addr] = value;
+    m_parasite_ram_dirty_flags[addr / BIG_PAGE_SIZE_BYTES] = 1;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -2292,7 +2622,13 @@ void BBCMicro::InitStuff() {
     m_last_mfn_change_cycle_count = m_state.cycle_count;
 #endif
 
-    m_ram = m_state.ram_buffer->data();
+    // The emulation accesses the RAM via the contiguous buffers, so make sure
+    // they exist.
+    m_ram = m_state.ram_buffer.GetData();
+
+    for (PagedRAM &sideways_ram_buffer : m_state.sideways_ram_buffers) {
+        sideways_ram_buffer.GetData();
+    }
 
 #if PCD8572_MOS510_DEBUG
     m_state.eeprom.cpu = &m_state.cpu;
@@ -2385,6 +2721,9 @@ void BBCMicro::InitStuff() {
 
     m_state.video_ula.InitStuff();
 
+    m_video_ula_pixel_cache = std::make_unique<VideoULA::PixelCache>();
+    m_state.video_ula.SetPixelCache(m_video_ula_pixel_cache.get());
+
     m_state.system_via.SetID(BBCMicroVIAID_SystemVIA, "SystemVIA");
     m_state.user_via.SetID(BBCMicroVIAID_UserVIA, "UserVIA");
 
@@ -2473,9 +2812,9 @@ void BBCMicro::InitStuff() {
     if (m_state.parasite_type != BBCMicroParasiteType_None) {
         m_state.parasite_cpu.context = this;
 
-        ASSERT(!!m_state.parasite_ram_buffer);
-        ASSERT(m_state.parasite_ram_buffer->size() == 65536);
-        m_parasite_ram = m_state.parasite_ram_buffer->data();
+        ASSERT(m_state.parasite_ram_buffer.GetSize() == 65536);
+        m_parasite_ram = m_state.parasite_ram_buffer.GetData();
+        m_parasite_ram_dirty_flags = m_state.parasite_ram_buffer.GetDirtyFlags();
 
         m_parasite_read_mmio_fns[0] = &ReadParasiteTube0;
         m_parasite_read_mmio_fns[1] = &ReadParasiteTube1;
@@ -2495,7 +2834,7 @@ void BBCMicro::InitStuff() {
         m_parasite_write_mmio_fns[6] = &WriteTubeDummy;
         m_parasite_write_mmio_fns[7] = &WriteParasiteTube7;
     } else {
-        ASSERT(!m_state.parasite_ram_buffer);
+        ASSERT(m_state.parasite_ram_buffer.GetSize() == 0);
     }
 
     m_host_cpu_metadata.name = "host";
@@ -2514,6 +2853,10 @@ void BBCMicro::InitStuff() {
 
     m_state.adc.SetHandler(&ReadAnalogueChannel, this);
 
+    // The tube I/O functions are set up by UpdatePaging when this changes,
+    // and this BBCMicro's I/O function tables are all fresh.
+    m_state.parasite_accessible = false;
+
     // Page in current ROM bank and sort out ACCCON.
     this->InitPaging();
 
@@ -2847,6 +3190,12 @@ void BBCMicro::UpdateCPUDataBusFn() {
         update_flags |= BBCMicroUpdateFlag_Hacks;
     }
 
+#if BBCMICRO_DEBUGGER
+    if (m_is_guest_profiling) {
+        update_flags |= BBCMicroUpdateFlag_Hacks;
+    }
+#endif
+
     if (m_state.type->type_id == BBCMicroTypeID_Master) {
         update_flags |= BBCMicroUpdateFlag_IsMaster128;
     } else if (m_state.type->type_id == BBCMicroTypeID_MasterCompact) {
@@ -2884,6 +3233,11 @@ void BBCMicro::UpdateCPUDataBusFn() {
     if (update_flags != m_update_flags) {
         ++m_update_mfn_data->num_update_mfn_changes;
     }
+
+    if (m_profile) {
+        // Attribute the time so far to the outgoing update function.
+        this->ProfileSample();
+    }
 #endif
 
     update_flags |= (uint32_t)m_state.paging.rom_types[m_state.paging.romsel.b_bits.pr] << BBCMicroUpdateFlag_ROMTypeShift;
@@ -2988,6 +3342,73 @@ void BBCMicro::UpdateUpdateMFnData() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+#if BBCMICRO_DEBUGGER
+void BBCMicro::ProfileSample() {
+    uint64_t now = GetCurrentTickCount();
+    uint64_t ticks = now - m_profile->last_sample_ticks;
+
+    // Time spent in MMIO handlers has already been counted. (If a handler
+    // caused a sample, some of it will have been counted twice, so it's
+    // possible for this to go negative.)
+    if (ticks > m_profile->mmio_ticks) {
+        ticks -= m_profile->mmio_ticks;
+    } else {
+        ticks = 0;
+    }
+
+    const BigPage *bp = m_pc_mem_big_pages[m_state.cpu.opcode_pc.p.p]->bp[m_state.cpu.opcode_pc.p.p];
+    m_profile->ticks_by_key[GetProfileKey(m_update_flags, bp->index, PROFILE_KIND_SELF, 0)] += ticks;
+
+    m_profile->last_sample_ticks = now;
+    m_profile->mmio_ticks = 0;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+void BBCMicro::ProfileAddMMIO(const ProfileMMIO *pm, bool write, uint64_t ticks) {
+    ASSERT(m_profile);
+
+    const BigPage *bp = m_pc_mem_big_pages[m_state.cpu.opcode_pc.p.p]->bp[m_state.cpu.opcode_pc.p.p];
+    m_profile->ticks_by_key[GetProfileKey(m_update_flags, bp->index, write ? PROFILE_KIND_MMIO_WRITE : PROFILE_KIND_MMIO_READ, pm->mmio_index)] += ticks;
+
+    m_profile->mmio_ticks += ticks;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+uint8_t BBCMicro::ProfileReadMMIO(void *context, M6502Word a) {
+    auto pm = (const ProfileMMIO *)context;
+
+    uint64_t start_ticks = GetCurrentTickCount();
+    uint8_t value = (*pm->read->fn)(pm->read->context, a);
+    pm->m->ProfileAddMMIO(pm, false, GetCurrentTickCount() - start_ticks);
+
+    return value;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_DEBUGGER
+void BBCMicro::ProfileWriteMMIO(void *context, M6502Word a, uint8_t value) {
+    auto pm = (const ProfileMMIO *)context;
+
+    uint64_t start_ticks = GetCurrentTickCount();
+    (*pm->write->fn)(pm->write->context, a, value);
+    pm->m->ProfileAddMMIO(pm, true, GetCurrentTickCount() - start_ticks);
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void BBCMicro::UpdateMapperRegion(uint8_t region) {
     m_state.paging.rom_regions[m_state.paging.romsel.b_bits.pr] = region;
     this->UpdatePaging();
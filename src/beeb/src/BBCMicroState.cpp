@@ -31,7 +31,7 @@ BBCMicroState::BBCMicroState(std::shared_ptr<const BBCMicroType> type_,
     , cycle_count(initial_cycle_count)
     , disc_interface(disc_interface_) {
     M6502_Init(&this->cpu, this->type->m6502_config);
-    this->ram_buffer = std::make_shared<std::vector<uint8_t>>(this->type->ram_buffer_size);
+    this->ram_buffer = PagedRAM(this->type->ram_buffer_size);
 
     if (this->disc_interface) {
         this->disc_interface_extra_hardware = this->disc_interface->CreateExtraHardwareState();
@@ -57,7 +57,7 @@ BBCMicroState::BBCMicroState(std::shared_ptr<const BBCMicroType> type_,
     }
 
     if (this->parasite_type != BBCMicroParasiteType_None) {
-        this->parasite_ram_buffer = std::make_shared<std::vector<uint8_t>>(65536);
+        this->parasite_ram_buffer = PagedRAM(65536);
         this->parasite_boot_mode = true;
         M6502_Init(&this->parasite_cpu, &M6502_rockwell65c02_config);
         ResetTube(&this->parasite_tube);
@@ -243,29 +243,72 @@ std::shared_ptr<const DiscImage> BBCMicroState::GetDiscImage(int drive) const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+std::vector<uint8_t> BBCMicroState::GetNVRAM() const {
+    switch (this->type->type_id) {
+    case BBCMicroTypeID_Master:
+        return this->rtc.GetRAMContents();
+
+    case BBCMicroTypeID_MasterCompact:
+        return std::vector<uint8_t>(this->eeprom.ram, this->eeprom.ram + sizeof this->eeprom.ram);
+
+    default:
+        return std::vector<uint8_t>();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 BBCMicroUniqueState::BBCMicroUniqueState(const BBCMicroUniqueState &src)
     : BBCMicroState(src) {
     for (BBCMicroState::DiscDrive &dd : this->drives) {
         dd.disc_image = DiscImage::Clone(dd.disc_image);
     }
 
-    if (this->ram_buffer) {
-        this->ram_buffer = std::make_shared<std::vector<uint8_t>>(*this->ram_buffer);
+    if (this->disc_interface) {
+        this->disc_interface_extra_hardware = this->disc_interface->CloneExtraHardwareState(this->disc_interface_extra_hardware);
     }
+}
 
-    for (int i = 0; i < 16; ++i) {
-        if (this->sideways_ram_buffers[i]) {
-            this->sideways_ram_buffers[i] = std::make_shared<std::array<uint8_t, 16384>>(*this->sideways_ram_buffers[i]);
-        }
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BBCMicroUniqueState::CompressRAM(const BBCMicroUniqueState &keyframe) {
+    this->ram_buffer.Compress(keyframe.ram_buffer);
+
+    for (size_t i = 0; i < 16; ++i) {
+        this->sideways_ram_buffers[i].Compress(keyframe.sideways_ram_buffers[i]);
     }
 
-    if (this->parasite_ram_buffer) {
-        this->parasite_ram_buffer = std::make_shared<std::vector<uint8_t>>(*this->parasite_ram_buffer);
+    this->parasite_ram_buffer.Compress(keyframe.parasite_ram_buffer);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void BBCMicroUniqueState::DecompressRAM() {
+    this->ram_buffer.Decompress();
+
+    for (size_t i = 0; i < 16; ++i) {
+        this->sideways_ram_buffers[i].Decompress();
     }
 
-    if (this->disc_interface) {
-        this->disc_interface_extra_hardware = this->disc_interface->CloneExtraHardwareState(this->disc_interface_extra_hardware);
+    this->parasite_ram_buffer.Decompress();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+size_t BBCMicroUniqueState::GetNumUnsharedRAMBytes(const BBCMicroUniqueState *other) const {
+    size_t num_bytes = this->ram_buffer.GetNumUnsharedBytes(other ? &other->ram_buffer : nullptr);
+
+    for (size_t i = 0; i < 16; ++i) {
+        num_bytes += this->sideways_ram_buffers[i].GetNumUnsharedBytes(other ? &other->sideways_ram_buffers[i] : nullptr);
     }
+
+    num_bytes += this->parasite_ram_buffer.GetNumUnsharedBytes(other ? &other->parasite_ram_buffer : nullptr);
+
+    return num_bytes;
 }
 
 //////////////////////////////////////////////////////////////////////////
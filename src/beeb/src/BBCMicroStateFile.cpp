@@ -0,0 +1,922 @@
+#include <shared/system.h>
+#include <shared/debug.h>
+#include <shared/file_io.h>
+#include <shared/load_store.h>
+#include <shared/log.h>
+#include <beeb/BBCMicroStateFile.h>
+#include <beeb/BBCMicro.h>
+#include <beeb/DiscGeometry.h>
+#include <beeb/DiscImage.h>
+#include <beeb/MemoryDiscImage.h>
+#include <inttypes.h>
+#include <map>
+#include <string.h>
+#include <type_traits>
+
+#include <shared/enum_def.h>
+#include <beeb/BBCMicroStateFile.inl>
+#include <shared/enum_end.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// File layout:
+//
+// +0 8 magic
+// +8 4 format version
+// +12 4 byte order mark (native byte order)
+// +16 4 sizeof(BBCMicroState)
+// +20 4 number of chunks
+// +24 8 reserved
+// +32 ... chunk directory
+//
+// Each chunk directory entry:
+//
+// +0 4 chunk ID (BBCMicroStateFileChunkID)
+// +4 4 index
+// +8 8 file offset of chunk data
+// +16 8 chunk size
+//
+// Numbers are little-endian, apart from the byte order mark, and whatever's
+// in the raw images.
+
+static const char MAGIC[8] = "b2state";
+
+// Bump this whenever anything changes.
+static constexpr uint32_t FORMAT_VERSION = 4;
+
+static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+static constexpr size_t HEADER_SIZE = 32;
+static constexpr size_t DIRECTORY_ENTRY_SIZE = 24;
+
+// Chunk data alignment. Large chunks are page-aligned, so that they can be
+// used directly from a memory-mapped file. (Only the OS and parasite ROMs
+// are, at the moment; everything else is copied.)
+static constexpr size_t CHUNK_ALIGNMENT = 16;
+static constexpr size_t LARGE_CHUNK_ALIGNMENT = 4096;
+static constexpr size_t MIN_LARGE_CHUNK_SIZE = 4096;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// BBCMicroState members that are stored as raw images. (The M6502s are dealt
+// with separately, as they contain function pointers.)
+//
+// Changing this list requires a FORMAT_VERSION bump.
+#define HARDWARE_MEMBERS(X)      \
+    X(crtc)                      \
+    X(crtc_last_output)          \
+    X(video_ula)                 \
+    X(saa5050)                   \
+    X(ic15_byte)                 \
+    X(shadow_select_mask)        \
+    X(sn76489)                   \
+    X(cycle_count)               \
+    X(addressable_latch)         \
+    X(old_addressable_latch)     \
+    X(stretch)                   \
+    X(resetting)                 \
+    X(system_via)                \
+    X(old_system_via_pb)         \
+    X(system_via_irq_pending)    \
+    X(user_via)                  \
+    X(user_via_irq_pending)      \
+    X(paging)                    \
+    X(key_columns)               \
+    X(key_scan_column)           \
+    X(num_keys_down)             \
+    X(fdc)                       \
+    X(disc_control)              \
+    X(rtc)                       \
+    X(eeprom)                    \
+    X(adc)                       \
+    X(digital_joystick_state)    \
+    X(mouse_data)                \
+    X(mouse_signal_x)            \
+    X(mouse_signal_y)            \
+    X(mouse_dx)                  \
+    X(mouse_dy)                  \
+    X(printer_enabled)           \
+    X(printer_busy_counter)      \
+    X(not_joystick_buttons)      \
+    X(analogue_channel_values)   \
+    X(last_vsync_cycle_count)    \
+    X(last_frame_cycle_count)    \
+    X(hack_flags)                \
+    X(paste_state)               \
+    X(paste_index)               \
+    X(paste_wait_end)            \
+    X(parasite_accessible)       \
+    X(parasite_boot_mode)        \
+    X(parasite_tube)
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+class ChunkWriter {
+  public:
+    std::vector<uint8_t> data;
+
+    void Add8(uint8_t value) {
+        this->data.push_back(value);
+    }
+
+    void Add32(uint32_t value) {
+        uint8_t buf[4];
+        Store32LE(buf, value);
+        this->AddBytes(buf, sizeof buf);
+    }
+
+    void Add64(uint64_t value) {
+        uint8_t buf[8];
+        Store64LE(buf, value);
+        this->AddBytes(buf, sizeof buf);
+    }
+
+    void AddString(const std::string &str) {
+        this->Add32((uint32_t)str.size());
+        this->AddBytes(str.data(), str.size());
+    }
+
+    void AddBytes(const void *bytes, size_t num_bytes) {
+        this->data.insert(this->data.end(), (const uint8_t *)bytes, (const uint8_t *)bytes + num_bytes);
+    }
+
+    // The size is included, so that loading can check the layout matches.
+    template <class T>
+    void AddRaw(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw images must be trivially copyable");
+
+        this->Add32((uint32_t)sizeof value);
+        this->AddBytes(&value, sizeof value);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Errors are sticky: once one Get fails, the rest do too, and IsGood returns
+// false.
+class ChunkReader {
+  public:
+    ChunkReader(const uint8_t *data, size_t size, BBCMicroStateFileChunkID id, const LogSet &logs)
+        : m_p(data)
+        , m_end(data + size)
+        , m_id(id)
+        , m_logs(logs) {
+    }
+
+    bool IsGood() const {
+        return m_good;
+    }
+
+    uint8_t Get8() {
+        uint8_t value = 0;
+        this->GetBytes(&value, 1);
+        return value;
+    }
+
+    uint32_t Get32() {
+        uint8_t buf[4] = {};
+        this->GetBytes(buf, sizeof buf);
+        return Load32LE(buf);
+    }
+
+    uint64_t Get64() {
+        uint8_t buf[8] = {};
+        this->GetBytes(buf, sizeof buf);
+        return Load64LE(buf);
+    }
+
+    std::string GetString() {
+        uint32_t size = this->Get32();
+        if (!this->Check(size)) {
+            return std::string();
+        }
+
+        std::string str((const char *)m_p, size);
+        m_p += size;
+        return str;
+    }
+
+    void GetBytes(void *bytes, size_t num_bytes) {
+        if (!this->Check(num_bytes)) {
+            return;
+        }
+
+        memcpy(bytes, m_p, num_bytes);
+        m_p += num_bytes;
+    }
+
+    template <class T>
+    void GetRaw(T *value, const char *name) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw images must be trivially copyable");
+
+        uint32_t size = this->Get32();
+        if (!m_good) {
+            return;
+        }
+
+        if (size != sizeof *value) {
+            m_logs.e.f("bad state file: %s chunk: %s size is %" PRIu32 " bytes; expected %zu bytes\n",
+                       GetBBCMicroStateFileChunkIDEnumName(m_id), name, size, sizeof *value);
+            m_good = false;
+            return;
+        }
+
+        this->GetBytes(value, sizeof *value);
+    }
+
+  protected:
+  private:
+    const uint8_t *m_p = nullptr;
+    const uint8_t *m_end = nullptr;
+    BBCMicroStateFileChunkID m_id = {};
+    const LogSet &m_logs;
+    bool m_good = true;
+
+    bool Check(size_t num_bytes) {
+        if (m_good) {
+            if ((size_t)(m_end - m_p) < num_bytes) {
+                m_logs.e.f("bad state file: %s chunk is truncated\n", GetBBCMicroStateFileChunkIDEnumName(m_id));
+                m_good = false;
+            }
+        }
+
+        return m_good;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct Chunk {
+    BBCMicroStateFileChunkID id = {};
+    uint32_t index = 0;
+    ChunkWriter writer;
+};
+
+static ChunkWriter *AddChunk(std::vector<Chunk> *chunks, BBCMicroStateFileChunkID id, uint32_t index) {
+    chunks->emplace_back();
+
+    Chunk *chunk = &chunks->back();
+    chunk->id = id;
+    chunk->index = index;
+
+    return &chunk->writer;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct ChunkData {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+};
+
+// Returns nullptr if not present.
+static const ChunkData *FindChunk(const std::map<std::pair<uint32_t, uint32_t>, ChunkData> &chunks, BBCMicroStateFileChunkID id, uint32_t index) {
+    auto it = chunks.find({(uint32_t)id, index});
+    if (it == chunks.end()) {
+        return nullptr;
+    }
+
+    return &it->second;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// The M6502 function pointers are saved by name, as they'll differ from
+// process to process.
+
+struct M6502FnNames {
+    std::map<M6502Fn, std::string> name_by_fn;
+    std::map<std::string, M6502Fn> fn_by_name;
+};
+
+static const M6502FnNames &GetM6502FnNames() {
+    static const M6502FnNames names = [] {
+        M6502FnNames tmp;
+
+        M6502_ForEachFn([](const char *name, M6502Fn fn, void *context) {
+            auto n = (M6502FnNames *)context;
+
+            n->name_by_fn[fn] = name;
+            n->fn_by_name[name] = fn;
+        },
+                        &tmp);
+
+        return tmp;
+    }();
+
+    return names;
+}
+
+static bool AddM6502Fn(ChunkWriter *w, M6502Fn fn, const LogSet &logs) {
+    if (!fn) {
+        w->AddString("");
+        return true;
+    }
+
+    const M6502FnNames &names = GetM6502FnNames();
+    auto it = names.name_by_fn.find(fn);
+    if (it == names.name_by_fn.end()) {
+        logs.e.f("can't save state: unknown 6502 function\n");
+        return false;
+    }
+
+    w->AddString(it->second);
+    return true;
+}
+
+static M6502Fn GetM6502Fn(ChunkReader *r, const LogSet &logs) {
+    std::string name = r->GetString();
+    if (!r->IsGood() || name.empty()) {
+        return nullptr;
+    }
+
+    const M6502FnNames &names = GetM6502FnNames();
+    auto it = names.fn_by_name.find(name);
+    if (it == names.fn_by_name.end()) {
+        logs.e.f("bad state file: unknown 6502 function: %s\n", name.c_str());
+        return nullptr;
+    }
+
+    return it->second;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static bool AddM6502(ChunkWriter *w, const M6502 &cpu, const LogSet &logs) {
+    // The pointers in the raw image are meaningless, so zero them, just to
+    // make the file contents a bit more repeatable.
+    M6502 tmp = cpu;
+    tmp.tfn = nullptr;
+    tmp.ifn = nullptr;
+    tmp.fns = nullptr;
+    tmp.interrupt_tfn = nullptr;
+    tmp.config = nullptr;
+    tmp.ill_fn = nullptr;
+    tmp.ill_context = nullptr;
+    tmp.context = nullptr;
+
+    w->AddRaw(tmp);
+
+    if (!AddM6502Fn(w, cpu.tfn, logs) ||
+        !AddM6502Fn(w, cpu.ifn, logs) ||
+        !AddM6502Fn(w, cpu.interrupt_tfn, logs)) {
+        return false;
+    }
+
+    return true;
+}
+
+// *cpu must have been initialised with the right config.
+static bool GetM6502(M6502 *cpu, const ChunkData *chunk, BBCMicroStateFileChunkID id, const LogSet &logs) {
+    if (!chunk) {
+        logs.e.f("bad state file: no %s chunk\n", GetBBCMicroStateFileChunkIDEnumName(id));
+        return false;
+    }
+
+    ChunkReader r(chunk->data, chunk->size, id, logs);
+
+    M6502 tmp;
+    r.GetRaw(&tmp, "M6502");
+    if (!r.IsGood()) {
+        return false;
+    }
+
+    tmp.tfn = GetM6502Fn(&r, logs);
+    tmp.ifn = GetM6502Fn(&r, logs);
+    tmp.interrupt_tfn = GetM6502Fn(&r, logs);
+    if (!r.IsGood() || !tmp.tfn) {
+        logs.e.f("bad state file: %s chunk: invalid 6502 state\n", GetBBCMicroStateFileChunkIDEnumName(id));
+        return false;
+    }
+
+    // The rest of the pointers come from the freshly initialised CPU.
+    tmp.fns = cpu->fns;
+    tmp.config = cpu->config;
+    tmp.ill_fn = cpu->ill_fn;
+    tmp.ill_context = cpu->ill_context;
+    tmp.context = cpu->context;
+
+    *cpu = tmp;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void AddPagedRAM(ChunkWriter *w, const PagedRAM &ram) {
+    w->data.resize(ram.GetSize());
+    ram.GetContents(w->data.data());
+}
+
+static bool GetPagedRAM(PagedRAM *ram, const ChunkData *chunk, BBCMicroStateFileChunkID id, const LogSet &logs) {
+    if (!chunk || chunk->size != ram->GetSize()) {
+        logs.e.f("bad state file: %s chunk missing or wrong size\n", GetBBCMicroStateFileChunkIDEnumName(id));
+        return false;
+    }
+
+    memcpy(ram->GetData(), chunk->data, chunk->size);
+
+    for (size_t i = 0; i < ram->GetNumBigPages(); ++i) {
+        ram->GetDirtyFlags()[i] = 1;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// The ROM isn't copied: it points into the file data, and keeps the file
+// alive. Saving replaces the file rather than overwriting it, so this is
+// safe even if the state is saved back over the file it was loaded from.
+template <size_t SIZE>
+static bool GetFixedSizeROM(std::shared_ptr<const std::array<uint8_t, SIZE>> *rom,
+                            const std::shared_ptr<const MappedFile> &file,
+                            const ChunkData *chunk,
+                            BBCMicroStateFileChunkID id,
+                            const LogSet &logs) {
+    static_assert(sizeof(std::array<uint8_t, SIZE>) == SIZE);
+
+    if (!chunk) {
+        rom->reset();
+        return true;
+    }
+
+    if (chunk->size != SIZE) {
+        logs.e.f("bad state file: %s chunk is %zu bytes; expected %zu bytes\n", GetBBCMicroStateFileChunkIDEnumName(id), chunk->size, SIZE);
+        return false;
+    }
+
+    *rom = std::shared_ptr<const std::array<uint8_t, SIZE>>(file, (const std::array<uint8_t, SIZE> *)chunk->data);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static std::shared_ptr<DiscImage> GetDiscContents(const BBCMicroStateFileDiscImage &disc_image, const ChunkData *chunk, const LogSet &logs) {
+    static constexpr size_t GEOMETRY_SIZE = 2 + 3 * 8;
+
+    ChunkReader r(chunk->data, chunk->size, BBCMicroStateFileChunkID_DiscContents, logs);
+
+    DiscGeometry geometry;
+    geometry.double_sided = !!r.Get8();
+    geometry.double_density = !!r.Get8();
+    geometry.num_tracks = (size_t)r.Get64();
+    geometry.sectors_per_track = (size_t)r.Get64();
+    geometry.bytes_per_sector = (size_t)r.Get64();
+    if (!r.IsGood()) {
+        return nullptr;
+    }
+
+    if (geometry.bytes_per_sector == 0) {
+        logs.e.f("bad state file: drive %d disc contents: invalid geometry\n", disc_image.drive);
+        return nullptr;
+    }
+
+    return MemoryDiscImage::LoadModifiedFromBuffer(disc_image.name,
+                                                   disc_image.load_method,
+                                                   chunk->data + GEOMETRY_SIZE,
+                                                   chunk->size - GEOMETRY_SIZE,
+                                                   geometry,
+                                                   logs);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool BBCMicroStateFile::Save(const std::string &path, const BBCMicroUniqueState &state, const LogSet &logs) {
+    if (!!state.disc_interface_extra_hardware) {
+        logs.e.f("can't save state: %s not supported\n", state.disc_interface->display_name.c_str());
+        return false;
+    }
+
+    std::vector<Chunk> chunks;
+
+    {
+        ChunkWriter *w = AddChunk(&chunks, BBCMicroStateFileChunkID_Machine, 0);
+
+        w->Add32((uint32_t)state.type->type_id);
+        w->Add32(state.init_flags);
+        w->Add32((uint32_t)state.parasite_type);
+        w->AddString(state.disc_interface ? state.disc_interface->config_name : std::string());
+    }
+
+    {
+        ChunkWriter *w = AddChunk(&chunks, BBCMicroStateFileChunkID_Hardware, 0);
+
+#define X(M) w->AddRaw(state.M);
+        HARDWARE_MEMBERS(X)
+#undef X
+
+        w->Add8(state.ext_mem.m_address_l);
+        w->Add8(state.ext_mem.m_address_h);
+    }
+
+    if (!AddM6502(AddChunk(&chunks, BBCMicroStateFileChunkID_HostCPU, 0), state.cpu, logs)) {
+        return false;
+    }
+
+    {
+        ChunkWriter *w = AddChunk(&chunks, BBCMicroStateFileChunkID_Drives, 0);
+
+        for (const BBCMicroState::DiscDrive &drive : state.drives) {
+            w->Add8(drive.motor);
+            w->Add8(drive.track);
+            w->Add32((uint32_t)drive.step_sound_index);
+            w->Add32((uint32_t)drive.seek_sound);
+            w->Add64(drive.seek_sound_index);
+            w->Add32((uint32_t)drive.spin_sound);
+            w->Add64(drive.spin_sound_index);
+            w->AddRaw(drive.noise);
+            w->Add8(drive.is_write_protected);
+
+            if (!!drive.disc_image) {
+                w->Add8(1);
+                w->AddString(drive.disc_image->GetName());
+                w->AddString(drive.disc_image->GetLoadMethod());
+                w->AddString(drive.disc_image->GetHash());
+            } else {
+                w->Add8(0);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < NUM_DRIVES; ++i) {
+        const BBCMicroState::DiscDrive &drive = state.drives[i];
+
+        std::vector<uint8_t> data;
+        DiscGeometry geometry;
+        if (!!drive.disc_image && drive.disc_image->GetModifiedContents(&data, &geometry)) {
+            ChunkWriter *w = AddChunk(&chunks, BBCMicroStateFileChunkID_DiscContents, i);
+
+            w->Add8(geometry.double_sided);
+            w->Add8(geometry.double_density);
+            w->Add64(geometry.num_tracks);
+            w->Add64(geometry.sectors_per_track);
+            w->Add64(geometry.bytes_per_sector);
+            w->AddBytes(data.data(), data.size());
+        }
+    }
+
+    if (!!state.paste_text) {
+        AddChunk(&chunks, BBCMicroStateFileChunkID_Paste, 0)->AddString(*state.paste_text);
+    }
+
+    if (!!state.os_buffer) {
+        AddChunk(&chunks, BBCMicroStateFileChunkID_OSROM, 0)->AddBytes(state.os_buffer->data(), state.os_buffer->size());
+    }
+
+    AddPagedRAM(AddChunk(&chunks, BBCMicroStateFileChunkID_RAM, 0), state.ram_buffer);
+
+    for (uint32_t bank = 0; bank < 16; ++bank) {
+        if (!!state.sideways_rom_buffers[bank]) {
+            const std::vector<uint8_t> &rom = *state.sideways_rom_buffers[bank];
+            AddChunk(&chunks, BBCMicroStateFileChunkID_SidewaysROM, bank)->AddBytes(rom.data(), rom.size());
+        }
+
+        if (state.sideways_ram_buffers[bank].GetSize() > 0) {
+            AddPagedRAM(AddChunk(&chunks, BBCMicroStateFileChunkID_SidewaysRAM, bank), state.sideways_ram_buffers[bank]);
+        }
+    }
+
+    if (state.parasite_type != BBCMicroParasiteType_None) {
+        if (!AddM6502(AddChunk(&chunks, BBCMicroStateFileChunkID_ParasiteCPU, 0), state.parasite_cpu, logs)) {
+            return false;
+        }
+
+        if (!!state.parasite_rom_buffer) {
+            AddChunk(&chunks, BBCMicroStateFileChunkID_ParasiteROM, 0)->AddBytes(state.parasite_rom_buffer->data(), state.parasite_rom_buffer->size());
+        }
+
+        AddPagedRAM(AddChunk(&chunks, BBCMicroStateFileChunkID_ParasiteRAM, 0), state.parasite_ram_buffer);
+    }
+
+    // Lay out the file.
+    std::vector<uint8_t> file(HEADER_SIZE + chunks.size() * DIRECTORY_ENTRY_SIZE);
+
+    memcpy(&file[0], MAGIC, sizeof MAGIC);
+    Store32LE(&file[8], FORMAT_VERSION);
+    memcpy(&file[12], &BYTE_ORDER_MARK, 4);
+    Store32LE(&file[16], (uint32_t)sizeof(BBCMicroState));
+    Store32LE(&file[20], (uint32_t)chunks.size());
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const Chunk *chunk = &chunks[i];
+        size_t size = chunk->writer.data.size();
+
+        size_t alignment = size >= MIN_LARGE_CHUNK_SIZE ? LARGE_CHUNK_ALIGNMENT : CHUNK_ALIGNMENT;
+        size_t offset = (file.size() + alignment - 1) / alignment * alignment;
+
+        uint8_t *entry = &file[HEADER_SIZE + i * DIRECTORY_ENTRY_SIZE];
+        Store32LE(entry + 0, (uint32_t)chunk->id);
+        Store32LE(entry + 4, chunk->index);
+        Store64LE(entry + 8, offset);
+        Store64LE(entry + 16, size);
+
+        file.resize(offset);
+        file.insert(file.end(), chunk->writer.data.begin(), chunk->writer.data.end());
+    }
+
+    if (!SaveFileReplacing(file, path, &logs)) {
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<BBCMicroUniqueState> BBCMicroStateFile::Load(const std::string &path,
+                                                             FindDiscImageFn find_disc_image_fn,
+                                                             void *find_disc_image_context,
+                                                             const LogSet &logs) {
+    if (!find_disc_image_fn) {
+        find_disc_image_fn = &FindDiscImageFile;
+    }
+
+    std::shared_ptr<const MappedFile> file = MappedFile::Open(path, &logs);
+    if (!file) {
+        return nullptr;
+    }
+
+    const uint8_t *data = file->GetData();
+    size_t size = file->GetSize();
+
+    if (size < HEADER_SIZE || memcmp(data, MAGIC, sizeof MAGIC) != 0) {
+        logs.e.f("not a state file: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    uint32_t version = Load32LE(data + 8);
+    uint32_t byte_order_mark;
+    memcpy(&byte_order_mark, data + 12, 4);
+    uint32_t state_size = Load32LE(data + 16);
+    if (version != FORMAT_VERSION || byte_order_mark != BYTE_ORDER_MARK || state_size != sizeof(BBCMicroState)) {
+        logs.e.f("state file was saved by a different build: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    uint32_t num_chunks = Load32LE(data + 20);
+    if ((size - HEADER_SIZE) / DIRECTORY_ENTRY_SIZE < num_chunks) {
+        logs.e.f("bad state file: chunk directory is truncated\n");
+        return nullptr;
+    }
+
+    std::map<std::pair<uint32_t, uint32_t>, ChunkData> chunks;
+    for (uint32_t i = 0; i < num_chunks; ++i) {
+        const uint8_t *entry = data + HEADER_SIZE + i * DIRECTORY_ENTRY_SIZE;
+        uint32_t id = Load32LE(entry + 0);
+        uint32_t index = Load32LE(entry + 4);
+        uint64_t offset = Load64LE(entry + 8);
+        uint64_t chunk_size = Load64LE(entry + 16);
+
+        if (offset > size || chunk_size > size - offset) {
+            logs.e.f("bad state file: %s chunk runs off end of file\n", GetBBCMicroStateFileChunkIDEnumName(id));
+            return nullptr;
+        }
+
+        chunks[{id, index}] = {data + offset, (size_t)chunk_size};
+    }
+
+    const ChunkData *machine_chunk = FindChunk(chunks, BBCMicroStateFileChunkID_Machine, 0);
+    if (!machine_chunk) {
+        logs.e.f("bad state file: no %s chunk\n", GetBBCMicroStateFileChunkIDEnumName(BBCMicroStateFileChunkID_Machine));
+        return nullptr;
+    }
+
+    ChunkReader machine_reader(machine_chunk->data, machine_chunk->size, BBCMicroStateFileChunkID_Machine, logs);
+    auto type_id = (BBCMicroTypeID)machine_reader.Get32();
+    uint32_t init_flags = machine_reader.Get32();
+    auto parasite_type = (BBCMicroParasiteType)machine_reader.Get32();
+    std::string disc_interface_config_name = machine_reader.GetString();
+    if (!machine_reader.IsGood()) {
+        return nullptr;
+    }
+
+    if (GetBBCMicroTypeIDEnumName(type_id)[0] == '?' ||
+        GetBBCMicroParasiteTypeEnumName(parasite_type)[0] == '?') {
+        logs.e.f("bad state file: invalid model\n");
+        return nullptr;
+    }
+
+    const DiscInterface *disc_interface = nullptr;
+    if (!disc_interface_config_name.empty()) {
+        disc_interface = FindDiscInterfaceByConfigName(disc_interface_config_name.c_str());
+        if (!disc_interface) {
+            logs.e.f("bad state file: unknown disc interface: %s\n", disc_interface_config_name.c_str());
+            return nullptr;
+        }
+    }
+
+    // The ROM types affect the BBCMicroType, but they're part of the paging
+    // state, so the type has to be recreated once that's been loaded.
+    static const ROMType ROM_TYPES[16] = {};
+
+    std::unique_ptr<BBCMicroUniqueState> state(new BBCMicroUniqueState(CreateBBCMicroType(type_id, ROM_TYPES),
+                                                                       disc_interface,
+                                                                       parasite_type,
+                                                                       std::vector<uint8_t>(),
+                                                                       init_flags,
+                                                                       nullptr,
+                                                                       CycleCount{0}));
+
+    if (!!state->disc_interface_extra_hardware) {
+        logs.e.f("bad state file: %s not supported\n", disc_interface->display_name.c_str());
+        return nullptr;
+    }
+
+    {
+        const ChunkData *chunk = FindChunk(chunks, BBCMicroStateFileChunkID_Hardware, 0);
+        if (!chunk) {
+            logs.e.f("bad state file: no %s chunk\n", GetBBCMicroStateFileChunkIDEnumName(BBCMicroStateFileChunkID_Hardware));
+            return nullptr;
+        }
+
+        ChunkReader r(chunk->data, chunk->size, BBCMicroStateFileChunkID_Hardware, logs);
+
+#define X(M) r.GetRaw(&state->M, #M);
+        HARDWARE_MEMBERS(X)
+#undef X
+
+        state->ext_mem.m_address_l = r.Get8();
+        state->ext_mem.m_address_h = r.Get8();
+
+        if (!r.IsGood()) {
+            return nullptr;
+        }
+
+        // The pointers in the raw images are from some other process, so
+        // reset them. The BBCMicro sets them up properly.
+        state->fdc.SetHandler(nullptr);
+        state->adc.SetHandler(nullptr, nullptr);
+        state->system_via.SetID(BBCMicroVIAID_SystemVIA, "SystemVIA");
+        state->user_via.SetID(BBCMicroVIAID_UserVIA, "UserVIA");
+        state->video_ula.InitStuff();
+        state->video_ula.SetPixelCache(nullptr);
+#if PCD8572_MOS510_DEBUG
+        state->eeprom.cpu = nullptr;
+#endif
+#if BBCMICRO_TRACE
+        state->crtc.SetTrace(nullptr, false, false);
+        state->system_via.SetTrace(nullptr, false);
+        state->user_via.SetTrace(nullptr, false);
+        state->fdc.SetTrace(nullptr);
+        state->rtc.SetTrace(nullptr);
+        state->video_ula.SetTrace(nullptr);
+        state->sn76489.SetTrace(nullptr);
+        state->adc.SetTrace(nullptr);
+        SetTubeTrace(&state->parasite_tube, nullptr);
+        SetPCD8572Trace(&state->eeprom, nullptr);
+#endif
+    }
+
+    state->type = CreateBBCMicroType(type_id, state->paging.rom_types);
+
+    if (!GetM6502(&state->cpu, FindChunk(chunks, BBCMicroStateFileChunkID_HostCPU, 0), BBCMicroStateFileChunkID_HostCPU, logs)) {
+        return nullptr;
+    }
+
+    {
+        const ChunkData *chunk = FindChunk(chunks, BBCMicroStateFileChunkID_Drives, 0);
+        if (!chunk) {
+            logs.e.f("bad state file: no %s chunk\n", GetBBCMicroStateFileChunkIDEnumName(BBCMicroStateFileChunkID_Drives));
+            return nullptr;
+        }
+
+        ChunkReader r(chunk->data, chunk->size, BBCMicroStateFileChunkID_Drives, logs);
+
+        for (int i = 0; i < NUM_DRIVES; ++i) {
+            BBCMicroState::DiscDrive *drive = &state->drives[i];
+
+            drive->motor = !!r.Get8();
+            drive->track = r.Get8();
+            drive->step_sound_index = (int)r.Get32();
+            drive->seek_sound = (DiscDriveSound)r.Get32();
+            drive->seek_sound_index = (size_t)r.Get64();
+            drive->spin_sound = (DiscDriveSound)r.Get32();
+            drive->spin_sound_index = (size_t)r.Get64();
+            r.GetRaw(&drive->noise, "noise");
+            drive->is_write_protected = !!r.Get8();
+
+            if (r.Get8()) {
+                BBCMicroStateFileDiscImage disc_image;
+                disc_image.drive = i;
+                disc_image.name = r.GetString();
+                disc_image.load_method = r.GetString();
+                disc_image.hash = r.GetString();
+                if (!r.IsGood()) {
+                    return nullptr;
+                }
+
+                if (const ChunkData *contents_chunk = FindChunk(chunks, BBCMicroStateFileChunkID_DiscContents, (uint32_t)i)) {
+                    drive->disc_image = GetDiscContents(disc_image, contents_chunk, logs);
+                } else {
+                    drive->disc_image = (*find_disc_image_fn)(disc_image, logs, find_disc_image_context);
+                }
+
+                if (!drive->disc_image) {
+                    return nullptr;
+                }
+            }
+        }
+
+        if (!r.IsGood()) {
+            return nullptr;
+        }
+    }
+
+    if (const ChunkData *chunk = FindChunk(chunks, BBCMicroStateFileChunkID_Paste, 0)) {
+        ChunkReader r(chunk->data, chunk->size, BBCMicroStateFileChunkID_Paste, logs);
+
+        auto paste_text = std::make_shared<std::string>(r.GetString());
+        if (!r.IsGood()) {
+            return nullptr;
+        }
+
+        state->paste_text = std::move(paste_text);
+    }
+
+    if (!GetFixedSizeROM(&state->os_buffer, file, FindChunk(chunks, BBCMicroStateFileChunkID_OSROM, 0), BBCMicroStateFileChunkID_OSROM, logs)) {
+        return nullptr;
+    }
+
+    if (!GetPagedRAM(&state->ram_buffer, FindChunk(chunks, BBCMicroStateFileChunkID_RAM, 0), BBCMicroStateFileChunkID_RAM, logs)) {
+        return nullptr;
+    }
+
+    for (uint32_t bank = 0; bank < 16; ++bank) {
+        if (const ChunkData *chunk = FindChunk(chunks, BBCMicroStateFileChunkID_SidewaysROM, bank)) {
+            state->sideways_rom_buffers[bank] = std::make_shared<std::vector<uint8_t>>(chunk->data, chunk->data + chunk->size);
+        }
+
+        if (const ChunkData *chunk = FindChunk(chunks, BBCMicroStateFileChunkID_SidewaysRAM, bank)) {
+            state->sideways_ram_buffers[bank] = PagedRAM(16384);
+            if (!GetPagedRAM(&state->sideways_ram_buffers[bank], chunk, BBCMicroStateFileChunkID_SidewaysRAM, logs)) {
+                return nullptr;
+            }
+        }
+    }
+
+    if (state->parasite_type != BBCMicroParasiteType_None) {
+        if (!GetM6502(&state->parasite_cpu, FindChunk(chunks, BBCMicroStateFileChunkID_ParasiteCPU, 0), BBCMicroStateFileChunkID_ParasiteCPU, logs)) {
+            return nullptr;
+        }
+
+        if (!GetFixedSizeROM(&state->parasite_rom_buffer, file, FindChunk(chunks, BBCMicroStateFileChunkID_ParasiteROM, 0), BBCMicroStateFileChunkID_ParasiteROM, logs)) {
+            return nullptr;
+        }
+
+        if (!GetPagedRAM(&state->parasite_ram_buffer, FindChunk(chunks, BBCMicroStateFileChunkID_ParasiteRAM, 0), BBCMicroStateFileChunkID_ParasiteRAM, logs)) {
+            return nullptr;
+        }
+    }
+
+    return state;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<DiscImage> BBCMicroStateFile::FindDiscImageFile(const BBCMicroStateFileDiscImage &disc_image, const LogSet &logs, void *context) {
+    (void)context;
+
+    if (disc_image.load_method != MemoryDiscImage::LOAD_METHOD_FILE) {
+        logs.e.f("can't find drive %d disc image: %s (load method: %s)\n", disc_image.drive, disc_image.name.c_str(), disc_image.load_method.c_str());
+        return nullptr;
+    }
+
+    std::vector<uint8_t> data;
+    if (!LoadFile(&data, disc_image.name, &logs)) {
+        return nullptr;
+    }
+
+    DiscGeometry geometry;
+    if (!FindDiscGeometryFromFileDetails(&geometry, disc_image.name.c_str(), data.size(), &logs)) {
+        return nullptr;
+    }
+
+    std::shared_ptr<DiscImage> result = MemoryDiscImage::LoadFromBuffer(disc_image.name, MemoryDiscImage::LOAD_METHOD_FILE, data.data(), data.size(), geometry, logs);
+    if (!result) {
+        return nullptr;
+    }
+
+    if (result->GetHash() != disc_image.hash) {
+        logs.e.f("drive %d disc image has changed since the state was saved: %s\n", disc_image.drive, disc_image.name.c_str());
+        return nullptr;
+    }
+
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
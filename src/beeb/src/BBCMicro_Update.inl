@@ -4,6 +4,7 @@
 #include <beeb/BeebLink.h>
 #include <beeb/sound.h>
 #include <beeb/Trace.h>
+#include <beeb/GuestProfile.h>
 
 #include <shared/enum_decl.h>
 #include "BBCMicro_private.inl"
@@ -211,6 +212,7 @@ uint32_t BBCMicro::UpdateTemplated(VideoDataUnit *video_unit, SoundDataUnit *sou
                 }
             } else {
                 m_parasite_ram[m_state.parasite_cpu.abus.w] = m_state.parasite_cpu.dbus;
+                m_parasite_ram_dirty_flags[m_state.parasite_cpu.abus.p.p] = 1;
             }
 
 #if BBCMICRO_DEBUGGER
@@ -255,6 +257,23 @@ uint32_t BBCMicro::UpdateTemplated(VideoDataUnit *video_unit, SoundDataUnit *sou
 #endif
         }
 
+#if BBCMICRO_DEBUGGER
+        if constexpr ((UPDATE_FLAGS & BBCMicroUpdateFlag_Hacks) != 0) {
+            if (m_is_guest_profiling) {
+                if (M6502_IsAboutToExecute(&m_state.parasite_cpu)) {
+                    BigPageIndex big_page_index;
+                    if (m_state.parasite_boot_mode && m_state.parasite_cpu.abus.p.p == 0xf) {
+                        big_page_index = PARASITE_ROM_BIG_PAGE_INDEX;
+                    } else {
+                        big_page_index.i = PARASITE_BIG_PAGE_INDEX.i + m_state.parasite_cpu.abus.p.p;
+                    }
+
+                    m_guest_profile->AddInstruction(GuestProfileCPU_Parasite, big_page_index, m_state.parasite_cpu.abus.p.o, m_state.cycle_count);
+                }
+            }
+        }
+#endif
+
         if constexpr ((UPDATE_FLAGS & BBCMicroUpdateFlag_DebugStepParasite) != 0) {
 #if BBCMICRO_DEBUGGER
             this->DebugHandleStep();
@@ -266,10 +285,12 @@ parasite_update_done:
 
     if (!phi2_2MHz_trailing_edge) {
 #if VIDEO_TRACK_METADATA
-        video_unit->metadata.flags = 0;
+        if (!m_catch_up_mode) {
+            video_unit->metadata.flags = 0;
 
-        if (phi2_1MHz_trailing_edge) {
-            video_unit->metadata.flags |= VideoDataUnitMetadataFlag_OddCycle;
+            if (phi2_1MHz_trailing_edge) {
+                video_unit->metadata.flags |= VideoDataUnitMetadataFlag_OddCycle;
+            }
         }
 #endif
 
@@ -517,6 +538,7 @@ parasite_update_done:
                     (*write_mmio->fn)(write_mmio->context, m_state.cpu.abus, m_state.cpu.dbus);
                 } else {
                     m_pc_mem_big_pages[m_state.cpu.opcode_pc.p.p]->w[m_state.cpu.abus.p.p][m_state.cpu.abus.p.o] = m_state.cpu.dbus;
+                    *m_pc_mem_big_pages[m_state.cpu.opcode_pc.p.p]->dirty[m_state.cpu.abus.p.p] = 1;
                 }
 
 #if BBCMICRO_DEBUGGER
@@ -533,6 +555,13 @@ parasite_update_done:
 
             if constexpr ((UPDATE_FLAGS & BBCMicroUpdateFlag_Hacks) != 0) {
                 if (M6502_IsAboutToExecute(&m_state.cpu)) {
+#if BBCMICRO_DEBUGGER
+                    if (m_is_guest_profiling) {
+                        const BigPage *bp = m_pc_mem_big_pages[m_state.cpu.abus.p.p]->bp[m_state.cpu.abus.p.p];
+                        m_guest_profile->AddInstruction(GuestProfileCPU_Host, bp->index, m_state.cpu.abus.p.o, m_state.cycle_count);
+                    }
+#endif
+
                     if (!m_host_instruction_fns.empty()) {
 
                         // This is a bit bizarre, but I just can't stomach the
@@ -647,30 +676,6 @@ parasite_update_done:
         if (m_state.video_ula.control.bits.fast_6845 | phi2_1MHz_trailing_edge) {
             const CRTC::Output output = m_state.crtc.Update(m_state.system_via.b.c2);
 
-            uint16_t addr = (uint16_t)output.address;
-
-            if (addr & 0x2000) {
-                addr = (addr & 0x3ff) | m_teletext_bases[addr >> 11 & 1];
-            } else {
-                if (addr & 0x1000) {
-                    addr -= SCREEN_WRAP_ADJUSTMENTS[m_state.addressable_latch.bits.screen_base];
-                    addr &= ~0x1000u;
-                }
-
-                addr <<= 3;
-
-                // When output.raster>=8, this address is bogus. There's a
-                // check later.
-                addr |= output.raster & 7;
-            }
-
-            ASSERTF(addr < 32768, "output: hsync=%u vsync=%u display=%u address=0x%x raster=%u; addr=0x%x; latch screen_base=%u\n",
-                    output.hsync, output.vsync, output.display, output.address, output.raster,
-                    addr,
-                    m_state.addressable_latch.bits.screen_base);
-            addr |= m_state.shadow_select_mask;
-
-            // Teletext update.
             if (phi2_1MHz_trailing_edge) {
                 if (output.vsync) {
                     if (!m_state.crtc_last_output.vsync) {
@@ -680,122 +685,154 @@ parasite_update_done:
                         m_state.saa5050.VSync();
                     }
                 }
+            }
 
-                if (m_state.video_ula.control.bits.teletext) {
-                    // Teletext line boundary stuff.
-                    //
-                    // The hsync output is linked up to the SAA505's GLR
-                    // ("General line reset") pin, which sounds like it should
-                    // do line stuff. The data sheet is a bit vague, though:
-                    // "required for internal synchronization of remote control
-                    // data signals"...??
-                    //
-                    // https://github.com/mist-devel/mist-board/blob/f6cc6ff597c22bdd8b002c04c331619a9767eae0/cores/bbc/rtl/saa5050/saa5050.v
-                    // seems to ignore it completely, and does everything based
-                    // on the LOSE pin, connected to 6845 DISPEN/DISPTMSG. So
-                    // that's what this does...
-                    //
-                    // (Evidence in favour of this: normally, R5 doesn't affect
-                    // the teletext chars, even though it must vary the number
-                    // of hsyncs between vsync and the first visible scanline.
-                    // But after setting R6=255, changing R5 does have an
-                    // affect, suggesting that DISPTMSG transitions are being
-                    // counted and hsyncs aren't.)
-                    if (output.display) {
-                        if (!m_state.crtc_last_output.display) {
-                            m_state.saa5050.StartOfLine();
-                        }
-                    } else {
-                        m_state.ic15_byte |= 0x40;
+            // In catch-up mode, the CRTC output is needed only for its effect
+            // on the system VIA. The rest is purely for the display.
+            if (!m_catch_up_mode) {
+                uint16_t addr = (uint16_t)output.address;
 
-                        if (m_state.crtc_last_output.display) {
-                            m_state.saa5050.EndOfLine();
-                        }
+                if (addr & 0x2000) {
+                    addr = (addr & 0x3ff) | m_teletext_bases[addr >> 11 & 1];
+                } else {
+                    if (addr & 0x1000) {
+                        addr -= SCREEN_WRAP_ADJUSTMENTS[m_state.addressable_latch.bits.screen_base];
+                        addr &= ~0x1000u;
                     }
-                }
 
-                m_state.saa5050.Byte(m_state.ic15_byte, output.display);
+                    addr <<= 3;
 
-                if (output.address & 0x2000) {
-                    m_state.ic15_byte = m_ram[addr];
-                } else {
-                    m_state.ic15_byte = 0;
+                    // When output.raster>=8, this address is bogus. There's a
+                    // check later.
+                    addr |= output.raster & 7;
                 }
 
+                ASSERTF(addr < 32768, "output: hsync=%u vsync=%u display=%u address=0x%x raster=%u; addr=0x%x; latch screen_base=%u\n",
+                        output.hsync, output.vsync, output.display, output.address, output.raster,
+                        addr,
+                        m_state.addressable_latch.bits.screen_base);
+                addr |= m_state.shadow_select_mask;
+
+                // Teletext update.
+                if (phi2_1MHz_trailing_edge) {
+                    if (m_state.video_ula.control.bits.teletext) {
+                        // Teletext line boundary stuff.
+                        //
+                        // The hsync output is linked up to the SAA505's GLR
+                        // ("General line reset") pin, which sounds like it should
+                        // do line stuff. The data sheet is a bit vague, though:
+                        // "required for internal synchronization of remote control
+                        // data signals"...??
+                        //
+                        // https://github.com/mist-devel/mist-board/blob/f6cc6ff597c22bdd8b002c04c331619a9767eae0/cores/bbc/rtl/saa5050/saa5050.v
+                        // seems to ignore it completely, and does everything based
+                        // on the LOSE pin, connected to 6845 DISPEN/DISPTMSG. So
+                        // that's what this does...
+                        //
+                        // (Evidence in favour of this: normally, R5 doesn't affect
+                        // the teletext chars, even though it must vary the number
+                        // of hsyncs between vsync and the first visible scanline.
+                        // But after setting R6=255, changing R5 does have an
+                        // affect, suggesting that DISPTMSG transitions are being
+                        // counted and hsyncs aren't.)
+                        if (output.display) {
+                            if (!m_state.crtc_last_output.display) {
+                                m_state.saa5050.StartOfLine();
+                            }
+                        } else {
+                            m_state.ic15_byte |= 0x40;
+
+                            if (m_state.crtc_last_output.display) {
+                                m_state.saa5050.EndOfLine();
+                            }
+                        }
+                    }
+
+                    m_state.saa5050.Byte(m_state.ic15_byte, output.display);
+
+                    if (output.address & 0x2000) {
+                        m_state.ic15_byte = m_ram[addr];
+                    } else {
+                        m_state.ic15_byte = 0;
+                    }
+
 #if VIDEO_TRACK_METADATA
-                video_unit->metadata.flags |= VideoDataUnitMetadataFlag_HasValue;
-                video_unit->metadata.value = m_state.ic15_byte;
+                    video_unit->metadata.flags |= VideoDataUnitMetadataFlag_HasValue;
+                    video_unit->metadata.value = m_state.ic15_byte;
 #endif
-            }
+                }
 
-            uint8_t value = m_ram[addr];
+                uint8_t value = m_ram[addr];
 
-            if (!m_state.video_ula.control.bits.teletext) {
-                if (!m_state.crtc_last_output.display) {
-                    m_state.video_ula.DisplayEnabled();
-                }
+                if (!m_state.video_ula.control.bits.teletext) {
+                    if (!m_state.crtc_last_output.display) {
+                        m_state.video_ula.DisplayEnabled();
+                    }
 
 #if VIDEO_TRACK_METADATA
-                video_unit->metadata.flags |= VideoDataUnitMetadataFlag_HasValue;
-                video_unit->metadata.value = value;
+                    video_unit->metadata.flags |= VideoDataUnitMetadataFlag_HasValue;
+                    video_unit->metadata.value = value;
 #endif
-            }
+                }
 
-            // Do this even in teletext mode - the cursor flag then sets up the
-            // new cursor state. The byte value only sets some state, so no harm
-            // in doing it.
-            m_state.video_ula.Byte(value, output.cudisp & m_cursor_mask);
+                // Do this even in teletext mode - the cursor flag then sets up the
+                // new cursor state. The byte value only sets some state, so no harm
+                // in doing it.
+                m_state.video_ula.Byte(value, output.cudisp & m_cursor_mask);
 
 #if VIDEO_TRACK_METADATA
-            video_unit->metadata.flags |= VideoDataUnitMetadataFlag_HasAddress;
-            video_unit->metadata.address = addr;
-            video_unit->metadata.crtc_address = output.address;
+                video_unit->metadata.flags |= VideoDataUnitMetadataFlag_HasAddress;
+                video_unit->metadata.address = addr;
+                video_unit->metadata.crtc_address = output.address;
 #endif
+            }
 
             m_state.crtc_last_output = output;
         }
 
 // Update display output.
 //if(m_state.crtc_last_output.display) {
+        if (!m_catch_up_mode) {
 #if VIDEO_TRACK_METADATA
-        if (m_state.crtc_last_output.raster == 0) {
-            video_unit->metadata.flags |= VideoDataUnitMetadataFlag_6845Raster0;
-        }
+            if (m_state.crtc_last_output.raster == 0) {
+                video_unit->metadata.flags |= VideoDataUnitMetadataFlag_6845Raster0;
+            }
 
-        if (m_state.crtc_last_output.display) {
-            video_unit->metadata.flags |= VideoDataUnitMetadataFlag_6845DISPEN;
-        }
+            if (m_state.crtc_last_output.display) {
+                video_unit->metadata.flags |= VideoDataUnitMetadataFlag_6845DISPEN;
+            }
 
-        if (m_state.crtc_last_output.cudisp) {
-            video_unit->metadata.flags |= VideoDataUnitMetadataFlag_6845CUDISP;
-        }
+            if (m_state.crtc_last_output.cudisp) {
+                video_unit->metadata.flags |= VideoDataUnitMetadataFlag_6845CUDISP;
+            }
 #endif
 
-        if (m_state.video_ula.control.bits.teletext) {
-            m_state.saa5050.EmitPixels(&video_unit->pixels, m_state.video_ula.output_palette);
+            if (m_state.video_ula.control.bits.teletext) {
+                m_state.saa5050.EmitPixels(&video_unit->pixels, m_state.video_ula.output_palette);
 
-            if (m_state.video_ula.cursor_pattern & 1) {
-                video_unit->pixels.pixels[0].all ^= 0x0fff;
-                video_unit->pixels.pixels[1].all ^= 0x0fff;
-            }
+                if (m_state.video_ula.cursor_pattern & 1) {
+                    video_unit->pixels.pixels[0].all ^= 0x0fff;
+                    video_unit->pixels.pixels[1].all ^= 0x0fff;
+                }
 
-            m_state.video_ula.cursor_pattern >>= 1;
-        } else {
-            if (m_state.crtc_last_output.display && m_state.crtc_last_output.raster < 8) {
-                m_state.video_ula.EmitPixels(&video_unit->pixels);
+                m_state.video_ula.cursor_pattern >>= 1;
             } else {
-                m_state.video_ula.EmitBlank(&video_unit->pixels);
+                if (m_state.crtc_last_output.display && m_state.crtc_last_output.raster < 8) {
+                    m_state.video_ula.EmitPixels(&video_unit->pixels);
+                } else {
+                    m_state.video_ula.EmitBlank(&video_unit->pixels);
+                }
             }
-        }
 
-        video_unit->pixels.pixels[1].bits.x = 0;
+            video_unit->pixels.pixels[1].bits.x = 0;
 
-        if (m_state.crtc_last_output.hsync) {
-            video_unit->pixels.pixels[1].bits.x |= VideoDataUnitFlag_HSync;
-        }
+            if (m_state.crtc_last_output.hsync) {
+                video_unit->pixels.pixels[1].bits.x |= VideoDataUnitFlag_HSync;
+            }
 
-        if (m_state.crtc_last_output.vsync) {
-            video_unit->pixels.pixels[1].bits.x |= VideoDataUnitFlag_VSync;
+            if (m_state.crtc_last_output.vsync) {
+                video_unit->pixels.pixels[1].bits.x |= VideoDataUnitFlag_VSync;
+            }
         }
 
         result |= BBCMicroUpdateResultFlag_VideoUnit;
@@ -978,13 +1015,32 @@ parasite_update_done:
 
         // Update sound.
         if ((m_state.cycle_count.n & ((1 << LSHIFT_SOUND_CLOCK_TO_CYCLE_COUNT) - 1)) == 0) {
-            sound_unit->sn_output = m_state.sn76489.Update(!m_state.addressable_latch.bits.not_sound_write,
-                                                           m_state.system_via.a.p);
+            if (m_catch_up_mode) {
+                // The SN76489 only needs updating properly when written to.
+                // The disc drive sounds are purely for the output.
+                if (!m_state.addressable_latch.bits.not_sound_write) {
+                    m_state.sn76489.Update(true, m_state.system_via.a.p);
+                } else {
+                    m_state.sn76489.Skip();
+                }
+            } else {
+                sound_unit->sn_output = m_state.sn76489.Update(!m_state.addressable_latch.bits.not_sound_write,
+                                                               m_state.system_via.a.p);
 
-            sound_unit->disc_drive_sound = this->UpdateDiscDriveSound(&m_state.drives[0]);
-            sound_unit->disc_drive_sound += this->UpdateDiscDriveSound(&m_state.drives[1]);
+                sound_unit->disc_drive_sound = this->UpdateDiscDriveSound(&m_state.drives[0]);
+                sound_unit->disc_drive_sound += this->UpdateDiscDriveSound(&m_state.drives[1]);
+            }
             result |= BBCMicroUpdateResultFlag_AudioUnit;
 
+#if BBCMICRO_DEBUGGER
+            if (m_profile) {
+                static_assert(PROFILE_SAMPLE_CYCLE_MASK >= (1 << LSHIFT_SOUND_CLOCK_TO_CYCLE_COUNT) - 1);
+                if ((m_state.cycle_count.n & PROFILE_SAMPLE_CYCLE_MASK) == 0) {
+                    this->ProfileSample();
+                }
+            }
+#endif
+
             if constexpr ((UPDATE_FLAGS & BBCMicroUpdateFlag_Mouse) != 0) {
                 static_assert(LSHIFT_MOUSE_CLOCK_TO_CYCLE_COUNT > LSHIFT_SOUND_CLOCK_TO_CYCLE_COUNT);
                 if ((m_state.cycle_count.n & ((1 << LSHIFT_MOUSE_CLOCK_TO_CYCLE_COUNT) - 1)) == 0) {
@@ -111,6 +111,8 @@ std::vector<FileDialogFilter> DirectDiscImage::GetFileDialogFilters() const {
 //////////////////////////////////////////////////////////////////////////
 
 bool DirectDiscImage::SaveToFile(const std::string &file_name, const LogSet &logs) const {
+    LockGuard<Mutex> lock(m_mutex);
+
     this->Close();
 
     std::vector<uint8_t> data;
@@ -133,6 +135,8 @@ bool DirectDiscImage::Read(uint8_t *value,
                            uint8_t track,
                            uint8_t sector,
                            size_t offset) const {
+    LockGuard<Mutex> lock(m_mutex);
+
     if (!this->fopenAndSeek(false, side, track, sector, offset)) {
         return false;
     }
@@ -160,6 +164,8 @@ bool DirectDiscImage::Write(uint8_t side,
                             uint8_t sector,
                             size_t offset,
                             uint8_t value) {
+    LockGuard<Mutex> lock(m_mutex);
+
     if (!this->fopenAndSeek(true, side, track, sector, offset)) {
         return false;
     }
@@ -176,6 +182,8 @@ bool DirectDiscImage::Write(uint8_t side,
 //////////////////////////////////////////////////////////////////////////
 
 void DirectDiscImage::Flush() {
+    LockGuard<Mutex> lock(m_mutex);
+
     this->Close();
 }
 
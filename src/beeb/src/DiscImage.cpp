@@ -64,3 +64,12 @@ DiscImageSummary DiscImage::GetSummary() const {
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
+
+bool DiscImage::GetModifiedContents(std::vector<uint8_t> *data, DiscGeometry *geometry) const {
+    (void)data, (void)geometry;
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
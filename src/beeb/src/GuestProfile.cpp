@@ -0,0 +1,362 @@
+#include <shared/system.h>
+#include <shared/debug.h>
+#include <beeb/GuestProfile.h>
+#include <beeb/6502.h>
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+GuestProfile::GuestProfile() = default;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+GuestProfile::~GuestProfile() = default;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void GuestProfile::Break() {
+    for (Current &current : m_current) {
+        current.valid = false;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+const GuestProfile::BigPage *GuestProfile::GetBigPage(BigPageIndex big_page_index) const {
+    ASSERT(big_page_index.i < NUM_BIG_PAGES);
+    return m_big_pages[big_page_index.i].get();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+GuestProfile::BigPage *GuestProfile::AllocBigPage(BigPageIndex big_page_index) {
+    ASSERT(big_page_index.i < NUM_BIG_PAGES);
+    ASSERT(!m_big_pages[big_page_index.i]);
+
+    m_big_pages[big_page_index.i] = std::make_unique<BigPage>();
+    return m_big_pages[big_page_index.i].get();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Disassembles the instruction at offset in data. Any bytes beyond the end of
+// the big page are shown as ??.
+static std::string DisassembleInstruction(const M6502Config *config, const uint8_t *data, uint16_t offset, uint16_t addr) {
+    if (!data) {
+        return "???";
+    }
+
+    uint8_t opcode = data[offset];
+    const M6502DisassemblyInfo *di = &config->disassembly_info[opcode];
+
+    char operand[50];
+    if (offset + di->num_bytes > BIG_PAGE_SIZE_BYTES) {
+        snprintf(operand, sizeof operand, "??");
+    } else {
+        uint8_t b1 = data[(offset + 1) % BIG_PAGE_SIZE_BYTES];
+        uint8_t b2 = data[(offset + 2) % BIG_PAGE_SIZE_BYTES];
+        uint16_t w = (uint16_t)(b1 | b2 << 8);
+
+        switch (di->mode) {
+        default:
+            ASSERT(false);
+            // fall through
+        case M6502AddrMode_IMP:
+            operand[0] = 0;
+            break;
+
+        case M6502AddrMode_IMM:
+            snprintf(operand, sizeof operand, "#$%02x", b1);
+            break;
+
+        case M6502AddrMode_REL:
+            snprintf(operand, sizeof operand, "$%04x", (uint16_t)(addr + 2 + (int8_t)b1));
+            break;
+
+        case M6502AddrMode_ZPG:
+            snprintf(operand, sizeof operand, "$%02x", b1);
+            break;
+
+        case M6502AddrMode_ZPX:
+            snprintf(operand, sizeof operand, "$%02x,X", b1);
+            break;
+
+        case M6502AddrMode_ZPY:
+            snprintf(operand, sizeof operand, "$%02x,Y", b1);
+            break;
+
+        case M6502AddrMode_INX:
+            snprintf(operand, sizeof operand, "($%02x,X)", b1);
+            break;
+
+        case M6502AddrMode_INY:
+            snprintf(operand, sizeof operand, "($%02x),Y", b1);
+            break;
+
+        case M6502AddrMode_ABS:
+            snprintf(operand, sizeof operand, "$%04x", w);
+            break;
+
+        case M6502AddrMode_ABX:
+            snprintf(operand, sizeof operand, "$%04x,X", w);
+            break;
+
+        case M6502AddrMode_ABY:
+            snprintf(operand, sizeof operand, "$%04x,Y", w);
+            break;
+
+        case M6502AddrMode_IND:
+            snprintf(operand, sizeof operand, "($%04x)", w);
+            break;
+
+        case M6502AddrMode_ACC:
+            snprintf(operand, sizeof operand, "A");
+            break;
+
+        case M6502AddrMode_INZ:
+            snprintf(operand, sizeof operand, "($%02x)", b1);
+            break;
+
+        case M6502AddrMode_INDX:
+            snprintf(operand, sizeof operand, "($%04x,X)", w);
+            break;
+
+        case M6502AddrMode_ZPG_REL_ROCKWELL:
+            snprintf(operand, sizeof operand, "$%02x,$%04x", b1, (uint16_t)(addr + 3 + (int8_t)b2));
+            break;
+        }
+    }
+
+    std::string result = di->mnemonic;
+    if (operand[0] != 0) {
+        result += " ";
+        result += operand;
+    }
+
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// If the instruction at offset in data could go backwards to somewhere else in
+// the same big page, returns true and fills in *dest_offset.
+static bool GetBackwardsDestOffset(uint16_t *dest_offset, const M6502Config *config, const uint8_t *data, uint16_t big_page_addr, uint16_t offset) {
+    if (!data) {
+        return false;
+    }
+
+    uint8_t opcode = data[offset];
+    const M6502DisassemblyInfo *di = &config->disassembly_info[opcode];
+
+    if (offset + di->num_bytes > BIG_PAGE_SIZE_BYTES) {
+        return false;
+    }
+
+    int dest;
+    if (di->mode == M6502AddrMode_REL) {
+        dest = offset + 2 + (int8_t)data[offset + 1];
+    } else if (di->mode == M6502AddrMode_ZPG_REL_ROCKWELL) {
+        dest = offset + 3 + (int8_t)data[offset + 2];
+    } else if (opcode == 0x4c) {
+        // JMP abs
+        dest = (data[offset + 1] | data[offset + 2] << 8) - big_page_addr;
+    } else {
+        return false;
+    }
+
+    if (dest < 0 || dest > offset) {
+        return false;
+    }
+
+    *dest_offset = (uint16_t)dest;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<GuestProfileReport> CreateGuestProfileReport(const GuestProfile &profile,
+                                                             std::shared_ptr<const BBCMicroType> type,
+                                                             const M6502Config *parasite_m6502_config,
+                                                             const std::function<const uint8_t *(BigPageIndex)> &get_big_page_data) {
+    auto report = std::make_unique<GuestProfileReport>();
+    report->type = std::move(type);
+
+    // Collect the instructions.
+    for (BigPageIndex::Type i = 0; i < NUM_BIG_PAGES; ++i) {
+        BigPageIndex big_page_index = {i};
+
+        const GuestProfile::BigPage *bp = profile.GetBigPage(big_page_index);
+        if (!bp) {
+            continue;
+        }
+
+        const BigPageMetadata *metadata = &report->type->big_pages_metadata[i];
+
+        GuestProfileCPU cpu;
+        const M6502Config *config;
+        uint64_t rshift;
+        if (metadata->is_parasite) {
+            cpu = GuestProfileCPU_Parasite;
+            config = parasite_m6502_config;
+            rshift = RSHIFT_CYCLE_COUNT_TO_4MHZ;
+        } else {
+            cpu = GuestProfileCPU_Host;
+            config = report->type->m6502_config;
+            rshift = RSHIFT_CYCLE_COUNT_TO_2MHZ;
+        }
+
+        if (!config) {
+            continue;
+        }
+
+        const uint8_t *data = get_big_page_data(big_page_index);
+
+        size_t big_page_begin_index = report->instructions.size();
+
+        for (uint16_t offset = 0; offset < BIG_PAGE_SIZE_BYTES; ++offset) {
+            if (bp->num_executions[offset] == 0) {
+                continue;
+            }
+
+            GuestProfileReport::Instruction instruction;
+            instruction.cpu = cpu;
+            instruction.big_page_index = big_page_index;
+            instruction.addr = (uint16_t)(metadata->addr + offset);
+            instruction.cycles = bp->cycles[offset] >> rshift;
+            instruction.num_executions = bp->num_executions[offset];
+            instruction.disassembly = DisassembleInstruction(config, data, offset, instruction.addr);
+
+            report->total_cycles[cpu] += instruction.cycles;
+            report->instructions.push_back(std::move(instruction));
+        }
+
+        // Find the loops in this big page. Whatever else is going on, there
+        // has to have been a backwards branch from the end of the loop, and
+        // something executed at its destination.
+        for (size_t end_index = big_page_begin_index; end_index < report->instructions.size(); ++end_index) {
+            const GuestProfileReport::Instruction *end = &report->instructions[end_index];
+            uint16_t end_offset = (uint16_t)(end->addr - metadata->addr);
+
+            uint16_t dest_offset;
+            if (!GetBackwardsDestOffset(&dest_offset, config, data, metadata->addr, end_offset)) {
+                continue;
+            }
+
+            size_t begin_index = end_index;
+            while (begin_index > big_page_begin_index && report->instructions[begin_index - 1].addr >= metadata->addr + dest_offset) {
+                --begin_index;
+            }
+
+            if (report->instructions[begin_index].addr != metadata->addr + dest_offset) {
+                // Never went there.
+                continue;
+            }
+
+            GuestProfileReport::Loop loop;
+            loop.cpu = cpu;
+            loop.big_page_index = big_page_index;
+            loop.begin_addr = report->instructions[begin_index].addr;
+            loop.end_addr = end->addr;
+            loop.num_branch_executions = end->num_executions;
+            loop.begin_index = begin_index;
+            loop.end_index = end_index + 1;
+
+            for (size_t j = loop.begin_index; j < loop.end_index; ++j) {
+                loop.cycles += report->instructions[j].cycles;
+            }
+
+            report->loops.push_back(loop);
+        }
+    }
+
+    for (GuestProfileReport::Instruction &instruction : report->instructions) {
+        if (report->total_cycles[instruction.cpu] > 0) {
+            instruction.fraction = (double)instruction.cycles / report->total_cycles[instruction.cpu];
+        }
+    }
+
+    for (GuestProfileReport::Loop &loop : report->loops) {
+        if (report->total_cycles[loop.cpu] > 0) {
+            loop.fraction = (double)loop.cycles / report->total_cycles[loop.cpu];
+        }
+    }
+
+    std::stable_sort(report->loops.begin(), report->loops.end(), [](const GuestProfileReport::Loop &a, const GuestProfileReport::Loop &b) {
+        return a.cycles > b.cycles;
+    });
+
+    // The innermost loop is the shortest one containing the instruction.
+    for (size_t loop_index = 0; loop_index < report->loops.size(); ++loop_index) {
+        const GuestProfileReport::Loop *loop = &report->loops[loop_index];
+
+        for (size_t i = loop->begin_index; i < loop->end_index; ++i) {
+            GuestProfileReport::Instruction *instruction = &report->instructions[i];
+
+            if (instruction->loop_index != SIZE_MAX) {
+                const GuestProfileReport::Loop *other = &report->loops[instruction->loop_index];
+                if (other->end_index - other->begin_index <= loop->end_index - loop->begin_index) {
+                    continue;
+                }
+            }
+
+            instruction->loop_index = loop_index;
+        }
+    }
+
+    report->hot_instructions.resize(report->instructions.size());
+    for (size_t i = 0; i < report->hot_instructions.size(); ++i) {
+        report->hot_instructions[i] = i;
+    }
+
+    std::stable_sort(report->hot_instructions.begin(), report->hot_instructions.end(), [&report](size_t a, size_t b) {
+        return report->instructions[a].cycles > report->instructions[b].cycles;
+    });
+
+    return report;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::string GetGuestProfileReportCSV(const GuestProfileReport &report) {
+    std::string csv = "CPU,Address,Big page,Cycles,Percent,Executions,Cycles per execution,Loop,Disassembly\n";
+
+    for (size_t index : report.hot_instructions) {
+        const GuestProfileReport::Instruction *instruction = &report.instructions[index];
+        const BigPageMetadata *metadata = &report.type->big_pages_metadata[instruction->big_page_index.i];
+
+        char loop[50] = {};
+        if (instruction->loop_index != SIZE_MAX) {
+            const GuestProfileReport::Loop *l = &report.loops[instruction->loop_index];
+            snprintf(loop, sizeof loop, "$%04x-$%04x", l->begin_addr, l->end_addr);
+        }
+
+        char line[500];
+        snprintf(line, sizeof line, "%s,$%04x,\"%s\",%" PRIu64 ",%.3f,%" PRIu64 ",%.2f,%s,\"%s\"\n",
+                 instruction->cpu == GuestProfileCPU_Parasite ? "Parasite" : "Host",
+                 instruction->addr,
+                 metadata->description.c_str(),
+                 instruction->cycles,
+                 instruction->fraction * 100.,
+                 instruction->num_executions,
+                 (double)instruction->cycles / instruction->num_executions,
+                 loop,
+                 instruction->disassembly.c_str());
+        csv += line;
+    }
+
+    return csv;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
@@ -54,6 +54,9 @@ struct MemoryDiscImage::Data {
     std::vector<uint8_t> data;
     std::string hash;
 
+    // Set if data has been written to since it was loaded.
+    bool modified = false;
+
     // (now go and fix up MakeDataUnique.)
 };
 
@@ -83,6 +86,26 @@ std::shared_ptr<MemoryDiscImage> MemoryDiscImage::LoadFromBuffer(
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+std::shared_ptr<MemoryDiscImage> MemoryDiscImage::LoadModifiedFromBuffer(
+    std::string path,
+    std::string load_method,
+    const void *data, size_t data_size,
+    const DiscGeometry &geometry,
+    const LogSet &logs) {
+    std::shared_ptr<MemoryDiscImage> result = LoadFromBuffer(std::move(path), std::move(load_method), data, data_size, geometry, logs);
+    if (!result) {
+        return nullptr;
+    }
+
+    // Nobody else can have a ref yet.
+    result->m_data->modified = true;
+
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 MemoryDiscImage::MemoryDiscImage()
     : m_data(new Data) {
 }
@@ -209,12 +232,30 @@ std::vector<FileDialogFilter> MemoryDiscImage::GetFileDialogFilters() const {
 //////////////////////////////////////////////////////////////////////////
 
 bool MemoryDiscImage::SaveToFile(const std::string &file_name, const LogSet &logs) const {
+    // The emulation thread may be writing to the disc while this happens.
+    LockGuard<Mutex> lock(m_data->mut);
+
     return SaveFile(m_data->data, file_name, &logs);
 }
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+bool MemoryDiscImage::GetModifiedContents(std::vector<uint8_t> *data, DiscGeometry *geometry) const {
+    LockGuard<Mutex> lock(m_data->mut);
+
+    if (!m_data->modified) {
+        return false;
+    }
+
+    *data = m_data->data;
+    *geometry = m_data->geometry;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 //void MemoryDiscImage::SetNameAndLoadMethod(std::string name,std::string load_method) {
 //    m_name=std::move(name);
 //    m_load_method=std::move(load_method);
@@ -265,11 +306,14 @@ bool MemoryDiscImage::Write(uint8_t side,
         // Round up to the next sector boundary, but don't try to be
         // any cleverer than that...
         m_data->data.resize((index + m_data->geometry.bytes_per_sector) / m_data->geometry.bytes_per_sector * m_data->geometry.bytes_per_sector, FILL_BYTE);
+        m_data->hash.clear();
+        m_data->modified = true;
     }
 
     if (m_data->data[index] != value) {
         m_data->data[index] = value;
         m_data->hash.clear();
+        m_data->modified = true;
     }
 
     return true;
@@ -329,6 +373,7 @@ void MemoryDiscImage::MakeDataUnique() {
 
         m_data->geometry = old_data->geometry;
         m_data->data = old_data->data;
+        m_data->modified = old_data->modified;
     }
 
     this->ReleaseData(&old_data);
@@ -0,0 +1,367 @@
+#include <shared/system.h>
+#include <shared/debug.h>
+#include <beeb/PagedRAM.h>
+#include <shared/mutex.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Guards every BigPage's compressed_base and compressed.
+static Mutex g_compressed_mutex;
+static MutexNameSetter g_compressed_mutex_name_setter(&g_compressed_mutex, "PagedRAM compressed");
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+PagedRAM::PagedRAM(size_t size)
+    : m_size(size) {
+    ASSERT(m_size % BIG_PAGE_SIZE_BYTES == 0);
+
+    // A new buffer shares a single zero page, and doesn't get its own copy of
+    // anything until needed.
+    if (m_size > 0) {
+        m_big_pages.resize(m_size / BIG_PAGE_SIZE_BYTES, GetZeroBigPage());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+PagedRAM::PagedRAM(const PagedRAM &src)
+    : m_size(src.m_size)
+    , m_big_pages(src.m_big_pages) {
+    if (!src.m_data.empty()) {
+        for (size_t i = 0; i < m_big_pages.size(); ++i) {
+            if (src.m_dirty_flags[i]) {
+                m_big_pages[i] = CreateBigPage(&src.m_data[i * BIG_PAGE_SIZE_BYTES]);
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+PagedRAM &PagedRAM::operator=(const PagedRAM &src) {
+    if (this != &src) {
+        PagedRAM tmp(src);
+
+        *this = std::move(tmp);
+    }
+
+    return *this;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+size_t PagedRAM::GetSize() const {
+    return m_size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+size_t PagedRAM::GetNumBigPages() const {
+    return m_big_pages.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+uint8_t *PagedRAM::GetData() {
+    if (m_size == 0) {
+        return nullptr;
+    }
+
+    if (m_data.empty()) {
+        m_data.resize(m_size);
+
+        for (size_t i = 0; i < m_big_pages.size(); ++i) {
+            GetBigPageContents(&m_data[i * BIG_PAGE_SIZE_BYTES], m_big_pages[i].get());
+        }
+
+        // The big pages are all in sync with the contiguous copy.
+        m_dirty_flags.clear();
+        m_dirty_flags.resize(m_big_pages.size(), 0);
+    }
+
+    return m_data.data();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+uint8_t *PagedRAM::GetDirtyFlags() {
+    ASSERT(!m_data.empty());
+
+    return m_dirty_flags.data();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+const uint8_t *PagedRAM::GetBigPage(size_t big_page_index) const {
+    ASSERT(big_page_index < m_big_pages.size());
+
+    if (!m_data.empty()) {
+        return &m_data[big_page_index * BIG_PAGE_SIZE_BYTES];
+    } else {
+        ASSERT(!m_big_pages[big_page_index]->bytes.empty());
+        return m_big_pages[big_page_index]->bytes.data();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void PagedRAM::GetContents(uint8_t *dest) const {
+    if (!m_data.empty()) {
+        memcpy(dest, m_data.data(), m_size);
+    } else {
+        for (size_t i = 0; i < m_big_pages.size(); ++i) {
+            GetBigPageContents(dest + i * BIG_PAGE_SIZE_BYTES, m_big_pages[i].get());
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void PagedRAM::Compress(const PagedRAM &keyframe) {
+    ASSERT(m_data.empty());
+
+    if (keyframe.m_size != m_size) {
+        return;
+    }
+
+    for (size_t i = 0; i < m_big_pages.size(); ++i) {
+        const std::shared_ptr<const BigPage> &base = keyframe.m_big_pages[i];
+        const BigPage *big_page = m_big_pages[i].get();
+
+        if (big_page == base.get()) {
+            // Shared, so already as small as it's going to get.
+            continue;
+        }
+
+        if (big_page->bytes.empty() || base->bytes.empty()) {
+            // Don't make chains of deltas.
+            continue;
+        }
+
+        std::shared_ptr<const BigPage> compressed;
+        {
+            LockGuard<Mutex> lock(g_compressed_mutex);
+
+            if (big_page->compressed_base.lock() == base) {
+                if (!big_page->compressed) {
+                    continue;
+                }
+
+                compressed = big_page->compressed;
+            }
+        }
+
+        if (!compressed) {
+            // Another thread might be doing the same thing. It'll come up
+            // with the same result, so it doesn't matter which one wins.
+            compressed = CompressBigPage(base, big_page);
+
+            LockGuard<Mutex> lock(g_compressed_mutex);
+
+            big_page->compressed_base = base;
+            big_page->compressed = compressed;
+        }
+
+        if (!!compressed) {
+            m_big_pages[i] = compressed;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void PagedRAM::Decompress() {
+    ASSERT(m_data.empty());
+
+    for (size_t i = 0; i < m_big_pages.size(); ++i) {
+        if (m_big_pages[i]->bytes.empty()) {
+            auto big_page = std::make_shared<BigPage>();
+            big_page->bytes.resize(BIG_PAGE_SIZE_BYTES);
+            GetBigPageContents(big_page->bytes.data(), m_big_pages[i].get());
+
+            m_big_pages[i] = std::move(big_page);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+size_t PagedRAM::GetNumUnsharedBytes(const PagedRAM *other) const {
+    if (other && other->m_size != m_size) {
+        other = nullptr;
+    }
+
+    size_t num_bytes = 0;
+
+    for (size_t i = 0; i < m_big_pages.size(); ++i) {
+        const BigPage *big_page = m_big_pages[i].get();
+
+        if (other && other->m_big_pages[i].get() == big_page) {
+            continue;
+        }
+
+        num_bytes += sizeof *big_page + big_page->bytes.size() + big_page->delta.size();
+    }
+
+    return num_bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void PagedRAM::UpdateBigPages() {
+    if (m_data.empty()) {
+        // The big pages are all there is.
+        return;
+    }
+
+    for (size_t i = 0; i < m_big_pages.size(); ++i) {
+        if (m_dirty_flags[i]) {
+            m_big_pages[i] = CreateBigPage(&m_data[i * BIG_PAGE_SIZE_BYTES]);
+            m_dirty_flags[i] = 0;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<const PagedRAM::BigPage> PagedRAM::CreateBigPage(const uint8_t *bytes) {
+    auto big_page = std::make_shared<BigPage>();
+    big_page->bytes.assign(bytes, bytes + BIG_PAGE_SIZE_BYTES);
+
+    return big_page;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<const PagedRAM::BigPage> PagedRAM::GetZeroBigPage() {
+    static const std::shared_ptr<const BigPage> ZERO_BIG_PAGE = [] {
+        auto big_page = std::make_shared<BigPage>();
+        big_page->bytes.resize(BIG_PAGE_SIZE_BYTES);
+        return big_page;
+    }();
+
+    return ZERO_BIG_PAGE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// The delta is a sequence of runs, each consisting of a 2-byte skip count, a
+// 2-byte literal count, then that many literal bytes. Skipped bytes are the
+// same as the base; literal bytes are XORed with the base.
+
+void PagedRAM::GetBigPageContents(uint8_t *dest, const BigPage *big_page) {
+    if (!big_page->bytes.empty()) {
+        ASSERT(big_page->bytes.size() == BIG_PAGE_SIZE_BYTES);
+        memcpy(dest, big_page->bytes.data(), BIG_PAGE_SIZE_BYTES);
+        return;
+    }
+
+    ASSERT(!!big_page->base);
+    GetBigPageContents(dest, big_page->base.get());
+
+    const uint8_t *p = big_page->delta.data();
+    const uint8_t *end = p + big_page->delta.size();
+    size_t offset = 0;
+
+    while (p < end) {
+        ASSERT(end - p >= 4);
+        size_t num_skip = (size_t)(p[0] | p[1] << 8);
+        size_t num_literal = (size_t)(p[2] | p[3] << 8);
+        p += 4;
+
+        offset += num_skip;
+        ASSERT(offset + num_literal <= BIG_PAGE_SIZE_BYTES);
+        ASSERT((size_t)(end - p) >= num_literal);
+
+        for (size_t i = 0; i < num_literal; ++i) {
+            dest[offset++] ^= *p++;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<const PagedRAM::BigPage> PagedRAM::CompressBigPage(const std::shared_ptr<const BigPage> &base, const BigPage *big_page) {
+    // Any bigger than this isn't worth it.
+    static constexpr size_t MAX_DELTA_SIZE_BYTES = BIG_PAGE_SIZE_BYTES / 2;
+
+    // A run of this many unchanged bytes is cheaper to skip than to include
+    // in a literal run.
+    static constexpr size_t MIN_SKIP = 4;
+
+    const uint8_t *a = base->bytes.data();
+    const uint8_t *b = big_page->bytes.data();
+
+    auto compressed = std::make_shared<BigPage>();
+    std::vector<uint8_t> *delta = &compressed->delta;
+
+    size_t i = 0;
+    while (i < BIG_PAGE_SIZE_BYTES) {
+        size_t skip_begin = i;
+        while (i < BIG_PAGE_SIZE_BYTES && a[i] == b[i]) {
+            ++i;
+        }
+
+        if (i == BIG_PAGE_SIZE_BYTES) {
+            break;
+        }
+
+        size_t literal_begin = i;
+        size_t num_same = 0;
+        while (i < BIG_PAGE_SIZE_BYTES && num_same < MIN_SKIP) {
+            if (a[i] == b[i]) {
+                ++num_same;
+            } else {
+                num_same = 0;
+            }
+
+            ++i;
+        }
+
+        // Leave the trailing unchanged bytes for the next skip.
+        i -= num_same;
+
+        size_t num_skip = literal_begin - skip_begin;
+        size_t num_literal = i - literal_begin;
+
+        delta->push_back((uint8_t)num_skip);
+        delta->push_back((uint8_t)(num_skip >> 8));
+        delta->push_back((uint8_t)num_literal);
+        delta->push_back((uint8_t)(num_literal >> 8));
+
+        for (size_t j = literal_begin; j < i; ++j) {
+            delta->push_back(a[j] ^ b[j]);
+        }
+
+        if (delta->size() > MAX_DELTA_SIZE_BYTES) {
+            return nullptr;
+        }
+    }
+
+    delta->shrink_to_fit();
+    compressed->base = base;
+
+    return compressed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
@@ -25,6 +25,7 @@ SN76489::SN76489() {
 
 void SN76489::Reset(bool tone) {
     m_state = State();
+    m_num_skipped_updates = 0;
 
     if (!tone) {
         for (size_t i = 0; i < 4; ++i) {
@@ -58,6 +59,10 @@ void SN76489::Reset(bool tone) {
 SN76489::Output SN76489::Update(bool write, uint8_t value) {
     Output output;
 
+    if (m_num_skipped_updates > 0) {
+        this->CatchUp();
+    }
+
     // Tone channels
     for (size_t i = 0; i < 3; ++i) {
         Channel *channel = &m_state.channels[i];
@@ -89,39 +94,8 @@ SN76489::Output SN76489::Update(bool write, uint8_t value) {
         }
 
         if (channel->counter == 0) {
-            m_state.noise_toggle = !m_state.noise_toggle;
-
-            if (m_state.noise_toggle) {
-                if (channel->values.freq & 4) {
-                    // White noise
-                    channel->mask = this->NextWhiteNoiseBit() ? 0xff : 0x00;
-                } else {
-                    // Periodic noise
-                    channel->mask = this->NextPeriodicNoiseBit() ? 0xff : 0x00;
-                }
-            }
-
-            switch (channel->values.freq & 3) {
-            case 3:
-                channel->counter = m_state.channels[2].values.freq;
-
-                if (channel->counter == 0) {
-                    channel->counter = 1024;
-                }
-                break;
-
-            case 2:
-                channel->counter = 0x40;
-                break;
-
-            case 1:
-                channel->counter = 0x20;
-                break;
-
-            case 0:
-                channel->counter = 0x10;
-                break;
-            }
+            this->UpdateNoiseMask();
+            channel->counter = this->GetNoisePeriod();
         }
 
         output.ch[3] = channel->values.vol & channel->mask;
@@ -194,6 +168,72 @@ SN76489::Output SN76489::Update(bool write, uint8_t value) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void SN76489::Skip() {
+    ++m_num_skipped_updates;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void SN76489::CatchUp() {
+    uint64_t n = m_num_skipped_updates;
+    m_num_skipped_updates = 0;
+
+    if (n == 0) {
+        return;
+    }
+
+    // Tone channels. The counter counts down to 0, toggling the mask and
+    // reloading when it gets there, so the number of toggles follows from
+    // the period.
+    for (size_t i = 0; i < 3; ++i) {
+        Channel *channel = &m_state.channels[i];
+
+        // Updates until the next toggle. (A counter of 0 is only possible
+        // after a reset, and toggles on the next update.)
+        uint64_t num_updates_to_toggle = channel->counter > 0 ? channel->counter : 1;
+
+        if (n < num_updates_to_toggle) {
+            channel->counter -= (uint16_t)n;
+        } else {
+            uint64_t period = channel->values.freq > 0 ? channel->values.freq : 1024;
+            uint64_t num_updates_after_toggle = n - num_updates_to_toggle;
+            uint64_t num_toggles = 1 + num_updates_after_toggle / period;
+
+            if (num_toggles & 1) {
+                channel->mask = ~channel->mask;
+            }
+
+            channel->counter = (uint16_t)(period - num_updates_after_toggle % period);
+        }
+    }
+
+    // Noise channel. The LFSR has to be stepped at each transition. With the
+    // fixed rates, they're at least 16 updates apart, but when the noise is
+    // clocked from tone 2 they can be as little as 1 update apart (freq=1) -
+    // so in the worst case this does as much work as the updates it's
+    // replacing would have done. GetNoisePeriod never returns 0, so the loop
+    // always terminates.
+    {
+        Channel *channel = &m_state.channels[3];
+        uint64_t num_updates_to_reload = channel->counter > 0 ? channel->counter : 1;
+
+        while (n >= num_updates_to_reload) {
+            n -= num_updates_to_reload;
+
+            this->UpdateNoiseMask();
+            channel->counter = this->GetNoisePeriod();
+
+            num_updates_to_reload = channel->counter;
+        }
+
+        channel->counter -= (uint16_t)n;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if BBCMICRO_TRACE
 void SN76489::SetTrace(Trace *t) {
     m_trace = t;
@@ -221,3 +261,45 @@ uint8_t SN76489::NextPeriodicNoiseBit() {
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
+
+void SN76489::UpdateNoiseMask() {
+    Channel *channel = &m_state.channels[3];
+
+    m_state.noise_toggle = !m_state.noise_toggle;
+
+    if (m_state.noise_toggle) {
+        if (channel->values.freq & 4) {
+            // White noise
+            channel->mask = this->NextWhiteNoiseBit() ? 0xff : 0x00;
+        } else {
+            // Periodic noise
+            channel->mask = this->NextPeriodicNoiseBit() ? 0xff : 0x00;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+uint16_t SN76489::GetNoisePeriod() const {
+    switch (m_state.channels[3].values.freq & 3) {
+    case 3:
+        if (m_state.channels[2].values.freq == 0) {
+            return 1024;
+        } else {
+            return m_state.channels[2].values.freq;
+        }
+
+    case 2:
+        return 0x40;
+
+    case 1:
+        return 0x20;
+
+    default:
+        return 0x10;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
@@ -15,6 +15,13 @@
 #include <string.h>
 #include <beeb/tube.h>
 #include <beeb/BBCMicroParasiteType.h>
+#include <shared/file_io.h>
+#include <shared/mutex.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
 
 #include <shared/enum_decl.h>
 #include "SaveTrace_private.inl"
@@ -27,25 +34,39 @@
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Converts events to text. Several of these can run at once, each
+// handling a different segment of the trace: any state that depends on
+// earlier events lives in a TraceSaver::State, which the caller tracks with
+// UpdateState as it divides the trace up.
 class TraceSaver {
   public:
+    struct R6522IRQEvent {
+        bool valid = false;
+        CycleCount time;
+        R6522::IRQ ifr, ier;
+    };
+
+    struct State {
+        PagingState paging;
+        bool parasite_boot_mode = false;
+        int sound_channel2_value = -1;
+        R6522IRQEvent last_6522_irq_event_by_via_id[256];
+        CycleCount last_instruction_time = {0};
+        std::vector<uint8_t> tube_fifo1;
+    };
+
     TraceSaver(std::shared_ptr<Trace> trace,
                uint32_t output_flags,
-               SaveTraceSaveDataFn save_data_fn,
-               void *save_data_context,
+               uint64_t time_initial_value,
+               CycleCount first_event_time,
                SaveTraceWasCanceledFn was_canceled_fn,
-               void *was_canceled_context,
-               SaveTraceProgress *progress)
+               void *was_canceled_context)
         : m_trace(std::move(trace))
         , m_output_flags(output_flags)
-        , m_save_data_fn(save_data_fn)
-        , m_save_data_context(save_data_context)
+        , m_first_event_time(first_event_time)
+        , m_time_initial_value(time_initial_value)
         , m_was_canceled_fn(was_canceled_fn)
-        , m_was_canceled_context(was_canceled_context)
-        , m_progress(progress) {
-    }
-
-    bool Execute() {
+        , m_was_canceled_context(was_canceled_context) {
         // It would be nice to have the TraceEventType handle the conversion to
         // strings itself. The INSTRUCTION_EVENT handler has to be able to read
         // the config stored by the INITIAL_EVENT handler, though...
@@ -70,124 +91,130 @@ class TraceSaver {
         this->SetHandler(TUBE_READ_FIFO4_EVENT, &TraceSaver::HandleTubeReadFIFO4Event, HandlerFlag_PrintPrefix);
         this->SetHandler(TUBE_WRITE_STATUS_EVENT, &TraceSaver::HandleTubeWriteStatusEvent, HandlerFlag_PrintPrefix);
 
-        {
-            TraceStats stats;
-            m_trace->GetStats(&stats);
-
-            if (m_progress) {
-                m_progress->num_events = stats.num_events;
-            }
+        m_type = m_trace->GetBBCMicroType();
+        m_parasite_m6502_config = m_trace->GetParasiteM6502Config();
+        m_parasite_type = m_trace->GetParasiteType();
 
-            m_time_initial_value = 0;
-            if (stats.max_time.n > 0) {
-                // fingers crossed this is actually accurate enough??
-                double exp = floor(1. + log10((double)stats.max_time.n));
-                m_time_initial_value = (uint64_t)pow(10., exp - 1.);
+        this->InitPaddedMnemonics(&m_host_m6502_padded_mnemonics_buffer, m_host_m6502_padded_mnemonics, m_type->m6502_config);
+        this->InitPaddedMnemonics(&m_parasite_m6502_padded_mnemonics_buffer, m_parasite_m6502_padded_mnemonics, m_parasite_m6502_config);
+    }
 
-                // Try to ensure the time column stays the same width for any
-                // reasonable trace size when output with relative cycle counts.
-                // I've got tripped up by this when trying to diff diverging
-                // traces that aren't the same length.
-                //
-                // No point trying to make room for the full 1<<64 cycles, as
-                // (a) that's like 20+ columns, and (b) that's nearly 150,000
-                // years of emulated time. But a 1-minute trace would have a 10
-                // digit cycle count, and that's not a ridiculous number of
-                // columns to reserve.
-                m_time_initial_value = std::max(m_time_initial_value,
-                                                (uint64_t)10000000000);
-            }
-        }
+    // Append text for the events from begin to end (as per
+    // Trace::ForEachEventInRange) to *text. state is the state as of the
+    // event before begin, and time its time.
+    //
+    // Returns false if canceled.
+    bool SaveEvents(std::string *text,
+                    const State &state,
+                    const void *begin,
+                    const void *end,
+                    CycleCount time,
+                    uint64_t *num_events_handled) {
+        m_text = text;
+        m_state = state;
+        m_paging_dirty = true;
+        m_num_events_handled = 0;
 
         LogPrinterTraceSaver printer(this);
-
         m_output = std::make_unique<Log>("", &printer);
 
-        //uint64_t start_ticks=GetCurrentTickCount();
+        bool completed = m_trace->ForEachEventInRange(begin, end, &time, &PrintTrace, this);
 
-        m_type = m_trace->GetBBCMicroType();
-        m_paging = m_trace->GetInitialPagingState();
-        m_parasite_m6502_config = m_trace->GetParasiteM6502Config();
-        m_parasite_boot_mode = m_trace->GetInitialParasiteBootMode();
-        m_paging_dirty = true;
-        m_parasite_type = m_trace->GetParasiteType();
+        m_output->Flush();
+        m_output = nullptr;
 
-        std::vector<char> host_m6502_padded_mnemonics_buffer;
-        this->InitPaddedMnemonics(&host_m6502_padded_mnemonics_buffer, m_host_m6502_padded_mnemonics, m_type->m6502_config);
+        m_text = nullptr;
+        *num_events_handled = m_num_events_handled;
 
-        std::vector<char> parasite_m6502_padded_mnemonics_buffer;
-        this->InitPaddedMnemonics(&parasite_m6502_padded_mnemonics_buffer, m_parasite_m6502_padded_mnemonics, m_parasite_m6502_config);
+        return completed;
+    }
 
-        bool completed;
-        if (m_trace->ForEachEvent(&PrintTrace, this)) {
-            completed = true;
-        } else {
-            m_output->f("(trace file output was canceled)\n");
+    // Update *state for the given event. Returns false if the event would
+    // print nothing useful and should be skipped.
+    static bool UpdateState(State *state, const TraceEvent *e) {
+        if (e->type == &BBCMicro::INSTRUCTION_EVENT) {
+            state->last_instruction_time = e->time;
+        } else if (e->type == &Trace::WRITE_ROMSEL_EVENT) {
+            auto ev = (const Trace::WriteROMSELEvent *)e->event;
 
-            completed = false;
-        }
+            state->paging.romsel = ev->romsel;
+        } else if (e->type == &Trace::WRITE_ACCCON_EVENT) {
+            auto ev = (const Trace::WriteACCCONEvent *)e->event;
 
-        m_output->Flush();
+            state->paging.acccon = ev->acccon;
+        } else if (e->type == &Trace::PARASITE_BOOT_MODE_EVENT) {
+            auto ev = (const Trace::ParasiteBootModeEvent *)e->event;
 
-        //            m_msgs.i.f(
-        //                       "trace output file saved: %s\n",
-        //                       m_file_name.c_str());
-        //        } else {
-        //            m_output->f("(trace file output was canceled)\n");
-        //
-        //            m_msgs.w.f(
-        //                       "trace output file canceled: %s\n",
-        //                       m_file_name.c_str());
-        //        }
-
-        //        double secs=GetSecondsFromTicks(GetCurrentTickCount()-start_ticks);
-        //        if(secs!=0.) {
-        //            double mbytes=m_num_bytes_written/1024./1024.;
-        //            m_msgs.i.f("(%.2f MBytes/sec)\n",mbytes/secs);
-        //        }
-
-        //        fclose(m_f);
-        //        m_f=NULL;
+            state->parasite_boot_mode = ev->parasite_boot_mode;
+        } else if (e->type == &Trace::SET_MAPPER_REGION_EVENT) {
+            auto ev = (const Trace::SetMapperRegionEvent *)e->event;
 
-        m_output = nullptr;
+            state->paging.rom_regions[state->paging.romsel.b_bits.pr] = ev->region;
+        } else if (e->type == &SN76489::WRITE_EVENT) {
+            auto ev = (const SN76489::WriteEvent *)e->event;
 
-        return completed;
+            if (!(ev->reg & 1) && ev->reg >> 1 == 2) {
+                state->sound_channel2_value = ev->reg_value;
+            }
+        } else if (e->type == &R6522::IRQ_EVENT) {
+            auto ev = (const R6522::IRQEvent *)e->event;
+            R6522IRQEvent *last_ev = &state->last_6522_irq_event_by_via_id[ev->id];
+
+            // Try not to spam the output file with too much useless junk when
+            // interrupts are disabled.
+            if (last_ev->valid) {
+                if (last_ev->time.n > state->last_instruction_time.n &&
+                    ev->ifr.value == last_ev->ifr.value &&
+                    ev->ier.value == last_ev->ier.value) {
+                    // skip it...
+                    return false;
+                }
+            }
+
+            last_ev->valid = true;
+            last_ev->time = e->time;
+            last_ev->ifr = ev->ifr;
+            last_ev->ier = ev->ier;
+        } else if (e->type == &TUBE_WRITE_FIFO1_EVENT) {
+            // The asymmetry is a bit annoying.
+            if (e->source != TraceEventSource_Host) {
+                auto ev = (const TubeFIFOEvent *)e->event;
+
+                state->tube_fifo1.push_back(ev->value);
+            }
+        } else if (e->type == &TUBE_READ_FIFO1_EVENT) {
+            if (e->source == TraceEventSource_Host) {
+                ASSERT(!state->tube_fifo1.empty());
+                state->tube_fifo1.erase(state->tube_fifo1.begin());
+            }
+        }
+
+        return true;
     }
 
   protected:
   private:
     typedef void (TraceSaver::*MFn)(const TraceEvent *);
 
-    struct R6522IRQEvent {
-        bool valid = false;
-        CycleCount time;
-        R6522::IRQ ifr, ier;
-    };
-
     struct Handler {
         MFn mfn = nullptr;
         uint32_t flags = 0; //combination of HandlerFlag
     };
 
     std::shared_ptr<Trace> m_trace;
-    std::string m_file_name;
     uint32_t m_output_flags = DEFAULT_TRACE_OUTPUT_FLAGS;
     Handler m_handlers[256] = {};
     std::unique_ptr<Log> m_output;
+    std::string *m_text = nullptr;
     std::shared_ptr<const BBCMicroType> m_type;
-    int m_sound_channel2_value = -1;
-    R6522IRQEvent m_last_6522_irq_event_by_via_id[256];
-    CycleCount m_last_instruction_time = {0};
-    bool m_got_first_event_time = false;
     CycleCount m_first_event_time = {0};
-    PagingState m_paging;
-    bool m_parasite_boot_mode = false;
+    State m_state;
     bool m_paging_dirty = true;
     MemoryBigPageTables m_paging_tables = {};
     uint32_t m_paging_flags = 0;
-    std::vector<uint8_t> m_tube_fifo1;
     const M6502Config *m_parasite_m6502_config = nullptr;
     BBCMicroParasiteType m_parasite_type = BBCMicroParasiteType_None;
+    uint64_t m_num_events_handled = 0;
 
     // State appropriate for current event.
     const M6502Config *m_m6502_config = nullptr;
@@ -195,7 +222,9 @@ class TraceSaver {
 
     // memcpy-friendly.
     static constexpr size_t PADDED_MNEMONIC_SIZE = 5; //padded with trailing spaces
+    std::vector<char> m_host_m6502_padded_mnemonics_buffer;
     const char *m_host_m6502_padded_mnemonics[256] = {};
+    std::vector<char> m_parasite_m6502_padded_mnemonics_buffer;
     const char *m_parasite_m6502_padded_mnemonics[256] = {};
 
     // <pre>
@@ -210,14 +239,9 @@ class TraceSaver {
     size_t m_time_prefix_len = 0;
     uint64_t m_time_initial_value = 0;
 
-    SaveTraceSaveDataFn m_save_data_fn = nullptr;
-    void *m_save_data_context = nullptr;
-
     SaveTraceWasCanceledFn m_was_canceled_fn = nullptr;
     void *m_was_canceled_context = nullptr;
 
-    SaveTraceProgress *m_progress = nullptr;
-
     class LogPrinterTraceSaver : public LogPrinter {
       public:
         explicit LogPrinterTraceSaver(TraceSaver *saver)
@@ -225,7 +249,7 @@ class TraceSaver {
         }
 
         void Print(const char *str, size_t str_len) override {
-            (*m_saver->m_save_data_fn)(str, str_len, m_saver->m_save_data_context);
+            m_saver->m_text->append(str, str_len);
         }
 
       protected:
@@ -287,7 +311,7 @@ class TraceSaver {
         if (m_paging_dirty) {
             (*m_type->get_mem_big_page_tables_fn)(&m_paging_tables,
                                                   &m_paging_flags,
-                                                  m_paging);
+                                                  m_state.paging);
             m_paging_dirty = false;
         }
 
@@ -316,7 +340,7 @@ class TraceSaver {
             break;
 
         case TraceEventSource_Parasite:
-            if (m_parasite_boot_mode && addr.b.h >= 0xf0) {
+            if (m_state.parasite_boot_mode && addr.b.h >= 0xf0) {
                 codes = "r";
             } else {
                 codes = "p";
@@ -408,23 +432,6 @@ class TraceSaver {
 
     void HandleR6522IRQEvent(const TraceEvent *e) {
         auto ev = (const R6522::IRQEvent *)e->event;
-        R6522IRQEvent *last_ev = &m_last_6522_irq_event_by_via_id[ev->id];
-
-        // Try not to spam the output file with too much useless junk when
-        // interrupts are disabled.
-        if (last_ev->valid) {
-            if (last_ev->time.n > m_last_instruction_time.n &&
-                ev->ifr.value == last_ev->ifr.value &&
-                ev->ier.value == last_ev->ier.value) {
-                // skip it...
-                return;
-            }
-        }
-
-        last_ev->valid = true;
-        last_ev->time = e->time;
-        last_ev->ifr = ev->ifr;
-        last_ev->ier = ev->ier;
 
         //m_output->s(m_time_prefix);
         m_output->f("%s - IRQ state: ", GetBBCMicroVIAIDEnumName(ev->id));
@@ -501,11 +508,9 @@ class TraceSaver {
             m_output->f("%s volume: %u", GetSoundChannelName(ev->reg), ev->reg_value);
         } else {
             switch (ev->reg >> 1) {
-            case 2:
-                m_sound_channel2_value = ev->reg_value;
-                // fall through
             case 0:
             case 1:
+            case 2:
                 m_output->f("%s freq: %u ($%03x) (%.1fHz)",
                             GetSoundChannelName(ev->reg),
                             ev->reg_value,
@@ -531,11 +536,11 @@ class TraceSaver {
                     break;
 
                 case 3:
-                    if (m_sound_channel2_value < 0) {
+                    if (m_state.sound_channel2_value < 0) {
                         m_output->s("unknown");
                     } else {
-                        ASSERT(m_sound_channel2_value < 65536);
-                        m_output->f("%.1fHz", GetSoundHz((uint16_t)m_sound_channel2_value));
+                        ASSERT(m_state.sound_channel2_value < 65536);
+                        m_output->f("%.1fHz", GetSoundHz((uint16_t)m_state.sound_channel2_value));
                     }
                     break;
                 }
@@ -552,14 +557,12 @@ class TraceSaver {
 
     //    static const char BLANK_LINE_CHAR = '\n';
 
-    //    (*m_save_data_fn)(&BLANK_LINE_CHAR, 1, m_save_data_context);
+    //    m_text->append(&BLANK_LINE_CHAR, 1);
     //}
 
     void HandleInstruction(const TraceEvent *e) {
         auto ev = (const BBCMicro::InstructionTraceEvent *)e->event;
 
-        m_last_instruction_time = e->time;
-
         const M6502DisassemblyInfo *i = &m_m6502_config->disassembly_info[ev->opcode];
 
         // This buffer size has been carefully selected to be Big
@@ -748,43 +751,35 @@ class TraceSaver {
         size_t num_chars = (size_t)(c - line);
         ASSERT(num_chars < sizeof line);
 
-        (*m_save_data_fn)(line, num_chars, m_save_data_context);
+        m_text->append(line, num_chars);
         //m_output.s(line);
-
-        if (m_progress) {
-            m_progress->num_bytes_written += num_chars;
-        }
     }
 
     void HandleWriteROMSEL(const TraceEvent *e) {
-        auto ev = (const Trace::WriteROMSELEvent *)e->event;
+        (void)e;
 
-        m_paging.romsel = ev->romsel;
         m_paging_dirty = true;
     }
 
     void HandleWriteACCCON(const TraceEvent *e) {
-        auto ev = (const Trace::WriteACCCONEvent *)e->event;
+        (void)e;
 
-        m_paging.acccon = ev->acccon;
         m_paging_dirty = true;
     }
 
     void HandleParasiteBootModeEvent(const TraceEvent *e) {
-        auto ev = (const Trace::ParasiteBootModeEvent *)e->event;
+        (void)e;
 
-        m_parasite_boot_mode = ev->parasite_boot_mode;
-        m_output->f("Parasite boot mode: %s\n", BOOL_STR(m_parasite_boot_mode));
+        m_output->f("Parasite boot mode: %s\n", BOOL_STR(m_state.parasite_boot_mode));
     }
 
     void HandleSetMapperRegionEvent(const TraceEvent *e) {
         auto ev = (const Trace::SetMapperRegionEvent *)e->event;
 
-        m_paging.rom_regions[m_paging.romsel.b_bits.pr] = ev->region;
         m_paging_dirty = true;
 
         if (m_output_flags & TraceOutputFlags_ROMMapper) {
-            m_output->f("Set ROM mapper region: %c%c\n", GetROMBankCode(m_paging.romsel.b_bits.pr), GetMapperRegionCode(ev->region));
+            m_output->f("Set ROM mapper region: %c%c\n", GetROMBankCode(m_state.paging.romsel.b_bits.pr), GetMapperRegionCode(ev->region));
         }
     }
 
@@ -793,10 +788,7 @@ class TraceSaver {
         if (e->source == TraceEventSource_Host) {
             this->HandleTubeWriteLatchEvent(e, 1);
         } else {
-            auto ev = (TubeFIFOEvent *)e->event;
-
             this->HandleTubeWriteLatchEvent(e, 1);
-            m_tube_fifo1.push_back(ev->value);
             this->DumpTubeFIFO1();
         }
     }
@@ -818,8 +810,6 @@ class TraceSaver {
         // The asymmetry is a bit annoying.
         if (e->source == TraceEventSource_Host) {
             this->HandleTubeReadLatchEvent(e, 1);
-            ASSERT(!m_tube_fifo1.empty());
-            m_tube_fifo1.erase(m_tube_fifo1.begin());
             this->DumpTubeFIFO1();
         } else {
             this->HandleTubeReadLatchEvent(e, 1);
@@ -866,7 +856,7 @@ class TraceSaver {
     }
 
     void DumpTubeFIFO1() {
-        size_t n = m_tube_fifo1.size();
+        size_t n = m_state.tube_fifo1.size();
 
         m_output->s("Index: ");
         for (size_t i = 0; i < n; ++i) {
@@ -876,19 +866,19 @@ class TraceSaver {
 
         m_output->s("Dec:   ");
         for (size_t i = 0; i < n; ++i) {
-            m_output->f("%-4u", m_tube_fifo1[i]);
+            m_output->f("%-4u", m_state.tube_fifo1[i]);
         }
         m_output->s("\n");
 
         m_output->s("Hex:   ");
         for (size_t i = 0; i < n; ++i) {
-            m_output->f("$%02x ", m_tube_fifo1[i]);
+            m_output->f("$%02x ", m_state.tube_fifo1[i]);
         }
         m_output->s("\n");
 
         m_output->s("ASCII: ");
         for (size_t i = 0; i < n; ++i) {
-            uint8_t c = m_tube_fifo1[i];
+            uint8_t c = m_state.tube_fifo1[i];
 
             if (c >= 32 && c <= 126) {
                 m_output->f("%c   ", c);
@@ -933,25 +923,36 @@ class TraceSaver {
 
         auto this_ = (TraceSaver *)context;
 
+        if (UpdateState(&this_->m_state, e)) {
+            this_->PrintEvent(e);
+        }
+
+        if (this_->m_was_canceled_fn) {
+            if ((*this_->m_was_canceled_fn)(this_->m_was_canceled_context)) {
+                return false;
+            }
+        }
+
+        ++this_->m_num_events_handled;
+
+        return true;
+    }
+
+    void PrintEvent(const TraceEvent *e) {
         uint64_t display_time; //in whatever units make sense for the event source
-        char *c = this_->m_time_prefix;
+        char *c = m_time_prefix;
         {
             CycleCount time = e->time;
-            if ((this_->m_output_flags & (TraceOutputFlags_Cycles | TraceOutputFlags_AbsoluteCycles)) == TraceOutputFlags_Cycles) {
-                if (!this_->m_got_first_event_time) {
-                    this_->m_got_first_event_time = true;
-                    this_->m_first_event_time = e->time;
-                }
-
-                time.n -= this_->m_first_event_time.n;
+            if ((m_output_flags & (TraceOutputFlags_Cycles | TraceOutputFlags_AbsoluteCycles)) == TraceOutputFlags_Cycles) {
+                time.n -= m_first_event_time.n;
             }
 
             switch (e->source) {
             case TraceEventSource_Host:
                 *c++ = 'H';
                 display_time = time.n >> RSHIFT_CYCLE_COUNT_TO_2MHZ;
-                this_->m_m6502_config = this_->m_type->m6502_config;
-                this_->m_m6502_padded_mnemonics = this_->m_host_m6502_padded_mnemonics;
+                m_m6502_config = m_type->m6502_config;
+                m_m6502_padded_mnemonics = m_host_m6502_padded_mnemonics;
                 break;
 
             case TraceEventSource_Parasite:
@@ -960,21 +961,21 @@ class TraceSaver {
                     size_t n = 80;
                     memset(c, ' ', n);
                     c += n;
-                    if (this_->m_parasite_type == BBCMicroParasiteType_External3MHz6502) {
+                    if (m_parasite_type == BBCMicroParasiteType_External3MHz6502) {
                         display_time = Get3MHzCycleCount(time);
                     } else {
                         display_time = time.n >> RSHIFT_CYCLE_COUNT_TO_4MHZ;
                     }
-                    this_->m_m6502_config = this_->m_parasite_m6502_config;
-                    this_->m_m6502_padded_mnemonics = this_->m_parasite_m6502_padded_mnemonics;
+                    m_m6502_config = m_parasite_m6502_config;
+                    m_m6502_padded_mnemonics = m_parasite_m6502_padded_mnemonics;
                 }
                 break;
 
             default:
                 *c++ = '?';
                 display_time = time.n;
-                this_->m_m6502_config = this_->m_type->m6502_config;
-                this_->m_m6502_padded_mnemonics = this_->m_host_m6502_padded_mnemonics;
+                m_m6502_config = m_type->m6502_config;
+                m_m6502_padded_mnemonics = m_host_m6502_padded_mnemonics;
                 break;
             }
 
@@ -982,10 +983,10 @@ class TraceSaver {
             *c++ = ' ';
         }
 
-        if (this_->m_output_flags & TraceOutputFlags_Cycles) {
+        if (m_output_flags & TraceOutputFlags_Cycles) {
             char zero = ' ';
 
-            for (uint64_t value = this_->m_time_initial_value; value != 0; value /= 10) {
+            for (uint64_t value = m_time_initial_value; value != 0; value /= 10) {
                 uint64_t digit = display_time / value % 10;
 
                 if (digit != 0) {
@@ -1004,52 +1005,356 @@ class TraceSaver {
             *c++ = ' ';
         }
 
-        this_->m_time_prefix_len = (size_t)(c - this_->m_time_prefix);
+        m_time_prefix_len = (size_t)(c - m_time_prefix);
 
         *c++ = 0;
-        ASSERT(c <= this_->m_time_prefix + sizeof this_->m_time_prefix);
+        ASSERT(c <= m_time_prefix + sizeof m_time_prefix);
 
-        Handler *h = &this_->m_handlers[e->type->type_id];
+        Handler *h = &m_handlers[e->type->type_id];
         bool need_pop_indent = false;
         if (h->flags & HandlerFlag_PrintPrefix) {
-            this_->m_output->s(this_->m_time_prefix);
-            this_->m_output->PushIndent();
+            m_output->s(m_time_prefix);
+            m_output->PushIndent();
             need_pop_indent = true;
         }
 
         if (h->mfn) {
-            (this_->*h->mfn)(e);
+            (this->*h->mfn)(e);
         } else {
-            this_->m_output->f("EVENT: type=%s; size=%zu\n", e->type->GetName().c_str(), e->size);
+            m_output->f("EVENT: type=%s; size=%zu\n", e->type->GetName().c_str(), e->size);
         }
 
         if (need_pop_indent) {
-            this_->m_output->PopIndent();
+            m_output->PopIndent();
         }
 
-        //this_->m_output->Flush();
+        //m_output->Flush();
+    }
 
-        if (this_->m_was_canceled_fn) {
-            if ((*this_->m_was_canceled_fn)(this_->m_was_canceled_context)) {
-                return false;
+    void
+    SetHandler(const TraceEventType &type, MFn mfn, uint32_t flags = 0) {
+        Handler *h = &m_handlers[type.type_id];
+
+        ASSERT(!h->mfn);
+
+        h->mfn = mfn;
+        h->flags = flags;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Splits the trace into segments, formats them on a few worker threads, and
+// writes the text out in order on the calling thread.
+//
+// Only the state tracking is sequential. That's cheap compared to the
+// formatting.
+class TraceSegmentSaver {
+  public:
+    TraceSegmentSaver(std::shared_ptr<Trace> trace,
+                      uint32_t output_flags,
+                      SaveTraceSaveDataFn save_data_fn,
+                      void *save_data_context,
+                      SaveTraceWasCanceledFn was_canceled_fn,
+                      void *was_canceled_context,
+                      SaveTraceProgress *progress,
+                      unsigned num_threads)
+        : m_trace(std::move(trace))
+        , m_output_flags(output_flags)
+        , m_save_data_fn(save_data_fn)
+        , m_save_data_context(save_data_context)
+        , m_was_canceled_fn(was_canceled_fn)
+        , m_was_canceled_context(was_canceled_context)
+        , m_progress(progress)
+        , m_num_threads(num_threads) {
+        if (m_num_threads == 0) {
+            m_num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        MUTEX_SET_NAME(m_mutex, "SaveTrace");
+    }
+
+    ~TraceSegmentSaver() {
+        {
+            LockGuard<Mutex> lock(m_mutex);
+
+            m_quit = true;
+        }
+
+        m_todo_cv.notify_all();
+
+        for (std::thread &thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    bool Execute() {
+        {
+            TraceStats stats;
+            m_trace->GetStats(&stats);
+
+            if (m_progress) {
+                m_progress->num_events = stats.num_events;
+            }
+
+            m_time_initial_value = 0;
+            if (stats.max_time.n > 0) {
+                // fingers crossed this is actually accurate enough??
+                double exp = floor(1. + log10((double)stats.max_time.n));
+                m_time_initial_value = (uint64_t)pow(10., exp - 1.);
+
+                // Try to ensure the time column stays the same width for any
+                // reasonable trace size when output with relative cycle counts.
+                // I've got tripped up by this when trying to diff diverging
+                // traces that aren't the same length.
+                //
+                // No point trying to make room for the full 1<<64 cycles, as
+                // (a) that's like 20+ columns, and (b) that's nearly 150,000
+                // years of emulated time. But a 1-minute trace would have a 10
+                // digit cycle count, and that's not a ridiculous number of
+                // columns to reserve.
+                m_time_initial_value = std::max(m_time_initial_value,
+                                                (uint64_t)10000000000);
             }
         }
 
-        if (this_->m_progress) {
-            ++this_->m_progress->num_events_handled;
+        m_state.paging = m_trace->GetInitialPagingState();
+        m_state.parasite_boot_mode = m_trace->GetInitialParasiteBootMode();
+
+        m_trace->ForEachChunk(&HandleChunk, this);
+
+        this->WriteSegments(0);
+
+        return !m_canceled;
+    }
+
+  protected:
+  private:
+    // Segments are cut every this many events, and at the end of each chunk.
+    static constexpr size_t MAX_NUM_SEGMENT_EVENTS = 32768;
+
+    // Segments formatted or being formatted per thread, before the writer
+    // has to catch up. Bounds the amount of text held in memory.
+    static constexpr size_t MAX_NUM_PENDING_SEGMENTS_PER_THREAD = 2;
+
+    struct Segment {
+        TraceSaver::State state;
+        const void *begin = nullptr;
+        const void *end = nullptr;
+        CycleCount time = {0};
+        std::shared_ptr<const MappedFile> spill_file;
+
+        std::string text;
+        bool completed = false;
+        bool done = false;
+    };
+
+    std::shared_ptr<Trace> m_trace;
+    uint32_t m_output_flags = 0;
+    SaveTraceSaveDataFn m_save_data_fn = nullptr;
+    void *m_save_data_context = nullptr;
+    SaveTraceWasCanceledFn m_was_canceled_fn = nullptr;
+    void *m_was_canceled_context = nullptr;
+    SaveTraceProgress *m_progress = nullptr;
+    unsigned m_num_threads = 0;
+    uint64_t m_time_initial_value = 0;
+
+    // Sequential state, as of the current event.
+    TraceSaver::State m_state;
+    bool m_got_time = false;
+    CycleCount m_time = {0};
+    bool m_got_first_event_time = false;
+    CycleCount m_first_event_time = {0};
+
+    // Segment being accumulated.
+    const Trace::ChunkData *m_chunk = nullptr;
+    std::unique_ptr<Segment> m_segment;
+    size_t m_segment_num_events = 0;
+
+    Mutex m_mutex;
+    std::condition_variable_any m_todo_cv;
+    std::condition_variable_any m_done_cv;
+    std::deque<std::shared_ptr<Segment>> m_todo;     //not yet started
+    std::deque<std::shared_ptr<Segment>> m_segments; //not yet written, in order
+    bool m_quit = false;
+    bool m_canceled = false;
+    std::vector<std::thread> m_threads;
+
+    static bool HandleChunk(const Trace::ChunkData *chunk, void *context) {
+        auto this_ = (TraceSegmentSaver *)context;
+
+        if (!this_->m_got_time) {
+            this_->m_time = chunk->initial_time;
+            this_->m_got_time = true;
+        }
+
+        auto data = (const uint8_t *)chunk->data;
+
+        this_->m_chunk = chunk;
+        this_->StartSegment(data);
+
+        if (!this_->m_trace->ForEachEventInRange(data, data + chunk->size, &this_->m_time, &HandleEvent, this_)) {
+            return false;
+        }
+
+        this_->FinishSegment(data + chunk->size);
+
+        return !this_->m_canceled;
+    }
+
+    static bool HandleEvent(Trace *t, const TraceEvent *e, void *context) {
+        (void)t;
+
+        auto this_ = (TraceSegmentSaver *)context;
+
+        if (!this_->m_got_first_event_time) {
+            this_->m_first_event_time = e->time;
+            this_->m_got_first_event_time = true;
+        }
+
+        TraceSaver::UpdateState(&this_->m_state, e);
+
+        ++this_->m_segment_num_events;
+        if (this_->m_segment_num_events == MAX_NUM_SEGMENT_EVENTS) {
+            // The next segment starts after this event, so its time is this
+            // event's time.
+            this_->m_time = e->time;
+
+            auto end = (const uint8_t *)e->event + e->size;
+            this_->FinishSegment(end);
+            this_->StartSegment(end);
+
+            return !this_->m_canceled;
         }
 
         return true;
     }
 
-    void
-    SetHandler(const TraceEventType &type, MFn mfn, uint32_t flags = 0) {
-        Handler *h = &m_handlers[type.type_id];
+    void StartSegment(const void *begin) {
+        m_segment = std::make_unique<Segment>();
 
-        ASSERT(!h->mfn);
+        m_segment->state = m_state;
+        m_segment->begin = begin;
+        m_segment->time = m_time;
+        m_segment->spill_file = m_chunk->spill_file;
 
-        h->mfn = mfn;
-        h->flags = flags;
+        m_segment_num_events = 0;
+    }
+
+    void FinishSegment(const void *end) {
+        ASSERT(m_segment);
+        if (m_segment->begin == end) {
+            return;
+        }
+
+        std::shared_ptr<Segment> segment = std::move(m_segment);
+        segment->end = end;
+
+        {
+            LockGuard<Mutex> lock(m_mutex);
+
+            m_todo.push_back(segment);
+            m_segments.push_back(segment);
+        }
+
+        m_todo_cv.notify_one();
+
+        // The first event time is known now, so the workers can start.
+        while (m_threads.size() < m_num_threads) {
+            m_threads.emplace_back(std::bind(&TraceSegmentSaver::ThreadFunc, this));
+        }
+
+        this->WriteSegments(m_num_threads * MAX_NUM_PENDING_SEGMENTS_PER_THREAD);
+    }
+
+    // Write out finished segments, in order, waiting for more to finish until
+    // there are at most max_num_pending left.
+    void WriteSegments(size_t max_num_pending) {
+        UniqueLock<Mutex> lock(m_mutex);
+
+        while (!m_segments.empty()) {
+            std::shared_ptr<Segment> segment = m_segments.front();
+            if (!segment->done) {
+                if (m_segments.size() <= max_num_pending) {
+                    break;
+                }
+
+                m_done_cv.wait(lock);
+                continue;
+            }
+
+            m_segments.pop_front();
+
+            if (m_canceled) {
+                // Discard anything after the cancellation point.
+                continue;
+            }
+
+            lock.unlock();
+
+            (*m_save_data_fn)(segment->text.data(), segment->text.size(), m_save_data_context);
+            if (m_progress) {
+                m_progress->num_bytes_written += segment->text.size();
+            }
+
+            if (!segment->completed) {
+                static const char CANCELED[] = "(trace file output was canceled)\n";
+                (*m_save_data_fn)(CANCELED, sizeof CANCELED - 1, m_save_data_context);
+            }
+
+            lock.lock();
+
+            if (!segment->completed) {
+                m_canceled = true;
+            }
+        }
+    }
+
+    void ThreadFunc() {
+        SetCurrentThreadName("SaveTrace");
+
+        TraceSaver saver(m_trace,
+                         m_output_flags,
+                         m_time_initial_value,
+                         m_first_event_time,
+                         m_was_canceled_fn, m_was_canceled_context);
+
+        UniqueLock<Mutex> lock(m_mutex);
+
+        for (;;) {
+            while (m_todo.empty() && !m_quit) {
+                m_todo_cv.wait(lock);
+            }
+
+            if (m_todo.empty()) {
+                break;
+            }
+
+            std::shared_ptr<Segment> segment = m_todo.front();
+            m_todo.pop_front();
+
+            if (!m_canceled) {
+                lock.unlock();
+
+                uint64_t num_events_handled;
+                segment->completed = saver.SaveEvents(&segment->text,
+                                                      segment->state,
+                                                      segment->begin,
+                                                      segment->end,
+                                                      segment->time,
+                                                      &num_events_handled);
+
+                if (m_progress) {
+                    m_progress->num_events_handled += num_events_handled;
+                }
+
+                lock.lock();
+            }
+
+            segment->done = true;
+            m_done_cv.notify_all();
+        }
     }
 };
 
@@ -1062,15 +1367,17 @@ bool SaveTrace(std::shared_ptr<Trace> trace,
                void *save_data_context,
                SaveTraceWasCanceledFn was_canceled_fn,
                void *was_canceled_context,
-               SaveTraceProgress *progress) {
-    TraceSaver saver(std::move(trace),
-                     output_flags,
-                     save_data_fn, save_data_context,
-                     was_canceled_fn, was_canceled_context,
-                     progress);
-
-    bool canceled = saver.Execute();
-    return canceled;
+               SaveTraceProgress *progress,
+               unsigned num_threads) {
+    TraceSegmentSaver saver(std::move(trace),
+                            output_flags,
+                            save_data_fn, save_data_context,
+                            was_canceled_fn, was_canceled_context,
+                            progress,
+                            num_threads);
+
+    bool completed = saver.Execute();
+    return completed;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -9,6 +9,14 @@
 #include <shared/log.h>
 #include <math.h>
 
+#if CPU_X64
+#define TVOUTPUT_SSE2 1
+#include <emmintrin.h>
+#elif CPU_ARM && (defined __ARM_NEON)
+#define TVOUTPUT_NEON 1
+#include <arm_neon.h>
+#endif
+
 #include <shared/enum_def.h>
 #include <beeb/TVOutput.inl>
 #include <shared/enum_end.h>
@@ -22,15 +30,21 @@
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Number of TVOutput::TeletextColours entries - see GetTeletextColoursIndex.
+static const size_t NUM_TELETEXT_COLOURS = 64;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 TVOutput::TVOutput() {
     // +1 to accommodate writing an extra row when emulating interlace. (This
     // extra row is ignored.)
     m_texture_pixels.resize(TV_TEXTURE_WIDTH * (TV_TEXTURE_HEIGHT + 1));
+    m_row_units.resize(TV_TEXTURE_WIDTH / 8 * (TV_TEXTURE_HEIGHT + 1));
+    m_dirty_lines.resize(TV_TEXTURE_HEIGHT + 1);
 #if VIDEO_TRACK_METADATA
     m_texture_units.resize(m_texture_pixels.size());
 #endif
-    m_last_vsync_texture_pixels.resize(TV_TEXTURE_WIDTH * (TV_TEXTURE_HEIGHT + 1));
-
     MUTEX_SET_NAME(m_last_vsync_texture_pixels_mutex, "Last vsync texture pixels");
 
     this->InitPalette();
@@ -49,6 +63,7 @@ void TVOutput::PrepareForUpdate() {
 #if BBCMICRO_DEBUGGER
     if (m_texture_dirty) {
         std::fill(m_texture_pixels.begin(), m_texture_pixels.end(), this->GetTexelValue(0, 0, 0));
+        this->InvalidateRowUnits();
         m_texture_dirty = false;
     }
 #endif
@@ -95,13 +110,365 @@ static const int MAX_NUM_SCANNED_LINES = 500;
 
 #define NOTHING_PALETTE_INDEX (0)
 
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Expand a run of 16 MHz bitmap units to XRGB8888, each 4-bit component x
+// becoming x<<4|x. Each unit is 8 pixels wide, and is written to both rows.
+
+#if TVOUTPUT_SSE2
+
+static inline __m128i Expand16MHzPixels(__m128i v) {
+    __m128i b = _mm_and_si128(v, _mm_set1_epi32(0x00f));
+    __m128i g = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x0f0)), 4);
+    __m128i r = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf00)), 8);
+    __m128i rgb = _mm_or_si128(_mm_or_si128(b, g), r);
+
+    return _mm_or_si128(rgb, _mm_slli_epi32(rgb, 4));
+}
+
+static void Expand16MHzUnits(uint32_t *pixels0, const VideoDataUnit *units, size_t num_units) {
+    uint32_t *pixels1 = pixels0 + TV_TEXTURE_WIDTH;
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t i = 0; i < num_units; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i *)units[i].pixels.values);
+
+        __m128i lo = Expand16MHzPixels(_mm_unpacklo_epi16(v, zero));
+        __m128i hi = Expand16MHzPixels(_mm_unpackhi_epi16(v, zero));
+
+        _mm_storeu_si128((__m128i *)(pixels0 + 0), lo);
+        _mm_storeu_si128((__m128i *)(pixels0 + 4), hi);
+        _mm_storeu_si128((__m128i *)(pixels1 + 0), lo);
+        _mm_storeu_si128((__m128i *)(pixels1 + 4), hi);
+
+        pixels0 += 8;
+        pixels1 += 8;
+    }
+}
+
+#elif TVOUTPUT_NEON
+
+static inline uint32x4_t Expand16MHzPixels(uint32x4_t v) {
+    uint32x4_t b = vandq_u32(v, vdupq_n_u32(0x00f));
+    uint32x4_t g = vshlq_n_u32(vandq_u32(v, vdupq_n_u32(0x0f0)), 4);
+    uint32x4_t r = vshlq_n_u32(vandq_u32(v, vdupq_n_u32(0xf00)), 8);
+    uint32x4_t rgb = vorrq_u32(vorrq_u32(b, g), r);
+
+    return vorrq_u32(rgb, vshlq_n_u32(rgb, 4));
+}
+
+static void Expand16MHzUnits(uint32_t *pixels0, const VideoDataUnit *units, size_t num_units) {
+    uint32_t *pixels1 = pixels0 + TV_TEXTURE_WIDTH;
+
+    for (size_t i = 0; i < num_units; ++i) {
+        uint16x8_t v = vld1q_u16(&units[i].pixels.pixels[0].all);
+
+        uint32x4_t lo = Expand16MHzPixels(vmovl_u16(vget_low_u16(v)));
+        uint32x4_t hi = Expand16MHzPixels(vmovl_u16(vget_high_u16(v)));
+
+        vst1q_u32(pixels0 + 0, lo);
+        vst1q_u32(pixels0 + 4, hi);
+        vst1q_u32(pixels1 + 0, lo);
+        vst1q_u32(pixels1 + 4, hi);
+
+        pixels0 += 8;
+        pixels1 += 8;
+    }
+}
+
+#else
+
+static void Expand16MHzUnits(uint32_t *pixels0, const VideoDataUnit *units, size_t num_units) {
+    uint32_t *pixels1 = pixels0 + TV_TEXTURE_WIDTH;
+
+    for (size_t i = 0; i < num_units; ++i) {
+        for (size_t j = 0; j < 8; ++j) {
+            uint32_t rgb = units[i].pixels.pixels[j].all & 0xfffu;
+            rgb = (rgb & 0x00fu) | (rgb & 0x0f0u) << 4u | (rgb & 0xf00u) << 8u;
+            pixels1[j] = pixels0[j] = rgb | rgb << 4u;
+        }
+
+        pixels0 += 8;
+        pixels1 += 8;
+    }
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static inline bool IsSameUnitPixels(const VideoDataUnitPixels &a, const VideoDataUnitPixels &b) {
+    return a.values[0] == b.values[0] && a.values[1] == b.values[1];
+}
+
+// Returns true if the unit at (X,Y) needs drawing, because it would be drawn
+// differently from last time.
+bool TVOutput::UpdateRowUnits(size_t x, size_t y, const VideoDataUnitPixels &pixels0, const VideoDataUnitPixels &pixels1) {
+    ASSERT(x < TV_TEXTURE_WIDTH);
+    ASSERT(y < TV_TEXTURE_HEIGHT);
+
+    VideoDataUnitPixels *row_units0 = &m_row_units[y * (TV_TEXTURE_WIDTH / 8) + x / 8];
+    VideoDataUnitPixels *row_units1 = row_units0 + TV_TEXTURE_WIDTH / 8;
+
+    if (IsSameUnitPixels(*row_units0, pixels0) && IsSameUnitPixels(*row_units1, pixels1)) {
+        return false;
+    }
+
+    *row_units0 = pixels0;
+    *row_units1 = pixels1;
+
+    m_dirty_lines[y] = 1;
+    m_dirty_lines[y + 1] = 1;
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#define EXPAND_12MHZ_VDP(VAR) ((uint32_t)(VAR).bits.b << 0u | (uint32_t)(VAR).bits.b << 4u | (uint32_t)(VAR).bits.g << 8u | (uint32_t)(VAR).bits.g << 12u | (uint32_t)(VAR).bits.r << 16u | (uint32_t)(VAR).bits.r << 20u)
+#define EXPAND_12MHZ_VARS(SUFFIX) ((uint32_t)(b##SUFFIX) << 0u | (uint32_t)(g##SUFFIX) << 8u | (uint32_t)(r##SUFFIX) << 16u)
+
+// 6 pixels:
+// <pre>
+// 0 1 2 3 4 5
+// </pre>
+//
+// Expand into 8. Scale up 4x, producing 24 pixels:
+//
+// <pre>
+// 0 0 0 0 1 1 1 1 2 2 2 2 3 3 3 3 4 4 4 4 5 5 5 5
+// </pre>
+//
+// Scale to 2/3 size, producing 8: (each pixel here is the gamma-corrected
+// average of all contributing pixels)
+//
+// <pre>
+// 000 011 112 222 333 344 445 555
+// </pre>
+void TVOutput::ExpandTeletextPixels(uint32_t *dest, const VideoDataUnitPixels &pixels, uint8_t data) const {
+    const VideoDataPixel p0 = pixels.pixels[data & 1];
+    const VideoDataPixel p1 = pixels.pixels[data >> 1 & 1];
+    const VideoDataPixel p2 = pixels.pixels[data >> 2 & 1];
+    const VideoDataPixel p3 = pixels.pixels[data >> 3 & 1];
+    const VideoDataPixel p4 = pixels.pixels[data >> 4 & 1];
+    const VideoDataPixel p5 = pixels.pixels[data >> 5 & 1];
+
+    uint8_t r011 = m_blend[p0.bits.r][p1.bits.r];
+    uint8_t g011 = m_blend[p0.bits.g][p1.bits.g];
+    uint8_t b011 = m_blend[p0.bits.b][p1.bits.b];
+
+    uint8_t r112 = m_blend[p2.bits.r][p1.bits.r];
+    uint8_t g112 = m_blend[p2.bits.g][p1.bits.g];
+    uint8_t b112 = m_blend[p2.bits.b][p1.bits.b];
+
+    uint8_t r344 = m_blend[p3.bits.r][p4.bits.r];
+    uint8_t g344 = m_blend[p3.bits.g][p4.bits.g];
+    uint8_t b344 = m_blend[p3.bits.b][p4.bits.b];
+
+    uint8_t r445 = m_blend[p5.bits.r][p4.bits.r];
+    uint8_t g445 = m_blend[p5.bits.g][p4.bits.g];
+    uint8_t b445 = m_blend[p5.bits.b][p4.bits.b];
+
+    dest[0] = EXPAND_12MHZ_VDP(p0);   //000
+    dest[1] = EXPAND_12MHZ_VARS(011); //011
+    dest[2] = EXPAND_12MHZ_VARS(112); //112
+    dest[3] = EXPAND_12MHZ_VDP(p2);   //222
+    dest[4] = EXPAND_12MHZ_VDP(p3);   //333
+    dest[5] = EXPAND_12MHZ_VARS(344); //344
+    dest[6] = EXPAND_12MHZ_VARS(445); //445
+    dest[7] = EXPAND_12MHZ_VDP(p5);   //555
+}
+
+// The top bit of each component of each colour, so the 8 standard colours'
+// combinations all get their own entries.
+static size_t GetTeletextColoursIndex(uint16_t bg, uint16_t fg) {
+    return (bg >> 3 & 1) | (bg >> 6 & 2) | (bg >> 9 & 4) | (fg & 8) | (fg >> 3 & 16) | (fg >> 6 & 32);
+}
+
+// Returns the 8 texels for one scanline of a teletext unit.
+const uint32_t *TVOutput::GetTeletextPixels(std::vector<TeletextColours> *teletext_colours,
+                                            const VideoDataUnitPixels &pixels,
+                                            uint16_t data) const {
+    if (teletext_colours->empty()) {
+        teletext_colours->resize(NUM_TELETEXT_COLOURS);
+    }
+
+    uint16_t bg = pixels.pixels[0].all & 0xfff;
+    uint16_t fg = pixels.pixels[1].all & 0xfff;
+    uint32_t bg_fg = (uint32_t)bg | (uint32_t)fg << 12;
+    data &= 63;
+
+    TeletextColours *colours = &(*teletext_colours)[GetTeletextColoursIndex(bg, fg)];
+    if (colours->bg_fg != bg_fg) {
+        colours->bg_fg = bg_fg;
+        colours->valid_mask = 0;
+    }
+
+    uint64_t mask = (uint64_t)1 << data;
+    if (!(colours->valid_mask & mask)) {
+        this->ExpandTeletextPixels(colours->pixels[data], pixels, (uint8_t)data);
+        colours->valid_mask |= mask;
+    }
+
+    return colours->pixels[data];
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if BUILD_TYPE_Debug
 #ifdef _MSC_VER
 #pragma optimize("tsg", on)
 #endif
 #endif
 
-void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
+// Draws a run of scanned-out units, the first at (X,Y). Only the texture rows
+// Y and Y+1 are touched.
+void TVOutput::DrawUnits(std::vector<TeletextColours> *teletext_colours,
+                         size_t x,
+                         size_t y,
+                         const VideoDataUnit *units,
+                         size_t num_units) {
+    if (y >= TV_TEXTURE_HEIGHT) {
+        return;
+    }
+
+    uint32_t *pixels_line = m_texture_pixels.data() + y * TV_TEXTURE_WIDTH;
+#if VIDEO_TRACK_METADATA
+    VideoDataUnit *units_line = m_texture_units.data() + y * TV_TEXTURE_WIDTH;
+#endif
+
+    const VideoDataUnit *unit = units;
+
+    for (size_t i = 0; i < num_units && x < TV_TEXTURE_WIDTH; ++i, ++unit) {
+        if (unit->pixels.pixels[0].bits.x == VideoDataType_Bitmap16MHz) {
+            // Find the run of bitmap units, and do them all in one go.
+            size_t n = 1;
+            while (i + n < num_units &&
+                   x + n * 8 < TV_TEXTURE_WIDTH &&
+                   unit[n].pixels.pixels[0].bits.x == VideoDataType_Bitmap16MHz) {
+                ++n;
+            }
+
+            // Only expand units that differ from last time.
+            size_t begin = 0;
+            for (size_t j = 0; j < n; ++j) {
+                if (!this->UpdateRowUnits(x + j * 8, y, unit[j].pixels, unit[j].pixels)) {
+                    if (j > begin) {
+                        Expand16MHzUnits(pixels_line + x + begin * 8, unit + begin, j - begin);
+                    }
+
+                    begin = j + 1;
+                }
+            }
+
+            if (n > begin) {
+                Expand16MHzUnits(pixels_line + x + begin * 8, unit + begin, n - begin);
+            }
+
+#if VIDEO_TRACK_METADATA
+            VideoDataUnit *units0 = units_line + x;
+            VideoDataUnit *units1 = units0 + TV_TEXTURE_WIDTH;
+            for (size_t j = 0; j < n; ++j) {
+                for (size_t k = 0; k < 8; ++k) {
+                    *units1++ = *units0++ = unit[j];
+                }
+            }
+#endif
+
+            x += n * 8;
+            i += n - 1;
+            unit += n - 1;
+            continue;
+        }
+
+        uint32_t *pixels0 = pixels_line + x;
+        uint32_t *pixels1 = pixels0 + TV_TEXTURE_WIDTH;
+
+        switch (unit->pixels.pixels[0].bits.x) {
+        default:
+            {
+                ASSERT(false);
+            }
+            break;
+
+        case VideoDataType_Teletext:
+            {
+                // The bottom row is drawn as the top row would be
+                // with the scanline data swapped.
+                VideoDataUnitPixels bottom_pixels = unit->pixels;
+                bottom_pixels.pixels[2] = unit->pixels.pixels[3];
+                bottom_pixels.pixels[3] = unit->pixels.pixels[2];
+
+                if (this->UpdateRowUnits(x, y, unit->pixels, bottom_pixels)) {
+                    memcpy(pixels0, this->GetTeletextPixels(teletext_colours, unit->pixels, unit->pixels.pixels[2].all), 8 * sizeof *pixels0);
+                    memcpy(pixels1, this->GetTeletextPixels(teletext_colours, unit->pixels, unit->pixels.pixels[3].all), 8 * sizeof *pixels1);
+                }
+            }
+            break;
+
+        case VideoDataType_Bitmap12MHz:
+            {
+                if (this->UpdateRowUnits(x, y, unit->pixels, unit->pixels)) {
+                    const VideoDataPixel p0 = unit->pixels.pixels[0];
+                    const VideoDataPixel p1 = unit->pixels.pixels[1];
+                    const VideoDataPixel p2 = unit->pixels.pixels[2];
+                    const VideoDataPixel p3 = unit->pixels.pixels[3];
+                    const VideoDataPixel p4 = unit->pixels.pixels[4];
+                    const VideoDataPixel p5 = unit->pixels.pixels[5];
+
+                    uint8_t r011 = m_blend[p0.bits.r][p1.bits.r];
+                    uint8_t g011 = m_blend[p0.bits.g][p1.bits.g];
+                    uint8_t b011 = m_blend[p0.bits.b][p1.bits.b];
+
+                    uint8_t r112 = m_blend[p2.bits.r][p1.bits.r];
+                    uint8_t g112 = m_blend[p2.bits.g][p1.bits.g];
+                    uint8_t b112 = m_blend[p2.bits.b][p1.bits.b];
+
+                    uint8_t r334 = m_blend[p3.bits.r][p4.bits.r];
+                    uint8_t g334 = m_blend[p3.bits.g][p4.bits.g];
+                    uint8_t b334 = m_blend[p3.bits.b][p4.bits.b];
+
+                    uint8_t r445 = m_blend[p5.bits.r][p4.bits.r];
+                    uint8_t g445 = m_blend[p5.bits.g][p4.bits.g];
+                    uint8_t b445 = m_blend[p5.bits.b][p4.bits.b];
+
+                    pixels1[0] = pixels0[0] = EXPAND_12MHZ_VDP(p0);
+                    pixels1[1] = pixels0[1] = EXPAND_12MHZ_VARS(011);
+                    pixels1[2] = pixels0[2] = EXPAND_12MHZ_VARS(112);
+                    pixels1[3] = pixels0[3] = EXPAND_12MHZ_VDP(p2);
+                    pixels1[4] = pixels0[4] = EXPAND_12MHZ_VDP(p3);
+                    pixels1[5] = pixels0[5] = EXPAND_12MHZ_VARS(334);
+                    pixels1[6] = pixels0[6] = EXPAND_12MHZ_VARS(445);
+                    pixels1[7] = pixels0[7] = EXPAND_12MHZ_VDP(p5);
+                }
+            }
+            break;
+        }
+
+#if VIDEO_TRACK_METADATA
+        VideoDataUnit *units0 = units_line + x;
+        units0[7] = units0[6] = units0[5] = units0[4] = units0[3] = units0[2] = units0[1] = units0[0] = *unit;
+
+        VideoDataUnit *units1 = units0 + TV_TEXTURE_WIDTH;
+        units1[7] = units1[6] = units1[5] = units1[4] = units1[3] = units1[2] = units1[1] = units1[0] = *unit;
+#endif
+
+        x += 8;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Runs the TV state machine over the units. Scanned-out units are drawn
+// immediately if SCANLINES is null, or recorded in *SCANLINES otherwise - in
+// which case, this stops once vertical retrace begins. Returns the number of
+// units consumed.
+size_t TVOutput::Scan(const VideoDataUnit *units, size_t num_units, std::vector<Scanline> *scanlines) {
     const VideoDataUnit *unit = units;
 
     for (size_t i = 0; i < num_units; ++i, ++unit) {
@@ -111,7 +478,7 @@ void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
             break;
 
         case TVOutputState_VerticalRetrace:
-            {
+            if (m_keep_last_vsync_texture_pixels) {
                 LockGuard<Mutex> lock(m_last_vsync_texture_pixels_mutex);
 
                 ASSERT(m_last_vsync_texture_pixels.size() == m_texture_pixels.size());
@@ -145,10 +512,6 @@ void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
             m_state = TVOutputState_VerticalRetraceWait;
             ++m_texture_data_version;
             m_x = 0;
-            m_pixels_line = m_texture_pixels.data() + m_y * TV_TEXTURE_WIDTH;
-#if VIDEO_TRACK_METADATA
-            m_units_line = m_texture_units.data() + m_y * TV_TEXTURE_WIDTH;
-#endif
             m_state_timer = 1;
             break;
 
@@ -174,210 +537,38 @@ void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
                     break;
                 }
 
-                uint32_t *pixels0;
-                uint32_t *pixels1;
-
-                switch (unit->pixels.pixels[0].bits.x) {
-                default:
-                    {
-                        ASSERT(false);
-                    }
-                    break;
-
-                case VideoDataType_Bitmap16MHz:
-                    {
-                        if (m_x < TV_TEXTURE_WIDTH && m_y < TV_TEXTURE_HEIGHT) {
-                            pixels0 = m_pixels_line + m_x;
-                            pixels1 = pixels0 + TV_TEXTURE_WIDTH;
-
-#define EXPAND_16MHZ(I)                                 \
-    const VideoDataPixel p##I = unit->pixels.pixels[I]; \
-    pixels1[I] = pixels0[I] = (uint32_t)p##I.bits.b << 0u | (uint32_t)p##I.bits.b << 4u | (uint32_t)p##I.bits.g << 8u | (uint32_t)p##I.bits.g << 12u | (uint32_t)p##I.bits.r << 16u | (uint32_t)p##I.bits.r << 20u
-
-                            EXPAND_16MHZ(0);
-                            EXPAND_16MHZ(1);
-                            EXPAND_16MHZ(2);
-                            EXPAND_16MHZ(3);
-                            EXPAND_16MHZ(4);
-                            EXPAND_16MHZ(5);
-                            EXPAND_16MHZ(6);
-                            EXPAND_16MHZ(7);
-
-#if VIDEO_TRACK_METADATA
-                            VideoDataUnit *units0 = m_units_line + m_x;
-                            units0[7] = units0[6] = units0[5] = units0[4] = units0[3] = units0[2] = units0[1] = units0[0] = *unit;
-
-                            VideoDataUnit *units1 = units0 + TV_TEXTURE_WIDTH;
-                            units1[7] = units1[6] = units1[5] = units1[4] = units1[3] = units1[2] = units1[1] = units1[0] = *unit;
-#endif
-                        }
-                    }
-                    break;
-
-                case VideoDataType_Teletext:
-                    {
-                        if (m_x < TV_TEXTURE_WIDTH && m_y < TV_TEXTURE_HEIGHT) {
-                            pixels0 = m_pixels_line + m_x;
-                            pixels1 = pixels0 + TV_TEXTURE_WIDTH;
-
-                            uint16_t p_0 = unit->pixels.pixels[2].all;
-                            uint16_t p_1 = unit->pixels.pixels[3].all;
-
-                            const VideoDataPixel p00 = unit->pixels.pixels[p_0 & 1];
-                            const VideoDataPixel p01 = unit->pixels.pixels[p_1 & 1];
-
-                            const VideoDataPixel p10 = unit->pixels.pixels[p_0 >> 1 & 1];
-                            const VideoDataPixel p11 = unit->pixels.pixels[p_1 >> 1 & 1];
-
-                            const VideoDataPixel p20 = unit->pixels.pixels[p_0 >> 2 & 1];
-                            const VideoDataPixel p21 = unit->pixels.pixels[p_1 >> 2 & 1];
-
-                            const VideoDataPixel p30 = unit->pixels.pixels[p_0 >> 3 & 1];
-                            const VideoDataPixel p31 = unit->pixels.pixels[p_1 >> 3 & 1];
-
-                            const VideoDataPixel p40 = unit->pixels.pixels[p_0 >> 4 & 1];
-                            const VideoDataPixel p41 = unit->pixels.pixels[p_1 >> 4 & 1];
-
-                            const VideoDataPixel p50 = unit->pixels.pixels[p_0 >> 5 & 1];
-                            const VideoDataPixel p51 = unit->pixels.pixels[p_1 >> 5 & 1];
-
-#define EXPAND_12MHZ_VDP(VAR) ((uint32_t)(VAR).bits.b << 0u | (uint32_t)(VAR).bits.b << 4u | (uint32_t)(VAR).bits.g << 8u | (uint32_t)(VAR).bits.g << 12u | (uint32_t)(VAR).bits.r << 16u | (uint32_t)(VAR).bits.r << 20u)
-#define EXPAND_12MHZ_VARS(SUFFIX) ((uint32_t)(b##SUFFIX) << 0u | (uint32_t)(g##SUFFIX) << 8u | (uint32_t)(r##SUFFIX) << 16u)
-
-                            // 6 pixels:
-                            // <pre>
-                            // 0 1 2 3 4 5
-                            // </pre>
-                            //
-                            // Expand into 8. Scale up 4x, producing 24 pixels:
-                            //
-                            // <pre>
-                            // 0 0 0 0 1 1 1 1 2 2 2 2 3 3 3 3 4 4 4 4 5 5 5 5
-                            // </pre>
-                            //
-                            // Scale to 2/3 size, producing 8: (each pixel here
-                            // is the gamma-corrected average of all
-                            // contributing pixels)
-                            //
-                            // <pre>
-                            // 000 011 112 222 333 344 445 555
-                            // </pre>
-
-                            uint8_t r011_0 = m_blend[p00.bits.r][p10.bits.r];
-                            uint8_t g011_0 = m_blend[p00.bits.g][p10.bits.g];
-                            uint8_t b011_0 = m_blend[p00.bits.b][p10.bits.b];
-                            uint8_t r011_1 = m_blend[p01.bits.r][p11.bits.r];
-                            uint8_t g011_1 = m_blend[p01.bits.g][p11.bits.g];
-                            uint8_t b011_1 = m_blend[p01.bits.b][p11.bits.b];
-
-                            // 112
-                            uint8_t r112_0 = m_blend[p20.bits.r][p10.bits.r];
-                            uint8_t g112_0 = m_blend[p20.bits.g][p10.bits.g];
-                            uint8_t b112_0 = m_blend[p20.bits.b][p10.bits.b];
-                            uint8_t r112_1 = m_blend[p21.bits.r][p11.bits.r];
-                            uint8_t g112_1 = m_blend[p21.bits.g][p11.bits.g];
-                            uint8_t b112_1 = m_blend[p21.bits.b][p11.bits.b];
-
-                            // 344
-                            uint8_t r344_0 = m_blend[p30.bits.r][p40.bits.r];
-                            uint8_t g344_0 = m_blend[p30.bits.g][p40.bits.g];
-                            uint8_t b344_0 = m_blend[p30.bits.b][p40.bits.b];
-                            uint8_t r344_1 = m_blend[p31.bits.r][p41.bits.r];
-                            uint8_t g344_1 = m_blend[p31.bits.g][p41.bits.g];
-                            uint8_t b344_1 = m_blend[p31.bits.b][p41.bits.b];
-
-                            // 445
-                            uint8_t r445_0 = m_blend[p50.bits.r][p40.bits.r];
-                            uint8_t g445_0 = m_blend[p50.bits.g][p40.bits.g];
-                            uint8_t b445_0 = m_blend[p50.bits.b][p40.bits.b];
-                            uint8_t r445_1 = m_blend[p51.bits.r][p41.bits.r];
-                            uint8_t g445_1 = m_blend[p51.bits.g][p41.bits.g];
-                            uint8_t b445_1 = m_blend[p51.bits.b][p41.bits.b];
-
-                            pixels0[0] = EXPAND_12MHZ_VDP(p00);    //000
-                            pixels0[1] = EXPAND_12MHZ_VARS(011_0); //011
-                            pixels0[2] = EXPAND_12MHZ_VARS(112_0); //112
-                            pixels0[3] = EXPAND_12MHZ_VDP(p20);    //222
-                            pixels0[4] = EXPAND_12MHZ_VDP(p30);    //333
-                            pixels0[5] = EXPAND_12MHZ_VARS(344_0); //344
-                            pixels0[6] = EXPAND_12MHZ_VARS(445_0); //445
-                            pixels0[7] = EXPAND_12MHZ_VDP(p50);    //555
-
-                            pixels1[0] = EXPAND_12MHZ_VDP(p01);
-                            pixels1[1] = EXPAND_12MHZ_VARS(011_1);
-                            pixels1[2] = EXPAND_12MHZ_VARS(112_1);
-                            pixels1[3] = EXPAND_12MHZ_VDP(p21);
-                            pixels1[4] = EXPAND_12MHZ_VDP(p31);
-                            pixels1[5] = EXPAND_12MHZ_VARS(344_1);
-                            pixels1[6] = EXPAND_12MHZ_VARS(445_1);
-                            pixels1[7] = EXPAND_12MHZ_VDP(p51);
-
-#if VIDEO_TRACK_METADATA
-                            VideoDataUnit *units0 = m_units_line + m_x;
-                            units0[7] = units0[6] = units0[5] = units0[4] = units0[3] = units0[2] = units0[1] = units0[0] = *unit;
-
-                            VideoDataUnit *units1 = units0 + TV_TEXTURE_WIDTH;
-                            units1[7] = units1[6] = units1[5] = units1[4] = units1[3] = units1[2] = units1[1] = units1[0] = *unit;
-#endif
-                        }
-                    }
-                    break;
-
-                case VideoDataType_Bitmap12MHz:
-                    {
-                        if (m_x < TV_TEXTURE_WIDTH && m_y < TV_TEXTURE_HEIGHT) {
-                            pixels0 = m_pixels_line + m_x;
-                            pixels1 = pixels0 + TV_TEXTURE_WIDTH;
-
-                            const VideoDataPixel p0 = unit->pixels.pixels[0];
-                            const VideoDataPixel p1 = unit->pixels.pixels[1];
-                            const VideoDataPixel p2 = unit->pixels.pixels[2];
-                            const VideoDataPixel p3 = unit->pixels.pixels[3];
-                            const VideoDataPixel p4 = unit->pixels.pixels[4];
-                            const VideoDataPixel p5 = unit->pixels.pixels[5];
-
-                            uint8_t r011 = m_blend[p0.bits.r][p1.bits.r];
-                            uint8_t g011 = m_blend[p0.bits.g][p1.bits.g];
-                            uint8_t b011 = m_blend[p0.bits.b][p1.bits.b];
-
-                            uint8_t r112 = m_blend[p2.bits.r][p1.bits.r];
-                            uint8_t g112 = m_blend[p2.bits.g][p1.bits.g];
-                            uint8_t b112 = m_blend[p2.bits.b][p1.bits.b];
-
-                            uint8_t r334 = m_blend[p3.bits.r][p4.bits.r];
-                            uint8_t g334 = m_blend[p3.bits.g][p4.bits.g];
-                            uint8_t b334 = m_blend[p3.bits.b][p4.bits.b];
-
-                            uint8_t r445 = m_blend[p5.bits.r][p4.bits.r];
-                            uint8_t g445 = m_blend[p5.bits.g][p4.bits.g];
-                            uint8_t b445 = m_blend[p5.bits.b][p4.bits.b];
-
-                            pixels1[0] = pixels0[0] = EXPAND_12MHZ_VDP(p0);
-                            pixels1[1] = pixels0[1] = EXPAND_12MHZ_VARS(011);
-                            pixels1[2] = pixels0[2] = EXPAND_12MHZ_VARS(112);
-                            pixels1[3] = pixels0[3] = EXPAND_12MHZ_VDP(p2);
-                            pixels1[4] = pixels0[4] = EXPAND_12MHZ_VDP(p3);
-                            pixels1[5] = pixels0[5] = EXPAND_12MHZ_VARS(334);
-                            pixels1[6] = pixels0[6] = EXPAND_12MHZ_VARS(445);
-                            pixels1[7] = pixels0[7] = EXPAND_12MHZ_VDP(p5);
+                // Find the run of units scanned out on this line before the
+                // next state change. The last unit of the scanout period is
+                // still drawn.
+                size_t max_n = 1;
+                if (m_state_timer < SCAN_OUT_CYCLES) {
+                    max_n += (size_t)(SCAN_OUT_CYCLES - m_state_timer);
+                }
 
-#if VIDEO_TRACK_METADATA
-                            VideoDataUnit *units0 = m_units_line + m_x;
-                            units0[7] = units0[6] = units0[5] = units0[4] = units0[3] = units0[2] = units0[1] = units0[0] = *unit;
+                size_t n = 1;
+                while (n < max_n &&
+                       i + n < num_units &&
+                       !(unit[n].pixels.pixels[1].bits.x & (VideoDataUnitFlag_VSync | VideoDataUnitFlag_HSync))) {
+                    ++n;
+                }
 
-                            VideoDataUnit *units1 = units0 + TV_TEXTURE_WIDTH;
-                            units1[7] = units1[6] = units1[5] = units1[4] = units1[3] = units1[2] = units1[1] = units1[0] = *unit;
-#endif
-                        }
+                if (scanlines) {
+                    if (m_x < TV_TEXTURE_WIDTH && m_y < TV_TEXTURE_HEIGHT) {
+                        scanlines->push_back({unit, n, m_x, m_y});
                     }
-                    break;
+                } else {
+                    this->DrawUnits(&m_teletext_colours, m_x, m_y, unit, n);
                 }
 
-                m_x += 8;
+                m_x += n * 8;
+                m_state_timer += (int)n;
 
-                if (m_state_timer++ >= SCAN_OUT_CYCLES) {
+                if (n == max_n) {
                     m_state = TVOutputState_HorizontalRetrace;
                 }
+
+                i += n - 1;
+                unit += n - 1;
             }
             break;
 
@@ -392,10 +583,6 @@ void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
                     break;
                 }
 
-                m_pixels_line += TV_TEXTURE_WIDTH * 2;
-#if VIDEO_TRACK_METADATA
-                m_units_line += TV_TEXTURE_WIDTH * 2;
-#endif
                 m_state_timer = 2; //+1 for Scanout; +1 for this state
                 m_state = TVOutputState_HorizontalRetraceWait;
             }
@@ -423,7 +610,13 @@ void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
             }
             break;
         }
+
+        if (scanlines && m_state == TVOutputState_VerticalRetrace) {
+            return i + 1;
+        }
     }
+
+    return num_units;
 }
 
 #if BUILD_TYPE_Debug
@@ -435,11 +628,51 @@ void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void TVOutput::Update(const VideoDataUnit *units, size_t num_units) {
+    this->Scan(units, num_units, nullptr);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+size_t TVOutput::PrepareScanlines(const VideoDataUnit *units,
+                                  size_t num_units,
+                                  std::vector<Scanline> *scanlines,
+                                  bool *vertical_retrace) {
+    scanlines->clear();
+
+    size_t num_consumed = this->Scan(units, num_units, scanlines);
+
+    // Processing any unit moves the TV out of this state, so if it's in it
+    // now, the last unit put it there.
+    *vertical_retrace = num_consumed > 0 && m_state == TVOutputState_VerticalRetrace;
+
+    return num_consumed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TVOutput::DrawScanlines(const Scanline *scanlines, size_t num_scanlines) {
+    // The teletext pixel cache can't be shared between threads.
+    std::vector<TeletextColours> teletext_colours;
+
+    for (size_t i = 0; i < num_scanlines; ++i) {
+        const Scanline *scanline = &scanlines[i];
+
+        this->DrawUnits(&teletext_colours, scanline->x, scanline->y, scanline->units, scanline->num_units);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if BBCMICRO_DEBUGGER
 
 void TVOutput::FillWithTestPattern() {
     m_texture_pixels.clear();
     m_texture_dirty = true;
+    this->InvalidateRowUnits();
 
     uint32_t palette[8];
     for (size_t i = 0; i < 8; ++i) {
@@ -522,12 +755,44 @@ uint32_t *TVOutput::GetTexturePixels(uint64_t *texture_data_version) const {
 uint32_t *TVOutput::GetLastVSyncTexturePixels(UniqueLock<Mutex> *lock) const {
     *lock = UniqueLock<Mutex>(m_last_vsync_texture_pixels_mutex);
 
+    if (!m_keep_last_vsync_texture_pixels) {
+        return m_texture_pixels.data();
+    }
+
     return m_last_vsync_texture_pixels.data();
 }
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+bool TVOutput::GetKeepLastVSyncTexturePixels() const {
+    return m_keep_last_vsync_texture_pixels;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TVOutput::SetKeepLastVSyncTexturePixels(bool keep) {
+    if (keep == m_keep_last_vsync_texture_pixels) {
+        return;
+    }
+
+    LockGuard<Mutex> lock(m_last_vsync_texture_pixels_mutex);
+
+    if (keep) {
+        // Start off with whatever's there now, rather than nothing.
+        m_last_vsync_texture_pixels = m_texture_pixels;
+    } else {
+        m_last_vsync_texture_pixels.clear();
+        m_last_vsync_texture_pixels.shrink_to_fit();
+    }
+
+    m_keep_last_vsync_texture_pixels = keep;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void TVOutput::CopyTexturePixels(void *dest_pixels, size_t dest_pitch_bytes) const {
     ASSERT(dest_pitch_bytes > 0);
     size_t src_pitch_bytes = TV_TEXTURE_WIDTH * 4;
@@ -545,6 +810,10 @@ void TVOutput::CopyTexturePixels(void *dest_pixels, size_t dest_pitch_bytes) con
         }
     }
 
+    if (!this->HasMarkers()) {
+        return;
+    }
+
     if (this->show_usec_markers || this->show_half_usec_markers) {
         for (size_t x = 0; x < TV_TEXTURE_WIDTH; x += 8) {
             char *dest = (char *)((uint32_t *)dest_pixels + x);
@@ -640,6 +909,40 @@ void TVOutput::CopyTexturePixels(void *dest_pixels, size_t dest_pitch_bytes) con
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+const uint8_t *TVOutput::GetDirtyLines() const {
+    return m_dirty_lines.data();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TVOutput::ResetDirtyLines() {
+    std::fill(m_dirty_lines.begin(), m_dirty_lines.end(), (uint8_t)0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TVOutput::HasMarkers() const {
+    if (this->show_usec_markers ||
+        this->show_half_usec_markers ||
+        this->show_6845_row_markers ||
+        this->show_6845_dispen_markers) {
+        return true;
+    }
+
+#if BBCMICRO_DEBUGGER
+    if (this->show_beam_position) {
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #if VIDEO_TRACK_METADATA
 const VideoDataUnit *TVOutput::GetTextureUnits() const {
     return m_texture_units.data();
@@ -735,6 +1038,27 @@ void TVOutput::InitPalette() {
     m_6845_dispen_marker_xor = this->GetTexelValue(128, 0, 128);
 
     m_beam_marker_xor = this->GetTexelValue(255, 255, 255);
+
+    // The 12 MHz blends depend on the gamma.
+    for (TeletextColours &colours : m_teletext_colours) {
+        colours.valid_mask = 0;
+    }
+
+    this->InvalidateRowUnits();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TVOutput::InvalidateRowUnits() {
+    // No unit has this value, as the x bits of pixel 0 would indicate an
+    // invalid VideoDataType.
+    VideoDataUnitPixels invalid;
+    invalid.values[0] = ~(uint64_t)0;
+    invalid.values[1] = ~(uint64_t)0;
+
+    std::fill(m_row_units.begin(), m_row_units.end(), invalid);
+    std::fill(m_dirty_lines.begin(), m_dirty_lines.end(), (uint8_t)1);
 }
 
 //////////////////////////////////////////////////////////////////////////
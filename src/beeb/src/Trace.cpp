@@ -7,7 +7,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <shared/log.h>
+#include <shared/file_io.h>
+#include <shared/mutex.h>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <thread>
 
 #include <shared/enum_def.h>
 #include <beeb/Trace.inl>
@@ -31,6 +39,14 @@ static const size_t MAX_EVENT_SIZE = 65535;
 
 static_assert(MAX_EVENT_SIZE <= CHUNK_SIZE, "chunks must be large enough for at least one event");
 
+// When spilling, the number of chunks that can be waiting to be written out
+// before the emulation has to wait for the writer thread to catch up.
+static constexpr size_t MAX_NUM_PENDING_SPILL_CHUNKS = 4;
+
+static constexpr size_t SPILL_ALIGNMENT = alignof(std::max_align_t);
+
+LOG_TAGGED_DEFINE(TRACE_SPILL, "trace", "SPILL ", &log_printer_stdout_and_debugger, true);
+
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
@@ -93,6 +109,27 @@ const std::string &TraceEventType::GetName() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+const TraceEventType *TraceEventType::GetByID(uint8_t type_id) {
+    return g_trace_event_types[type_id];
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+const TraceEventType *TraceEventType::FindByName(const std::string &name) {
+    for (size_t i = 0; i < g_trace_next_id; ++i) {
+        const TraceEventType *type = g_trace_event_types[i];
+        if (type && type->m_name == name) {
+            return type;
+        }
+    }
+
+    return nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 //const TraceEventType Trace::BLANK_LINE_EVENT("_blank_line", 0, TraceEventSource_None);
 const TraceEventType Trace::STRING_EVENT("_string", 0, TraceEventSource_None);
 
@@ -130,11 +167,54 @@ struct Trace::Chunk {
 
     PagingState initial_paging;
     bool initial_parasite_boot_mode = false;
+
+    bool passed_to_chunk_fn = false;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// The spill file is just the spilled chunks, as they are in memory, one
+// after the other. Each is padded so the next one's Chunk is suitably
+// aligned.
+struct Trace::SpillState {
+    std::string path;
+    FILE *f = nullptr;
+
+    // The first spilled chunk's initial state. Only touched by the thread
+    // producing the events.
+    bool any_spilled = false;
+    PagingState initial_paging;
+    bool initial_parasite_boot_mode = false;
+
+    Mutex mutex;
+    std::condition_variable_any cv;
+
+    // Chunks waiting to be written, or being written. The writer thread
+    // removes each one once it's done with it.
+    std::deque<Chunk *> chunks;
+
+    bool quit = false;
+    bool good = true;
+
+    std::thread thread;
 };
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+static size_t GetSpilledChunkNumBytes(size_t chunk_header_size, size_t chunk_size) {
+    size_t n = chunk_header_size + chunk_size;
+
+    n += SPILL_ALIGNMENT - 1;
+    n -= n % SPILL_ALIGNMENT;
+
+    return n;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 Trace::Trace(size_t max_num_bytes,
              std::shared_ptr<const BBCMicroType> bbc_micro_type,
              const PagingState &initial_paging,
@@ -153,6 +233,25 @@ Trace::Trace(size_t max_num_bytes,
 //////////////////////////////////////////////////////////////////////////
 
 Trace::~Trace() {
+    if (m_spill) {
+        {
+            LockGuard<Mutex> lock(m_spill->mutex);
+
+            m_spill->quit = true;
+            m_spill->cv.notify_all();
+        }
+
+        m_spill->thread.join();
+
+        // Anything not yet written is no longer needed.
+        for (Chunk *c : m_spill->chunks) {
+            free(c);
+        }
+
+        fclose(m_spill->f);
+        remove(m_spill->path.c_str());
+    }
+
     Chunk *c = m_head;
     while (c) {
         Chunk *next = c->next;
@@ -419,7 +518,9 @@ std::shared_ptr<const BBCMicroType> Trace::GetBBCMicroType() const {
 //////////////////////////////////////////////////////////////////////////
 
 const PagingState &Trace::GetInitialPagingState() const {
-    if (m_head) {
+    if (m_spill && m_spill->any_spilled) {
+        return m_spill->initial_paging;
+    } else if (m_head) {
         return m_head->initial_paging;
     } else {
         return m_paging;
@@ -437,7 +538,9 @@ BBCMicroParasiteType Trace::GetParasiteType() const {
 //////////////////////////////////////////////////////////////////////////
 
 bool Trace::GetInitialParasiteBootMode() const {
-    if (m_head) {
+    if (m_spill && m_spill->any_spilled) {
+        return m_spill->initial_parasite_boot_mode;
+    } else if (m_head) {
         return m_head->initial_parasite_boot_mode;
     } else {
         return m_parasite_boot_mode;
@@ -454,65 +557,289 @@ const M6502Config *Trace::GetParasiteM6502Config() const {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-int Trace::ForEachEvent(ForEachEventFn fn, void *context) {
-    if (!m_head) {
-        return 1;
+template <class ChunkFnType>
+bool Trace::ForEachChunkInternal(ChunkFnType &&fn) const {
+    // Keep the file mapped for the duration.
+    std::shared_ptr<const MappedFile> spilled = this->GetSpilledChunks();
+    if (spilled) {
+        const uint8_t *p = spilled->GetData();
+        const uint8_t *end = p + spilled->GetSize();
+
+        while ((size_t)(end - p) >= sizeof(Chunk)) {
+            auto c = (const Chunk *)p;
+
+            size_t n = GetSpilledChunkNumBytes(sizeof *c, c->size);
+            if (n > (size_t)(end - p)) {
+                // Incomplete last chunk.
+                break;
+            }
+
+            if (!fn(c, spilled)) {
+                return false;
+            }
+
+            p += n;
+        }
+    }
+
+    const std::shared_ptr<const MappedFile> no_file;
+    for (const Chunk *c = m_head; c; c = c->next) {
+        if (!fn(c, no_file)) {
+            return false;
+        }
     }
 
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int Trace::ForEachEvent(ForEachEventFn fn, void *context) {
+    CycleCount time;
+    bool first = true;
+
+    return this->ForEachChunkInternal([this, &time, &first, fn, context](const Chunk *c, const std::shared_ptr<const MappedFile> &) -> bool {
+        if (first) {
+            time = c->initial_time;
+            first = false;
+        }
+
+        auto data = (const uint8_t *)(c + 1);
+        return this->ForEachEventInRange(data, data + c->size, &time, fn, context);
+    }) ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool Trace::ForEachEventInRange(const void *begin,
+                                const void *end_,
+                                CycleCount *time,
+                                ForEachEventFn fn,
+                                void *context) {
     TraceEvent e;
-    e.time = m_head->initial_time;
+    e.time = *time;
 
-    Chunk *c = m_head;
-    while (c) {
-        const uint8_t *p = (uint8_t *)(c + 1);
-        const uint8_t *end = p + c->size;
+    const uint8_t *p = (const uint8_t *)begin;
+    const uint8_t *end = (const uint8_t *)end_;
 
-        while (p < end) {
-            const EventHeader *h = (const EventHeader *)p;
-            p += sizeof(EventHeader);
+    while (p < end) {
+        const EventHeader *h = (const EventHeader *)p;
+        p += sizeof(EventHeader);
 
-            ASSERT(h->type < g_trace_next_id);
+        ASSERT(h->type < g_trace_next_id);
 
-            e.type = g_trace_event_types[h->type];
-            ASSERT(e.type);
+        e.type = g_trace_event_types[h->type];
+        ASSERT(e.type);
 
-            e.size = e.type->size;
-            if (e.size == 0) {
-                const EventWithSizeHeader *hs = (const EventWithSizeHeader *)h;
+        e.size = e.type->size;
+        if (e.size == 0) {
+            const EventWithSizeHeader *hs = (const EventWithSizeHeader *)h;
 
-                e.size = hs->size;
-                p += sizeof(EventWithSizeHeader) - sizeof(EventHeader);
-            }
+            e.size = hs->size;
+            p += sizeof(EventWithSizeHeader) - sizeof(EventHeader);
+        }
 
-            e.event = p;
+        e.event = p;
 
-            if (e.type == &DISCONTINUITY_EVENT) {
-                auto de = (const DiscontinuityTraceEvent *)e.event;
+        if (e.type == &DISCONTINUITY_EVENT) {
+            auto de = (const DiscontinuityTraceEvent *)e.event;
 
-                // Shouldn't be able to find one to cancel it...
-                ASSERT(!h->canceled);
+            // Shouldn't be able to find one to cancel it...
+            ASSERT(!h->canceled);
 
-                e.time = de->new_time;
-            } else {
-                e.time.n += h->time_delta;
+            e.time = de->new_time;
+        } else {
+            e.time.n += h->time_delta;
 
-                if (!h->canceled) {
-                    e.source = (TraceEventSource)h->source;
-                    if (!(*fn)(this, &e, context)) {
-                        return 0;
-                    }
+            if (!h->canceled) {
+                e.source = (TraceEventSource)h->source;
+                if (!(*fn)(this, &e, context)) {
+                    *time = e.time;
+                    return false;
                 }
             }
+        }
+
+        p += e.size;
+    }
+
+    ASSERT(p == end);
+
+    *time = e.time;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
 
-            p += e.size;
+void Trace::SetChunkFn(ChunkFn fn, void *context) {
+    m_chunk_fn = fn;
+    m_chunk_fn_context = context;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void Trace::FlushChunks() {
+    this->CallChunkFn(nullptr);
+
+    if (m_tail) {
+        m_tail_flushed = true;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool Trace::ForEachChunk(ForEachChunkFn fn, void *context) const {
+    return this->ForEachChunkInternal([fn, context](const Chunk *c, const std::shared_ptr<const MappedFile> &file) -> bool {
+        ChunkData data;
+        GetChunkData(&data, c);
+        data.spill_file = file;
+
+        return (*fn)(&data, context);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool Trace::AddChunk(const ChunkData &chunk, const TraceEventType *const types[256]) {
+    Chunk *c = (Chunk *)malloc(sizeof *c + chunk.size);
+    if (!c) {
+        return false;
+    }
+
+    new (c) Chunk;
+    c->size = chunk.size;
+    c->capacity = chunk.size; // so the next Alloc starts a new chunk
+    c->num_events = chunk.num_events;
+    c->initial_time = chunk.initial_time;
+    c->last_time = chunk.last_time;
+    c->initial_paging = chunk.initial_paging;
+    c->initial_parasite_boot_mode = chunk.initial_parasite_boot_mode;
+
+    memcpy(c + 1, chunk.data, chunk.size);
+
+    // Check the events all make sense, remapping the type IDs as they go, and
+    // find the times in the same way as ForEachEvent.
+    CycleCount time = m_tail ? m_last_time : chunk.initial_time;
+    CycleCount max_time = m_stats.max_time;
+    size_t num_events = 0;
+    bool good = true;
+
+    uint8_t *p = (uint8_t *)(c + 1);
+    const uint8_t *end = p + c->size;
+    while (p < end) {
+        if ((size_t)(end - p) < sizeof(EventHeader)) {
+            good = false;
+            break;
         }
 
-        ASSERT(p == end);
+        auto h = (EventHeader *)p;
+
+        const TraceEventType *type = types[h->type];
+        if (!type) {
+            good = false;
+            break;
+        }
+
+        h->type = type->type_id;
+
+        size_t header_size = sizeof(EventHeader);
+        size_t size = type->size;
+        if (size == 0) {
+            header_size = sizeof(EventWithSizeHeader);
+            if ((size_t)(end - p) < header_size) {
+                good = false;
+                break;
+            }
+
+            size = ((const EventWithSizeHeader *)p)->size;
+        }
 
-        c = c->next;
+        if ((size_t)(end - p) - header_size < size) {
+            good = false;
+            break;
+        }
+
+        const uint8_t *data = p + header_size;
+
+        if (type == &STRING_EVENT) {
+            // SaveTrace relies on the terminating 0.
+            if (size == 0 || data[size - 1] != 0) {
+                good = false;
+                break;
+            }
+        }
+
+        if (type == &DISCONTINUITY_EVENT) {
+            DiscontinuityTraceEvent de;
+            memcpy(&de, data, sizeof de);
+
+            time = de.new_time;
+        } else {
+            time.n += h->time_delta;
+        }
+
+        if (time.n > max_time.n) {
+            max_time = time;
+        }
+
+        p += header_size + size;
+        ++num_events;
+    }
+
+    if (!good || num_events != c->num_events) {
+        free(c);
+        return false;
     }
 
-    return 1;
+    if (!m_head) {
+        m_head = c;
+    } else {
+        ASSERT(m_tail);
+        m_tail->next = c;
+    }
+
+    m_tail = c;
+    m_tail_flushed = false;
+    m_last_time = time;
+
+    m_stats.num_events += c->num_events;
+    m_stats.num_used_bytes += c->size;
+    m_stats.num_allocated_bytes += c->capacity;
+    m_stats.max_time = max_time;
+
+    this->Check();
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool Trace::SetSpillFile(const std::string &path, const LogSet &logs) {
+    ASSERT(!m_spill);
+
+    FILE *f = fopenUTF8(path.c_str(), "wb");
+    if (!f) {
+        int err = errno;
+        logs.e.f("failed to create trace spill file: %s\n", path.c_str());
+        logs.i.f("(fopen failed: %s)\n", strerror(err));
+        return false;
+    }
+
+    m_spill = std::make_unique<SpillState>();
+    m_spill->path = path;
+    m_spill->f = f;
+    MUTEX_SET_NAME(m_spill->mutex, "Trace spill");
+
+    m_spill->thread = std::thread(std::bind(&Trace::SpillThreadFunc, this));
+
+    return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -579,9 +906,21 @@ void *Trace::Alloc(CycleCount time, size_t n) {
         return nullptr;
     }
 
-    if (!m_tail || m_tail->size + n > m_tail->capacity) {
+    // If a discontinuity event is needed, it has to go in the same chunk.
+    bool discontinuity = time.n < m_last_time.n || time.n - m_last_time.n > MAX_TIME_DELTA;
+
+    size_t total_n = n;
+    if (discontinuity) {
+        total_n += sizeof(EventHeader) + sizeof(DiscontinuityTraceEvent);
+    }
+
+    if (!m_tail || m_tail_flushed || m_tail->size + total_n > m_tail->capacity) {
         size_t size = CHUNK_SIZE;
 
+        // Everything before the current tail is now finished with. This has
+        // to happen before the head is discarded.
+        this->CallChunkFn(m_tail);
+
         Chunk *c = (Chunk *)malloc(sizeof *c + size);
         if (!c) {
             return nullptr;
@@ -597,17 +936,24 @@ void *Trace::Alloc(CycleCount time, size_t n) {
 
                 m_head = m_head->next;
 
-                ASSERT(m_stats.num_used_bytes >= old_head->size);
-                m_stats.num_used_bytes -= old_head->size;
-
                 ASSERT(m_stats.num_allocated_bytes >= old_head->capacity);
                 m_stats.num_allocated_bytes -= old_head->capacity;
 
-                ASSERT(m_stats.num_events >= old_head->num_events);
-                m_stats.num_events -= old_head->num_events;
+                if (m_spill) {
+                    // The events are still part of the trace, just not in
+                    // memory.
+                    this->SpillChunk(old_head);
+                } else {
+                    ASSERT(m_stats.num_used_bytes >= old_head->size);
+                    m_stats.num_used_bytes -= old_head->size;
+
+                    ASSERT(m_stats.num_events >= old_head->num_events);
+                    m_stats.num_events -= old_head->num_events;
+
+                    // Could/should maybe reuse the old head instead...
+                    free(old_head);
+                }
 
-                // Could/should maybe reuse the old head instead...
-                free(old_head);
                 old_head = nullptr;
 
                 this->Check();
@@ -628,6 +974,7 @@ void *Trace::Alloc(CycleCount time, size_t n) {
         }
 
         m_tail = c;
+        m_tail_flushed = false;
 
         // Don't bother accounting for the header... it's just noise.
         m_stats.num_allocated_bytes += m_tail->capacity;
@@ -639,7 +986,7 @@ void *Trace::Alloc(CycleCount time, size_t n) {
         m_stats.max_time = time;
     }
 
-    if (time.n < m_last_time.n || time.n - m_last_time.n > MAX_TIME_DELTA) {
+    if (discontinuity) {
         // Insert a discontinuity event. Ensure it has a time_delta of
         // 0.
         m_last_time = time;
@@ -670,6 +1017,153 @@ void *Trace::Alloc(CycleCount time, size_t n) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+// Pass each chunk before end (or all of them, if end is null) to the chunk
+// fn, if it hasn't been already.
+void Trace::CallChunkFn(const Chunk *end) {
+    if (!m_chunk_fn) {
+        return;
+    }
+
+    for (Chunk *c = m_head; c != end; c = c->next) {
+        if (!c->passed_to_chunk_fn) {
+            ChunkData data;
+            GetChunkData(&data, c);
+
+            (*m_chunk_fn)(&data, m_chunk_fn_context);
+
+            c->passed_to_chunk_fn = true;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void Trace::GetChunkData(ChunkData *data, const Chunk *c) {
+    data->data = c + 1;
+    data->size = c->size;
+    data->num_events = c->num_events;
+    data->initial_time = c->initial_time;
+    data->last_time = c->last_time;
+    data->initial_paging = c->initial_paging;
+    data->initial_parasite_boot_mode = c->initial_parasite_boot_mode;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Hand the chunk to the writer thread, which will free it once it's been
+// written out.
+void Trace::SpillChunk(Chunk *c) {
+    ASSERT(m_spill);
+
+    if (!m_spill->any_spilled) {
+        m_spill->initial_paging = c->initial_paging;
+        m_spill->initial_parasite_boot_mode = c->initial_parasite_boot_mode;
+        m_spill->any_spilled = true;
+    }
+
+    c->next = nullptr;
+
+    m_stats.num_spilled_bytes += c->size;
+
+    UniqueLock<Mutex> lock(m_spill->mutex);
+
+    while (m_spill->chunks.size() >= MAX_NUM_PENDING_SPILL_CHUNKS) {
+        m_spill->cv.wait(lock);
+    }
+
+    m_spill->chunks.push_back(c);
+    m_spill->cv.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Wait for any pending chunks to be written, then map the file. Returns
+// nullptr if there are no spilled chunks.
+std::shared_ptr<const MappedFile> Trace::GetSpilledChunks() const {
+    if (!m_spill || !m_spill->any_spilled) {
+        return nullptr;
+    }
+
+    {
+        UniqueLock<Mutex> lock(m_spill->mutex);
+
+        while (!m_spill->chunks.empty()) {
+            m_spill->cv.wait(lock);
+        }
+
+        // The writer thread is idle now, so it's safe to touch the FILE.
+        if (fflush(m_spill->f) != 0) {
+            m_spill->good = false;
+        }
+
+        if (!m_spill->good) {
+            LOGF(TRACE_SPILL, "trace spill file is incomplete: %s\n", m_spill->path.c_str());
+        }
+    }
+
+    return MappedFile::Open(m_spill->path, nullptr);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void Trace::SpillThreadFunc() {
+    SetCurrentThreadName("Trace spill");
+
+    SpillState *s = m_spill.get();
+    static const uint8_t PADDING[SPILL_ALIGNMENT] = {};
+
+    UniqueLock<Mutex> lock(s->mutex);
+
+    for (;;) {
+        while (s->chunks.empty() && !s->quit) {
+            s->cv.wait(lock);
+        }
+
+        if (s->quit) {
+            break;
+        }
+
+        Chunk *c = s->chunks.front();
+        bool good = s->good;
+
+        lock.unlock();
+
+        // Once one write has failed, there's no point trying any more.
+        // The spill file stops at the last complete chunk.
+        if (good) {
+            size_t num_padding_bytes = GetSpilledChunkNumBytes(sizeof *c, c->size) - sizeof *c - c->size;
+
+            if (fwrite(c, sizeof *c + c->size, 1, s->f) != 1 ||
+                fwrite(PADDING, 1, num_padding_bytes, s->f) != num_padding_bytes) {
+                int err = errno;
+                LOGF(TRACE_SPILL, "failed to write trace spill file: %s\n", s->path.c_str());
+                LOGF(TRACE_SPILL, "(fwrite failed: %s)\n", strerror(err));
+                good = false;
+            }
+        }
+
+        static_assert(std::is_trivially_destructible<decltype(*c)>::value);
+        free(c);
+        c = nullptr;
+
+        lock.lock();
+
+        if (!good) {
+            s->good = false;
+        }
+
+        s->chunks.pop_front();
+        s->cv.notify_all();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void Trace::Check() {
 #if ASSERT_ENABLED
 //    size_t total_num_used_bytes=0;
@@ -0,0 +1,532 @@
+#include <shared/system.h>
+#include <beeb/TraceFile.h>
+
+#if BBCMICRO_TRACE
+
+#include <shared/debug.h>
+#include <shared/file_io.h>
+#include <shared/load_store.h>
+#include <shared/log.h>
+#include <beeb/6502.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// File layout:
+//
+// +0 8 magic
+// +8 4 format version
+// +12 4 byte order mark (native byte order)
+// +16 4 size of header data
+// +20 12 reserved
+// +32 ... header data
+// ... chunks, until end of file
+//
+// Header data:
+//
+// +0 4 BBCMicroTypeID
+// +4 ... initial PagingState (raw)
+// ... 4 BBCMicroParasiteType
+// ... parasite M6502Config name (string; empty if no parasite)
+// ... 1 initial parasite boot mode
+// ... 4 number of event types
+// ... event types
+//
+// Each event type:
+//
+// +0 1 type ID
+// +1 4 size (0 if variable size)
+// +5 ... name (string)
+//
+// Each chunk:
+//
+// +0 8 size of chunk data
+// +8 8 number of events
+// +16 8 initial time
+// +24 8 last time
+// +32 ... initial PagingState (raw)
+// ... 1 initial parasite boot mode
+// ... chunk data
+//
+// Strings are a 4-byte size followed by the chars. Raw images are a 4-byte
+// size followed by the data.
+//
+// Numbers are little-endian, apart from the byte order mark, and whatever's
+// in the raw images and chunk data.
+
+static const char MAGIC[8] = "b2trace";
+
+// Bump this whenever anything changes, including the Trace chunk data
+// format.
+static constexpr uint32_t FORMAT_VERSION = 1;
+
+static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+static constexpr size_t HEADER_SIZE = 32;
+
+// Possible parasite M6502Configs, found by name when loading.
+static const M6502Config *const PARASITE_M6502_CONFIGS[] = {
+    &M6502_nmos6502_config,
+    &M6502_defined_config,
+    &M6502_cmos6502_config,
+    &M6502_rockwell65c02_config,
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+class DataWriter {
+  public:
+    std::vector<uint8_t> data;
+
+    void Add8(uint8_t value) {
+        this->data.push_back(value);
+    }
+
+    void Add32(uint32_t value) {
+        uint8_t buf[4];
+        Store32LE(buf, value);
+        this->AddBytes(buf, sizeof buf);
+    }
+
+    void Add64(uint64_t value) {
+        uint8_t buf[8];
+        Store64LE(buf, value);
+        this->AddBytes(buf, sizeof buf);
+    }
+
+    void AddString(const std::string &str) {
+        this->Add32((uint32_t)str.size());
+        this->AddBytes(str.data(), str.size());
+    }
+
+    void AddBytes(const void *bytes, size_t num_bytes) {
+        this->data.insert(this->data.end(), (const uint8_t *)bytes, (const uint8_t *)bytes + num_bytes);
+    }
+
+    template <class T>
+    void AddRaw(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw images must be trivially copyable");
+
+        this->Add32((uint32_t)sizeof value);
+        this->AddBytes(&value, sizeof value);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Errors are sticky: once one Get fails, the rest do too, and IsGood returns
+// false.
+class DataReader {
+  public:
+    DataReader(const uint8_t *data, size_t size, const LogSet &logs)
+        : m_p(data)
+        , m_end(data + size)
+        , m_logs(logs) {
+    }
+
+    bool IsGood() const {
+        return m_good;
+    }
+
+    bool IsEOF() const {
+        return m_p == m_end;
+    }
+
+    uint8_t Get8() {
+        const uint8_t *p = this->GetBytes(1);
+        return p ? *p : 0;
+    }
+
+    uint32_t Get32() {
+        const uint8_t *p = this->GetBytes(4);
+        return p ? Load32LE(p) : 0;
+    }
+
+    uint64_t Get64() {
+        const uint8_t *p = this->GetBytes(8);
+        return p ? Load64LE(p) : 0;
+    }
+
+    std::string GetString() {
+        uint32_t size = this->Get32();
+
+        const uint8_t *p = this->GetBytes(size);
+        if (!p) {
+            return std::string();
+        }
+
+        return std::string((const char *)p, size);
+    }
+
+    // Returns a pointer into the data, or nullptr if there isn't enough
+    // left.
+    const uint8_t *GetBytes(size_t num_bytes) {
+        if (m_good) {
+            if ((size_t)(m_end - m_p) < num_bytes) {
+                m_logs.e.f("bad trace file: truncated\n");
+                m_good = false;
+            }
+        }
+
+        if (!m_good) {
+            return nullptr;
+        }
+
+        const uint8_t *p = m_p;
+        m_p += num_bytes;
+        return p;
+    }
+
+    template <class T>
+    void GetRaw(T *value, const char *name) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw images must be trivially copyable");
+
+        uint32_t size = this->Get32();
+        if (!m_good) {
+            return;
+        }
+
+        if (size != sizeof *value) {
+            m_logs.e.f("bad trace file: %s size is %" PRIu32 " bytes; expected %zu bytes\n",
+                       name, size, sizeof *value);
+            m_good = false;
+            return;
+        }
+
+        if (const uint8_t *p = this->GetBytes(sizeof *value)) {
+            memcpy(value, p, sizeof *value);
+        }
+    }
+
+  protected:
+  private:
+    const uint8_t *m_p = nullptr;
+    const uint8_t *m_end = nullptr;
+    const LogSet &m_logs;
+    bool m_good = true;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+TraceFileWriter::TraceFileWriter(const LogSet &logs)
+    : m_logs(logs) {
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+TraceFileWriter::~TraceFileWriter() {
+    if (m_f) {
+        fclose(m_f);
+        m_f = nullptr;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TraceFileWriter::Open(const std::string &path, const Trace &trace) {
+    ASSERT(!m_f);
+
+    m_path = path;
+    m_num_bytes_written = 0;
+
+    m_f = fopenUTF8(m_path.c_str(), "wb");
+    if (!m_f) {
+        int err = errno;
+        m_logs.e.f("failed to open trace file: %s\n", m_path.c_str());
+        m_logs.i.f("(fopen failed: %s)\n", strerror(err));
+        return false;
+    }
+
+    m_good = true;
+
+    DataWriter header_data;
+
+    std::shared_ptr<const BBCMicroType> type = trace.GetBBCMicroType();
+    header_data.Add32((uint32_t)type->type_id);
+    header_data.AddRaw(trace.GetInitialPagingState());
+    header_data.Add32((uint32_t)trace.GetParasiteType());
+
+    if (const M6502Config *config = trace.GetParasiteM6502Config()) {
+        header_data.AddString(config->name);
+    } else {
+        header_data.AddString("");
+    }
+
+    header_data.Add8(trace.GetInitialParasiteBootMode());
+
+    std::vector<const TraceEventType *> types;
+    for (size_t i = 0; i < 256; ++i) {
+        if (const TraceEventType *type = TraceEventType::GetByID((uint8_t)i)) {
+            types.push_back(type);
+        }
+    }
+
+    header_data.Add32((uint32_t)types.size());
+    for (const TraceEventType *type : types) {
+        header_data.Add8(type->type_id);
+        header_data.Add32((uint32_t)type->size);
+        header_data.AddString(type->GetName());
+    }
+
+    uint8_t header[HEADER_SIZE] = {};
+    memcpy(header + 0, MAGIC, sizeof MAGIC);
+    Store32LE(header + 8, FORMAT_VERSION);
+    memcpy(header + 12, &BYTE_ORDER_MARK, 4);
+    Store32LE(header + 16, (uint32_t)header_data.data.size());
+
+    this->Write(header, sizeof header);
+    this->Write(header_data.data.data(), header_data.data.size());
+
+    return m_good;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TraceFileWriter::WriteChunk(const Trace::ChunkData &chunk) {
+    if (!m_good) {
+        return;
+    }
+
+    DataWriter chunk_header;
+
+    chunk_header.Add64(chunk.size);
+    chunk_header.Add64(chunk.num_events);
+    chunk_header.Add64(chunk.initial_time.n);
+    chunk_header.Add64(chunk.last_time.n);
+    chunk_header.AddRaw(chunk.initial_paging);
+    chunk_header.Add8(chunk.initial_parasite_boot_mode);
+
+    this->Write(chunk_header.data.data(), chunk_header.data.size());
+    this->Write(chunk.data, chunk.size);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TraceFileWriter::Close() {
+    if (!m_f) {
+        return false;
+    }
+
+    if (fclose(m_f) != 0) {
+        if (m_good) {
+            int err = errno;
+            m_logs.e.f("failed to write trace file: %s\n", m_path.c_str());
+            m_logs.i.f("(fclose failed: %s)\n", strerror(err));
+            m_good = false;
+        }
+    }
+
+    m_f = nullptr;
+
+    return m_good;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+uint64_t TraceFileWriter::GetNumBytesWritten() const {
+    return m_num_bytes_written;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TraceFileWriter::ChunkFn(const Trace::ChunkData *chunk, void *context) {
+    auto writer = (TraceFileWriter *)context;
+
+    writer->WriteChunk(*chunk);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TraceFileWriter::Write(const void *data, size_t num_bytes) {
+    if (!m_good) {
+        return;
+    }
+
+    if (fwrite(data, 1, num_bytes, m_f) != num_bytes) {
+        int err = errno;
+        m_logs.e.f("failed to write trace file: %s\n", m_path.c_str());
+        m_logs.i.f("(fwrite failed: %s)\n", strerror(err));
+        m_good = false;
+        return;
+    }
+
+    m_num_bytes_written += num_bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool SaveTraceFile(const std::string &path, const Trace &trace, const LogSet &logs) {
+    TraceFileWriter writer(logs);
+
+    if (!writer.Open(path, trace)) {
+        return false;
+    }
+
+    trace.ForEachChunk([](const Trace::ChunkData *chunk, void *context) -> bool {
+        auto writer = (TraceFileWriter *)context;
+
+        writer->WriteChunk(*chunk);
+        return true;
+    },
+                       &writer);
+
+    return writer.Close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<Trace> LoadTraceFile(const std::string &path, const LogSet &logs) {
+    std::shared_ptr<const MappedFile> file = MappedFile::Open(path, &logs);
+    if (!file) {
+        return nullptr;
+    }
+
+    const uint8_t *data = file->GetData();
+    size_t size = file->GetSize();
+
+    if (size < HEADER_SIZE || memcmp(data, MAGIC, sizeof MAGIC) != 0) {
+        logs.e.f("not a trace file: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    uint32_t version = Load32LE(data + 8);
+    uint32_t byte_order_mark;
+    memcpy(&byte_order_mark, data + 12, 4);
+    if (version != FORMAT_VERSION || byte_order_mark != BYTE_ORDER_MARK) {
+        logs.e.f("trace file was saved by a different build: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    uint32_t header_data_size = Load32LE(data + 16);
+    if (header_data_size > size - HEADER_SIZE) {
+        logs.e.f("bad trace file: header is truncated\n");
+        return nullptr;
+    }
+
+    DataReader header_reader(data + HEADER_SIZE, header_data_size, logs);
+
+    uint32_t type_id = header_reader.Get32();
+
+    PagingState initial_paging;
+    header_reader.GetRaw(&initial_paging, "PagingState");
+
+    uint32_t parasite_type = header_reader.Get32();
+    std::string parasite_m6502_config_name = header_reader.GetString();
+    bool initial_parasite_boot_mode = header_reader.Get8() != 0;
+
+    // Map the file's type IDs to this build's types.
+    const TraceEventType *types[256] = {};
+    uint32_t num_types = header_reader.Get32();
+    for (uint32_t i = 0; i < num_types; ++i) {
+        uint8_t file_type_id = header_reader.Get8();
+        uint32_t type_size = header_reader.Get32();
+        std::string type_name = header_reader.GetString();
+        if (!header_reader.IsGood()) {
+            break;
+        }
+
+        // Unknown types are left null. That's only a problem if there are
+        // any events of that type.
+        if (const TraceEventType *type = TraceEventType::FindByName(type_name)) {
+            if (type->size != type_size) {
+                logs.e.f("bad trace file: %s event size is %" PRIu32 " bytes; expected %zu bytes\n",
+                         type_name.c_str(), type_size, type->size);
+                return nullptr;
+            }
+
+            types[file_type_id] = type;
+        }
+    }
+
+    if (!header_reader.IsGood()) {
+        return nullptr;
+    }
+
+    if (GetBBCMicroTypeIDEnumName((int)type_id)[0] == '?') {
+        logs.e.f("bad trace file: unknown model: %" PRIu32 "\n", type_id);
+        return nullptr;
+    }
+
+    if (GetBBCMicroParasiteTypeEnumName((int)parasite_type)[0] == '?') {
+        logs.e.f("bad trace file: unknown parasite type: %" PRIu32 "\n", parasite_type);
+        return nullptr;
+    }
+
+    const M6502Config *parasite_m6502_config = nullptr;
+    if (!parasite_m6502_config_name.empty()) {
+        for (const M6502Config *config : PARASITE_M6502_CONFIGS) {
+            if (parasite_m6502_config_name == config->name) {
+                parasite_m6502_config = config;
+                break;
+            }
+        }
+
+        if (!parasite_m6502_config) {
+            logs.e.f("bad trace file: unknown parasite CPU: %s\n", parasite_m6502_config_name.c_str());
+            return nullptr;
+        }
+    }
+
+    auto trace = std::make_shared<Trace>(SIZE_MAX,
+                                         CreateBBCMicroType((BBCMicroTypeID)type_id, initial_paging.rom_types),
+                                         initial_paging,
+                                         (BBCMicroParasiteType)parasite_type,
+                                         parasite_m6502_config,
+                                         initial_parasite_boot_mode);
+
+    DataReader chunks_reader(data + HEADER_SIZE + header_data_size, size - HEADER_SIZE - header_data_size, logs);
+    size_t chunk_index = 0;
+    while (!chunks_reader.IsEOF()) {
+        Trace::ChunkData chunk;
+
+        uint64_t chunk_size = chunks_reader.Get64();
+        chunk.num_events = (size_t)chunks_reader.Get64();
+        chunk.initial_time.n = chunks_reader.Get64();
+        chunk.last_time.n = chunks_reader.Get64();
+        chunks_reader.GetRaw(&chunk.initial_paging, "PagingState");
+        chunk.initial_parasite_boot_mode = chunks_reader.Get8() != 0;
+
+        if (chunk_size > SIZE_MAX) {
+            logs.e.f("bad trace file: chunk %zu is too large\n", chunk_index);
+            return nullptr;
+        }
+
+        chunk.size = (size_t)chunk_size;
+        chunk.data = chunks_reader.GetBytes(chunk.size);
+
+        if (!chunks_reader.IsGood()) {
+            return nullptr;
+        }
+
+        if (!trace->AddChunk(chunk, types)) {
+            logs.e.f("bad trace file: chunk %zu contains invalid or unsupported events\n", chunk_index);
+            return nullptr;
+        }
+
+        ++chunk_index;
+    }
+
+    return trace;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
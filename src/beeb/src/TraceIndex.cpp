@@ -0,0 +1,443 @@
+#include <shared/system.h>
+#include <shared/debug.h>
+#include <beeb/TraceIndex.h>
+
+#if BBCMICRO_TRACE
+
+#include <beeb/BBCMicro.h>
+#include <beeb/6502.h>
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Blocks are cut every this many events, and at the end of each chunk. Fewer
+// events per block means less to rescan per candidate block, but bigger block
+// lists.
+static constexpr size_t MAX_NUM_BLOCK_EVENTS = 4096;
+
+static constexpr size_t NUM_ADDRESSES = 65536;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct TraceIndex::Builder {
+    TraceIndex *index = nullptr;
+    bool got_time = false;
+    CycleCount time = {0};
+    bool got_event_time = false;
+    CycleCount event_time = {0};
+    size_t num_block_events = 0;
+
+    static bool HandleChunk(const Trace::ChunkData *chunk, void *context) {
+        auto this_ = (Builder *)context;
+
+        if (!this_->got_time) {
+            this_->time = chunk->initial_time;
+            this_->got_time = true;
+        }
+
+        if (chunk->spill_file) {
+            std::vector<std::shared_ptr<const MappedFile>> *spill_files = &this_->index->m_spill_files;
+            if (spill_files->empty() || spill_files->back() != chunk->spill_file) {
+                spill_files->push_back(chunk->spill_file);
+            }
+        }
+
+        auto data = (const uint8_t *)chunk->data;
+
+        this_->StartBlock(data);
+
+        if (!this_->index->m_trace->ForEachEventInRange(data, data + chunk->size, &this_->time, &HandleEvent, this_)) {
+            return false;
+        }
+
+        this_->FinishBlock(data + chunk->size);
+
+        return true;
+    }
+
+    static bool HandleEvent(Trace *t, const TraceEvent *e, void *context) {
+        (void)t;
+
+        auto this_ = (Builder *)context;
+        TraceIndex *index = this_->index;
+
+        ASSERT(!index->m_blocks.empty());
+        auto block = (uint32_t)(index->m_blocks.size() - 1);
+        Block *b = &index->m_blocks.back();
+
+        b->min_time.n = std::min(b->min_time.n, e->time.n);
+        b->max_time.n = std::max(b->max_time.n, e->time.n);
+
+        if (!this_->got_event_time) {
+            index->m_first_event_time = e->time;
+        } else if (e->time.n < this_->event_time.n) {
+            index->m_monotonic = false;
+        }
+        this_->event_time = e->time;
+        this_->got_event_time = true;
+
+        AddBlock(&index->m_event_type_blocks[e->type->type_id], block);
+
+        if (e->type == &BBCMicro::INSTRUCTION_EVENT) {
+            ASSERT(e->source < TraceEventSource_Count);
+            size_t base = e->source * NUM_ADDRESSES;
+
+            auto ev = (const BBCMicro::InstructionTraceEvent *)e->event;
+            AddBlock(&index->m_execute_blocks[base + ev->pc], block);
+
+            uint16_t addr;
+            if (index->GetInstructionWriteAddress(&addr, e)) {
+                AddBlock(&index->m_write_blocks[base + addr], block);
+            }
+        }
+
+        ++this_->num_block_events;
+        if (this_->num_block_events == MAX_NUM_BLOCK_EVENTS) {
+            // The next block starts after this event, so its time is this
+            // event's time.
+            this_->time = e->time;
+
+            auto end = (const uint8_t *)e->event + e->size;
+            this_->FinishBlock(end);
+            this_->StartBlock(end);
+        }
+
+        return true;
+    }
+
+    void StartBlock(const void *begin) {
+        index->m_blocks.emplace_back();
+
+        Block *b = &index->m_blocks.back();
+        b->begin = begin;
+        b->time = this->time;
+
+        this->num_block_events = 0;
+    }
+
+    void FinishBlock(const void *end) {
+        ASSERT(!index->m_blocks.empty());
+        Block *b = &index->m_blocks.back();
+
+        if (this->num_block_events == 0) {
+            // Nothing refers to it, so it can just go.
+            index->m_blocks.pop_back();
+            return;
+        }
+
+        b->end = end;
+    }
+
+    static void AddBlock(BlockList *list, uint32_t block) {
+        if (list->empty() || list->back() != block) {
+            list->push_back(block);
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+TraceIndex::TraceIndex(std::shared_ptr<Trace> trace)
+    : m_trace(std::move(trace))
+    , m_execute_blocks(TraceEventSource_Count * NUM_ADDRESSES)
+    , m_write_blocks(TraceEventSource_Count * NUM_ADDRESSES) {
+    // Events with no specific source are treated as host events, as per
+    // SaveTrace.
+    const M6502Config *host_config = m_trace->GetBBCMicroType()->m6502_config;
+    m_m6502_configs[TraceEventSource_None] = host_config;
+    m_m6502_configs[TraceEventSource_Host] = host_config;
+    m_m6502_configs[TraceEventSource_Parasite] = m_trace->GetParasiteM6502Config();
+
+    Builder builder;
+    builder.index = this;
+    m_trace->ForEachChunk(&Builder::HandleChunk, &builder);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+TraceIndex::~TraceIndex() = default;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+const std::shared_ptr<Trace> &TraceIndex::GetTrace() const {
+    return m_trace;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct TraceIndexMatchContext {
+    const TraceIndex *index = nullptr;
+    const TraceQuery *query = nullptr;
+    Trace::ForEachEventFn fn = nullptr;
+    void *context = nullptr;
+};
+
+static bool HandleMatchCandidate(Trace *t, const TraceEvent *e, void *context) {
+    auto mc = (TraceIndexMatchContext *)context;
+    const TraceQuery *query = mc->query;
+
+    if (e->time.n < query->begin.n || e->time.n >= query->end.n) {
+        return true;
+    }
+
+    switch (query->type) {
+    case TraceQueryType_Execute:
+        if (e->type != &BBCMicro::INSTRUCTION_EVENT || e->source != query->source) {
+            return true;
+        }
+
+        if (((const BBCMicro::InstructionTraceEvent *)e->event)->pc != query->addr) {
+            return true;
+        }
+        break;
+
+    case TraceQueryType_Write:
+        {
+            if (e->source != query->source) {
+                return true;
+            }
+
+            uint16_t addr;
+            if (!mc->index->GetInstructionWriteAddress(&addr, e) || addr != query->addr) {
+                return true;
+            }
+        }
+        break;
+
+    case TraceQueryType_EventType:
+        if (e->type != query->event_type) {
+            return true;
+        }
+        break;
+    }
+
+    return (*mc->fn)(t, e, mc->context);
+}
+
+bool TraceIndex::ForEachMatch(const TraceQuery &query, Trace::ForEachEventFn fn, void *context) const {
+    const BlockList *blocks = this->GetBlockList(query);
+    if (!blocks) {
+        return true;
+    }
+
+    auto it = blocks->begin();
+    if (m_monotonic) {
+        it = std::lower_bound(blocks->begin(), blocks->end(), query.begin, [this](uint32_t block, CycleCount begin) {
+            return m_blocks[block].max_time.n < begin.n;
+        });
+    }
+
+    TraceIndexMatchContext mc;
+    mc.index = this;
+    mc.query = &query;
+    mc.fn = fn;
+    mc.context = context;
+
+    for (; it != blocks->end(); ++it) {
+        const Block *b = &m_blocks[*it];
+
+        if (b->min_time.n >= query.end.n) {
+            if (m_monotonic) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (b->max_time.n < query.begin.n) {
+            continue;
+        }
+
+        CycleCount time = b->time;
+        if (!m_trace->ForEachEventInRange(b->begin, b->end, &time, &HandleMatchCandidate, &mc)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TraceIndex::GetInstructionWriteAddress(uint16_t *addr, const TraceEvent *e) const {
+    if (e->type != &BBCMicro::INSTRUCTION_EVENT) {
+        return false;
+    }
+
+    ASSERT(e->source < TraceEventSource_Count);
+    const M6502Config *config = m_m6502_configs[e->source];
+    if (!config) {
+        return false;
+    }
+
+    auto ev = (const BBCMicro::InstructionTraceEvent *)e->event;
+    const M6502DisassemblyInfo *di = &config->disassembly_info[ev->opcode];
+    if (!di->writes) {
+        return false;
+    }
+
+    // Effective address calculations as per SaveTrace.
+    switch (di->mode) {
+    default:
+        return false;
+
+    case M6502AddrMode_ZPG:
+        *addr = (uint8_t)ev->ad;
+        break;
+
+    case M6502AddrMode_ZPX:
+        *addr = (uint8_t)(ev->ad + ev->x);
+        break;
+
+    case M6502AddrMode_ZPY:
+        *addr = (uint8_t)(ev->ad + ev->y);
+        break;
+
+    case M6502AddrMode_ABS:
+    case M6502AddrMode_INX:
+    case M6502AddrMode_INZ:
+        *addr = ev->ad;
+        break;
+
+    case M6502AddrMode_ABX:
+        *addr = (uint16_t)(ev->ad + ev->x);
+        break;
+
+    case M6502AddrMode_ABY:
+    case M6502AddrMode_INY:
+        *addr = (uint16_t)(ev->ad + ev->y);
+        break;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+CycleCount TraceIndex::GetTimeFrom2MHzCycles(uint64_t num_2MHz_cycles) const {
+    return {m_first_event_time.n + (num_2MHz_cycles << LSHIFT_2MHZ_TO_CYCLE_COUNT)};
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::string TraceIndex::GetEventDescription(const TraceEvent *e) const {
+    char prefix[100];
+    snprintf(prefix, sizeof prefix, "%c %" PRIu64 ": ",
+             e->source == TraceEventSource_Parasite ? 'P' : 'H',
+             (e->time.n - m_first_event_time.n) >> RSHIFT_CYCLE_COUNT_TO_2MHZ);
+
+    std::string description = prefix;
+
+    if (e->type == &BBCMicro::INSTRUCTION_EVENT) {
+        auto ev = (const BBCMicro::InstructionTraceEvent *)e->event;
+
+        char instruction[100];
+        const M6502Config *config = m_m6502_configs[e->source];
+        snprintf(instruction, sizeof instruction, "$%04x: %s",
+                 ev->pc,
+                 config ? config->disassembly_info[ev->opcode].mnemonic : "???");
+        description += instruction;
+
+        uint16_t addr;
+        if (this->GetInstructionWriteAddress(&addr, e)) {
+            char ea[100];
+            snprintf(ea, sizeof ea, " [$%04x]", addr);
+            description += ea;
+        }
+
+        char registers[100];
+        snprintf(registers, sizeof registers, " A=%02x X=%02x Y=%02x S=%02x (D=%02x)", ev->a, ev->x, ev->y, ev->s, ev->data);
+        description += registers;
+    } else if (e->type == &Trace::STRING_EVENT) {
+        description.append((const char *)e->event, strnlen((const char *)e->event, e->size));
+
+        while (!description.empty() && description.back() == '\n') {
+            description.pop_back();
+        }
+    } else {
+        description += e->type->GetName();
+    }
+
+    return description;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct TraceIndexDescriptionsContext {
+    const TraceIndex *index = nullptr;
+    std::vector<std::string> *descriptions = nullptr;
+    size_t max_num_results = 0;
+    size_t num_matches = 0;
+};
+
+static bool AddMatchDescription(Trace *t, const TraceEvent *e, void *context) {
+    (void)t;
+
+    auto dc = (TraceIndexDescriptionsContext *)context;
+
+    if (dc->num_matches < dc->max_num_results) {
+        dc->descriptions->push_back(dc->index->GetEventDescription(e));
+    }
+
+    ++dc->num_matches;
+
+    return true;
+}
+
+size_t TraceIndex::GetMatchDescriptions(std::vector<std::string> *descriptions,
+                                        const TraceQuery &query,
+                                        size_t max_num_results) const {
+    TraceIndexDescriptionsContext dc;
+    dc.index = this;
+    dc.descriptions = descriptions;
+    dc.max_num_results = max_num_results;
+
+    this->ForEachMatch(query, &AddMatchDescription, &dc);
+
+    return dc.num_matches;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+const TraceIndex::BlockList *TraceIndex::GetBlockList(const TraceQuery &query) const {
+    switch (query.type) {
+    case TraceQueryType_Execute:
+        if (query.source >= TraceEventSource_Count) {
+            return nullptr;
+        }
+        return &m_execute_blocks[query.source * NUM_ADDRESSES + query.addr];
+
+    case TraceQueryType_Write:
+        if (query.source >= TraceEventSource_Count) {
+            return nullptr;
+        }
+        return &m_write_blocks[query.source * NUM_ADDRESSES + query.addr];
+
+    case TraceQueryType_EventType:
+        if (!query.event_type) {
+            return nullptr;
+        }
+        return &m_event_type_blocks[query.event_type->type_id];
+    }
+
+    return nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,501 @@
+#include <shared/system.h>
+#include <shared/debug.h>
+#include <shared/log.h>
+#include <beeb/TraceTrigger.h>
+
+#if BBCMICRO_TRACE
+
+#include <beeb/BBCMicro.h>
+#include <6502/6502.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+enum TraceTriggerField {
+    TraceTriggerField_PC,
+    TraceTriggerField_OpcodePC,
+    TraceTriggerField_A,
+    TraceTriggerField_X,
+    TraceTriggerField_Y,
+    TraceTriggerField_S,
+    TraceTriggerField_P,
+    TraceTriggerField_Opcode,
+    TraceTriggerField_LastOpcode,
+    TraceTriggerField_Memory,
+    TraceTriggerField_WriteAddress,
+    TraceTriggerField_WriteValue,
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct TraceTriggerName {
+    const char *name;
+
+    // Instruction trigger field, write trigger field.
+    TraceTriggerField instruction_field;
+    TraceTriggerField write_field;
+
+    bool is_write;
+    uint16_t max_value;
+};
+
+static const TraceTriggerName TRACE_TRIGGER_NAMES[] = {
+    {"pc", TraceTriggerField_PC, TraceTriggerField_OpcodePC, false, 0xffff},
+    {"a", TraceTriggerField_A, TraceTriggerField_A, false, 0xff},
+    {"x", TraceTriggerField_X, TraceTriggerField_X, false, 0xff},
+    {"y", TraceTriggerField_Y, TraceTriggerField_Y, false, 0xff},
+    {"s", TraceTriggerField_S, TraceTriggerField_S, false, 0xff},
+    {"p", TraceTriggerField_P, TraceTriggerField_P, false, 0xff},
+    {"opcode", TraceTriggerField_Opcode, TraceTriggerField_LastOpcode, false, 0xff},
+    {"write", TraceTriggerField_WriteAddress, TraceTriggerField_WriteAddress, true, 0xffff},
+    {"value", TraceTriggerField_WriteValue, TraceTriggerField_WriteValue, true, 0xff},
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Parsed term, before it's known whether this is an instruction trigger or a
+// write trigger.
+struct TraceTriggerTerm {
+    const TraceTriggerName *name = nullptr;
+    bool is_memory = false;
+    uint16_t addr = 0;
+    bool negate = false;
+    uint16_t min = 0;
+    uint16_t max = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void SkipSpaces(const char **c) {
+    while (isspace((unsigned char)**c)) {
+        ++*c;
+    }
+}
+
+static bool ParseNumber(uint64_t *value, const char **c, int base) {
+    SkipSpaces(c);
+
+    if (base == 16) {
+        if (**c == '&' || **c == '$') {
+            ++*c;
+        } else if ((*c)[0] == '0' && ((*c)[1] == 'x' || (*c)[1] == 'X')) {
+            *c += 2;
+        }
+    }
+
+    if (!isxdigit((unsigned char)**c)) {
+        return false;
+    }
+
+    char *ep;
+    errno = 0;
+    unsigned long long v = strtoull(*c, &ep, base);
+    if (errno != 0 || ep == *c) {
+        return false;
+    }
+
+    *value = v;
+    *c = ep;
+    return true;
+}
+
+static bool ParseValue(uint16_t *value, const char **c, uint16_t max_value) {
+    uint64_t v;
+    if (!ParseNumber(&v, c, 16)) {
+        return false;
+    }
+
+    if (v > max_value) {
+        return false;
+    }
+
+    *value = (uint16_t)v;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Returns true if OK, and fills in *term, or *count for a count term. Returns
+// false if not, and prints messages on *log if not NULL.
+static bool ParseTerm(TraceTriggerTerm *term, uint64_t *count, const char **c, Log *log) {
+    SkipSpaces(c);
+
+    const char *name_begin = *c;
+    uint16_t max_value;
+
+    if (**c == '[') {
+        ++*c;
+
+        if (!ParseValue(&term->addr, c, 0x7fff)) {
+            if (log) {
+                log->f("invalid memory address (must be less than &8000)\n");
+            }
+            return false;
+        }
+
+        SkipSpaces(c);
+        if (**c != ']') {
+            if (log) {
+                log->f("missing ]\n");
+            }
+            return false;
+        }
+        ++*c;
+
+        term->is_memory = true;
+        max_value = 0xff;
+    } else {
+        while (isalpha((unsigned char)**c)) {
+            ++*c;
+        }
+
+        std::string name(name_begin, *c);
+        if (name.empty()) {
+            if (log) {
+                log->f("expected name: %s\n", name_begin);
+            }
+            return false;
+        }
+
+        if (name == "count") {
+            SkipSpaces(c);
+            if (**c == '=' && (*c)[1] == '=') {
+                *c += 2;
+            } else if (**c == '=') {
+                ++*c;
+            } else {
+                if (log) {
+                    log->f("count must be followed by =\n");
+                }
+                return false;
+            }
+
+            if (!ParseNumber(count, c, 10) || *count == 0) {
+                if (log) {
+                    log->f("invalid count\n");
+                }
+                return false;
+            }
+
+            term->name = nullptr;
+            return true;
+        }
+
+        for (const TraceTriggerName &n : TRACE_TRIGGER_NAMES) {
+            if (name == n.name) {
+                term->name = &n;
+                break;
+            }
+        }
+
+        if (!term->name) {
+            if (log) {
+                log->f("unknown name: %s\n", name.c_str());
+            }
+            return false;
+        }
+
+        max_value = term->name->max_value;
+    }
+
+    SkipSpaces(c);
+
+    char op[3] = {};
+    for (size_t i = 0; i < 2 && **c != 0 && strchr("=!<>", **c); ++i) {
+        op[i] = *(*c)++;
+    }
+
+    uint16_t value;
+    if (!ParseValue(&value, c, max_value)) {
+        if (log) {
+            log->f("invalid value (max &%x)\n", max_value);
+        }
+        return false;
+    }
+
+    term->min = value;
+    term->max = value;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0 || strcmp(op, "!=") == 0) {
+        term->negate = op[0] == '!';
+
+        SkipSpaces(c);
+        if (**c == '-') {
+            ++*c;
+            if (!ParseValue(&term->max, c, max_value) || term->max < term->min) {
+                if (log) {
+                    log->f("invalid range\n");
+                }
+                return false;
+            }
+        }
+    } else if (strcmp(op, "<") == 0) {
+        if (value == 0) {
+            if (log) {
+                log->f("condition is never true: <0\n");
+            }
+            return false;
+        }
+        term->min = 0;
+        term->max = (uint16_t)(value - 1);
+    } else if (strcmp(op, "<=") == 0) {
+        term->min = 0;
+    } else if (strcmp(op, ">") == 0) {
+        if (value == max_value) {
+            if (log) {
+                log->f("condition is never true: >&%x\n", max_value);
+            }
+            return false;
+        }
+        term->min = (uint16_t)(value + 1);
+        term->max = max_value;
+    } else if (strcmp(op, ">=") == 0) {
+        term->max = max_value;
+    } else {
+        if (log) {
+            log->f("invalid operator: %s\n", op);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+TraceTrigger::TraceTrigger() = default;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+TraceTrigger::~TraceTrigger() = default;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TraceTrigger::Compile(const std::string &expr, Log *log) {
+    std::vector<TraceTriggerTerm> terms;
+    uint64_t count = 1;
+    bool write = false;
+
+    const char *c = expr.c_str();
+    for (;;) {
+        TraceTriggerTerm term;
+        if (!ParseTerm(&term, &count, &c, log)) {
+            return false;
+        }
+
+        if (term.name || term.is_memory) {
+            if (term.name && term.name->is_write) {
+                write = true;
+            }
+
+            terms.push_back(term);
+        }
+
+        SkipSpaces(&c);
+        if (*c == 0) {
+            break;
+        } else if (c[0] == '&' && c[1] == '&') {
+            c += 2;
+        } else {
+            if (log) {
+                log->f("expected &&: %s\n", c);
+            }
+            return false;
+        }
+    }
+
+    std::vector<Test> tests;
+    for (const TraceTriggerTerm &term : terms) {
+        Test test;
+        test.addr = term.addr;
+        test.min = term.min;
+        test.range = (uint16_t)(term.max - term.min);
+
+        TraceTriggerField field;
+        if (term.is_memory) {
+            field = TraceTriggerField_Memory;
+        } else if (write) {
+            field = term.name->write_field;
+        } else {
+            field = term.name->instruction_field;
+        }
+
+        switch (field) {
+        case TraceTriggerField_PC:
+            test.fn = GetTestFn<TraceTriggerField_PC>(term.negate);
+            break;
+
+        case TraceTriggerField_OpcodePC:
+            test.fn = GetTestFn<TraceTriggerField_OpcodePC>(term.negate);
+            break;
+
+        case TraceTriggerField_A:
+            test.fn = GetTestFn<TraceTriggerField_A>(term.negate);
+            break;
+
+        case TraceTriggerField_X:
+            test.fn = GetTestFn<TraceTriggerField_X>(term.negate);
+            break;
+
+        case TraceTriggerField_Y:
+            test.fn = GetTestFn<TraceTriggerField_Y>(term.negate);
+            break;
+
+        case TraceTriggerField_S:
+            test.fn = GetTestFn<TraceTriggerField_S>(term.negate);
+            break;
+
+        case TraceTriggerField_P:
+            test.fn = GetTestFn<TraceTriggerField_P>(term.negate);
+            break;
+
+        case TraceTriggerField_Opcode:
+            test.fn = GetTestFn<TraceTriggerField_Opcode>(term.negate);
+            break;
+
+        case TraceTriggerField_LastOpcode:
+            test.fn = GetTestFn<TraceTriggerField_LastOpcode>(term.negate);
+            break;
+
+        case TraceTriggerField_Memory:
+            test.fn = GetTestFn<TraceTriggerField_Memory>(term.negate);
+            break;
+
+        case TraceTriggerField_WriteAddress:
+            test.fn = GetTestFn<TraceTriggerField_WriteAddress>(term.negate);
+            break;
+
+        case TraceTriggerField_WriteValue:
+            test.fn = GetTestFn<TraceTriggerField_WriteValue>(term.negate);
+            break;
+        }
+
+        ASSERT(test.fn);
+        tests.push_back(test);
+    }
+
+    if (tests.empty()) {
+        if (log) {
+            log->f("no conditions\n");
+        }
+        return false;
+    }
+
+    m_tests = std::move(tests);
+    m_write = write;
+    m_count = count;
+    m_num_matches = 0;
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TraceTrigger::IsEmpty() const {
+    return m_tests.empty();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TraceTrigger::IsWriteTrigger() const {
+    return m_write;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+bool TraceTrigger::Check(const BBCMicro *m, const M6502 *cpu) {
+    if (m_tests.empty()) {
+        return false;
+    }
+
+    for (const Test &test : m_tests) {
+        if (!(*test.fn)(test, m, cpu)) {
+            return false;
+        }
+    }
+
+    ++m_num_matches;
+    return m_num_matches >= m_count;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void TraceTrigger::ResetCount() {
+    m_num_matches = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+template <int FIELD, bool NEGATE>
+bool TraceTrigger::TestField(const Test &test, const BBCMicro *m, const M6502 *cpu) {
+    uint16_t value;
+
+    if constexpr (FIELD == TraceTriggerField_PC) {
+        // Instruction callbacks are called after the opcode fetch, so the
+        // instruction address is on the address bus.
+        value = cpu->abus.w;
+    } else if constexpr (FIELD == TraceTriggerField_OpcodePC) {
+        value = cpu->opcode_pc.w;
+    } else if constexpr (FIELD == TraceTriggerField_A) {
+        value = cpu->a;
+    } else if constexpr (FIELD == TraceTriggerField_X) {
+        value = cpu->x;
+    } else if constexpr (FIELD == TraceTriggerField_Y) {
+        value = cpu->y;
+    } else if constexpr (FIELD == TraceTriggerField_S) {
+        value = cpu->s.b.l;
+    } else if constexpr (FIELD == TraceTriggerField_P) {
+        value = M6502_GetP(cpu).value;
+    } else if constexpr (FIELD == TraceTriggerField_Opcode) {
+        // ...and the opcode is on the data bus.
+        value = cpu->dbus;
+    } else if constexpr (FIELD == TraceTriggerField_LastOpcode) {
+        value = cpu->opcode;
+    } else if constexpr (FIELD == TraceTriggerField_Memory) {
+        value = m->GetRAM()[test.addr];
+    } else if constexpr (FIELD == TraceTriggerField_WriteAddress) {
+        value = cpu->abus.w;
+    } else if constexpr (FIELD == TraceTriggerField_WriteValue) {
+        value = cpu->dbus;
+    } else {
+        static_assert(FIELD < 0, "unknown field");
+    }
+
+    (void)m, (void)test;
+
+    bool in_range = (uint16_t)(value - test.min) <= test.range;
+    return in_range != NEGATE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+template <int FIELD>
+TraceTrigger::TestFn TraceTrigger::GetTestFn(bool negate) {
+    if (negate) {
+        return &TestField<FIELD, true>;
+    } else {
+        return &TestField<FIELD, false>;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -72,8 +72,14 @@ void VideoULA::WriteControlRegister(void *ula_, M6502Word a, uint8_t value) {
     (void)a;
 
     if (value != ula->control.value) {
+        Control old_control = ula->control;
         ula->control.value = value;
 
+        // The line width just selects a different table.
+        if (ula->control.bits.flash != old_control.bits.flash) {
+            ula->InvalidatePixelCache();
+        }
+
         TRACEF(ula->m_trace, "ULA Control: Flash=%s Teletext=%s Line Width=%d Fast6845=%s Cursor=%d\n", BOOL_STR(ula->control.bits.flash), BOOL_STR(ula->control.bits.teletext), ula->control.bits.line_width, BOOL_STR(ula->control.bits.fast_6845), ula->control.bits.cursor);
 
         ula->UpdatePixelBufferOffset();
@@ -92,7 +98,10 @@ void VideoULA::WritePalette(void *ula_, M6502Word a, uint8_t value) {
     uint8_t phy = (value & 0x0f) ^ 7;
     uint8_t log = value >> 4;
 
-    ula->m_palette[log] = phy;
+    if (ula->m_palette[log] != phy) {
+        ula->m_palette[log] = phy;
+        ula->InvalidatePixelCache();
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -110,6 +119,7 @@ void VideoULA::WriteNuLAControlRegister(void *ula_, M6502Word a, uint8_t value)
         case 1:
             // Toggle direct palette mode.
             ula->m_logical_mode = param & 1;
+            ula->InvalidatePixelCache();
             TRACEF(ula->m_trace, "NuLA Control: Logical Mode=%s\n", BOOL_STR(ula->m_logical_mode));
             break;
 
@@ -156,6 +166,7 @@ void VideoULA::WriteNuLAControlRegister(void *ula_, M6502Word a, uint8_t value)
             ula->m_flash[9] = param & 0x04;
             ula->m_flash[10] = param & 0x02;
             ula->m_flash[11] = param & 0x01;
+            ula->InvalidatePixelCache();
             TRACEF(ula->m_trace, "NuLA Control: Flash: 8=%s 9=%s 10=%s 11=%s\n", BOOL_STR(ula->m_flash[8]), BOOL_STR(ula->m_flash[9]), BOOL_STR(ula->m_flash[10]), BOOL_STR(ula->m_flash[11]));
             break;
 
@@ -165,6 +176,7 @@ void VideoULA::WriteNuLAControlRegister(void *ula_, M6502Word a, uint8_t value)
             ula->m_flash[13] = param & 0x04;
             ula->m_flash[14] = param & 0x02;
             ula->m_flash[15] = param & 0x01;
+            ula->InvalidatePixelCache();
             TRACEF(ula->m_trace, "NuLA Control: Flash: 12=%s 13=%s 14=%s 15=%s\n", BOOL_STR(ula->m_flash[12]), BOOL_STR(ula->m_flash[13]), BOOL_STR(ula->m_flash[14]), BOOL_STR(ula->m_flash[15]));
             break;
 
@@ -196,6 +208,8 @@ void VideoULA::WriteNuLAPalette(void *ula_, M6502Word a, uint8_t value) {
 
             ula->m_flash[index] = 0;
 
+            ula->InvalidatePixelCache();
+
             TRACEF(ula->m_trace,
                    "NuLA Palette: index=%u, rgb=0x%x%x%x\n",
                    index,
@@ -227,6 +241,16 @@ void VideoULA::InitStuff() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void VideoULA::SetPixelCache(PixelCache *cache) {
+    m_pixel_cache = cache;
+
+    // Whatever's in the cache could be from some other state.
+    this->InvalidatePixelCache();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void VideoULA::DisplayEnabled() {
     // 1 fractional bit - it counts halves in slow clock mode.
     m_blanking_counter = m_blanking_size << 1;
@@ -331,6 +355,26 @@ void VideoULA::ResetNuLAState() {
 
     // Reset attribute mode.
     m_attribute_mode = {};
+
+    this->InvalidatePixelCache();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+void VideoULA::InvalidatePixelCache() {
+    ++m_pixel_cache_version;
+
+    if (m_pixel_cache_version == 0) {
+        // Wrapped round. Start again with no valid entries.
+        if (m_pixel_cache) {
+            for (PixelCache::Table &table : m_pixel_cache->tables) {
+                memset(table.versions, 0, sizeof table.versions);
+            }
+        }
+
+        m_pixel_cache_version = 1;
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -353,19 +397,6 @@ VideoDataPixel VideoULA::GetPalette(uint8_t index) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-VideoDataPixel VideoULA::Shift() {
-    uint8_t index = m_work_byte;
-    index = ((index >> 1) & 1) | ((index >> 2) & 2) | ((index >> 3) & 4) | ((index >> 4) & 8);
-
-    m_work_byte <<= 1;
-    m_work_byte |= 1;
-
-    return this->GetPalette(index);
-}
-
-//////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////
-
 VideoDataPixel VideoULA::ShiftAttributeMode0() {
     uint8_t attribute = m_original_byte & 0x03;
 
@@ -404,172 +435,63 @@ VideoDataPixel VideoULA::ShiftAttributeText() {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-void VideoULA::Emit2MHz(VideoDataUnitPixels *pixels) {
-    VideoDataPixel *dest = &m_pixel_buffer.pixels[m_pixel_buffer_offset];
-
-    VideoDataPixel pixel = this->Shift();
-
-    dest[0] = pixel;
-    dest[1] = pixel;
-    dest[2] = pixel;
-    dest[3] = pixel;
-    dest[4] = pixel;
-    dest[5] = pixel;
-    dest[6] = pixel;
-    dest[7] = pixel;
-
-    if (this->cursor_pattern & 1) {
-        dest[0].all ^= 0x0fff;
-        dest[1].all ^= 0x0fff;
-        dest[2].all ^= 0x0fff;
-        dest[3].all ^= 0x0fff;
-        dest[4].all ^= 0x0fff;
-        dest[5].all ^= 0x0fff;
-        dest[6].all ^= 0x0fff;
-        dest[7].all ^= 0x0fff;
+// LINE_WIDTH is the control register bits: 2 << LINE_WIDTH MHz, so 1 <<
+// LINE_WIDTH pixels per Emit, each one 8 >> LINE_WIDTH output pixels wide.
+//
+// Each pixel's palette index comes from bits 7, 5, 3 and 1 of the work byte,
+// which is then shifted left with a 1 coming in.
+template <uint8_t LINE_WIDTH>
+void VideoULA::ExpandPixels(VideoDataUnitPixels *pixels, uint8_t work_byte) {
+    constexpr size_t NUM_PIXELS = 1 << LINE_WIDTH;
+    constexpr size_t PIXEL_WIDTH = 8 >> LINE_WIDTH;
+
+    for (size_t i = 0; i < NUM_PIXELS; ++i) {
+        uint8_t index = ((work_byte >> 1) & 1) | ((work_byte >> 2) & 2) | ((work_byte >> 3) & 4) | ((work_byte >> 4) & 8);
+
+        work_byte <<= 1;
+        work_byte |= 1;
+
+        VideoDataPixel pixel = this->GetPalette(index);
+        for (size_t j = 0; j < PIXEL_WIDTH; ++j) {
+            pixels->pixels[i * PIXEL_WIDTH + j] = pixel;
+        }
     }
-
-    pixels->values[0] = m_pixel_buffer.values[0];
-    pixels->values[1] = m_pixel_buffer.values[1];
-
-    m_pixel_buffer.values[0] = m_pixel_buffer.values[2];
-    m_pixel_buffer.values[1] = m_pixel_buffer.values[3];
-    m_pixel_buffer.values[2] = m_pixel_buffer.values[4];
-    m_pixel_buffer.values[3] = m_pixel_buffer.values[5];
-    m_pixel_buffer.values[4] = m_pixel_buffer.values[6];
-    m_pixel_buffer.values[5] = m_pixel_buffer.values[7];
 }
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-void VideoULA::Emit4MHz(VideoDataUnitPixels *pixels) {
-    VideoDataPixel *dest = &m_pixel_buffer.pixels[m_pixel_buffer_offset];
-
-    VideoDataPixel pixel;
+template <uint8_t LINE_WIDTH>
+void VideoULA::EmitBitmap(VideoDataUnitPixels *pixels) {
+    constexpr unsigned NUM_SHIFTS = 1 << LINE_WIDTH;
 
-    pixel = this->Shift();
-    dest[0] = pixel;
-    dest[1] = pixel;
-    dest[2] = pixel;
-    dest[3] = pixel;
+    VideoDataUnitPixels expanded;
+    const VideoDataUnitPixels *src;
+    if (m_pixel_cache) {
+        PixelCache::Table *table = &m_pixel_cache->tables[LINE_WIDTH];
 
-    pixel = this->Shift();
-    dest[4] = pixel;
-    dest[5] = pixel;
-    dest[6] = pixel;
-    dest[7] = pixel;
+        if (table->versions[m_work_byte] != m_pixel_cache_version) {
+            this->ExpandPixels<LINE_WIDTH>(&table->pixels[m_work_byte], m_work_byte);
+            table->versions[m_work_byte] = m_pixel_cache_version;
+        }
 
-    if (this->cursor_pattern & 1) {
-        dest[0].all ^= 0x0fff;
-        dest[1].all ^= 0x0fff;
-        dest[2].all ^= 0x0fff;
-        dest[3].all ^= 0x0fff;
-        dest[4].all ^= 0x0fff;
-        dest[5].all ^= 0x0fff;
-        dest[6].all ^= 0x0fff;
-        dest[7].all ^= 0x0fff;
+        src = &table->pixels[m_work_byte];
+    } else {
+        this->ExpandPixels<LINE_WIDTH>(&expanded, m_work_byte);
+        src = &expanded;
     }
 
-    pixels->values[0] = m_pixel_buffer.values[0];
-    pixels->values[1] = m_pixel_buffer.values[1];
+    m_work_byte = (uint8_t)(m_work_byte << NUM_SHIFTS | ((1 << NUM_SHIFTS) - 1));
 
-    m_pixel_buffer.values[0] = m_pixel_buffer.values[2];
-    m_pixel_buffer.values[1] = m_pixel_buffer.values[3];
-    m_pixel_buffer.values[2] = m_pixel_buffer.values[4];
-    m_pixel_buffer.values[3] = m_pixel_buffer.values[5];
-    m_pixel_buffer.values[4] = m_pixel_buffer.values[6];
-    m_pixel_buffer.values[5] = m_pixel_buffer.values[7];
-}
-
-//////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////
-
-void VideoULA::Emit8MHz(VideoDataUnitPixels *pixels) {
-    VideoDataPixel *dest = &m_pixel_buffer.pixels[m_pixel_buffer_offset];
-
-    VideoDataPixel pixel;
-
-    pixel = this->Shift();
-    dest[0] = pixel;
-    dest[1] = pixel;
-
-    pixel = this->Shift();
-    dest[2] = pixel;
-    dest[3] = pixel;
-
-    pixel = this->Shift();
-    dest[4] = pixel;
-    dest[5] = pixel;
-
-    pixel = this->Shift();
-    dest[6] = pixel;
-    dest[7] = pixel;
+    uint64_t values[2] = {src->values[0], src->values[1]};
 
     if (this->cursor_pattern & 1) {
-        dest[0].all ^= 0x0fff;
-        dest[1].all ^= 0x0fff;
-        dest[2].all ^= 0x0fff;
-        dest[3].all ^= 0x0fff;
-        dest[4].all ^= 0x0fff;
-        dest[5].all ^= 0x0fff;
-        dest[6].all ^= 0x0fff;
-        dest[7].all ^= 0x0fff;
+        values[0] ^= 0x0fff0fff0fff0fffull;
+        values[1] ^= 0x0fff0fff0fff0fffull;
     }
 
-    pixels->values[0] = m_pixel_buffer.values[0];
-    pixels->values[1] = m_pixel_buffer.values[1];
-
-    m_pixel_buffer.values[0] = m_pixel_buffer.values[2];
-    m_pixel_buffer.values[1] = m_pixel_buffer.values[3];
-    m_pixel_buffer.values[2] = m_pixel_buffer.values[4];
-    m_pixel_buffer.values[3] = m_pixel_buffer.values[5];
-    m_pixel_buffer.values[4] = m_pixel_buffer.values[6];
-    m_pixel_buffer.values[5] = m_pixel_buffer.values[7];
-}
-
-//////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////
-
-void VideoULA::Emit16MHz(VideoDataUnitPixels *pixels) {
-    VideoDataPixel *dest = &m_pixel_buffer.pixels[m_pixel_buffer_offset];
-
-    VideoDataPixel pixel;
-
-    pixel = this->Shift();
-    dest[0] = pixel;
-
-    pixel = this->Shift();
-    dest[1] = pixel;
-
-    pixel = this->Shift();
-    dest[2] = pixel;
-
-    pixel = this->Shift();
-    dest[3] = pixel;
-
-    pixel = this->Shift();
-    dest[4] = pixel;
-
-    pixel = this->Shift();
-    dest[5] = pixel;
-
-    pixel = this->Shift();
-    dest[6] = pixel;
-
-    pixel = this->Shift();
-    dest[7] = pixel;
-
-    if (this->cursor_pattern & 1) {
-        dest[0].all ^= 0x0fff;
-        dest[1].all ^= 0x0fff;
-        dest[2].all ^= 0x0fff;
-        dest[3].all ^= 0x0fff;
-        dest[4].all ^= 0x0fff;
-        dest[5].all ^= 0x0fff;
-        dest[6].all ^= 0x0fff;
-        dest[7].all ^= 0x0fff;
-    }
+    // The offset is in pixels, so the destination isn't necessarily aligned.
+    memcpy(&m_pixel_buffer.pixels[m_pixel_buffer_offset], values, sizeof values);
 
     pixels->values[0] = m_pixel_buffer.values[0];
     pixels->values[1] = m_pixel_buffer.values[1];
@@ -726,18 +648,18 @@ const VideoULA::EmitMFn VideoULA::EMIT_MFNS[4][2][4] = {
     {
         // Slow 6845
         {
-            &VideoULA::Emit2MHz,
-            &VideoULA::Emit4MHz,
-            &VideoULA::Emit8MHz,
-            &VideoULA::Emit16MHz,
+            &VideoULA::EmitBitmap<0>,
+            &VideoULA::EmitBitmap<1>,
+            &VideoULA::EmitBitmap<2>,
+            &VideoULA::EmitBitmap<3>,
         },
 
         // Fast 6845
         {
-            &VideoULA::Emit2MHz,
-            &VideoULA::Emit4MHz,
-            &VideoULA::Emit8MHz,
-            &VideoULA::Emit16MHz,
+            &VideoULA::EmitBitmap<0>,
+            &VideoULA::EmitBitmap<1>,
+            &VideoULA::EmitBitmap<2>,
+            &VideoULA::EmitBitmap<3>,
         },
     },
 
@@ -764,18 +686,18 @@ const VideoULA::EmitMFn VideoULA::EMIT_MFNS[4][2][4] = {
     {
         // Slow 6845
         {
-            &VideoULA::Emit2MHz,
-            &VideoULA::Emit4MHz,
-            &VideoULA::Emit8MHz,
-            &VideoULA::Emit16MHz,
+            &VideoULA::EmitBitmap<0>,
+            &VideoULA::EmitBitmap<1>,
+            &VideoULA::EmitBitmap<2>,
+            &VideoULA::EmitBitmap<3>,
         },
 
         // Fast 6845
         {
-            &VideoULA::Emit2MHz,
-            &VideoULA::Emit4MHz,
-            &VideoULA::Emit8MHz,
-            &VideoULA::Emit16MHz,
+            &VideoULA::EmitBitmap<0>,
+            &VideoULA::EmitBitmap<1>,
+            &VideoULA::EmitBitmap<2>,
+            &VideoULA::EmitBitmap<3>,
         },
     },
 
@@ -2,6 +2,156 @@
 #include <shared/testing.h>
 #include <beeb/6522.h>
 
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+typedef uint8_t (*ReadFn)(void *via, M6502Word addr);
+typedef void (*WriteFn)(void *via, M6502Word addr, uint8_t value);
+
+static const ReadFn READ_FNS[16] = {
+    &R6522::Read0,
+    &R6522::Read1,
+    &R6522::Read2,
+    &R6522::Read3,
+    &R6522::Read4,
+    &R6522::Read5,
+    &R6522::Read6,
+    &R6522::Read7,
+    &R6522::Read8,
+    &R6522::Read9,
+    &R6522::ReadA,
+    &R6522::ReadB,
+    &R6522::ReadC,
+    &R6522::ReadD,
+    &R6522::ReadE,
+    &R6522::ReadF,
+};
+
+static const WriteFn WRITE_FNS[16] = {
+    &R6522::Write0,
+    &R6522::Write1,
+    &R6522::Write2,
+    &R6522::Write3,
+    &R6522::Write4,
+    &R6522::Write5,
+    &R6522::Write6,
+    &R6522::Write7,
+    &R6522::Write8,
+    &R6522::Write9,
+    &R6522::WriteA,
+    &R6522::WriteB,
+    &R6522::WriteC,
+    &R6522::WriteD,
+    &R6522::WriteE,
+    &R6522::WriteF,
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void Write(R6522 *via, uint8_t reg, uint8_t value) {
+    (*WRITE_FNS[reg])(via, M6502Word{reg}, value);
+}
+
+// Number of trailing edges until the T1 IRQ flag is set.
+static unsigned GetT1Timeout(bool force_ticking, uint16_t n) {
+    R6522 via;
+    via.ForceTimerTicking(force_ticking);
+
+    Write(&via, 4, (uint8_t)n);
+    Write(&via, 5, (uint8_t)(n >> 8));
+
+    for (unsigned i = 1; i < 70000; ++i) {
+        via.UpdatePhi2TrailingEdge();
+        via.UpdatePhi2LeadingEdge();
+        if (via.ifr.bits.t1) {
+            return i;
+        }
+    }
+
+    TEST_FAIL("T1 didn't time out");
+    return 0;
+}
+
+static void TestT1Timeout() {
+    for (uint16_t n : {0, 1, 2, 100, 9998, 65535}) {
+        TEST_EQ_UU(GetT1Timeout(false, n), n + 2u);
+        TEST_EQ_UU(GetT1Timeout(true, n), n + 2u);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Random accesses, with emphasis on the timers, against a VIA that updates
+// its timers every cycle and one that schedules them.
+static void TestScheduledTimers() {
+    R6522 scheduled, ticked;
+    ticked.ForceTimerTicking(true);
+
+    size_t num_t1_irqs = 0, num_t2_irqs = 0;
+
+    for (uint32_t cycle = 0; cycle < 2000000; ++cycle) {
+        // Occasional PB6 pulses, for T2 pulse counting mode.
+        if (TestRandom() % 8 == 0) {
+            uint8_t p = ticked.b.p ^ 0x40;
+            scheduled.b.p = ticked.b.p = p;
+        }
+
+        uint8_t scheduled_irq = scheduled.UpdatePhi2TrailingEdge();
+        uint8_t ticked_irq = ticked.UpdatePhi2TrailingEdge();
+        TEST_EQ_UU(scheduled_irq, ticked_irq);
+
+        if (TestRandom() % 16 == 0) {
+            uint32_t r = TestRandom();
+            auto reg = (uint8_t)(r & 15);
+
+            if (r & 16) {
+                uint8_t value;
+                if (reg == 4 || reg == 6 || reg == 8) {
+                    // Mostly short timer periods, so lots of timeouts.
+                    value = (uint8_t)(TestRandom() % 200);
+                } else if (reg == 5 || reg == 7 || reg == 9) {
+                    value = TestRandom() % 8 == 0 ? (uint8_t)TestRandom() : 0;
+                } else if (reg == 11) {
+                    // Only the timer control bits, and not too much PB6
+                    // counting.
+                    value = (uint8_t)(TestRandom() & 0xc0);
+                    if (TestRandom() % 4 == 0) {
+                        value |= 0x20;
+                    }
+                } else {
+                    value = (uint8_t)TestRandom();
+                }
+
+                Write(&scheduled, reg, value);
+                Write(&ticked, reg, value);
+            } else {
+                uint8_t scheduled_value = (*READ_FNS[reg])(&scheduled, M6502Word{reg});
+                uint8_t ticked_value = (*READ_FNS[reg])(&ticked, M6502Word{reg});
+                TEST_EQ_UU(scheduled_value, ticked_value);
+            }
+        }
+
+        TEST_EQ_UU(scheduled.GetT1(), ticked.GetT1());
+        TEST_EQ_UU(scheduled.GetT2(), ticked.GetT2());
+
+        scheduled_irq = scheduled.UpdatePhi2LeadingEdge();
+        ticked_irq = ticked.UpdatePhi2LeadingEdge();
+        TEST_EQ_UU(scheduled_irq, ticked_irq);
+        TEST_EQ_UU(scheduled.ifr.value, ticked.ifr.value);
+
+        num_t1_irqs += ticked.ifr.bits.t1;
+        num_t2_irqs += ticked.ifr.bits.t2;
+    }
+
+    TEST_GT_UU(num_t1_irqs, 0);
+    TEST_GT_UU(num_t2_irqs, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 int main(void) {
     {
         R6522::PCR pcr;
@@ -23,4 +173,7 @@ int main(void) {
 
         TEST_TRUE(irq.bits.ca2);
     }
+
+    TestT1Timeout();
+    TestScheduledTimers();
 }
@@ -0,0 +1,249 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <shared/file_io.h>
+#include <shared/log.h>
+#include <shared/path.h>
+#include <beeb/BBCMicro.h>
+#include <beeb/BBCMicroStateFile.h>
+#include <beeb/DiscGeometry.h>
+#include <beeb/DiscInterface.h>
+#include <beeb/MemoryDiscImage.h>
+#include <beeb/type.h>
+#include <beeb/sound.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef ROMS_FOLDER
+#error
+#endif
+
+#ifndef BBC_TESTS_OUTPUT_FOLDER
+#error
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+LOG_DEFINE(OUTPUT, "", &log_printer_stdout_and_debugger, true);
+
+static const LogSet LOGS = {LOG(OUTPUT), LOG(OUTPUT), LOG(OUTPUT)};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+template <size_t SIZE>
+static std::shared_ptr<const std::array<uint8_t, SIZE>> LoadOSROM(const std::string &name) {
+    std::vector<uint8_t> data;
+    TEST_TRUE(LoadFile(&data, PathJoined(ROMS_FOLDER, name), &LOGS));
+    TEST_TRUE(data.size() <= SIZE);
+
+    auto rom = std::make_shared<std::array<uint8_t, SIZE>>();
+    rom->fill(0);
+    memcpy(rom->data() + SIZE - data.size(), data.data(), data.size());
+
+    return rom;
+}
+
+static std::shared_ptr<const std::vector<uint8_t>> LoadSidewaysROM(const std::string &name) {
+    auto rom = std::make_shared<std::vector<uint8_t>>();
+    TEST_TRUE(LoadFile(rom.get(), PathJoined(ROMS_FOLDER, name), &LOGS));
+    rom->resize(16384);
+
+    return rom;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void Run(BBCMicro *beeb, uint64_t num_cycles) {
+    VideoDataUnit video_unit;
+    SoundDataUnit sound_unit;
+
+    for (uint64_t i = 0; i < num_cycles; ++i) {
+        beeb->Update(&video_unit, &sound_unit);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Save the state part way through running a program, then check that
+// continuing from the loaded state gives the same results as continuing
+// from the original.
+static void TestRoundTrip(BBCMicroParasiteType parasite_type, const std::string &file_name) {
+    static const ROMType ROM_TYPES[16] = {};
+
+    BBCMicro a(CreateBBCMicroType(BBCMicroTypeID_B, ROM_TYPES),
+               nullptr,
+               parasite_type,
+               std::vector<uint8_t>(),
+               nullptr,
+               0,
+               nullptr,
+               CycleCount{0});
+    a.SetCatchUpMode(true);
+
+    a.SetOSROM(LoadOSROM<16384>("OS12.ROM"));
+    a.SetSidewaysROM(15, LoadSidewaysROM("BASIC2.ROM"), ROMType_16KB);
+    a.SetSidewaysRAM(13, nullptr);
+    if (parasite_type != BBCMicroParasiteType_None) {
+        a.SetParasiteOS(LoadOSROM<4096>("TUBE110.rom"));
+    }
+
+    Run(&a, 2 * CYCLES_PER_SECOND);
+
+    a.StartPaste(std::make_shared<std::string>("FORI%=0TO9999:?(&3000+I%MOD&1000)=I%:PRINTI%;:NEXT\r"));
+
+    Run(&a, CYCLES_PER_SECOND / 2);
+
+    std::string path = PathJoined(BBC_TESTS_OUTPUT_FOLDER, file_name);
+    TEST_TRUE(PathCreateFolder(PathGetFolder(path)));
+
+    const BBCMicroUniqueState *a_state = a.GetUniqueState();
+    TEST_TRUE(!!a_state);
+    TEST_TRUE(BBCMicroStateFile::Save(path, *a_state, LOGS));
+
+    std::unique_ptr<BBCMicroUniqueState> b_state = BBCMicroStateFile::Load(path, nullptr, nullptr, LOGS);
+    TEST_TRUE(!!b_state);
+
+    // The CRTC is stored as a raw image, padding and all, so the loaded copy
+    // should be byte-for-byte the same. (Its Trace pointer is null in both.)
+    TEST_TRUE(memcmp(&b_state->crtc, &a_state->crtc, sizeof(CRTC)) == 0);
+
+    // The loaded state's ROMs refer to the file, and saving over the file
+    // mustn't affect them. (If it did, b would go wrong.)
+    {
+        BBCMicro c(CreateBBCMicroType(BBCMicroTypeID_B, ROM_TYPES),
+                   nullptr,
+                   BBCMicroParasiteType_None,
+                   std::vector<uint8_t>(),
+                   nullptr,
+                   0,
+                   nullptr,
+                   CycleCount{0});
+        TEST_TRUE(BBCMicroStateFile::Save(path, *c.GetUniqueState(), LOGS));
+    }
+
+    BBCMicro b(*b_state);
+    b.SetCatchUpMode(true);
+
+    TEST_EQ_UU(a.GetCycleCountPtr()->n, b.GetCycleCountPtr()->n);
+
+    Run(&a, CYCLES_PER_SECOND);
+    Run(&b, CYCLES_PER_SECOND);
+
+    const M6502 *a_cpu = &a.GetUniqueState()->cpu;
+    const M6502 *b_cpu = &b.GetUniqueState()->cpu;
+    TEST_EQ_UU(a_cpu->pc.w, b_cpu->pc.w);
+    TEST_EQ_UU(a_cpu->a, b_cpu->a);
+    TEST_EQ_UU(a_cpu->x, b_cpu->x);
+    TEST_EQ_UU(a_cpu->y, b_cpu->y);
+    TEST_EQ_UU(a_cpu->s.w, b_cpu->s.w);
+    TEST_TRUE(a_cpu->tfn == b_cpu->tfn);
+
+    const uint8_t *a_ram = a.GetRAM();
+    const uint8_t *b_ram = b.GetRAM();
+    for (size_t i = 0; i < 32768; ++i) {
+        TEST_EQ_UU(a_ram[i], b_ram[i]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static std::shared_ptr<const DiscImage> SaveAndLoadDiscImage(BBCMicro *beeb, const std::string &path) {
+    TEST_TRUE(BBCMicroStateFile::Save(path, *beeb->GetUniqueState(), LOGS));
+
+    std::unique_ptr<BBCMicroUniqueState> state = BBCMicroStateFile::Load(path, nullptr, nullptr, LOGS);
+    TEST_TRUE(!!state);
+
+    BBCMicro loaded(*state);
+    return loaded.GetDiscImage(0);
+}
+
+// A disc that's been written to must survive a save and load, even though
+// it no longer matches the file it was loaded from.
+static void TestModifiedDisc() {
+    static const ROMType ROM_TYPES[16] = {};
+
+    std::string disc_path = PathJoined(BBC_TESTS_OUTPUT_FOLDER, "test_BBCMicroStateFile.ssd");
+    std::string state_path = PathJoined(BBC_TESTS_OUTPUT_FOLDER, "test_BBCMicroStateFile_disc.b2state");
+    TEST_TRUE(PathCreateFolder(PathGetFolder(disc_path)));
+
+    std::vector<uint8_t> contents(SSD_GEOMETRY.GetTotalNumBytes());
+    for (size_t i = 0; i < contents.size(); ++i) {
+        contents[i] = (uint8_t)i;
+    }
+    TEST_TRUE(SaveFile(contents, disc_path, &LOGS));
+
+    std::shared_ptr<MemoryDiscImage> disc = MemoryDiscImage::LoadFromBuffer(disc_path, MemoryDiscImage::LOAD_METHOD_FILE, contents.data(), contents.size(), SSD_GEOMETRY, LOGS);
+    TEST_TRUE(!!disc);
+
+    BBCMicro beeb(CreateBBCMicroType(BBCMicroTypeID_B, ROM_TYPES),
+                  &DISC_INTERFACE_ACORN_1770,
+                  BBCMicroParasiteType_None,
+                  std::vector<uint8_t>(),
+                  nullptr,
+                  0,
+                  nullptr,
+                  CycleCount{0});
+    beeb.SetDiscImage(0, disc);
+
+    // Unmodified: found again from the file.
+    {
+        std::shared_ptr<const DiscImage> loaded = SaveAndLoadDiscImage(&beeb, state_path);
+        TEST_TRUE(!!loaded);
+        TEST_EQ_SS(loaded->GetHash(), disc->GetHash());
+
+        std::vector<uint8_t> data;
+        DiscGeometry geometry;
+        TEST_FALSE(loaded->GetModifiedContents(&data, &geometry));
+    }
+
+    // Modified: the file is out of date, so the contents come from the
+    // state.
+    TEST_TRUE(disc->Write(0, 2, 3, 4, 0x55));
+
+    std::vector<uint8_t> modified_contents;
+    DiscGeometry modified_geometry;
+    TEST_TRUE(disc->GetModifiedContents(&modified_contents, &modified_geometry));
+    TEST_TRUE(modified_geometry == SSD_GEOMETRY);
+
+    {
+        std::shared_ptr<const DiscImage> loaded = SaveAndLoadDiscImage(&beeb, state_path);
+        TEST_TRUE(!!loaded);
+        TEST_EQ_SS(loaded->GetName(), disc_path);
+        TEST_EQ_SS(loaded->GetHash(), disc->GetHash());
+
+        uint8_t value;
+        TEST_TRUE(loaded->Read(&value, 0, 2, 3, 4));
+        TEST_EQ_UU(value, 0x55);
+
+        // Still modified, so saving it again keeps the contents.
+        std::vector<uint8_t> data;
+        DiscGeometry geometry;
+        TEST_TRUE(loaded->GetModifiedContents(&data, &geometry));
+        TEST_TRUE(data == modified_contents);
+        TEST_TRUE(geometry == SSD_GEOMETRY);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    TestRoundTrip(BBCMicroParasiteType_None, "test_BBCMicroStateFile.b2state");
+    TestRoundTrip(BBCMicroParasiteType_External3MHz6502, "test_BBCMicroStateFile_6502sp.b2state");
+    TestModifiedDisc();
+
+    // Not a state file.
+    {
+        std::string path = PathJoined(BBC_TESTS_OUTPUT_FOLDER, "test_BBCMicroStateFile.txt");
+        TEST_TRUE(SaveTextFile("hello", path, &LOGS));
+
+        std::unique_ptr<BBCMicroUniqueState> state = BBCMicroStateFile::Load(path, nullptr, nullptr, LOGS);
+        TEST_TRUE(!state);
+    }
+}
@@ -0,0 +1,178 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <beeb/GuestProfile.h>
+#include <beeb/type.h>
+#include <beeb/6502.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Host code at $1000:
+//
+// $1000: ldx #$04
+// $1002: dex
+// $1003: bne $1002
+// $1005: jmp $1000
+static const uint8_t HOST_CODE[] = {0xa2, 0x04, 0xca, 0xd0, 0xfd, 0x4c, 0x00, 0x10};
+
+static const BigPageIndex HOST_BIG_PAGE_INDEX = {1};
+
+// Parasite code at $0000.
+//
+// $0000: nop
+static const uint8_t PARASITE_CODE[] = {0xea};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static uint8_t g_host_big_page[BIG_PAGE_SIZE_BYTES];
+static uint8_t g_parasite_big_page[BIG_PAGE_SIZE_BYTES];
+
+static const uint8_t *GetBigPageData(BigPageIndex big_page_index) {
+    if (big_page_index.i == HOST_BIG_PAGE_INDEX.i) {
+        return g_host_big_page;
+    } else if (big_page_index.i == PARASITE_BIG_PAGE_INDEX.i) {
+        return g_parasite_big_page;
+    } else {
+        return nullptr;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Times are in 2 MHz cycles.
+static void AddHostInstruction(GuestProfile *profile, uint64_t *now, uint16_t addr, uint64_t num_cycles) {
+    profile->AddInstruction(GuestProfileCPU_Host, HOST_BIG_PAGE_INDEX, (uint16_t)(addr - 0x1000), {*now << LSHIFT_2MHZ_TO_CYCLE_COUNT});
+    *now += num_cycles;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static const GuestProfileReport::Instruction *FindInstruction(const GuestProfileReport &report, GuestProfileCPU cpu, uint16_t addr) {
+    for (const GuestProfileReport::Instruction &instruction : report.instructions) {
+        if (instruction.cpu == cpu && instruction.addr == addr) {
+            return &instruction;
+        }
+    }
+
+    return nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    memcpy(g_host_big_page, HOST_CODE, sizeof HOST_CODE);
+    memcpy(g_parasite_big_page, PARASITE_CODE, sizeof PARASITE_CODE);
+
+    static const ROMType ROM_TYPES[16] = {};
+    std::shared_ptr<const BBCMicroType> type = CreateBBCMicroType(BBCMicroTypeID_B, ROM_TYPES);
+
+    GuestProfile profile;
+
+    TEST_TRUE(!profile.GetBigPage(HOST_BIG_PAGE_INDEX));
+
+    // Run the outer loop twice.
+    uint64_t now = 0;
+    for (int i = 0; i < 2; ++i) {
+        AddHostInstruction(&profile, &now, 0x1000, 2);
+        for (int j = 0; j < 4; ++j) {
+            AddHostInstruction(&profile, &now, 0x1002, 2);
+            AddHostInstruction(&profile, &now, 0x1003, j < 3 ? 3 : 2);
+        }
+        AddHostInstruction(&profile, &now, 0x1005, 3);
+    }
+
+    // Parasite instructions are interleaved with the host ones, and are in 4
+    // MHz cycles.
+    profile.AddInstruction(GuestProfileCPU_Parasite, PARASITE_BIG_PAGE_INDEX, 0, {0});
+    profile.AddInstruction(GuestProfileCPU_Parasite, PARASITE_BIG_PAGE_INDEX, 0, {2});
+
+    // This one is still in progress, so it shouldn't count.
+    AddHostInstruction(&profile, &now, 0x1000, 1000);
+    profile.Break();
+    profile.AddInstruction(GuestProfileCPU_Host, HOST_BIG_PAGE_INDEX, 0, {1000000});
+
+    TEST_TRUE(!!profile.GetBigPage(HOST_BIG_PAGE_INDEX));
+    TEST_TRUE(!!profile.GetBigPage(PARASITE_BIG_PAGE_INDEX));
+    TEST_TRUE(!profile.GetBigPage({0}));
+
+    std::unique_ptr<GuestProfileReport> report = CreateGuestProfileReport(profile, type, &M6502_cmos6502_config, &GetBigPageData);
+
+    TEST_EQ_UU(report->instructions.size(), 5);
+    TEST_EQ_UU(report->total_cycles[GuestProfileCPU_Host], 2 * (2 + 4 * 2 + 3 * 3 + 2 + 3));
+    TEST_EQ_UU(report->total_cycles[GuestProfileCPU_Parasite], 2);
+
+    {
+        const GuestProfileReport::Instruction *ldx = FindInstruction(*report, GuestProfileCPU_Host, 0x1000);
+        TEST_TRUE(!!ldx);
+        TEST_EQ_UU(ldx->num_executions, 4);
+        TEST_EQ_UU(ldx->cycles, 2 * 2);
+        TEST_TRUE(ldx->disassembly == "ldx #$04");
+
+        const GuestProfileReport::Instruction *dex = FindInstruction(*report, GuestProfileCPU_Host, 0x1002);
+        TEST_TRUE(!!dex);
+        TEST_EQ_UU(dex->num_executions, 8);
+        TEST_EQ_UU(dex->cycles, 8 * 2);
+        TEST_TRUE(dex->disassembly == "dex");
+
+        const GuestProfileReport::Instruction *bne = FindInstruction(*report, GuestProfileCPU_Host, 0x1003);
+        TEST_TRUE(!!bne);
+        TEST_EQ_UU(bne->num_executions, 8);
+        TEST_EQ_UU(bne->cycles, 2 * (3 * 3 + 2));
+        TEST_TRUE(bne->disassembly == "bne $1002");
+
+        const GuestProfileReport::Instruction *jmp = FindInstruction(*report, GuestProfileCPU_Host, 0x1005);
+        TEST_TRUE(!!jmp);
+        TEST_TRUE(jmp->disassembly == "jmp $1000");
+
+        const GuestProfileReport::Instruction *nop = FindInstruction(*report, GuestProfileCPU_Parasite, 0x0000);
+        TEST_TRUE(!!nop);
+        TEST_EQ_UU(nop->num_executions, 2);
+        TEST_EQ_UU(nop->cycles, 2);
+        TEST_TRUE(nop->fraction == 1.);
+
+        // The hottest instruction is the branch.
+        TEST_EQ_UU(report->instructions[report->hot_instructions[0]].addr, 0x1003);
+
+        // Two loops: the inner dex/bne one, and the outer one.
+        TEST_EQ_UU(report->loops.size(), 2);
+
+        const GuestProfileReport::Loop *outer = &report->loops[0];
+        TEST_EQ_UU(outer->begin_addr, 0x1000);
+        TEST_EQ_UU(outer->end_addr, 0x1005);
+        TEST_EQ_UU(outer->cycles, report->total_cycles[GuestProfileCPU_Host]);
+        TEST_EQ_UU(outer->num_branch_executions, 2);
+
+        const GuestProfileReport::Loop *inner = &report->loops[1];
+        TEST_EQ_UU(inner->begin_addr, 0x1002);
+        TEST_EQ_UU(inner->end_addr, 0x1003);
+        TEST_EQ_UU(inner->cycles, dex->cycles + bne->cycles);
+        TEST_EQ_UU(inner->num_branch_executions, 8);
+
+        TEST_EQ_UU(ldx->loop_index, 0);
+        TEST_EQ_UU(dex->loop_index, 1);
+        TEST_EQ_UU(bne->loop_index, 1);
+        TEST_EQ_UU(jmp->loop_index, 0);
+        TEST_EQ_UU(nop->loop_index, SIZE_MAX);
+    }
+
+    {
+        std::string csv = GetGuestProfileReportCSV(*report);
+
+        size_t num_lines = 0;
+        for (char c : csv) {
+            if (c == '\n') {
+                ++num_lines;
+            }
+        }
+
+        // Header, plus one per instruction.
+        TEST_EQ_UU(num_lines, 1 + report->instructions.size());
+        TEST_TRUE(csv.find("Host,$1003,") != std::string::npos);
+        TEST_TRUE(csv.find("\"bne $1002\"") != std::string::npos);
+    }
+}
@@ -0,0 +1,142 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <beeb/PagedRAM.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestContents(const PagedRAM &ram, size_t big_page_index, uint8_t value) {
+    const uint8_t *big_page = ram.GetBigPage(big_page_index);
+
+    for (size_t i = 0; i < BIG_PAGE_SIZE_BYTES; ++i) {
+        TEST_EQ_UU(big_page[i], value);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    PagedRAM ram(32768);
+
+    TEST_EQ_UU(ram.GetNumBigPages(), 8);
+
+    uint8_t *data = ram.GetData();
+    TEST_TRUE(!!data);
+
+    for (size_t i = 0; i < ram.GetNumBigPages(); ++i) {
+        TestContents(ram, i, 0);
+    }
+
+    // Modify a couple of big pages.
+    memset(data + 0 * BIG_PAGE_SIZE_BYTES, 1, BIG_PAGE_SIZE_BYTES);
+    ram.GetDirtyFlags()[0] = 1;
+
+    memset(data + 5 * BIG_PAGE_SIZE_BYTES, 5, BIG_PAGE_SIZE_BYTES);
+    ram.GetDirtyFlags()[5] = 1;
+
+    // Copying doesn't touch the original, so the modified big pages are
+    // copied separately each time.
+    {
+        PagedRAM unshared_copy(ram);
+        TestContents(unshared_copy, 0, 1);
+        TestContents(unshared_copy, 5, 5);
+
+        TEST_EQ_UU(ram.GetDirtyFlags()[0], 1);
+        TEST_EQ_UU(ram.GetDirtyFlags()[5], 1);
+
+        PagedRAM unshared_copy2(ram);
+        TEST_TRUE(unshared_copy.GetBigPage(0) != unshared_copy2.GetBigPage(0));
+    }
+
+    // Updating the big pages clears the dirty flags.
+    ram.UpdateBigPages();
+
+    for (size_t i = 0; i < ram.GetNumBigPages(); ++i) {
+        TEST_EQ_UU(ram.GetDirtyFlags()[i], 0);
+    }
+
+    PagedRAM copy(ram);
+
+    // The copy has no contiguous buffer, so its big pages are the shared
+    // ones.
+    TEST_TRUE(copy.GetBigPage(1) == copy.GetBigPage(2));
+    TestContents(copy, 0, 1);
+    TestContents(copy, 1, 0);
+    TestContents(copy, 5, 5);
+
+    // Further modifications to the original don't affect the copy.
+    memset(data + 5 * BIG_PAGE_SIZE_BYTES, 6, BIG_PAGE_SIZE_BYTES);
+    ram.GetDirtyFlags()[5] = 1;
+
+    TestContents(copy, 5, 5);
+
+    ram.UpdateBigPages();
+    PagedRAM copy2(ram);
+    TestContents(copy2, 5, 6);
+    TEST_TRUE(copy.GetBigPage(0) == copy2.GetBigPage(0));
+    TEST_TRUE(copy.GetBigPage(5) != copy2.GetBigPage(5));
+
+    // A copy's contiguous buffer is created from the big pages.
+    uint8_t *copy_data = copy.GetData();
+    TEST_TRUE(copy_data != data);
+    TEST_EQ_UU(copy_data[0 * BIG_PAGE_SIZE_BYTES], 1);
+    TEST_EQ_UU(copy_data[5 * BIG_PAGE_SIZE_BYTES], 5);
+    TEST_EQ_UU(copy_data[7 * BIG_PAGE_SIZE_BYTES], 0);
+
+    // Compress a copy relative to the original, and check the contents
+    // survive.
+    {
+        ram.UpdateBigPages();
+        PagedRAM keyframe(ram);
+
+        data[100] = 0xaa;
+        data[101] = 0xbb;
+        data[200] = 0xcc;
+        ram.GetDirtyFlags()[0] = 1;
+
+        for (size_t i = 0; i < BIG_PAGE_SIZE_BYTES; ++i) {
+            data[2 * BIG_PAGE_SIZE_BYTES + i] = (uint8_t)(i * 7);
+        }
+        ram.GetDirtyFlags()[2] = 1;
+
+        ram.UpdateBigPages();
+        PagedRAM compressed(ram);
+        size_t num_unshared_bytes = compressed.GetNumUnsharedBytes(&keyframe);
+
+        compressed.Compress(keyframe);
+
+        // Page 0 differs only slightly, so should get smaller. Page 2 is
+        // completely different, so shouldn't change.
+        TEST_TRUE(compressed.GetNumUnsharedBytes(&keyframe) < num_unshared_bytes);
+        TEST_TRUE(compressed.GetNumUnsharedBytes(&keyframe) > BIG_PAGE_SIZE_BYTES);
+
+        // Compressing again should share the previous result.
+        PagedRAM compressed2(ram);
+        compressed2.Compress(keyframe);
+        TEST_EQ_UU(compressed2.GetNumUnsharedBytes(&compressed), 0);
+
+        PagedRAM decompressed(compressed);
+        const uint8_t *decompressed_data = decompressed.GetData();
+
+        for (size_t i = 0; i < ram.GetSize(); ++i) {
+            TEST_EQ_UU(decompressed_data[i], data[i]);
+        }
+
+        // Decompressing in place stores everything in full again, without
+        // creating a contiguous buffer.
+        PagedRAM expanded(compressed);
+        expanded.Decompress();
+        TEST_TRUE(expanded.GetNumUnsharedBytes(&compressed) > 0);
+
+        for (size_t i = 0; i < expanded.GetNumBigPages(); ++i) {
+            TEST_TRUE(memcmp(expanded.GetBigPage(i), data + i * BIG_PAGE_SIZE_BYTES, BIG_PAGE_SIZE_BYTES) == 0);
+        }
+    }
+
+    // Size 0 means no RAM.
+    PagedRAM none;
+    TEST_EQ_UU(none.GetSize(), 0);
+    TEST_TRUE(!none.GetData());
+}
@@ -0,0 +1,93 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <beeb/SN76489.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void Write(SN76489 *sn, uint8_t value) {
+    sn->Update(true, value);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void SetUp(SN76489 *sn, const uint16_t *tone_freqs, uint8_t noise) {
+    for (uint8_t i = 0; i < 3; ++i) {
+        Write(sn, (uint8_t)(0x80 | i << 5 | (tone_freqs[i] & 0xf)));
+        Write(sn, (uint8_t)(tone_freqs[i] >> 4 & 0x3f));
+
+        // full volume
+        Write(sn, (uint8_t)(0x90 | i << 5));
+    }
+
+    Write(sn, (uint8_t)(0xe0 | noise));
+    Write(sn, 0xf0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Check that skipping updates leaves the chip in the same state as updating
+// it normally, by comparing the outputs afterwards.
+static void TestSkip(const uint16_t *tone_freqs, uint8_t noise, uint32_t num_skips) {
+    SN76489 a, b;
+
+    SetUp(&a, tone_freqs, noise);
+    SetUp(&b, tone_freqs, noise);
+
+    for (uint32_t i = 0; i < num_skips; ++i) {
+        a.Update(false, 0);
+        b.Skip();
+    }
+
+    for (uint32_t i = 0; i < 5000; ++i) {
+        SN76489::Output a_output = a.Update(false, 0);
+        SN76489::Output b_output = b.Update(false, 0);
+
+        for (size_t j = 0; j < 4; ++j) {
+            TEST_EQ_UU(a_output.ch[j], b_output.ch[j]);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    static const uint16_t TONE_FREQS[][3] = {
+        {0, 1, 2},
+        {1023, 100, 7},
+        {3, 17, 0},
+        {5, 9, 1}, // noise clocked from tone 2 can step every update
+    };
+
+    static const uint32_t NUM_SKIPS[] = {0, 1, 2, 15, 16, 17, 1023, 1024, 1025, 100000};
+
+    for (const uint16_t *tone_freqs : TONE_FREQS) {
+        for (uint8_t noise = 0; noise < 8; ++noise) {
+            for (uint32_t num_skips : NUM_SKIPS) {
+                TestSkip(tone_freqs, noise, num_skips);
+            }
+        }
+    }
+
+    // Skip straight after reset, when the counters are 0.
+    {
+        SN76489 a, b;
+
+        for (uint32_t i = 0; i < 3000; ++i) {
+            a.Update(false, 0);
+            b.Skip();
+        }
+
+        for (uint32_t i = 0; i < 5000; ++i) {
+            SN76489::Output a_output = a.Update(false, 0);
+            SN76489::Output b_output = b.Update(false, 0);
+
+            for (size_t j = 0; j < 4; ++j) {
+                TEST_EQ_UU(a_output.ch[j], b_output.ch[j]);
+            }
+        }
+    }
+}
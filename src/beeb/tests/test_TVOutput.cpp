@@ -0,0 +1,383 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <shared/debug.h>
+#include <beeb/TVOutput.h>
+#include <beeb/video.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static VideoDataUnit GetRandomUnit(VideoDataType type, uint16_t flags) {
+    VideoDataUnit unit = {};
+
+    for (size_t i = 0; i < 8; ++i) {
+        unit.pixels.pixels[i].all = (uint16_t)TestRandom();
+    }
+
+    unit.pixels.pixels[0].bits.x = type;
+    unit.pixels.pixels[1].bits.x = flags;
+
+    return unit;
+}
+
+// Some fields' worth of mostly 16 MHz bitmap data, with some other unit
+// types and some scanlines of varying length.
+static std::vector<VideoDataUnit> GetUnits(size_t num_fields) {
+    std::vector<VideoDataUnit> units;
+
+    for (size_t field = 0; field < num_fields; ++field) {
+        for (size_t line = 0; line < 312; ++line) {
+            size_t num_display = 90 + TestRandom() % 30;
+            for (size_t i = 0; i < num_display; ++i) {
+                uint32_t r = TestRandom() % 100;
+                if (r == 0) {
+                    units.push_back(GetRandomUnit(VideoDataType_Bitmap12MHz, 0));
+                } else if (r == 1) {
+                    units.push_back(GetRandomUnit(VideoDataType_Teletext, 0));
+                } else {
+                    units.push_back(GetRandomUnit(VideoDataType_Bitmap16MHz, 0));
+                }
+            }
+
+            uint16_t flags = line >= 308 ? VideoDataUnitFlag_VSync : 0;
+
+            for (size_t i = num_display; i < 128; ++i) {
+                if (i < num_display + 10) {
+                    units.push_back(GetRandomUnit(VideoDataType_Bitmap16MHz, flags | VideoDataUnitFlag_HSync));
+                } else {
+                    units.push_back(GetRandomUnit(VideoDataType_Bitmap16MHz, flags));
+                }
+            }
+        }
+    }
+
+    return units;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void CheckSameTexturePixels(const TVOutput &a, const TVOutput &b) {
+    const uint32_t *a_pixels = a.GetTexturePixels(nullptr);
+    const uint32_t *b_pixels = b.GetTexturePixels(nullptr);
+
+    if (memcmp(a_pixels, b_pixels, TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT * 4) != 0) {
+        for (size_t i = 0; i < TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT; ++i) {
+            TEST_EQ_UU(a_pixels[i], b_pixels[i]);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Units submitted one at a time go through the unit-by-unit path, and
+// longer spans go through the run path. The output must be the same.
+static void TestRuns() {
+    std::vector<VideoDataUnit> units = GetUnits(5);
+
+    TVOutput runs;
+    TVOutput singles;
+
+    size_t i = 0;
+    while (i < units.size()) {
+        size_t n = 1 + TestRandom() % 1000;
+        if (n > units.size() - i) {
+            n = units.size() - i;
+        }
+
+        runs.Update(&units[i], n);
+
+        for (size_t j = 0; j < n; ++j) {
+            singles.Update(&units[i + j], 1);
+        }
+
+        i += n;
+
+        CheckSameTexturePixels(runs, singles);
+    }
+
+    // Check something actually got drawn.
+    const uint32_t *pixels = runs.GetTexturePixels(nullptr);
+    size_t num_non_zero = 0;
+    for (size_t j = 0; j < TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT; ++j) {
+        if (pixels[j] != 0) {
+            ++num_non_zero;
+        }
+    }
+    TEST_TRUE(num_non_zero > TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT / 2);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Check 16 MHz pixels expand as expected: each 4-bit component x becomes
+// x<<4|x.
+static void TestExpand16MHz() {
+    std::vector<VideoDataUnit> units;
+
+    // Skip the vertical retrace and get to the start of the first scanline.
+    units.resize(1 + 12 * 128);
+
+    for (size_t i = 0; i < 16; ++i) {
+        VideoDataUnit unit = {};
+
+        for (size_t j = 0; j < 8; ++j) {
+            uint16_t value = (uint16_t)(i * 8 + j);
+            unit.pixels.pixels[j].bits.r = value & 15;
+            unit.pixels.pixels[j].bits.g = value >> 4 & 15;
+            unit.pixels.pixels[j].bits.b = (value ^ 15) & 15;
+        }
+
+        units.push_back(unit);
+    }
+
+    TVOutput tv;
+    tv.Update(units.data(), units.size());
+
+    size_t x, y;
+    TEST_TRUE(tv.GetBeamPosition(&x, &y));
+    TEST_EQ_UU(x, 16 * 8);
+
+    const uint32_t *line0 = tv.GetTexturePixels(nullptr) + y * TV_TEXTURE_WIDTH;
+    const uint32_t *line1 = line0 + TV_TEXTURE_WIDTH;
+
+    for (size_t i = 0; i < 16 * 8; ++i) {
+        uint32_t r = i & 15, g = i >> 4 & 15, b = (i ^ 15) & 15;
+        uint32_t expected = (r << 4 | r) << 16 | (g << 4 | g) << 8 | (b << 4 | b);
+        TEST_EQ_UU(line0[i], expected);
+        TEST_EQ_UU(line1[i], expected);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static size_t GetNumDirtyLines(const TVOutput &tv) {
+    const uint8_t *dirty_lines = tv.GetDirtyLines();
+
+    size_t n = 0;
+    for (size_t y = 0; y < TV_TEXTURE_HEIGHT; ++y) {
+        if (dirty_lines[y]) {
+            ++n;
+        }
+    }
+
+    return n;
+}
+
+// Redrawing the same field leaves no dirty lines, and changing one unit
+// dirties only the lines it's drawn on.
+static void TestDirtyLines() {
+    std::vector<VideoDataUnit> units = GetUnits(1);
+
+    // Find a displayed unit in the middle of the field.
+    size_t changed_index = 150 * 128 + 10;
+    TEST_EQ_UU(units[changed_index].pixels.pixels[0].bits.x, VideoDataType_Bitmap16MHz);
+    TEST_EQ_UU(units[changed_index].pixels.pixels[1].bits.x, 0);
+
+    // Successive fields may be drawn at alternating positions, so always
+    // do 2 at once.
+    //
+    // The reference TVOutput gets the same data, but setting the gamma means
+    // it redraws everything each time.
+    TVOutput tv;
+    TVOutput ref;
+    for (size_t i = 0; i < 4; ++i) {
+        tv.Update(units.data(), units.size());
+
+        ref.SetGamma(ref.GetGamma());
+        ref.Update(units.data(), units.size());
+    }
+    TEST_TRUE(GetNumDirtyLines(tv) > TV_TEXTURE_HEIGHT / 2);
+    tv.ResetDirtyLines();
+
+    std::vector<uint32_t> pixels(tv.GetTexturePixels(nullptr),
+                                 tv.GetTexturePixels(nullptr) + TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT);
+
+    for (size_t i = 0; i < 2; ++i) {
+        tv.Update(units.data(), units.size());
+
+        ref.SetGamma(ref.GetGamma());
+        ref.Update(units.data(), units.size());
+    }
+    TEST_EQ_UU(GetNumDirtyLines(tv), 0);
+    TEST_TRUE(memcmp(pixels.data(), tv.GetTexturePixels(nullptr), pixels.size() * 4) == 0);
+
+    units[changed_index].pixels.pixels[3].all ^= 0x111;
+
+    for (size_t i = 0; i < 2; ++i) {
+        tv.Update(units.data(), units.size());
+
+        ref.SetGamma(ref.GetGamma());
+        ref.Update(units.data(), units.size());
+    }
+    size_t num_dirty_lines = GetNumDirtyLines(tv);
+    TEST_TRUE(num_dirty_lines > 0);
+    TEST_TRUE(num_dirty_lines <= 4);
+
+    CheckSameTexturePixels(tv, ref);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Teletext units with colours that share expanded pixel cache entries,
+// against a reference TVOutput that has its cache (and everything else)
+// invalidated before each unit.
+static void TestTeletextColours() {
+    static const uint16_t COLOURS[] = {0x000, 0x111, 0x777, 0xf00, 0xe00, 0x0f0, 0xfff, 0x888};
+
+    std::vector<VideoDataUnit> units;
+
+    // Skip the vertical retrace and get to the start of the first scanline.
+    units.resize(1 + 12 * 128);
+    size_t num_retrace_units = units.size();
+
+    for (size_t line = 0; line < 3; ++line) {
+        for (size_t i = 0; i < 128; ++i) {
+            VideoDataUnit unit = {};
+
+            unit.pixels.pixels[0].all = COLOURS[TestRandom() % 8];
+            unit.pixels.pixels[0].bits.x = VideoDataType_Teletext;
+            unit.pixels.pixels[1].all = COLOURS[TestRandom() % 8];
+            unit.pixels.pixels[2].all = TestRandom() % 64;
+            unit.pixels.pixels[3].all = TestRandom() % 64;
+
+            if (i >= 100 && i < 110) {
+                unit.pixels.pixels[1].bits.x = VideoDataUnitFlag_HSync;
+            }
+
+            units.push_back(unit);
+        }
+    }
+
+    TVOutput tv;
+    tv.Update(units.data(), units.size());
+
+    TVOutput ref;
+    ref.Update(units.data(), num_retrace_units);
+    for (size_t i = num_retrace_units; i < units.size(); ++i) {
+        ref.SetGamma(ref.GetGamma());
+        ref.Update(&units[i], 1);
+    }
+
+    CheckSameTexturePixels(tv, ref);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Units drawn via PrepareScanlines and DrawScanlines, with the scanlines
+// shuffled and split between threads, against the same units passed to
+// Update.
+static void TestScanlines() {
+    std::vector<VideoDataUnit> units = GetUnits(5);
+
+    TVOutput serial;
+    TVOutput parallel;
+
+    serial.SetKeepLastVSyncTexturePixels(true);
+    parallel.SetKeepLastVSyncTexturePixels(true);
+
+    std::vector<TVOutput::Scanline> scanlines;
+    size_t num_scanlines = 0;
+    size_t num_vertical_retraces = 0;
+    size_t i = 0;
+    while (i < units.size()) {
+        size_t n = 1 + TestRandom() % 100000;
+        if (n > units.size() - i) {
+            n = units.size() - i;
+        }
+
+        serial.Update(&units[i], n);
+
+        size_t end = i + n;
+        while (i < end) {
+            bool vertical_retrace;
+            size_t num_consumed = parallel.PrepareScanlines(&units[i], end - i, &scanlines, &vertical_retrace);
+            TEST_TRUE(num_consumed > 0);
+            TEST_TRUE(num_consumed <= end - i);
+            i += num_consumed;
+
+            // Only stops early for vertical retrace.
+            if (i < end) {
+                TEST_TRUE(vertical_retrace);
+            }
+
+            if (vertical_retrace) {
+                TEST_TRUE(parallel.IsInVerticalBlank());
+                ++num_vertical_retraces;
+            }
+
+            for (size_t j = scanlines.size(); j > 1; --j) {
+                std::swap(scanlines[j - 1], scanlines[TestRandom() % j]);
+            }
+
+            std::vector<std::thread> threads;
+            size_t num_threads = 4;
+            for (size_t j = 0; j < num_threads; ++j) {
+                size_t begin = scanlines.size() * j / num_threads;
+                size_t count = scanlines.size() * (j + 1) / num_threads - begin;
+                threads.emplace_back([&parallel, &scanlines, begin, count]() {
+                    parallel.DrawScanlines(scanlines.data() + begin, count);
+                });
+            }
+
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+
+            num_scanlines += scanlines.size();
+        }
+
+        CheckSameTexturePixels(serial, parallel);
+
+        TEST_EQ_UU(serial.IsInVerticalBlank(), parallel.IsInVerticalBlank());
+
+        uint64_t serial_version, parallel_version;
+        serial.GetTexturePixels(&serial_version);
+        parallel.GetTexturePixels(&parallel_version);
+        TEST_EQ_UU(serial_version, parallel_version);
+
+        size_t serial_x = 0, serial_y = 0, parallel_x = 0, parallel_y = 0;
+        TEST_EQ_UU(serial.GetBeamPosition(&serial_x, &serial_y), parallel.GetBeamPosition(&parallel_x, &parallel_y));
+        TEST_EQ_UU(serial_x, parallel_x);
+        TEST_EQ_UU(serial_y, parallel_y);
+
+        TEST_TRUE(memcmp(serial.GetDirtyLines(), parallel.GetDirtyLines(), TV_TEXTURE_HEIGHT) == 0);
+
+        {
+            UniqueLock<Mutex> serial_lock, parallel_lock;
+            const uint32_t *serial_pixels = serial.GetLastVSyncTexturePixels(&serial_lock);
+            const uint32_t *parallel_pixels = parallel.GetLastVSyncTexturePixels(&parallel_lock);
+            TEST_TRUE(memcmp(serial_pixels, parallel_pixels, TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT * 4) == 0);
+        }
+
+#if VIDEO_TRACK_METADATA
+        TEST_TRUE(memcmp(serial.GetTextureUnits(), parallel.GetTextureUnits(), TV_TEXTURE_WIDTH * TV_TEXTURE_HEIGHT * sizeof(VideoDataUnit)) == 0);
+#endif
+    }
+
+    // Most of 5 fields' worth.
+    TEST_TRUE(num_scanlines > 4 * 250);
+    TEST_EQ_UU(num_vertical_retraces, 5);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main() {
+    TestExpand16MHz();
+    TestRuns();
+    TestDirtyLines();
+    TestTeletextColours();
+    TestScanlines();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,280 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <shared/file_io.h>
+#include <shared/log.h>
+#include <shared/path.h>
+#include <beeb/Trace.h>
+#include <beeb/TraceFile.h>
+#include <beeb/SaveTrace.h>
+#include <beeb/type.h>
+#include <string.h>
+#include <inttypes.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef BBC_TESTS_OUTPUT_FOLDER
+#error
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+LOG_DEFINE(OUTPUT, "", &log_printer_stdout_and_debugger, true);
+
+static const LogSet LOGS = {LOG(OUTPUT), LOG(OUTPUT), LOG(OUTPUT)};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_TRACE
+
+struct EventsHash {
+    uint64_t hash = 14695981039346656037ull;
+    size_t num_events = 0;
+
+    void Add(const void *data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            this->hash = (this->hash ^ ((const uint8_t *)data)[i]) * 1099511628211ull;
+        }
+    }
+};
+
+static bool AddEventToHash(Trace *t, const TraceEvent *e, void *context) {
+    (void)t;
+
+    auto h = (EventsHash *)context;
+
+    h->Add(e->type->GetName().c_str(), e->type->GetName().size());
+    h->Add(&e->time, sizeof e->time);
+    h->Add(&e->source, sizeof e->source);
+    h->Add(&e->size, sizeof e->size);
+    h->Add(e->event, e->size);
+    ++h->num_events;
+
+    return true;
+}
+
+static EventsHash GetEventsHash(Trace *t) {
+    EventsHash h;
+    TEST_TRUE(t->ForEachEvent(&AddEventToHash, &h));
+    return h;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static const uint32_t NUM_EVENTS = 15000000;
+
+// Enough events for a few chunks, with the odd time discontinuity.
+static void AddEvents(Trace *t, CycleCount *now) {
+    for (uint32_t i = 0; i < NUM_EVENTS; ++i) {
+        now->n += i % 37;
+
+        if (i % 1000 == 0) {
+            t->AllocStringf(TraceEventSource_Host, "event %" PRIu32 "\n", i);
+        } else if (i % 3 == 0) {
+            t->AllocSetMapperRegionEvent((uint8_t)(i % NUM_MAPPER_REGIONS));
+        } else {
+            ROMSEL romsel;
+            romsel.value = (uint8_t)i;
+            t->AllocWriteROMSELEvent(romsel);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static bool AppendTraceText(const void *data, size_t num_bytes, void *context) {
+    ((std::string *)context)->append((const char *)data, num_bytes);
+    return true;
+}
+
+static std::string GetTraceText(const std::shared_ptr<Trace> &trace, unsigned num_threads, size_t num_events) {
+    std::string text;
+    SaveTraceProgress progress;
+    TEST_TRUE(SaveTrace(trace,
+                        DEFAULT_TRACE_OUTPUT_FLAGS | TraceOutputFlags_ROMMapper,
+                        &AppendTraceText, &text,
+                        nullptr, nullptr,
+                        &progress,
+                        num_threads));
+    TEST_EQ_UU(progress.num_events_handled, num_events);
+    TEST_EQ_UU(progress.num_bytes_written, text.size());
+    return text;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static std::string GetOutputPath(const char *file_name) {
+    std::string path = PathJoined(BBC_TESTS_OUTPUT_FOLDER, file_name);
+    TEST_TRUE(PathCreateFolder(PathGetFolder(path)));
+    return path;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    static const ROMType ROM_TYPES[16] = {};
+
+    PagingState paging;
+    paging.romsel.value = 12;
+
+    auto trace = std::make_shared<Trace>(SIZE_MAX,
+                                         CreateBBCMicroType(BBCMicroTypeID_B, ROM_TYPES),
+                                         paging,
+                                         BBCMicroParasiteType_None,
+                                         nullptr,
+                                         false);
+
+    CycleCount now = {0};
+    trace->SetTime(&now);
+
+    // Write the trace out as it's produced.
+    std::string streamed_path = GetOutputPath("test_TraceFile.streamed.b2trace");
+    TraceFileWriter writer(LOGS);
+    TEST_TRUE(writer.Open(streamed_path, *trace));
+    trace->SetChunkFn(&TraceFileWriter::ChunkFn, &writer);
+
+    AddEvents(trace.get(), &now);
+
+    // A canceled event.
+    trace->CancelEvent(Trace::WRITE_ROMSEL_EVENT, trace->AllocEvent(Trace::WRITE_ROMSEL_EVENT));
+
+    trace->FlushChunks();
+    TEST_TRUE(writer.Close());
+
+    TraceStats stats;
+    trace->GetStats(&stats);
+    TEST_TRUE(stats.num_used_bytes > 3 * 16777216);
+    TEST_TRUE(writer.GetNumBytesWritten() > stats.num_used_bytes);
+
+    EventsHash hash = GetEventsHash(trace.get());
+
+    // Save the whole thing in one go.
+    std::string saved_path = GetOutputPath("test_TraceFile.saved.b2trace");
+    TEST_TRUE(SaveTraceFile(saved_path, *trace, LOGS));
+
+    for (const std::string &path : {streamed_path, saved_path}) {
+        std::shared_ptr<Trace> loaded = LoadTraceFile(path, LOGS);
+        TEST_TRUE(!!loaded);
+
+        TraceStats loaded_stats;
+        loaded->GetStats(&loaded_stats);
+        TEST_EQ_UU(loaded_stats.num_events, stats.num_events);
+        TEST_EQ_UU(loaded_stats.num_used_bytes, stats.num_used_bytes);
+        TEST_EQ_UU(loaded_stats.max_time.n, stats.max_time.n);
+
+        TEST_EQ_UU(loaded->GetBBCMicroType()->type_id, BBCMicroTypeID_B);
+        TEST_EQ_UU(loaded->GetInitialPagingState().romsel.value, 12);
+        TEST_EQ_UU(loaded->GetParasiteType(), BBCMicroParasiteType_None);
+        TEST_TRUE(!loaded->GetParasiteM6502Config());
+
+        EventsHash loaded_hash = GetEventsHash(loaded.get());
+        TEST_EQ_UU(loaded_hash.num_events, hash.num_events);
+        TEST_EQ_UU(loaded_hash.hash, hash.hash);
+    }
+
+    // Text output is the same however many threads produce it. The mapper
+    // region events depend on the paging state, which has to be carried
+    // across segment boundaries.
+    {
+        std::string text = GetTraceText(trace, 4, hash.num_events);
+
+        static const char MAPPER_REGION[] = "Set ROM mapper region: ";
+        size_t pos = 0;
+        for (uint32_t i = 0; i < NUM_EVENTS; ++i) {
+            if (i % 1000 != 0 && i % 3 == 0) {
+                // Bank is from the most recent ROMSEL write.
+                uint32_t romsel_i = (i - 1) % 1000 == 0 ? i - 2 : i - 1;
+
+                pos = text.find(MAPPER_REGION, pos);
+                TEST_TRUE(pos != std::string::npos);
+                pos += sizeof MAPPER_REGION - 1;
+
+                TEST_EQ_II(text[pos + 0], GetROMBankCode(romsel_i & 15));
+                TEST_EQ_II(text[pos + 1], GetMapperRegionCode(i % NUM_MAPPER_REGIONS));
+            }
+        }
+        TEST_TRUE(text.find(MAPPER_REGION, pos) == std::string::npos);
+
+        TEST_TRUE(text == GetTraceText(trace, 1, hash.num_events));
+    }
+
+    // Bad files.
+    {
+        std::string path = GetOutputPath("test_TraceFile.txt");
+        TEST_TRUE(SaveTextFile("hello", path, &LOGS));
+        TEST_TRUE(!LoadTraceFile(path, LOGS));
+    }
+
+    {
+        std::vector<uint8_t> data;
+        TEST_TRUE(LoadFile(&data, saved_path, &LOGS));
+        data.resize(data.size() - 1);
+
+        std::string path = GetOutputPath("test_TraceFile.truncated.b2trace");
+        TEST_TRUE(SaveFile(data, path, &LOGS));
+        TEST_TRUE(!LoadTraceFile(path, LOGS));
+    }
+
+    // The same events again, spilling to disk once there's more than a couple
+    // of chunks.
+    {
+        std::string spill_path = GetOutputPath("test_TraceFile.spill");
+
+        {
+            auto spilled = std::make_shared<Trace>(2 * 16777216,
+                                                   CreateBBCMicroType(BBCMicroTypeID_B, ROM_TYPES),
+                                                   paging,
+                                                   BBCMicroParasiteType_None,
+                                                   nullptr,
+                                                   false);
+            TEST_TRUE(spilled->SetSpillFile(spill_path, LOGS));
+
+            CycleCount spilled_now = {0};
+            spilled->SetTime(&spilled_now);
+
+            AddEvents(spilled.get(), &spilled_now);
+            spilled->CancelEvent(Trace::WRITE_ROMSEL_EVENT, spilled->AllocEvent(Trace::WRITE_ROMSEL_EVENT));
+
+            TraceStats spilled_stats;
+            spilled->GetStats(&spilled_stats);
+            TEST_EQ_UU(spilled_stats.num_events, stats.num_events);
+            TEST_EQ_UU(spilled_stats.num_used_bytes, stats.num_used_bytes);
+            TEST_TRUE(spilled_stats.num_spilled_bytes > 0);
+            TEST_TRUE(spilled_stats.num_allocated_bytes < stats.num_allocated_bytes);
+
+            TEST_EQ_UU(spilled->GetInitialPagingState().romsel.value, 12);
+
+            EventsHash spilled_hash = GetEventsHash(spilled.get());
+            TEST_EQ_UU(spilled_hash.num_events, hash.num_events);
+            TEST_EQ_UU(spilled_hash.hash, hash.hash);
+
+            // Saving includes the spilled chunks.
+            std::string saved_spilled_path = GetOutputPath("test_TraceFile.saved_spilled.b2trace");
+            TEST_TRUE(SaveTraceFile(saved_spilled_path, *spilled, LOGS));
+
+            std::shared_ptr<Trace> loaded = LoadTraceFile(saved_spilled_path, LOGS);
+            TEST_TRUE(!!loaded);
+
+            EventsHash loaded_hash = GetEventsHash(loaded.get());
+            TEST_EQ_UU(loaded_hash.hash, hash.hash);
+        }
+
+        // The spill file goes away with the trace.
+        TEST_FALSE(PathIsFileOnDisk(spill_path, nullptr, nullptr));
+    }
+
+    LOGF(OUTPUT, "Events: %zu\n", hash.num_events);
+}
+
+#else
+
+int main(void) {
+}
+
+#endif
@@ -0,0 +1,292 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <beeb/Trace.h>
+#include <beeb/TraceIndex.h>
+#include <beeb/BBCMicro.h>
+#include <beeb/type.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_TRACE
+
+struct Opcode {
+    uint8_t opcode;
+
+    // Whether it writes, and if so, how the address is formed.
+    bool writes;
+    bool zp;
+    bool x;
+    bool y;
+};
+
+// A mix of reads, writes and stack operations, in various addressing modes.
+static const Opcode OPCODES[] = {
+    {0xad, false, false, false, false}, // LDA abs
+    {0x8d, true, false, false, false},  // STA abs
+    {0x9d, true, false, true, false},   // STA abs,X
+    {0x99, true, false, false, true},   // STA abs,Y
+    {0x85, true, true, false, false},   // STA zp
+    {0x96, true, true, false, true},    // STX zp,Y
+    {0xf6, true, true, true, false},    // INC zp,X
+    {0x0e, true, false, false, false},  // ASL abs
+    {0x91, true, false, false, true},   // STA (zp),Y
+    {0x81, true, false, false, false},  // STA (zp,X)
+    {0x48, false, false, false, false}, // PHA
+    {0x0a, false, false, false, false}, // ASL A
+};
+
+static const size_t NUM_OPCODES = sizeof OPCODES / sizeof OPCODES[0];
+
+static const uint32_t NUM_EVENTS = 4000000;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Enough instruction events for a few chunks, mostly host, with a few
+// parasite ones and the odd string.
+static void AddEvents(Trace *t, CycleCount *now, bool backwards) {
+    for (uint32_t i = 0; i < NUM_EVENTS; ++i) {
+        if (backwards && i % 100000 == 99999) {
+            now->n -= 1000;
+        } else {
+            now->n += 1 + TestRandom() % 40;
+        }
+
+        if (i % 777 == 0) {
+            t->AllocStringf(TraceEventSource_Host, "event %u\n", i);
+        } else {
+            TraceEventSource source = i % 5 == 0 ? TraceEventSource_Parasite : TraceEventSource_Host;
+
+            auto ev = (BBCMicro::InstructionTraceEvent *)t->AllocEvent(BBCMicro::INSTRUCTION_EVENT, source);
+            ev->opcode = OPCODES[TestRandom() % NUM_OPCODES].opcode;
+            ev->pc = (uint16_t)(0xffe0 + TestRandom() % 16);
+            ev->ad = (uint16_t)(0xfe38 + TestRandom() % 16);
+            ev->x = (uint8_t)(TestRandom() % 4);
+            ev->y = (uint8_t)(TestRandom() % 4);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static bool GetExpectedWriteAddress(uint16_t *addr, const TraceEvent *e) {
+    auto ev = (const BBCMicro::InstructionTraceEvent *)e->event;
+
+    for (const Opcode &opcode : OPCODES) {
+        if (opcode.opcode == ev->opcode) {
+            if (!opcode.writes) {
+                return false;
+            }
+
+            uint16_t a = ev->ad;
+            if (opcode.x) {
+                a += ev->x;
+            }
+            if (opcode.y) {
+                a += ev->y;
+            }
+            if (opcode.zp) {
+                a &= 0xff;
+            }
+
+            *addr = a;
+            return true;
+        }
+    }
+
+    TEST_FAIL("unexpected opcode: 0x%02x", ev->opcode);
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+struct BruteForceContext {
+    const TraceQuery *query = nullptr;
+    std::vector<TraceEvent> events;
+};
+
+static bool AddMatchingEvent(Trace *t, const TraceEvent *e, void *context) {
+    (void)t;
+
+    auto c = (BruteForceContext *)context;
+    const TraceQuery *q = c->query;
+
+    if (e->time.n < q->begin.n || e->time.n >= q->end.n) {
+        return true;
+    }
+
+    bool match = false;
+    switch (q->type) {
+    case TraceQueryType_Execute:
+        match = e->type == &BBCMicro::INSTRUCTION_EVENT && e->source == q->source && ((const BBCMicro::InstructionTraceEvent *)e->event)->pc == q->addr;
+        break;
+
+    case TraceQueryType_Write:
+        if (e->type == &BBCMicro::INSTRUCTION_EVENT && e->source == q->source) {
+            // The test trace has no parasite, so there's no parasite config,
+            // so parasite writes can't be identified.
+            uint16_t addr;
+            match = q->source == TraceEventSource_Host && GetExpectedWriteAddress(&addr, e) && addr == q->addr;
+        }
+        break;
+
+    case TraceQueryType_EventType:
+        match = e->type == q->event_type;
+        break;
+    }
+
+    if (match) {
+        c->events.push_back(*e);
+    }
+
+    return true;
+}
+
+static bool AddEvent(Trace *t, const TraceEvent *e, void *context) {
+    (void)t;
+
+    ((std::vector<TraceEvent> *)context)->push_back(*e);
+    return true;
+}
+
+static bool StopAfterOne(Trace *t, const TraceEvent *e, void *context) {
+    (void)t, (void)e;
+
+    ++*(size_t *)context;
+    return false;
+}
+
+static bool GetFirstEvent(Trace *t, const TraceEvent *e, void *context) {
+    (void)t;
+
+    *(TraceEvent *)context = *e;
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static size_t TestQuery(const TraceIndex &index, const TraceQuery &query) {
+    BruteForceContext bfc;
+    bfc.query = &query;
+    TEST_TRUE(index.GetTrace()->ForEachEvent(&AddMatchingEvent, &bfc));
+
+    std::vector<TraceEvent> events;
+    TEST_TRUE(index.ForEachMatch(query, &AddEvent, &events));
+
+    TEST_EQ_UU(events.size(), bfc.events.size());
+    for (size_t i = 0; i < events.size(); ++i) {
+        TEST_EQ_PP(events[i].event, bfc.events[i].event);
+        TEST_EQ_UU(events[i].time.n, bfc.events[i].time.n);
+    }
+
+    if (!events.empty()) {
+        size_t n = 0;
+        TEST_FALSE(index.ForEachMatch(query, &StopAfterOne, &n));
+        TEST_EQ_UU(n, 1);
+    }
+
+    return events.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestIndex(bool backwards) {
+    static const ROMType ROM_TYPES[16] = {};
+
+    auto trace = std::make_shared<Trace>(SIZE_MAX,
+                                         CreateBBCMicroType(BBCMicroTypeID_B, ROM_TYPES),
+                                         PagingState(),
+                                         BBCMicroParasiteType_None,
+                                         nullptr,
+                                         false);
+
+    CycleCount now = {0};
+    trace->SetTime(&now);
+    AddEvents(trace.get(), &now, backwards);
+
+    TraceStats stats;
+    trace->GetStats(&stats);
+    TEST_TRUE(stats.num_used_bytes > 2 * 16777216);
+
+    TraceIndex index(trace);
+
+    CycleCount mid = {now.n / 2};
+    CycleCount quarter = {now.n / 4};
+
+    size_t num_matches = 0;
+    for (uint16_t addr : {0xffe3, 0xffe0, 0xfe40, 0x0040, 0x1234}) {
+        for (TraceEventSource source : {TraceEventSource_Host, TraceEventSource_Parasite}) {
+            for (TraceQueryType type : {TraceQueryType_Execute, TraceQueryType_Write}) {
+                TraceQuery query;
+                query.type = type;
+                query.source = source;
+                query.addr = addr;
+                num_matches += TestQuery(index, query);
+
+                query.begin = quarter;
+                query.end = mid;
+                num_matches += TestQuery(index, query);
+            }
+        }
+    }
+    TEST_GT_UU(num_matches, 0);
+
+    for (const TraceEventType *type : {&Trace::STRING_EVENT, &BBCMicro::INSTRUCTION_EVENT, &Trace::WRITE_ROMSEL_EVENT}) {
+        TraceQuery query;
+        query.type = TraceQueryType_EventType;
+        query.event_type = type;
+        TestQuery(index, query);
+
+        query.begin = mid;
+        TestQuery(index, query);
+    }
+
+    {
+        TraceQuery query;
+        query.type = TraceQueryType_EventType;
+        query.event_type = &Trace::STRING_EVENT;
+
+        TraceEvent e;
+        TEST_FALSE(index.ForEachMatch(query, &GetFirstEvent, &e));
+        TEST_EQ_SS(index.GetEventDescription(&e), "H 0: event 0");
+    }
+
+    {
+        TraceQuery query;
+        query.type = TraceQueryType_Write;
+        query.addr = 0xfe40;
+
+        TraceEvent e;
+        TEST_FALSE(index.ForEachMatch(query, &GetFirstEvent, &e));
+        TEST_TRUE(index.GetEventDescription(&e).find(" [$fe40] A=") != std::string::npos);
+
+        std::vector<std::string> descriptions;
+        size_t num_matches = index.GetMatchDescriptions(&descriptions, query, 10);
+        TEST_EQ_UU(descriptions.size(), 10);
+        TEST_EQ_UU(num_matches, TestQuery(index, query));
+        TEST_EQ_SS(descriptions[0], index.GetEventDescription(&e));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    TestIndex(false);
+
+    // Time going backwards means the blocks can't be binary searched.
+    TestIndex(true);
+}
+
+#else
+
+int main(void) {
+}
+
+#endif
@@ -0,0 +1,190 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <shared/log.h>
+#include <beeb/TraceTrigger.h>
+#include <6502/6502.h>
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+LOG_DEFINE(OUTPUT, "", &log_printer_stdout_and_debugger, true);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if BBCMICRO_TRACE
+
+// None of these use memory terms, so no BBCMicro is needed.
+static bool Check(const char *expr, const M6502 *cpu) {
+    TraceTrigger trigger;
+    TEST_TRUE(trigger.Compile(expr, &LOG(OUTPUT)));
+    return trigger.Check(nullptr, cpu);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestCompile() {
+    for (const char *expr : {"pc=ffe3",
+                             " pc == &ffe3 ",
+                             "pc=$8000-$bfff && a!=0",
+                             "[70]=ff",
+                             "[7fff]>=80 && x<10 && y>0 && s<=f0",
+                             "opcode=0x60",
+                             "write=fe40-fe4f && value>=80 && count=3",
+                             "p=ff && count==100"}) {
+        TraceTrigger trigger;
+        TEST_TRUE(trigger.Compile(expr, &LOG(OUTPUT)));
+        TEST_FALSE(trigger.IsEmpty());
+    }
+
+    for (const char *expr : {"",
+                             "count=3",
+                             "pc",
+                             "pc=",
+                             "pc=10000",
+                             "a=100",
+                             "a=10-5",
+                             "a<0",
+                             "a>ff",
+                             "a=>5",
+                             "a<5-6",
+                             "q=1",
+                             "PC=ffe3",
+                             "[8000]=0",
+                             "[70=0",
+                             "pc=ffe3 &&",
+                             "pc=ffe3 & a=0",
+                             "pc=ffe3 || a=0",
+                             "count=0 && a=0",
+                             "count=x && a=0"}) {
+        TraceTrigger trigger;
+        TEST_FALSE(trigger.Compile(expr, nullptr));
+        TEST_TRUE(trigger.IsEmpty());
+    }
+
+    {
+        TraceTrigger trigger;
+        TEST_TRUE(trigger.Compile("pc=1234", nullptr));
+        TEST_FALSE(trigger.IsWriteTrigger());
+
+        // Failed compile leaves the old trigger in place.
+        TEST_FALSE(trigger.Compile("write=", nullptr));
+        TEST_FALSE(trigger.IsEmpty());
+        TEST_FALSE(trigger.IsWriteTrigger());
+
+        TEST_TRUE(trigger.Compile("a=0 && value=1", nullptr));
+        TEST_TRUE(trigger.IsWriteTrigger());
+    }
+
+    {
+        TraceTrigger trigger;
+        TEST_FALSE(trigger.Check(nullptr, nullptr));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestInstruction() {
+    M6502 cpu;
+    M6502_Init(&cpu, &M6502_nmos6502_config);
+
+    // As it would be for an instruction callback: about to execute RTS at
+    // &ffe3.
+    cpu.abus.w = 0xffe3;
+    cpu.dbus = 0x60;
+    cpu.opcode = 0x20;
+    cpu.a = 0x0d;
+    cpu.x = 0x10;
+    cpu.y = 0xff;
+    cpu.s.w = 0x1f0;
+
+    TEST_TRUE(Check("pc=ffe3", &cpu));
+    TEST_FALSE(Check("pc=ffe4", &cpu));
+    TEST_TRUE(Check("pc!=ffe4", &cpu));
+    TEST_TRUE(Check("pc=ff00-ffff", &cpu));
+    TEST_FALSE(Check("pc!=ff00-ffff", &cpu));
+    TEST_FALSE(Check("pc=8000-bfff", &cpu));
+    TEST_TRUE(Check("pc>ffe2", &cpu));
+    TEST_FALSE(Check("pc>ffe3", &cpu));
+    TEST_TRUE(Check("pc>=ffe3", &cpu));
+    TEST_TRUE(Check("pc<ffe4", &cpu));
+    TEST_FALSE(Check("pc<ffe3", &cpu));
+    TEST_TRUE(Check("pc<=ffe3", &cpu));
+
+    TEST_TRUE(Check("a=d && x=10 && y=ff && s=f0", &cpu));
+    TEST_FALSE(Check("a=d && x=10 && y=fe && s=f0", &cpu));
+    TEST_TRUE(Check("y>=80", &cpu));
+    TEST_TRUE(Check("y>fe", &cpu));
+
+    // The opcode about to be executed, not the last one.
+    TEST_TRUE(Check("opcode=60", &cpu));
+
+    M6502P p = M6502_GetP(&cpu);
+    char p_expr[20];
+    snprintf(p_expr, sizeof p_expr, "p=%x", p.value);
+    TEST_TRUE(Check(p_expr, &cpu));
+
+    {
+        TraceTrigger trigger;
+        TEST_TRUE(trigger.Compile("count=3 && pc=ffe3", nullptr));
+        TEST_FALSE(trigger.Check(nullptr, &cpu));
+        TEST_FALSE(trigger.Check(nullptr, &cpu));
+
+        // Non-matches don't count.
+        cpu.abus.w = 0xffe0;
+        TEST_FALSE(trigger.Check(nullptr, &cpu));
+        cpu.abus.w = 0xffe3;
+
+        TEST_TRUE(trigger.Check(nullptr, &cpu));
+
+        trigger.ResetCount();
+        TEST_FALSE(trigger.Check(nullptr, &cpu));
+        TEST_FALSE(trigger.Check(nullptr, &cpu));
+        TEST_TRUE(trigger.Check(nullptr, &cpu));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void TestWrite() {
+    M6502 cpu;
+    M6502_Init(&cpu, &M6502_nmos6502_config);
+
+    // As it would be for a write callback: STA &FE4E, executed at &1900.
+    cpu.abus.w = 0xfe4e;
+    cpu.dbus = 0x7f;
+    cpu.read = 0;
+    cpu.opcode = 0x8d;
+    cpu.opcode_pc.w = 0x1900;
+    cpu.a = 0x7f;
+
+    TEST_TRUE(Check("write=fe4e", &cpu));
+    TEST_TRUE(Check("write=fe40-fe4f", &cpu));
+    TEST_FALSE(Check("write=fe40-fe4d", &cpu));
+    TEST_TRUE(Check("write=fe40-fe4f && value=7f", &cpu));
+    TEST_FALSE(Check("write=fe40-fe4f && value>=80", &cpu));
+
+    // pc and opcode refer to the instruction doing the write.
+    TEST_TRUE(Check("value=7f && pc=1900 && opcode=8d", &cpu));
+    TEST_FALSE(Check("value=7f && pc=fe4e", &cpu));
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    TestCompile();
+    TestInstruction();
+    TestWrite();
+}
+
+#else
+
+int main(void) {
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <beeb/VideoULA.h>
+#include <beeb/6502.h>
+#include <memory>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static void WritePalette(VideoULA *ula, uint8_t logical, uint8_t physical) {
+    VideoULA::WritePalette(ula, M6502Word{0xfe21}, (uint8_t)(logical << 4 | (physical ^ 7)));
+}
+
+static VideoDataUnitPixels Emit(VideoULA *ula, uint8_t byte) {
+    ula->Byte(byte, 0);
+
+    VideoDataUnitPixels pixels = {};
+    ula->EmitPixels(&pixels);
+    return pixels;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Mode 0, 2 colours: logical colour 0 -> physical 0 (black), logical colour 1
+// -> physical 7 (white).
+static void TestMode0() {
+    auto cache = std::make_unique<VideoULA::PixelCache>();
+
+    VideoULA ula;
+    ula.SetPixelCache(cache.get());
+    ula.InitStuff();
+
+    VideoULA::WriteControlRegister(&ula, M6502Word{0xfe20}, 0x9c);
+
+    for (uint8_t i = 0; i < 16; ++i) {
+        WritePalette(&ula, i, i & 8 ? 7 : 0);
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        VideoDataUnitPixels pixels = Emit(&ula, 0xa5);
+
+        for (size_t i = 0; i < 8; ++i) {
+            uint16_t expected = (0xa5 << i & 0x80) ? 0x0fff : 0x0000;
+            TEST_EQ_UU(pixels.pixels[i].all, expected);
+        }
+    }
+
+    // The cached entry must not survive a palette change.
+    WritePalette(&ula, 8, 1);
+    WritePalette(&ula, 9, 1);
+    WritePalette(&ula, 10, 1);
+    WritePalette(&ula, 11, 1);
+    WritePalette(&ula, 12, 1);
+    WritePalette(&ula, 13, 1);
+    WritePalette(&ula, 14, 1);
+    WritePalette(&ula, 15, 1);
+
+    {
+        VideoDataUnitPixels pixels = Emit(&ula, 0xa5);
+
+        for (size_t i = 0; i < 8; ++i) {
+            uint16_t expected = (0xa5 << i & 0x80) ? 0x0f00 : 0x0000;
+            TEST_EQ_UU(pixels.pixels[i].all, expected);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Random register writes and data against one ULA with a pixel cache and one
+// without.
+static void TestPixelCache() {
+    auto cache = std::make_unique<VideoULA::PixelCache>();
+
+    VideoULA cached, uncached;
+    cached.nula = uncached.nula = true;
+    cached.SetPixelCache(cache.get());
+    cached.InitStuff();
+    uncached.InitStuff();
+
+    size_t num_non_black = 0;
+
+    for (uint32_t i = 0; i < 2000000; ++i) {
+        if (TestRandom() % 32 == 0) {
+            auto value = (uint8_t)TestRandom();
+
+            switch (TestRandom() % 8) {
+            case 0:
+                VideoULA::WriteControlRegister(&cached, M6502Word{0xfe20}, value);
+                VideoULA::WriteControlRegister(&uncached, M6502Word{0xfe20}, value);
+                break;
+
+            case 1:
+                {
+                    // NuLA control: mostly logical mode and flash, rarely a
+                    // reset.
+                    static const uint8_t CODES[] = {1, 1, 8, 8, 9, 9, 2, 4};
+                    value = (uint8_t)(CODES[TestRandom() % 8] << 4 | (value & 0xf));
+                    VideoULA::WriteNuLAControlRegister(&cached, M6502Word{0xfe22}, value);
+                    VideoULA::WriteNuLAControlRegister(&uncached, M6502Word{0xfe22}, value);
+                }
+                break;
+
+            case 2:
+                VideoULA::WriteNuLAPalette(&cached, M6502Word{0xfe23}, value);
+                VideoULA::WriteNuLAPalette(&uncached, M6502Word{0xfe23}, value);
+                break;
+
+            default:
+                VideoULA::WritePalette(&cached, M6502Word{0xfe21}, value);
+                VideoULA::WritePalette(&uncached, M6502Word{0xfe21}, value);
+                break;
+            }
+        }
+
+        // A new byte every 1 MHz cycle, with the occasional cursor.
+        if (i % 2 == 0) {
+            auto byte = (uint8_t)TestRandom();
+            uint8_t cudisp = TestRandom() % 64 == 0;
+            cached.Byte(byte, cudisp);
+            uncached.Byte(byte, cudisp);
+        }
+
+        VideoDataUnitPixels cached_pixels = {}, uncached_pixels = {};
+        cached.EmitPixels(&cached_pixels);
+        uncached.EmitPixels(&uncached_pixels);
+
+        TEST_EQ_UU(cached_pixels.values[0], uncached_pixels.values[0]);
+        TEST_EQ_UU(cached_pixels.values[1], uncached_pixels.values[1]);
+
+        if (cached_pixels.values[0] != 0) {
+            ++num_non_black;
+        }
+    }
+
+    TEST_GT_UU(num_non_black, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    TestMode0();
+    TestPixelCache();
+}
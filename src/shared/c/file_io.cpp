@@ -5,6 +5,13 @@
 
 #include <string.h>
 
+#if SYSTEM_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <shared/enum_def.h>
 #include <shared/file_io.inl>
 #include <shared/enum_end.h>
@@ -191,3 +198,120 @@ bool SaveTextFile(const std::string &data, const std::string &path, const LogSet
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
+
+bool SaveFileReplacing(const std::vector<uint8_t> &data, const std::string &path, const LogSet *logs) {
+    std::string tmp_path = path + ".tmp";
+
+    if (!SaveFile2(data.data(), data.size(), tmp_path, logs, "wb")) {
+        return false;
+    }
+
+#if SYSTEM_WINDOWS
+
+    if (!MoveFileExW(GetWideString(tmp_path).c_str(), GetWideString(path).c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        if (logs) {
+            logs->w.f("save failed: %s\n", path.c_str());
+            logs->i.f("(MoveFileEx failed: %s)\n", GetLastErrorDescription());
+        }
+
+        DeleteFileW(GetWideString(tmp_path).c_str());
+        return false;
+    }
+
+#else
+
+    if (rename(tmp_path.c_str(), path.c_str()) == -1) {
+        AddError(logs, path, "save", "rename failed", errno);
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+#endif
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::string &path, const LogSet *logs) {
+    std::shared_ptr<MappedFile> file(new MappedFile);
+
+#if SYSTEM_POSIX
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        AddError(logs, path, "map", "open failed", errno);
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        AddError(logs, path, "map", "fstat failed", errno);
+        close(fd);
+        return nullptr;
+    }
+
+    if (st.st_size > 0) {
+        void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            AddError(logs, path, "map", "mmap failed", errno);
+            close(fd);
+            return nullptr;
+        }
+
+        file->m_data = (const uint8_t *)data;
+        file->m_size = (size_t)st.st_size;
+        file->m_mapped = true;
+    }
+
+    // The mapping stays valid once the file is closed.
+    close(fd);
+
+#else
+
+    if (!LoadFile(&file->m_buffer, path, logs)) {
+        return nullptr;
+    }
+
+    file->m_data = file->m_buffer.data();
+    file->m_size = file->m_buffer.size();
+
+#endif
+
+    return file;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+MappedFile::~MappedFile() {
+#if SYSTEM_POSIX
+    if (m_mapped) {
+        munmap((void *)m_data, m_size);
+    }
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+const uint8_t *MappedFile::GetData() const {
+    return m_data;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+size_t MappedFile::GetSize() const {
+    return m_size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+MappedFile::MappedFile() {
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
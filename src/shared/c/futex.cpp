@@ -0,0 +1,106 @@
+#include <shared/system.h>
+#include <shared/futex.h>
+
+#if SYSTEM_LINUX
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#elif SYSTEM_WINDOWS
+
+#include <shared/system_windows.h>
+
+#else
+
+#include <mutex>
+#include <condition_variable>
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "");
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#if SYSTEM_LINUX
+
+static uint32_t *GetFutexWord(std::atomic<uint32_t> *word) {
+    return reinterpret_cast<uint32_t *>(word);
+}
+
+void FutexWait(std::atomic<uint32_t> *word, uint32_t expected) {
+    syscall(SYS_futex, GetFutexWord(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+void FutexWakeOne(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, GetFutexWord(word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void FutexWakeAll(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, GetFutexWord(word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+#elif SYSTEM_WINDOWS
+
+void FutexWait(std::atomic<uint32_t> *word, uint32_t expected) {
+    WaitOnAddress(word, &expected, sizeof expected, INFINITE);
+}
+
+void FutexWakeOne(std::atomic<uint32_t> *word) {
+    WakeByAddressSingle(word);
+}
+
+void FutexWakeAll(std::atomic<uint32_t> *word) {
+    WakeByAddressAll(word);
+}
+
+#else
+
+// Waiters and wakers for the same word always use the same bucket. Words can
+// share buckets, so every waiter in the bucket gets woken.
+struct FutexBucket {
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+static const size_t NUM_FUTEX_BUCKETS = 16;
+static FutexBucket g_futex_buckets[NUM_FUTEX_BUCKETS];
+
+static FutexBucket *GetFutexBucket(std::atomic<uint32_t> *word) {
+    auto n = (uintptr_t)word;
+    return &g_futex_buckets[(n >> 2 ^ n >> 8) % NUM_FUTEX_BUCKETS];
+}
+
+void FutexWait(std::atomic<uint32_t> *word, uint32_t expected) {
+    FutexBucket *bucket = GetFutexBucket(word);
+
+    std::unique_lock<std::mutex> lock(bucket->mutex);
+    if (word->load(std::memory_order_acquire) == expected) {
+        bucket->cv.wait(lock);
+    }
+}
+
+void FutexWakeOne(std::atomic<uint32_t> *word) {
+    FutexWakeAll(word);
+}
+
+void FutexWakeAll(std::atomic<uint32_t> *word) {
+    FutexBucket *bucket = GetFutexBucket(word);
+
+    {
+        // The value has already changed. Taking the lock means any waiter
+        // is either yet to check it or already waiting.
+        std::lock_guard<std::mutex> lock(bucket->mutex);
+    }
+
+    bucket->cv.notify_all();
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
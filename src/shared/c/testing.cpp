@@ -372,3 +372,13 @@ void TestFail(const char *file, int line, const char *fmt, ...) {
 
     LOG(TESTING).EnsureBOL();
 }
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static uint32_t g_test_random_seed = 1;
+
+uint32_t TestRandom() {
+    g_test_random_seed = g_test_random_seed * 1103515245u + 12345u;
+    return g_test_random_seed >> 8;
+}
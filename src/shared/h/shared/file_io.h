@@ -5,6 +5,7 @@
 //////////////////////////////////////////////////////////////////////////
 
 #include <stdio.h>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -26,6 +27,49 @@ bool SaveFile(const void *data, size_t data_size, const std::string &path, const
 bool SaveFile(const std::vector<uint8_t> &data, const std::string &path, const LogSet *logs);
 bool SaveTextFile(const std::string &data, const std::string &path, const LogSet *logs);
 
+// Save to a temp file alongside path, then rename it over path. Anything that
+// has the old file open or mapped keeps seeing the old contents.
+bool SaveFileReplacing(const std::vector<uint8_t> &data, const std::string &path, const LogSet *logs);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Read-only view of a file's contents.
+//
+// On POSIX systems, the file is memory-mapped, so only the parts actually
+// accessed get read in, and processes mapping the same file share the
+// memory. Elsewhere, the file is just loaded into a buffer.
+//
+// Use SaveFileReplacing to write to a file that might be mapped. (Writing it
+// in place would change, or truncate, the mapping's contents.)
+class MappedFile {
+  public:
+    // Returns nullptr, having printed something to logs (if non-null), if
+    // the file couldn't be opened.
+    static std::shared_ptr<const MappedFile> Open(const std::string &path, const LogSet *logs);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&) = delete;
+    MappedFile &operator=(MappedFile &&) = delete;
+
+    const uint8_t *GetData() const;
+    size_t GetSize() const;
+
+  protected:
+  private:
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+
+    // Contents, if not memory-mapped.
+    std::vector<uint8_t> m_buffer;
+
+    MappedFile();
+};
+
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
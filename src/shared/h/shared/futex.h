@@ -0,0 +1,29 @@
+#ifndef HEADER_DAE3F670D4534340B5282C482472A78D // -*- mode:c++ -*-
+#define HEADER_DAE3F670D4534340B5282C482472A78D
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Futex-style waiting on a 32-bit atomic, for when a mutex and condition
+// variable would be overkill: the waker only needs to change the value and
+// call FutexWake, and that's cheap when nobody is waiting.
+//
+// FutexWait blocks while *word==expected, until a FutexWake call. It can
+// return spuriously, so the caller has to re-check whatever it's waiting for.
+//
+// Uses futex on Linux and WaitOnAddress on Windows. Elsewhere, a fixed set of
+// mutexes and condition variables stand in.
+
+void FutexWait(std::atomic<uint32_t> *word, uint32_t expected);
+void FutexWakeOne(std::atomic<uint32_t> *word);
+void FutexWakeAll(std::atomic<uint32_t> *word);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef HEADER_3E0F2B7C91D64A8AA0C5D1E6B4F87A29 // -*- mode:c++ -*-
+#define HEADER_3E0F2B7C91D64A8AA0C5D1E6B4F87A29
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <string.h>
+#include <type_traits>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Single writer, any number of readers. The writer never waits; readers
+// retry if they overlap with a write.
+//
+// The value is stored as relaxed atomic words, so a torn read is never a
+// data race, just a wasted copy.
+template <class T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock value must be trivially copyable");
+
+  public:
+    SeqLock()
+        : SeqLock(T()) {
+    }
+
+    explicit SeqLock(const T &value) {
+        this->StoreWords(value);
+    }
+
+    SeqLock(const SeqLock &) = delete;
+    SeqLock &operator=(const SeqLock &) = delete;
+    SeqLock(SeqLock &&) = delete;
+    SeqLock &operator=(SeqLock &&) = delete;
+
+    // Writer only.
+    void Write(const T &value) {
+        uint64_t seq = m_seq.load(std::memory_order_relaxed);
+
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        this->StoreWords(value);
+
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    T Read() const {
+        uint64_t words[NUM_WORDS];
+
+        for (;;) {
+            uint64_t seq0 = m_seq.load(std::memory_order_acquire);
+            if (seq0 & 1) {
+                // Write in progress.
+                continue;
+            }
+
+            for (size_t i = 0; i < NUM_WORDS; ++i) {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (m_seq.load(std::memory_order_relaxed) == seq0) {
+                break;
+            }
+        }
+
+        T value;
+        memcpy(&value, words, sizeof value);
+        return value;
+    }
+
+  protected:
+  private:
+    static constexpr size_t NUM_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> m_seq{0};
+    std::atomic<uint64_t> m_words[NUM_WORDS];
+
+    void StoreWords(const T &value) {
+        uint64_t words[NUM_WORDS] = {};
+        memcpy(words, &value, sizeof value);
+
+        for (size_t i = 0; i < NUM_WORDS; ++i) {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif
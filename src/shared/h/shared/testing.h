@@ -183,4 +183,13 @@ void PRINTF_LIKE(3, 4) TestFail(const char *file, int line, const char *fmt, ...
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+/* Cheap pseudo-random numbers for tests, 24 bits at a time. The sequence is
+ * the same on every run and every platform, so failures are reproducible.
+ * Not thread safe.
+ */
+uint32_t TestRandom();
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 #endif //HEADER_3D2FA1AC94784254AE3F43FF2D06F61A
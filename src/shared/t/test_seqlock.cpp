@@ -0,0 +1,72 @@
+#include <shared/system.h>
+#include <shared/testing.h>
+#include <shared/seqlock.h>
+#include <thread>
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Deliberately not a multiple of 8 bytes.
+struct Value {
+    uint32_t a = 0;
+    uint64_t b = 0;
+    uint8_t c = 0;
+    uint32_t d = 0;
+};
+
+static const uint32_t NUM_WRITES = 1000000;
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    {
+        SeqLock<Value> lock;
+
+        Value value = lock.Read();
+        TEST_EQ_UU(value.a, 0);
+        TEST_EQ_UU(value.b, 0);
+        TEST_EQ_UU(value.c, 0);
+        TEST_EQ_UU(value.d, 0);
+
+        lock.Write({1, 2, 3, 4});
+
+        value = lock.Read();
+        TEST_EQ_UU(value.a, 1);
+        TEST_EQ_UU(value.b, 2);
+        TEST_EQ_UU(value.c, 3);
+        TEST_EQ_UU(value.d, 4);
+    }
+
+    // Every value read must be one that was written in its entirety.
+    {
+        SeqLock<Value> lock;
+        std::atomic<bool> done{false};
+
+        std::thread writer([&lock, &done]() {
+            for (uint32_t i = 1; i <= NUM_WRITES; ++i) {
+                lock.Write({i, (uint64_t)i << 32 | i, (uint8_t)i, ~i});
+            }
+
+            done.store(true);
+        });
+
+        uint32_t last_a = 0;
+        while (!done.load()) {
+            Value value = lock.Read();
+
+            TEST_EQ_UU(value.b, (uint64_t)value.a << 32 | value.a);
+            TEST_EQ_UU(value.c, (uint8_t)value.a);
+            if (value.a != 0) {
+                TEST_EQ_UU(value.d, ~value.a);
+            }
+
+            TEST_TRUE(value.a >= last_a);
+            last_a = value.a;
+        }
+
+        writer.join();
+
+        TEST_EQ_UU(lock.Read().a, NUM_WRITES);
+    }
+}